@@ -19,6 +19,7 @@ BOOLEAN HalpOnlyBootProcessor;
 //#endif
 BOOLEAN HalpPciLockSettings;
 BOOLEAN HalBootViaEfi;
+BOOLEAN HalpDisableDynamicTick;
 
 /* PRIVATE FUNCTIONS *********************************************************/
 
@@ -44,6 +45,10 @@ HalpGetParameters(
         if (strstr(CommandLine, "PCILOCK"))
             HalpPciLockSettings = TRUE;
 
+        /* Check if idle processors must keep receiving every clock tick */
+        if (strstr(CommandLine, "NODYNAMICTICK"))
+            HalpDisableDynamicTick = TRUE;
+
         /* Check for initial breakpoint */
         if (strstr(CommandLine, "BREAK"))
             DbgBreakPoint();
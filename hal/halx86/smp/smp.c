@@ -17,6 +17,7 @@
 /* GLOBALS *******************************************************************/
 
 extern PPROCESSOR_IDENTITY HalpProcessorIdentity;
+extern BOOLEAN HalpDisableDynamicTick;
 
 /* FUNCTIONS *****************************************************************/
 
@@ -34,11 +35,56 @@ HalpSetupProcessorsTable(
     HalpProcessorIdentity[NTProcessorNumber].ProcessorPrcb = CurrentPrcb;
 }
 
+/*!
+ *  \brief Forwards the clock interrupt to the other processors.
+ *
+ *  \param Vector - Specifies the clock IPI vector.
+ *
+ *  \remarks Processors that are sitting in their idle loop with no pending
+ *   work are skipped (dynamic tick), so they can stay halted until an IPI
+ *   wakes them up. Only the boot processor maintains the system time, and
+ *   the kernel accounts the skipped ticks as idle time once the processor
+ *   receives its next clock IPI.
+ */
 VOID
 FASTCALL
 HalpBroadcastClockIpi(
     _In_ UCHAR Vector)
 {
-    /* Send a clock IPI to all processors */
-    HalpBroadcastIpiSpecifyVector(Vector, FALSE);
+    KAFFINITY TargetSet, RemainingSet, SetMember;
+    ULONG ProcessorIndex;
+    PKPRCB Prcb;
+
+    /* Send a clock IPI to all processors if dynamic tick is disabled */
+    if (HalpDisableDynamicTick)
+    {
+        HalpBroadcastIpiSpecifyVector(Vector, FALSE);
+        return;
+    }
+
+    /* Loop all other active processors */
+    TargetSet = HalpActiveProcessors & ~KeGetCurrentPrcb()->SetMember;
+    RemainingSet = TargetSet;
+    while (RemainingSet != 0)
+    {
+        NT_VERIFY(BitScanForwardAffinity(&ProcessorIndex, RemainingSet) != 0);
+        SetMember = AFFINITY_MASK(ProcessorIndex);
+        RemainingSet &= ~SetMember;
+
+        /* Skip processors that are idle and have nothing to do */
+        Prcb = HalpProcessorIdentity[ProcessorIndex].ProcessorPrcb;
+        if ((Prcb != NULL) &&
+            (Prcb->CurrentThread == Prcb->IdleThread) &&
+            (Prcb->NextThread == NULL) &&
+            (Prcb->DpcData[0].DpcQueueDepth == 0))
+        {
+            TargetSet &= ~SetMember;
+        }
+    }
+
+    /* Send the clock IPI to the processors that need it */
+    if (TargetSet != 0)
+    {
+        HalRequestIpiSpecifyVector(TargetSet, Vector);
+    }
 }
@@ -0,0 +1,173 @@
+/*
+ * PROJECT:     ReactOS Cache Statistics
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Displays the cache manager counters live
+ */
+
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#define NTOS_MODE_USER
+#include <ndk/exfuncs.h>
+
+#define HEADER_EVERY 20
+
+static
+ULONG
+Delta(ULONG New, ULONG Old)
+{
+    /* The counters wrap around */
+    return New - Old;
+}
+
+static
+ULONG
+Percent(ULONG Part, ULONG Total)
+{
+    if (!Total) return 0;
+    return (ULONG)(((ULONGLONG)min(Part, Total) * 100) / Total);
+}
+
+static
+void
+PrintTotals(PSYSTEM_CACHE_MANAGER_INFORMATION Info)
+{
+    printf("Since boot:\n");
+    printf("  Copy reads          %10lu wait, %lu missed  %10lu no wait, %lu missed\n",
+           Info->CopyReadWait, Info->CopyReadWaitMiss,
+           Info->CopyReadNoWait, Info->CopyReadNoWaitMiss);
+    printf("  Fast reads          %10lu wait  %10lu no wait  %10lu resource miss  %10lu not possible\n",
+           Info->FastReadWait, Info->FastReadNoWait,
+           Info->FastReadResourceMiss, Info->FastReadNotPossible);
+    printf("  Read ahead          %10lu I/Os  %10lu pages  %10lu used (%lu%%)\n",
+           Info->ReadAheadIos, Info->ReadAheadPages, Info->ReadAheadPagesUsed,
+           Percent(Info->ReadAheadPagesUsed, Info->ReadAheadPages));
+    printf("  Lazy writer         %10lu I/Os  %10lu pages\n",
+           Info->LazyWriteIos, Info->LazyWritePages);
+    printf("  Flushes             %10lu       %10lu pages\n",
+           Info->DataFlushes, Info->DataPages);
+    printf("  Deferred writes     %10lu\n", Info->DeferredWrites);
+    printf("  Views               %10lu mapped  %10lu stolen\n",
+           Info->VacbAllocations, Info->VacbSteals);
+    printf("  Pins                %10lu wait  %10lu no wait  %10lu contended\n",
+           Info->PinReadWait, Info->PinReadNoWait, Info->PinContention);
+    printf("  Dirty pages         %10lu of %lu\n\n",
+           Info->DirtyPages, Info->DirtyPageThreshold);
+}
+
+static
+void
+PrintHeader(void)
+{
+    printf("  reads  hit%%  fast    ra-pg used%%  lazy-pg flush-pg  defer  views steal  pinc  dirty-kb\n");
+}
+
+static
+void
+PrintRates(PSYSTEM_CACHE_MANAGER_INFORMATION New,
+           PSYSTEM_CACHE_MANAGER_INFORMATION Old,
+           ULONG Interval)
+{
+    ULONG Reads, Misses, ReadAhead;
+
+    Reads = Delta(New->CopyReadWait, Old->CopyReadWait) +
+            Delta(New->CopyReadNoWait, Old->CopyReadNoWait);
+    Misses = Delta(New->CopyReadWaitMiss, Old->CopyReadWaitMiss) +
+             Delta(New->CopyReadNoWaitMiss, Old->CopyReadNoWaitMiss);
+    ReadAhead = Delta(New->ReadAheadPages, Old->ReadAheadPages);
+
+    printf("%7lu %4lu%% %5lu %8lu %4lu%% %8lu %8lu %6lu %6lu %5lu %5lu %9lu\n",
+           Reads / Interval,
+           Reads ? 100 - Percent(Misses, Reads) : 100,
+           (Delta(New->FastReadWait, Old->FastReadWait) +
+            Delta(New->FastReadNoWait, Old->FastReadNoWait)) / Interval,
+           ReadAhead / Interval,
+           Percent(Delta(New->ReadAheadPagesUsed, Old->ReadAheadPagesUsed), ReadAhead),
+           Delta(New->LazyWritePages, Old->LazyWritePages) / Interval,
+           Delta(New->DataPages, Old->DataPages) / Interval,
+           Delta(New->DeferredWrites, Old->DeferredWrites) / Interval,
+           Delta(New->VacbAllocations, Old->VacbAllocations) / Interval,
+           Delta(New->VacbSteals, Old->VacbSteals) / Interval,
+           Delta(New->PinContention, Old->PinContention) / Interval,
+           New->DirtyPages * (PAGE_SIZE / 1024));
+}
+
+static
+void
+Usage(void)
+{
+    printf("Usage: cachestat [interval [count]]\n\n"
+           "Displays the cache manager counters since boot, then their rates per\n"
+           "second every interval seconds (1 by default), count times or forever.\n\n"
+           "  reads     copy reads          hit%%      copy reads served from memory\n"
+           "  fast      fast I/O reads      ra-pg     pages read ahead\n"
+           "  used%%     read ahead pages the readers got to\n"
+           "  lazy-pg   pages written by the lazy writer\n"
+           "  flush-pg  pages written by flushes\n"
+           "  defer     writes deferred     views     views mapped\n"
+           "  steal     unused views unmapped for others\n"
+           "  pinc      contended pins      dirty-kb  dirty data in the cache\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    SYSTEM_CACHE_MANAGER_INFORMATION Info[2];
+    ULONG Interval = 1, Count = 0, Current = 0, i;
+    NTSTATUS Status;
+
+    /* Parse the command line */
+    if (argc > 1)
+    {
+        Interval = strtoul(argv[1], NULL, 0);
+        if (!Interval)
+        {
+            Usage();
+            return 1;
+        }
+    }
+    if (argc > 2)
+    {
+        Count = strtoul(argv[2], NULL, 0);
+    }
+    if (argc > 3)
+    {
+        Usage();
+        return 1;
+    }
+
+    Status = NtQuerySystemInformation(SystemCacheManagerInformation,
+                                      &Info[Current],
+                                      sizeof(Info[Current]),
+                                      NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Failed to query the cache manager counters: 0x%08lx\n", Status);
+        return 1;
+    }
+
+    PrintTotals(&Info[Current]);
+
+    for (i = 0; !Count || i < Count; i++)
+    {
+        if (i % HEADER_EVERY == 0) PrintHeader();
+
+        Sleep(Interval * 1000);
+
+        Status = NtQuerySystemInformation(SystemCacheManagerInformation,
+                                          &Info[!Current],
+                                          sizeof(Info[!Current]),
+                                          NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Failed to query the cache manager counters: 0x%08lx\n", Status);
+            return 1;
+        }
+
+        PrintRates(&Info[!Current], &Info[Current], Interval);
+        Current = !Current;
+    }
+
+    return 0;
+}
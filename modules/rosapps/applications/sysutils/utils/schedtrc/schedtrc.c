@@ -0,0 +1,252 @@
+/*
+ * PROJECT:     ReactOS Scheduler Trace Dumper
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Dumps the kernel scheduler trace as a merged timeline
+ */
+
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#define NTOS_MODE_USER
+#include <ndk/exfuncs.h>
+#include <ndk/rtlfuncs.h>
+#include <ndk/setypes.h>
+
+static const char *EventNames[] =
+{
+    "?",
+    "SWITCH",
+    "READY",
+    "WAIT",
+    "UNWAIT",
+    "PRIORITY"
+};
+
+static const char *ThreadStates[] =
+{
+    "Initialized",
+    "Ready",
+    "Running",
+    "Standby",
+    "Terminated",
+    "Waiting",
+    "Transition",
+    "DeferredReady",
+    "GateWait"
+};
+
+static
+int
+__cdecl
+CompareRecords(const void *First, const void *Second)
+{
+    const SYSTEM_SCHEDULER_TRACE_RECORD *A = First, *B = Second;
+
+    /* Order by time, then by processor to keep the output stable */
+    if (A->TimeStamp != B->TimeStamp) return (A->TimeStamp < B->TimeStamp) ? -1 : 1;
+    return (int)A->Processor - (int)B->Processor;
+}
+
+static
+void
+PrintRecord(PSYSTEM_SCHEDULER_TRACE_RECORD Record,
+            double Microseconds)
+{
+    const char *Name;
+
+    Name = (Record->Event < ARRAYSIZE(EventNames)) ? EventNames[Record->Event] : EventNames[0];
+    printf("%14.3f  %3u  %-8s  ", Microseconds, Record->Processor, Name);
+
+    switch (Record->Event)
+    {
+        case SchedulerTraceContextSwitch:
+            printf("pid %-5lu tid %-5lu -> tid %-5lu prio %2u  old %s reason %u\n",
+                   Record->ProcessId, Record->ThreadId, Record->OtherThreadId,
+                   Record->Priority,
+                   ((ULONG)Record->Data < ARRAYSIZE(ThreadStates)) ? ThreadStates[Record->Data] : "?",
+                   Record->Reason);
+            break;
+
+        case SchedulerTraceReadyThread:
+            printf("pid %-5lu tid %-5lu by tid %-5lu prio %2u  last cpu %ld\n",
+                   Record->ProcessId, Record->ThreadId, Record->OtherThreadId,
+                   Record->Priority, Record->Data);
+            break;
+
+        case SchedulerTraceWaitBegin:
+            printf("pid %-5lu tid %-5lu reason %u objects %ld\n",
+                   Record->ProcessId, Record->ThreadId, Record->Reason, Record->Data);
+            break;
+
+        case SchedulerTraceWaitEnd:
+            printf("pid %-5lu tid %-5lu reason %u status 0x%08lx\n",
+                   Record->ProcessId, Record->ThreadId, Record->Reason, Record->Data);
+            break;
+
+        case SchedulerTraceSetPriority:
+            printf("pid %-5lu tid %-5lu by tid %-5lu prio %ld -> %u\n",
+                   Record->ProcessId, Record->ThreadId, Record->OtherThreadId,
+                   Record->Data, Record->Priority);
+            break;
+
+        default:
+            printf("data %ld\n", Record->Data);
+            break;
+    }
+}
+
+static
+void
+Usage(void)
+{
+    printf("Usage: schedtrc [-on | -off] [-reset] [-tid <thread id>]\n\n"
+           "Dumps the scheduler trace of all processors as one timeline.\n\n"
+           "  -on       Turn tracing on\n"
+           "  -off      Turn tracing off\n"
+           "  -reset    Clear the trace after dumping it\n"
+           "  -tid      Only show events involving the given thread\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    PSYSTEM_SCHEDULER_TRACE_INFORMATION Information = NULL;
+    SYSTEM_SCHEDULER_TRACE_CONTROL Control;
+    ULONG Length = 0, i, FilterThread = 0;
+    BOOLEAN OldValue, Enable = TRUE, SetState = FALSE, Reset = FALSE;
+    ULONGLONG Start;
+    double Frequency;
+    NTSTATUS Status;
+    int Argument;
+
+    /* Parse the command line */
+    for (Argument = 1; Argument < argc; Argument++)
+    {
+        if (!_stricmp(argv[Argument], "-on"))
+        {
+            SetState = TRUE;
+            Enable = TRUE;
+        }
+        else if (!_stricmp(argv[Argument], "-off"))
+        {
+            SetState = TRUE;
+            Enable = FALSE;
+        }
+        else if (!_stricmp(argv[Argument], "-reset"))
+        {
+            Reset = TRUE;
+        }
+        else if (!_stricmp(argv[Argument], "-tid") && (Argument + 1 < argc))
+        {
+            FilterThread = strtoul(argv[++Argument], NULL, 0);
+        }
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    /* The trace is only readable with the profile privilege */
+    Status = RtlAdjustPrivilege(SE_SYSTEM_PROFILE_PRIVILEGE, TRUE, FALSE, &OldValue);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Failed to enable the system profile privilege: 0x%08lx\n", Status);
+        return 1;
+    }
+
+    /* Change the tracing state if we were asked to */
+    if (SetState)
+    {
+        Control.Enable = Enable;
+        Control.Reset = FALSE;
+        Status = NtSetSystemInformation(SystemSchedulerTraceInformation,
+                                        &Control,
+                                        sizeof(Control));
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Failed to change the tracing state: 0x%08lx\n", Status);
+            return 1;
+        }
+
+        printf("Scheduler tracing is now %s\n", Enable ? "on" : "off");
+        if (!Reset) return 0;
+    }
+
+    /* Get the trace, it may grow while we allocate */
+    do
+    {
+        Length += 4096;
+        if (Information) HeapFree(GetProcessHeap(), 0, Information);
+        Information = HeapAlloc(GetProcessHeap(), 0, Length);
+        if (!Information)
+        {
+            printf("Out of memory\n");
+            return 1;
+        }
+
+        Status = NtQuerySystemInformation(SystemSchedulerTraceInformation,
+                                          Information,
+                                          Length,
+                                          &Length);
+    } while (Status == STATUS_INFO_LENGTH_MISMATCH);
+
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Failed to query the scheduler trace: 0x%08lx\n", Status);
+        HeapFree(GetProcessHeap(), 0, Information);
+        return 1;
+    }
+
+    printf("Scheduler trace: %s, %lu processors, %lu records per processor, %lu records\n\n",
+           Information->Enabled ? "on" : "off",
+           Information->NumberOfProcessors,
+           Information->RecordsPerProcessor,
+           Information->NumberOfRecords);
+
+    if (Information->NumberOfRecords)
+    {
+        /* Merge the processors into a single timeline */
+        qsort(Information->Records,
+              Information->NumberOfRecords,
+              sizeof(SYSTEM_SCHEDULER_TRACE_RECORD),
+              CompareRecords);
+
+        /* Print times in microseconds from the first record */
+        Frequency = Information->TimeStampFrequency ?
+                    (double)Information->TimeStampFrequency : 1000000.0;
+        Start = Information->Records[0].TimeStamp;
+
+        printf("  Time (usec)  CPU  Event     Details\n");
+        for (i = 0; i < Information->NumberOfRecords; i++)
+        {
+            if ((FilterThread) &&
+                (Information->Records[i].ThreadId != FilterThread) &&
+                (Information->Records[i].OtherThreadId != FilterThread))
+            {
+                continue;
+            }
+
+            PrintRecord(&Information->Records[i],
+                        (double)(Information->Records[i].TimeStamp - Start) * 1000000.0 / Frequency);
+        }
+    }
+
+    /* Clear the trace if requested */
+    if (Reset)
+    {
+        Control.Enable = Information->Enabled;
+        Control.Reset = TRUE;
+        Status = NtSetSystemInformation(SystemSchedulerTraceInformation,
+                                        &Control,
+                                        sizeof(Control));
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Failed to reset the trace: 0x%08lx\n", Status);
+        }
+    }
+
+    HeapFree(GetProcessHeap(), 0, Information);
+    return NT_SUCCESS(Status) ? 0 : 1;
+}
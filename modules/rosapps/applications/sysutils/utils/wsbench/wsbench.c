@@ -0,0 +1,252 @@
+/*
+ * PROJECT:     ReactOS Working Set Benchmark
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Counts the hard faults of a hot/cold access pattern under memory pressure
+ */
+
+#define WIN32_NO_STATUS
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#define NTOS_MODE_USER
+#include <ndk/exfuncs.h>
+#include <ndk/psfuncs.h>
+
+#define COLD_EVERY 8
+
+typedef struct _COUNTERS
+{
+    ULONG PageReads;
+    ULONG Transitions;
+    ULONG DemandZero;
+} COUNTERS, *PCOUNTERS;
+
+typedef struct _RESULTS
+{
+    ULONG HotHard;
+    ULONG HotSoft;
+    ULONG HotPasses;
+    ULONG ColdHard;
+    ULONG ColdPasses;
+} RESULTS, *PRESULTS;
+
+static
+BOOL
+QueryCounters(PCOUNTERS Counters)
+{
+    SYSTEM_PERFORMANCE_INFORMATION Info;
+    NTSTATUS Status;
+
+    Status = NtQuerySystemInformation(SystemPerformanceInformation,
+                                      &Info,
+                                      sizeof(Info),
+                                      NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Failed to query the memory counters: 0x%08lx\n", Status);
+        return FALSE;
+    }
+
+    Counters->PageReads = Info.PageReadCount;
+    Counters->Transitions = Info.TransitionCount;
+    Counters->DemandZero = Info.DemandZeroCount;
+    return TRUE;
+}
+
+static
+SIZE_T
+QueryWorkingSetSize(void)
+{
+    VM_COUNTERS VmCounters;
+    NTSTATUS Status;
+
+    Status = NtQueryInformationProcess(NtCurrentProcess(),
+                                       ProcessVmCounters,
+                                       &VmCounters,
+                                       sizeof(VmCounters),
+                                       NULL);
+    return NT_SUCCESS(Status) ? VmCounters.WorkingSetSize : 0;
+}
+
+static
+void
+TouchPages(volatile UCHAR *Base, SIZE_T Pages, ULONG PageSize, UCHAR Value)
+{
+    SIZE_T i;
+
+    /* Write, so that the pages must go to the page file to be trimmed */
+    for (i = 0; i < Pages; i++)
+    {
+        Base[i * PageSize] = Value;
+    }
+}
+
+static
+BOOL
+RunPasses(PUCHAR Base,
+          SIZE_T TotalPages,
+          SIZE_T HotPages,
+          ULONG PageSize,
+          ULONG Passes,
+          BOOL Empty,
+          PRESULTS Results)
+{
+    COUNTERS Before, After;
+    ULONG Pass, Hard, Soft;
+    DWORD End;
+    BOOL Cold;
+
+    ZeroMemory(Results, sizeof(*Results));
+
+    /* Start from the same place in both modes: everything was used once */
+    TouchPages(Base, TotalPages, PageSize, 1);
+
+    printf("\n%s: pass  phase   hard    soft    ws-kb\n", Empty ? "empty" : "aged ");
+    for (Pass = 0; Pass < Passes; Pass++)
+    {
+        if (!QueryCounters(&Before)) return FALSE;
+
+        /* Take every page out, like a trimmer that doesn't know which ones are hot */
+        if (Empty && !SetProcessWorkingSetSize(GetCurrentProcess(), (SIZE_T)-1, (SIZE_T)-1))
+        {
+            printf("Failed to empty the working set: %lu\n", GetLastError());
+            return FALSE;
+        }
+
+        /* The cold pages are used once in a while */
+        Cold = ((Pass % COLD_EVERY) == (COLD_EVERY - 1));
+        if (Cold)
+        {
+            TouchPages(Base + HotPages * PageSize,
+                       TotalPages - HotPages,
+                       PageSize,
+                       (UCHAR)Pass);
+        }
+
+        /* Keep the hot ones busy for as long as the working set manager takes to run */
+        End = GetTickCount() + 1000;
+        do
+        {
+            TouchPages(Base, HotPages, PageSize, (UCHAR)Pass);
+        } while ((LONG)(End - GetTickCount()) > 0);
+
+        if (!QueryCounters(&After)) return FALSE;
+
+        Hard = After.PageReads - Before.PageReads;
+        Soft = After.Transitions - Before.Transitions;
+        printf("       %4lu  %-5s %6lu  %6lu  %7Iu\n",
+               Pass,
+               Cold ? "cold" : "hot",
+               Hard,
+               Soft,
+               QueryWorkingSetSize() / 1024);
+
+        if (Cold)
+        {
+            Results->ColdHard += Hard;
+            Results->ColdPasses++;
+        }
+        else
+        {
+            Results->HotHard += Hard;
+            Results->HotSoft += Soft;
+            Results->HotPasses++;
+        }
+    }
+
+    return TRUE;
+}
+
+static
+void
+PrintResults(PCSTR Mode, PRESULTS Results)
+{
+    printf("%-6s %13lu %13lu %14lu\n",
+           Mode,
+           Results->HotPasses ? Results->HotHard / Results->HotPasses : 0,
+           Results->HotPasses ? Results->HotSoft / Results->HotPasses : 0,
+           Results->ColdPasses ? Results->ColdHard / Results->ColdPasses : 0);
+}
+
+static
+void
+Usage(void)
+{
+    printf("Usage: wsbench total-mb [hot-percent [passes [cap-mb]]]\n\n"
+           "Commits total-mb of memory and keeps hot-percent of it (10 by default) in\n"
+           "use for one second per pass, touching the rest once every %u passes.\n"
+           "The working set can be capped to cap-mb. For the pages to be trimmed,\n"
+           "total-mb must exceed the memory available to the system.\n\n"
+           "The passes run twice with the same hot set: first emptying the working\n"
+           "set at the start of each pass, which trims regardless of age, then\n"
+           "leaving the trimming to the working set manager, which takes the\n"
+           "coldest pages first. The aged run should take far fewer hard faults\n"
+           "in its hot passes.\n\n"
+           "  hard    pages read back from the page file\n"
+           "  soft    pages taken back from the standby or modified list\n"
+           "  ws-kb   working set of the benchmark at the end of the pass\n",
+           COLD_EVERY);
+}
+
+int
+main(int argc, char **argv)
+{
+    MEMORYSTATUSEX MemoryStatus;
+    SYSTEM_INFO SystemInfo;
+    RESULTS Empty, Aged;
+    SIZE_T TotalPages, HotPages, CapBytes = 0;
+    ULONG TotalMb, HotPercent = 10, Passes = 30;
+    PUCHAR Base;
+
+    /* Parse the command line */
+    if ((argc < 2) || (argc > 5))
+    {
+        Usage();
+        return 1;
+    }
+    TotalMb = strtoul(argv[1], NULL, 0);
+    if (argc > 2) HotPercent = strtoul(argv[2], NULL, 0);
+    if (argc > 3) Passes = strtoul(argv[3], NULL, 0);
+    if (argc > 4) CapBytes = (SIZE_T)strtoul(argv[4], NULL, 0) * 1024 * 1024;
+    if (!TotalMb || !HotPercent || (HotPercent > 100) || !Passes)
+    {
+        Usage();
+        return 1;
+    }
+
+    GetSystemInfo(&SystemInfo);
+    TotalPages = ((SIZE_T)TotalMb * 1024 * 1024) / SystemInfo.dwPageSize;
+    HotPages = max(TotalPages * HotPercent / 100, 1);
+
+    MemoryStatus.dwLength = sizeof(MemoryStatus);
+    GlobalMemoryStatusEx(&MemoryStatus);
+    printf("%lu MB committed, %lu%% hot, %I64u MB of memory available\n",
+           TotalMb, HotPercent, MemoryStatus.ullAvailPhys / (1024 * 1024));
+
+    if (CapBytes && !SetProcessWorkingSetSize(GetCurrentProcess(), CapBytes / 2, CapBytes))
+    {
+        printf("Failed to cap the working set: %lu\n", GetLastError());
+        return 1;
+    }
+
+    Base = VirtualAlloc(NULL, TotalPages * SystemInfo.dwPageSize, MEM_COMMIT, PAGE_READWRITE);
+    if (!Base)
+    {
+        printf("Failed to commit %lu MB: %lu\n", TotalMb, GetLastError());
+        return 1;
+    }
+
+    if (!RunPasses(Base, TotalPages, HotPages, SystemInfo.dwPageSize, Passes, TRUE, &Empty) ||
+        !RunPasses(Base, TotalPages, HotPages, SystemInfo.dwPageSize, Passes, FALSE, &Aged))
+    {
+        VirtualFree(Base, 0, MEM_RELEASE);
+        return 1;
+    }
+
+    printf("\nmode   hot hard/pass hot soft/pass cold hard/pass\n");
+    PrintResults("empty", &Empty);
+    PrintResults("aged", &Aged);
+
+    VirtualFree(Base, 0, MEM_RELEASE);
+    return 0;
+}
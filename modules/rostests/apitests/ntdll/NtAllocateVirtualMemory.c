@@ -794,6 +794,107 @@ CheckSomeDefaultAddresses(VOID)
     }
 }
 
+static
+VOID
+CheckLargePages(VOID)
+{
+    NTSTATUS Status;
+    PVOID BaseAddress;
+    SIZE_T Size, LargePageSize;
+    MEMORY_BASIC_INFORMATION MemoryInfo;
+    BOOLEAN WasEnabled;
+
+    LargePageSize = SharedUserData->LargePageMinimum;
+    if (!LargePageSize)
+    {
+        skip("Large pages are not supported\n");
+        return;
+    }
+
+    Status = RtlAdjustPrivilege(SE_LOCK_MEMORY_PRIVILEGE, TRUE, FALSE, &WasEnabled);
+    if (!NT_SUCCESS(Status))
+    {
+        skip("SeLockMemoryPrivilege not available: 0x%lx\n", Status);
+        return;
+    }
+
+    /* Large pages must be committed right away */
+    BaseAddress = NULL;
+    Size = LargePageSize;
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(),
+                                     &BaseAddress,
+                                     0,
+                                     &Size,
+                                     MEM_RESERVE | MEM_LARGE_PAGES,
+                                     PAGE_READWRITE);
+    ok_ntstatus(Status, STATUS_INVALID_PARAMETER_5);
+
+    /* The size must be a multiple of the large page size */
+    BaseAddress = NULL;
+    Size = LargePageSize / 2;
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(),
+                                     &BaseAddress,
+                                     0,
+                                     &Size,
+                                     MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                                     PAGE_READWRITE);
+    ok_ntstatus(Status, STATUS_INVALID_PARAMETER);
+
+    /* Allocate two large pages. This may fail when memory is fragmented */
+    BaseAddress = NULL;
+    Size = 2 * LargePageSize;
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(),
+                                     &BaseAddress,
+                                     0,
+                                     &Size,
+                                     MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                                     PAGE_READWRITE);
+    if (Status == STATUS_INSUFFICIENT_RESOURCES)
+    {
+        skip("No free large pages\n");
+        goto Exit;
+    }
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        goto Exit;
+
+    ok(((ULONG_PTR)BaseAddress & (LargePageSize - 1)) == 0, "BaseAddress = %p is not aligned\n", BaseAddress);
+    ok_eq_size(Size, 2 * LargePageSize);
+
+    /* The memory is zeroed and writable */
+    ok_long(((PLONG)BaseAddress)[0], 0);
+    ok_long(((PLONG)((PUCHAR)BaseAddress + Size))[-1], 0);
+    StartSeh()
+        ((PLONG)BaseAddress)[0] = 1;
+        ((PLONG)((PUCHAR)BaseAddress + Size))[-1] = 2;
+    EndSeh(STATUS_SUCCESS)
+
+    /* And shows up as one committed region */
+    Status = NtQueryVirtualMemory(NtCurrentProcess(),
+                                  BaseAddress,
+                                  MemoryBasicInformation,
+                                  &MemoryInfo,
+                                  sizeof(MemoryInfo),
+                                  NULL);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok_eq_size(MemoryInfo.RegionSize, 2 * LargePageSize);
+    ok_hex(MemoryInfo.State, MEM_COMMIT);
+    ok_hex(MemoryInfo.Protect, PAGE_READWRITE);
+    ok_hex(MemoryInfo.Type, MEM_PRIVATE);
+
+    /* Large pages can't be decommitted */
+    Size = PAGE_SIZE;
+    Status = NtFreeVirtualMemory(NtCurrentProcess(), &BaseAddress, &Size, MEM_DECOMMIT);
+    ok_ntstatus(Status, STATUS_MEMORY_NOT_ALLOCATED);
+
+    Size = 0;
+    Status = NtFreeVirtualMemory(NtCurrentProcess(), &BaseAddress, &Size, MEM_RELEASE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+
+Exit:
+    RtlAdjustPrivilege(SE_LOCK_MEMORY_PRIVILEGE, WasEnabled, FALSE, &WasEnabled);
+}
+
 #define RUNS 32
 
 START_TEST(NtAllocateVirtualMemory)
@@ -805,6 +906,7 @@ START_TEST(NtAllocateVirtualMemory)
     CheckAlignment();
     CheckAdjacentVADs();
     CheckSomeDefaultAddresses();
+    CheckLargePages();
 
     Size1 = 32;
     Mem1 = Allocate(Size1);
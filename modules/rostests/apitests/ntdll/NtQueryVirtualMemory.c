@@ -0,0 +1,178 @@
+/*
+ * PROJECT:     ReactOS API Tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Test for NtQueryVirtualMemory
+ */
+
+#include "precomp.h"
+
+#define REGION_PAGES 64
+
+static
+VOID
+CheckBasicInformationList(VOID)
+{
+    PMEMORY_BASIC_INFORMATION_LIST List;
+    MEMORY_BASIC_INFORMATION Single;
+    PVOID Base = NULL, Address;
+    SIZE_T Size = REGION_PAGES * PAGE_SIZE, ListSize, ReturnLength;
+    NTSTATUS Status;
+    ULONG i;
+
+    /* Reserve a range and commit every other page, which gives one region per page */
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Base, 0, &Size, MEM_RESERVE, PAGE_READWRITE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status)) return;
+
+    for (i = 0; i < REGION_PAGES; i += 2)
+    {
+        Address = (PUCHAR)Base + i * PAGE_SIZE;
+        Size = PAGE_SIZE;
+        Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Address, 0, &Size, MEM_COMMIT, PAGE_READWRITE);
+        ok_ntstatus(Status, STATUS_SUCCESS);
+    }
+
+    /* Too small for a single region */
+    ListSize = FIELD_OFFSET(MEMORY_BASIC_INFORMATION_LIST, Regions) + REGION_PAGES * sizeof(MEMORY_BASIC_INFORMATION);
+    List = HeapAlloc(GetProcessHeap(), 0, ListSize);
+    if (!List)
+    {
+        skip("Out of memory\n");
+        goto Cleanup;
+    }
+
+    Status = NtQueryVirtualMemory(NtCurrentProcess(),
+                                  Base,
+                                  MemoryBasicInformationList,
+                                  List,
+                                  FIELD_OFFSET(MEMORY_BASIC_INFORMATION_LIST, Regions),
+                                  &ReturnLength);
+    ok_ntstatus(Status, STATUS_INFO_LENGTH_MISMATCH);
+
+    /* One call describes the whole range */
+    ReturnLength = 0;
+    Status = NtQueryVirtualMemory(NtCurrentProcess(),
+                                  Base,
+                                  MemoryBasicInformationList,
+                                  List,
+                                  ListSize,
+                                  &ReturnLength);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status)) goto Cleanup;
+
+    ok_eq_ulong(List->NumberOfRegions, REGION_PAGES);
+    ok_eq_size(ReturnLength, ListSize);
+    ok_eq_pointer(List->NextAddress, (PUCHAR)Base + REGION_PAGES * PAGE_SIZE);
+
+    /* And it must match what one call per region returns */
+    for (i = 0; i < List->NumberOfRegions; i++)
+    {
+        Address = (PUCHAR)Base + i * PAGE_SIZE;
+        Status = NtQueryVirtualMemory(NtCurrentProcess(),
+                                      Address,
+                                      MemoryBasicInformation,
+                                      &Single,
+                                      sizeof(Single),
+                                      NULL);
+        ok_ntstatus(Status, STATUS_SUCCESS);
+
+        ok_eq_pointer(List->Regions[i].BaseAddress, Single.BaseAddress);
+        ok_eq_pointer(List->Regions[i].AllocationBase, Base);
+        ok_eq_size(List->Regions[i].RegionSize, PAGE_SIZE);
+        ok_eq_ulong(List->Regions[i].State, Single.State);
+        ok_eq_ulong(List->Regions[i].Protect, Single.Protect);
+        ok_eq_ulong(List->Regions[i].Type, MEM_PRIVATE);
+        ok_eq_ulong(List->Regions[i].State, (i % 2) ? MEM_RESERVE : MEM_COMMIT);
+    }
+
+    /* A walk of the whole address space ends with no next address */
+    Address = NULL;
+    for (i = 0; i < 100000; i++)
+    {
+        Status = NtQueryVirtualMemory(NtCurrentProcess(),
+                                      Address,
+                                      MemoryBasicInformationList,
+                                      List,
+                                      ListSize,
+                                      NULL);
+        ok_ntstatus(Status, STATUS_SUCCESS);
+        if (!NT_SUCCESS(Status) || !List->NextAddress) break;
+
+        ok(List->NumberOfRegions == REGION_PAGES, "Got %lu regions\n", List->NumberOfRegions);
+        ok((ULONG_PTR)List->NextAddress > (ULONG_PTR)Address, "NextAddress %p did not advance\n", List->NextAddress);
+        Address = List->NextAddress;
+    }
+    ok(List->NextAddress == NULL, "Walk did not finish\n");
+
+Cleanup:
+    if (List) HeapFree(GetProcessHeap(), 0, List);
+    Size = 0;
+    Status = NtFreeVirtualMemory(NtCurrentProcess(), &Base, &Size, MEM_RELEASE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+}
+
+static
+VOID
+CheckGapSearch(VOID)
+{
+    PVOID Bases[64], Address, Highest;
+    SIZE_T Size;
+    NTSTATUS Status;
+    ULONG i;
+
+    /* Punch holes into a run of reservations */
+    for (i = 0; i < RTL_NUMBER_OF(Bases); i++)
+    {
+        Bases[i] = NULL;
+        Size = 4 * PAGE_SIZE;
+        Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Bases[i], 0, &Size, MEM_RESERVE, PAGE_READWRITE);
+        ok_ntstatus(Status, STATUS_SUCCESS);
+    }
+
+    for (i = 0; i < RTL_NUMBER_OF(Bases); i += 2)
+    {
+        Size = 0;
+        Status = NtFreeVirtualMemory(NtCurrentProcess(), &Bases[i], &Size, MEM_RELEASE);
+        ok_ntstatus(Status, STATUS_SUCCESS);
+    }
+
+    /* Allocations have to land in free space, bottom-up and top-down alike */
+    for (i = 0; i < RTL_NUMBER_OF(Bases); i += 2)
+    {
+        Bases[i] = NULL;
+        Size = PAGE_SIZE;
+        Status = NtAllocateVirtualMemory(NtCurrentProcess(),
+                                         &Bases[i],
+                                         0,
+                                         &Size,
+                                         MEM_RESERVE | ((i % 4) ? MEM_TOP_DOWN : 0),
+                                         PAGE_READWRITE);
+        ok_ntstatus(Status, STATUS_SUCCESS);
+    }
+
+    /* Shrinking a reservation from the end makes room right behind it */
+    Address = (PUCHAR)Bases[1] + 2 * PAGE_SIZE;
+    Size = 2 * PAGE_SIZE;
+    Status = NtFreeVirtualMemory(NtCurrentProcess(), &Address, &Size, MEM_RELEASE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+
+    Highest = Address;
+    Size = 2 * PAGE_SIZE;
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Highest, 0, &Size, MEM_RESERVE, PAGE_READWRITE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok_eq_pointer(Highest, Address);
+
+    Size = 0;
+    NtFreeVirtualMemory(NtCurrentProcess(), &Highest, &Size, MEM_RELEASE);
+    for (i = 0; i < RTL_NUMBER_OF(Bases); i++)
+    {
+        Size = 0;
+        NtFreeVirtualMemory(NtCurrentProcess(), &Bases[i], &Size, MEM_RELEASE);
+    }
+}
+
+START_TEST(NtQueryVirtualMemory)
+{
+    CheckBasicInformationList();
+    CheckGapSearch();
+}
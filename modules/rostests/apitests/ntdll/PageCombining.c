@@ -0,0 +1,153 @@
+/*
+ * PROJECT:     ReactOS API Tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Test for the combining of identical private pages
+ */
+
+#include "precomp.h"
+
+#define TEST_PAGES 64
+#define SCAN_TIMEOUT_MS 60000
+
+static
+BOOLEAN
+QueryCombining(PSYSTEM_PAGE_COMBINING_INFORMATION Info)
+{
+    NTSTATUS Status;
+
+    Status = NtQuerySystemInformation(SystemPageCombiningInformation, Info, sizeof(*Info), NULL);
+    return NT_SUCCESS(Status);
+}
+
+static
+NTSTATUS
+SetCombining(BOOLEAN Enable, BOOLEAN ScanNow)
+{
+    SYSTEM_PAGE_COMBINING_CONTROL Control;
+
+    Control.Enable = Enable;
+    Control.ScanNow = ScanNow;
+    return NtSetSystemInformation(SystemPageCombiningInformation, &Control, sizeof(Control));
+}
+
+static
+BOOLEAN
+WaitForScans(ULONG Scans)
+{
+    SYSTEM_PAGE_COMBINING_INFORMATION Info;
+    ULONG Waited;
+
+    for (Waited = 0; Waited < SCAN_TIMEOUT_MS; Waited += 100)
+    {
+        if (!QueryCombining(&Info)) return FALSE;
+        if (Info.NumberOfScans >= Scans) return TRUE;
+        Sleep(100);
+    }
+
+    return FALSE;
+}
+
+static
+VOID
+FillPage(PUCHAR Page, ULONG Seed)
+{
+    ULONG i;
+
+    for (i = 0; i < PAGE_SIZE; i++)
+    {
+        Page[i] = (UCHAR)(i * 7 + Seed);
+    }
+}
+
+static
+BOOLEAN
+CheckPage(PUCHAR Page, ULONG Seed)
+{
+    ULONG i;
+
+    for (i = 0; i < PAGE_SIZE; i++)
+    {
+        if (Page[i] != (UCHAR)(i * 7 + Seed)) return FALSE;
+    }
+
+    return TRUE;
+}
+
+START_TEST(PageCombining)
+{
+    SYSTEM_PAGE_COMBINING_INFORMATION Before, After;
+    PUCHAR Base = NULL;
+    SIZE_T Size = TEST_PAGES * PAGE_SIZE;
+    BOOLEAN WasEnabled, WasCombining, ScansDone;
+    NTSTATUS Status;
+    ULONG i, Seed;
+
+    if (!QueryCombining(&Before))
+    {
+        skip("Page combining is not supported\n");
+        return;
+    }
+    WasCombining = Before.Enabled;
+
+    Status = RtlAdjustPrivilege(SE_PROF_SINGLE_PROCESS_PRIVILEGE, TRUE, FALSE, &WasEnabled);
+    if (!NT_SUCCESS(Status))
+    {
+        skip("Cannot enable the profile single process privilege\n");
+        return;
+    }
+
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(), (PVOID*)&Base, 0, &Size, MEM_COMMIT, PAGE_READWRITE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status)) goto Cleanup;
+
+    /* The same content everywhere, unlikely to be found elsewhere */
+    Seed = GetTickCount();
+    for (i = 0; i < TEST_PAGES; i++)
+    {
+        FillPage(Base + i * PAGE_SIZE, Seed);
+    }
+
+    /* A pass that starts after the pages were filled must combine them */
+    Status = SetCombining(TRUE, TRUE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ScansDone = WaitForScans(Before.NumberOfScans + 2);
+    ok(ScansDone, "The scans did not complete\n");
+
+    if (!skip(ScansDone && QueryCombining(&After), "No pass was made\n"))
+    {
+        /* The first page is seen, the second kept, and all others merged with it */
+        ok(After.PagesMerged - Before.PagesMerged >= TEST_PAGES - 1,
+           "Only %I64u pages merged\n", After.PagesMerged - Before.PagesMerged);
+        ok(After.CombinedPages >= 1, "No combined page\n");
+
+        /* Reading the combined pages gives the same content */
+        for (i = 0; i < TEST_PAGES; i++)
+        {
+            ok(CheckPage(Base + i * PAGE_SIZE, Seed), "Page %lu changed\n", i);
+        }
+
+        /* Writing gives every page its own copy back, without touching the others */
+        for (i = 0; i < TEST_PAGES; i++)
+        {
+            FillPage(Base + i * PAGE_SIZE, Seed + i);
+        }
+        for (i = 0; i < TEST_PAGES; i++)
+        {
+            ok(CheckPage(Base + i * PAGE_SIZE, Seed + i), "Page %lu has the wrong content\n", i);
+        }
+
+        Before = After;
+        ok(QueryCombining(&After), "Query failed\n");
+        ok(After.PagesUnmerged - Before.PagesUnmerged >= TEST_PAGES - 2,
+           "Only %I64u pages unmerged\n", After.PagesUnmerged - Before.PagesUnmerged);
+    }
+
+    Size = 0;
+    Status = NtFreeVirtualMemory(NtCurrentProcess(), (PVOID*)&Base, &Size, MEM_RELEASE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+
+Cleanup:
+    /* Leave combining as it was */
+    SetCombining(WasCombining, FALSE);
+    RtlAdjustPrivilege(SE_PROF_SINGLE_PROCESS_PRIVILEGE, WasEnabled, FALSE, &WasEnabled);
+}
@@ -0,0 +1,194 @@
+/*
+ * PROJECT:     ReactOS API Tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Test for the call stack sampling profiler (class 0x102)
+ */
+
+#include "precomp.h"
+
+#define DRAIN_SAMPLES 1024
+#define BUSY_TIME_MS 1000
+
+static
+NTSTATUS
+SetStackProfile(BOOLEAN Enable)
+{
+    SYSTEM_STACK_PROFILE_CONTROL Control;
+
+    Control.Enable = Enable;
+    Control.CaptureUserStacks = TRUE;
+    Control.Interval = 0;
+    Control.SamplesPerProcessor = 0;
+    return NtSetSystemInformation(SystemStackProfileInformation, &Control, sizeof(Control));
+}
+
+static
+BOOLEAN
+IsInModule(PRTL_PROCESS_MODULES Modules, PVOID Address)
+{
+    ULONG i;
+
+    for (i = 0; i < Modules->NumberOfModules; i++)
+    {
+        if (((ULONG_PTR)Address >= (ULONG_PTR)Modules->Modules[i].ImageBase) &&
+            ((ULONG_PTR)Address < (ULONG_PTR)Modules->Modules[i].ImageBase + Modules->Modules[i].ImageSize))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static
+PRTL_PROCESS_MODULES
+QueryModules(VOID)
+{
+    PRTL_PROCESS_MODULES Modules;
+    ULONG Length = 0;
+    NTSTATUS Status;
+
+    Status = NtQuerySystemInformation(SystemModuleInformation, NULL, 0, &Length);
+    if (Status != STATUS_INFO_LENGTH_MISMATCH) return NULL;
+
+    /* Leave room for a driver that loads in between */
+    Length += 4096;
+    Modules = RtlAllocateHeap(RtlGetProcessHeap(), 0, Length);
+    if (!Modules) return NULL;
+
+    Status = NtQuerySystemInformation(SystemModuleInformation, Modules, Length, NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        RtlFreeHeap(RtlGetProcessHeap(), 0, Modules);
+        return NULL;
+    }
+
+    return Modules;
+}
+
+START_TEST(StackProfile)
+{
+    SYSTEM_STACK_PROFILE_INFORMATION Header;
+    PSYSTEM_STACK_PROFILE_INFORMATION Info;
+    PSYSTEM_STACK_PROFILE_SAMPLE Sample;
+    SYSTEM_BASIC_INFORMATION BasicInfo;
+    VM_COUNTERS VmCounters;
+    PRTL_PROCESS_MODULES Modules;
+    ULONG Length, i, j;
+    ULONG OurSamples = 0, KernelSamples = 0, UserSamples = 0, KernelCallers = 0;
+    PVOID NtosBase, NtosEnd;
+    BOOLEAN WasEnabled;
+    NTSTATUS Status;
+    DWORD End;
+
+    /* A buffer with just the header drains nothing */
+    Status = NtQuerySystemInformation(SystemStackProfileInformation, &Header, FIELD_OFFSET(SYSTEM_STACK_PROFILE_INFORMATION, Samples), NULL);
+    if ((Status == STATUS_INVALID_INFO_CLASS) || (Status == STATUS_NOT_IMPLEMENTED))
+    {
+        skip("Stack profiling is not supported\n");
+        return;
+    }
+
+    Status = RtlAdjustPrivilege(SE_SYSTEM_PROFILE_PRIVILEGE, TRUE, FALSE, &WasEnabled);
+    if (!NT_SUCCESS(Status))
+    {
+        skip("Cannot enable the system profile privilege\n");
+        return;
+    }
+
+    Status = NtQuerySystemInformation(SystemStackProfileInformation, &Header, FIELD_OFFSET(SYSTEM_STACK_PROFILE_INFORMATION, Samples), NULL);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status) || Header.Enabled)
+    {
+        skip("The stack profiler is already in use\n");
+        goto Cleanup;
+    }
+
+    Status = NtQuerySystemInformation(SystemBasicInformation, &BasicInfo, sizeof(BasicInfo), NULL);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    Modules = QueryModules();
+    ok(Modules != NULL, "Failed to query the loaded modules\n");
+    Length = FIELD_OFFSET(SYSTEM_STACK_PROFILE_INFORMATION, Samples[DRAIN_SAMPLES]);
+    Info = RtlAllocateHeap(RtlGetProcessHeap(), 0, Length);
+    ok(Info != NULL, "Failed to allocate the sample buffer\n");
+    if (!NT_SUCCESS(Status) || !Modules || !Info) goto Free;
+
+    /* The kernel image comes first */
+    NtosBase = Modules->Modules[0].ImageBase;
+    NtosEnd = (PUCHAR)NtosBase + Modules->Modules[0].ImageSize;
+
+    Status = SetStackProfile(TRUE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status)) goto Free;
+
+    /* Keep this thread busy, going in and out of the kernel */
+    End = GetTickCount() + BUSY_TIME_MS;
+    do
+    {
+        NtQueryInformationProcess(NtCurrentProcess(), ProcessVmCounters, &VmCounters, sizeof(VmCounters), NULL);
+    } while ((LONG)(End - GetTickCount()) > 0);
+
+    Status = SetStackProfile(FALSE);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+
+    /* Drain what the rings kept */
+    do
+    {
+        Status = NtQuerySystemInformation(SystemStackProfileInformation, Info, Length, NULL);
+        ok_ntstatus(Status, STATUS_SUCCESS);
+        if (!NT_SUCCESS(Status)) break;
+
+        ok(Info->NumberOfSamples <= DRAIN_SAMPLES, "Got %lu samples\n", Info->NumberOfSamples);
+        for (i = 0; i < Info->NumberOfSamples; i++)
+        {
+            Sample = &Info->Samples[i];
+            ok((ULONG)Sample->KernelFrameCount + Sample->UserFrameCount <= SYSTEM_STACK_PROFILE_MAX_FRAMES,
+               "Sample %lu has %u + %u frames\n", i, Sample->KernelFrameCount, Sample->UserFrameCount);
+            if (Sample->UniqueThread != NtCurrentTeb()->ClientId.UniqueThread) continue;
+
+            /* The samples of this thread are attributed to this process */
+            OurSamples++;
+            ok(Sample->UniqueProcess == NtCurrentTeb()->ClientId.UniqueProcess,
+               "Sample of our thread in process %p\n", Sample->UniqueProcess);
+
+            /* We interrupted some kernel module, and its callers were unwound from there */
+            if (Sample->KernelFrameCount)
+            {
+                KernelSamples++;
+                ok(IsInModule(Modules, Sample->Frames[0]),
+                   "Kernel PC %p is outside the loaded modules\n", Sample->Frames[0]);
+                for (j = 1; j < Sample->KernelFrameCount; j++)
+                {
+                    if ((Sample->Frames[j] >= NtosBase) && (Sample->Frames[j] < NtosEnd))
+                    {
+                        KernelCallers++;
+                        break;
+                    }
+                }
+            }
+
+            /* The user frames follow, starting with the interrupted user PC */
+            if (Sample->UserFrameCount)
+            {
+                UserSamples++;
+                for (j = Sample->KernelFrameCount; j < (ULONG)Sample->KernelFrameCount + Sample->UserFrameCount; j++)
+                {
+                    ok((ULONG_PTR)Sample->Frames[j] <= BasicInfo.MaximumUserModeAddress,
+                       "User frame %lu is %p\n", j - Sample->KernelFrameCount, Sample->Frames[j]);
+                }
+            }
+        }
+    } while (Info->NumberOfSamples);
+
+    trace("%lu samples of this thread, %lu in the kernel, %lu with kernel callers, %lu with user frames\n",
+          OurSamples, KernelSamples, KernelCallers, UserSamples);
+    ok(OurSamples > 0, "No sample of this thread\n");
+    ok(UserSamples == OurSamples, "Only %lu of %lu samples have user frames\n", UserSamples, OurSamples);
+    ok(KernelCallers > 0, "No kernel sample was unwound into the kernel image\n");
+
+Free:
+    if (Info) RtlFreeHeap(RtlGetProcessHeap(), 0, Info);
+    if (Modules) RtlFreeHeap(RtlGetProcessHeap(), 0, Modules);
+Cleanup:
+    RtlAdjustPrivilege(SE_SYSTEM_PROFILE_PRIVILEGE, WasEnabled, FALSE, &WasEnabled);
+}
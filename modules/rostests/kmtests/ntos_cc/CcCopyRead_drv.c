@@ -28,6 +28,14 @@ BOOLEAN ReadCalledNonCached;
 LARGE_INTEGER ReadOffset;
 ULONG ReadLength;
 
+#define READ_AHEAD_FILE_SIZE (16 * 1024 * 1024)
+#define READ_AHEAD_CHUNK_SIZE (64 * 1024)
+#define READ_AHEAD_CHUNKS 12
+
+static PETHREAD ReadAheadTestThread;
+static ULONG ReadAheadDemandReads;
+static volatile LONGLONG ReadAheadEnd;
+
 static
 BOOLEAN
 NTAPI
@@ -274,6 +282,110 @@ Test_CcCopyRead(PFILE_OBJECT FileObject)
     ok_eq_char(Ret, 'x');
 }
 
+static
+LONGLONG
+WaitForReadAhead(VOID)
+{
+    LARGE_INTEGER Interval;
+    LONGLONG End;
+    ULONG Waited, Stable = 0;
+
+    /* Read ahead runs in a worker, wait until it stops moving */
+    Interval.QuadPart = -50 * 1000 * 10;
+    End = ReadAheadEnd;
+    for (Waited = 0; Waited < 40 && Stable < 3; Waited++)
+    {
+        KeDelayExecutionThread(KernelMode, FALSE, &Interval);
+        if (ReadAheadEnd == End)
+        {
+            Stable++;
+        }
+        else
+        {
+            End = ReadAheadEnd;
+            Stable = 0;
+        }
+    }
+
+    return End;
+}
+
+static
+VOID
+Test_ReadAhead(PFILE_OBJECT FileObject)
+{
+    BOOLEAN Ret;
+    PVOID Buffer;
+    ULONG i, DemandReads, Hits = 0;
+    LARGE_INTEGER Offset;
+    IO_STATUS_BLOCK IoStatus;
+    LONGLONG End, Lead = 0, FirstLead = 0;
+
+    Buffer = ExAllocatePoolWithTag(PagedPool, READ_AHEAD_CHUNK_SIZE, 'FwrI');
+    if (skip(Buffer != NULL, "Out of memory\n"))
+        return;
+
+    ReadAheadTestThread = PsGetCurrentThread();
+    ReadAheadDemandReads = 0;
+    ReadAheadEnd = 0;
+
+    for (i = 0; i < READ_AHEAD_CHUNKS; i++)
+    {
+        Offset.QuadPart = (LONGLONG)i * READ_AHEAD_CHUNK_SIZE;
+
+        /* Once the stream was seen, the next chunk must already be there */
+        if (i >= 2)
+        {
+            Ret = 'x';
+            DemandReads = ReadAheadDemandReads;
+            KmtStartSeh()
+                Ret = CcCopyRead(FileObject, &Offset, READ_AHEAD_CHUNK_SIZE, FALSE, Buffer, &IoStatus);
+            KmtEndSeh(STATUS_SUCCESS);
+            ok(Ret == TRUE, "Chunk %lu was not read ahead\n", i);
+            ok_eq_ulong(ReadAheadDemandReads, DemandReads);
+            if (Ret == TRUE) Hits++;
+        }
+        else
+        {
+            Ret = FALSE;
+        }
+
+        /* Otherwise, go and read it */
+        if (Ret != TRUE)
+        {
+            Ret = 'x';
+            KmtStartSeh()
+                Ret = CcCopyRead(FileObject, &Offset, READ_AHEAD_CHUNK_SIZE, TRUE, Buffer, &IoStatus);
+            KmtEndSeh(STATUS_SUCCESS);
+            ok_bool_true(Ret, "CcCopyRead should succeed\n");
+        }
+        ok_eq_hex(IoStatus.Status, STATUS_SUCCESS);
+        ok_eq_ulongptr(IoStatus.Information, READ_AHEAD_CHUNK_SIZE);
+        if (i > 0) ok_eq_hex(*(PUSHORT)Buffer, 0xBABA);
+
+        /* Look at how far ahead of the reader the worker went */
+        End = WaitForReadAhead();
+        Lead = End - (Offset.QuadPart + READ_AHEAD_CHUNK_SIZE);
+        if (i == 0)
+        {
+            /* A single read isn't a stream yet */
+            ok_eq_longlong(End, 0LL);
+        }
+        else if (i == 1)
+        {
+            ok(Lead > 0, "Nothing was read ahead of the second chunk\n");
+            FirstLead = Lead;
+        }
+        trace("Chunk %lu: read ahead %I64d bytes beyond it\n", i, Lead);
+    }
+
+    /* Everything after the first two chunks came from read ahead, and the window grew meanwhile */
+    ok_eq_ulong(Hits, READ_AHEAD_CHUNKS - 2UL);
+    ok(Lead > FirstLead, "The window didn't grow: %I64d bytes ahead at first, %I64d at the end\n", FirstLead, Lead);
+
+    ReadAheadTestThread = NULL;
+    ExFreePoolWithTag(Buffer, 'FwrI');
+}
 
 static
 NTSTATUS
@@ -286,6 +398,7 @@ TestIrpHandler(
     NTSTATUS Status;
     PTEST_FCB Fcb;
     CACHE_UNINITIALIZE_EVENT CacheUninitEvent;
+    static const UNICODE_STRING ReadAheadTestFileName = RTL_CONSTANT_STRING(L"\\ReadAheadTestFile");
 
     PAGED_CODE();
 
@@ -311,8 +424,14 @@ TestIrpHandler(
         ExInitializeFastMutex(&Fcb->HeaderMutex);
         FsRtlSetupAdvancedHeader(&Fcb->Header, &Fcb->HeaderMutex);
         Fcb->BigFile = FALSE;
-        if (IoStack->FileObject->FileName.Length >= 2 * sizeof(WCHAR) &&
-            IoStack->FileObject->FileName.Buffer[1] == 'B')
+        if (RtlCompareUnicodeString(&IoStack->FileObject->FileName, &ReadAheadTestFileName, TRUE) == 0)
+        {
+            Fcb->Header.AllocationSize.QuadPart = READ_AHEAD_FILE_SIZE;
+            Fcb->Header.FileSize.QuadPart = READ_AHEAD_FILE_SIZE;
+            Fcb->Header.ValidDataLength.QuadPart = READ_AHEAD_FILE_SIZE;
+        }
+        else if (IoStack->FileObject->FileName.Length >= 2 * sizeof(WCHAR) &&
+                 IoStack->FileObject->FileName.Buffer[1] == 'B')
         {
             Fcb->Header.AllocationSize.QuadPart = 1000000;
             Fcb->Header.FileSize.QuadPart = 1000000;
@@ -384,6 +503,11 @@ TestIrpHandler(
                 Test_CcCopyRead(IoStack->FileObject);
                 Status = Irp->IoStatus.Status = STATUS_SUCCESS;
             }
+            else if (RtlCompareUnicodeString(&IoStack->FileObject->FileName, &ReadAheadTestFileName, TRUE) == 0)
+            {
+                Test_ReadAhead(IoStack->FileObject);
+                Status = Irp->IoStatus.Status = STATUS_SUCCESS;
+            }
             else
             {
                 /* We don't want to test alignement for big files (not the purpose of the test) */
@@ -431,6 +555,15 @@ TestIrpHandler(
             ReadOffset = Offset;
             ReadLength = Length;
 
+            /* Tell the reads of the read ahead test apart from the ones of the worker */
+            if (ReadAheadTestThread != NULL)
+            {
+                if (PsGetCurrentThread() == ReadAheadTestThread)
+                    ReadAheadDemandReads++;
+                else if (Offset.QuadPart + Length > ReadAheadEnd)
+                    ReadAheadEnd = Offset.QuadPart + Length;
+            }
+
             ok_irql(APC_LEVEL);
             ok((Offset.QuadPart % PAGE_SIZE == 0 || Offset.QuadPart == 0), "Offset is not aligned: %I64i\n", Offset.QuadPart);
             ok(Length % PAGE_SIZE == 0, "Length is not aligned: %I64i\n", Length);
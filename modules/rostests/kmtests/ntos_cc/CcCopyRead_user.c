@@ -7,6 +7,8 @@
 
 #include <kmt_test.h>
 
+#define STREAM_CHUNK_SIZE (1024 * 1024)
+
 START_TEST(CcCopyRead)
 {
     HANDLE Handle;
@@ -20,6 +22,8 @@ START_TEST(CcCopyRead)
     UNICODE_STRING ReallySmallAlignmentTest = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyRead\\ReallySmallAlignmentTest");
     UNICODE_STRING FileBig = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyRead\\FileBig");
     UNICODE_STRING BehaviourTestFile = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyRead\\BehaviourTestFile");
+    UNICODE_STRING ReadAheadTestFile = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyRead\\ReadAheadTestFile");
+    PVOID StreamBuffer;
     DWORD Error;
 
     Error = KmtLoadAndOpenDriver(L"CcCopyRead", FALSE);
@@ -103,6 +107,35 @@ START_TEST(CcCopyRead)
     ok_eq_hex(Status, STATUS_SUCCESS);
     ok_eq_hex(((USHORT *)Buffer)[0], 0xBABA);
 
+    /* Stream the whole 4GB file, so that the cache map has to keep track of thousands of views */
+    StreamBuffer = RtlAllocateHeap(RtlGetProcessHeap(), 0, STREAM_CHUNK_SIZE);
+    if (skip(StreamBuffer != NULL, "Out of memory\n"))
+    {
+        for (ByteOffset.QuadPart = 0; ByteOffset.QuadPart < 4294967296LL; ByteOffset.QuadPart += STREAM_CHUNK_SIZE)
+        {
+            Status = NtReadFile(Handle, NULL, NULL, NULL, &IoStatusBlock, StreamBuffer, STREAM_CHUNK_SIZE, &ByteOffset, NULL);
+            if (Status != STATUS_SUCCESS || IoStatusBlock.Information != STREAM_CHUNK_SIZE)
+                break;
+            if (((USHORT *)StreamBuffer)[STREAM_CHUNK_SIZE / sizeof(USHORT) - 1] != 0xBABA)
+                break;
+        }
+        ok_eq_hex(Status, STATUS_SUCCESS);
+        ok_eq_longlong(ByteOffset.QuadPart, 4294967296LL);
+
+        /* Views from both ends of the file must still be found */
+        ByteOffset.QuadPart = 4294967296LL - 1024;
+        Status = NtReadFile(Handle, NULL, NULL, NULL, &IoStatusBlock, Buffer, 1024, &ByteOffset, NULL);
+        ok_eq_hex(Status, STATUS_SUCCESS);
+        ok_eq_hex(((USHORT *)Buffer)[511], 0xBABA);
+
+        ByteOffset.QuadPart = 0;
+        Status = NtReadFile(Handle, NULL, NULL, NULL, &IoStatusBlock, Buffer, 1024, &ByteOffset, NULL);
+        ok_eq_hex(Status, STATUS_SUCCESS);
+        ok_eq_hex(((USHORT *)Buffer)[0], 0xBABA);
+
+        RtlFreeHeap(RtlGetProcessHeap(), 0, StreamBuffer);
+    }
+
     NtClose(Handle);
 
     InitializeObjectAttributes(&ObjectAttributes, &BehaviourTestFile, OBJ_CASE_INSENSITIVE, NULL, NULL);
@@ -114,6 +147,17 @@ START_TEST(CcCopyRead)
 
     NtClose(Handle);
 
+    /* The driver reads this one sequentially on its own, and checks what read ahead does */
+    InitializeObjectAttributes(&ObjectAttributes, &ReadAheadTestFile, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&Handle, FILE_ALL_ACCESS, &ObjectAttributes, &IoStatusBlock, 0, FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+
+    ByteOffset.QuadPart = 0;
+    Status = NtReadFile(Handle, NULL, NULL, NULL, &IoStatusBlock, Buffer, 1024, &ByteOffset, NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+
+    NtClose(Handle);
+
     RtlFreeHeap(RtlGetProcessHeap(), 0, Buffer);
     KmtCloseDriver();
     KmtUnloadDriver();
@@ -0,0 +1,454 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2.1+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Test driver for the Cc MDL functions
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/* Twice the view size, so that a range can span two views */
+#define TEST_FILE_SIZE (2 * 256 * 1024)
+#define VIEW_BOUNDARY  (256 * 1024)
+
+typedef struct _TEST_FCB
+{
+    FSRTL_ADVANCED_FCB_HEADER Header;
+    SECTION_OBJECT_POINTERS SectionObjectPointers;
+    FAST_MUTEX HeaderMutex;
+} TEST_FCB, *PTEST_FCB;
+
+static PFILE_OBJECT TestFileObject;
+static PDEVICE_OBJECT TestDeviceObject;
+static KMT_IRP_HANDLER TestIrpHandler;
+static FAST_IO_DISPATCH TestFastIoDispatch;
+
+BOOLEAN WriteCalled;
+LARGE_INTEGER WriteOffset;
+ULONG WriteLength;
+
+static
+BOOLEAN
+NTAPI
+FastIoRead(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ PLARGE_INTEGER FileOffset,
+    _In_ ULONG Length,
+    _In_ BOOLEAN Wait,
+    _In_ ULONG LockKey,
+    _Out_ PVOID Buffer,
+    _Out_ PIO_STATUS_BLOCK IoStatus,
+    _In_ PDEVICE_OBJECT DeviceObject)
+{
+    IoStatus->Status = STATUS_NOT_SUPPORTED;
+    return FALSE;
+}
+
+static
+BOOLEAN
+NTAPI
+FastIoWrite(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ PLARGE_INTEGER FileOffset,
+    _In_ ULONG Length,
+    _In_ BOOLEAN Wait,
+    _In_ ULONG LockKey,
+    _Out_ PVOID Buffer,
+    _Out_ PIO_STATUS_BLOCK IoStatus,
+    _In_ PDEVICE_OBJECT DeviceObject)
+{
+    IoStatus->Status = STATUS_NOT_SUPPORTED;
+    return FALSE;
+}
+
+NTSTATUS
+TestEntry(
+    _In_ PDRIVER_OBJECT DriverObject,
+    _In_ PCUNICODE_STRING RegistryPath,
+    _Out_ PCWSTR *DeviceName,
+    _Inout_ INT *Flags)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(RegistryPath);
+
+    *DeviceName = L"CcMdl";
+    *Flags = TESTENTRY_NO_EXCLUSIVE_DEVICE |
+             TESTENTRY_BUFFERED_IO_DEVICE |
+             TESTENTRY_NO_READONLY_DEVICE;
+
+    KmtRegisterIrpHandler(IRP_MJ_CLEANUP, NULL, TestIrpHandler);
+    KmtRegisterIrpHandler(IRP_MJ_CREATE, NULL, TestIrpHandler);
+    KmtRegisterIrpHandler(IRP_MJ_READ, NULL, TestIrpHandler);
+    KmtRegisterIrpHandler(IRP_MJ_WRITE, NULL, TestIrpHandler);
+
+    /* No MDL fast I/O, so that the complete calls take the Cc path */
+    TestFastIoDispatch.FastIoRead = FastIoRead;
+    TestFastIoDispatch.FastIoWrite = FastIoWrite;
+    DriverObject->FastIoDispatch = &TestFastIoDispatch;
+
+    return Status;
+}
+
+VOID
+TestUnload(
+    _In_ PDRIVER_OBJECT DriverObject)
+{
+    PAGED_CODE();
+}
+
+BOOLEAN
+NTAPI
+AcquireForLazyWrite(
+    _In_ PVOID Context,
+    _In_ BOOLEAN Wait)
+{
+    return TRUE;
+}
+
+VOID
+NTAPI
+ReleaseFromLazyWrite(
+    _In_ PVOID Context)
+{
+    return;
+}
+
+BOOLEAN
+NTAPI
+AcquireForReadAhead(
+    _In_ PVOID Context,
+    _In_ BOOLEAN Wait)
+{
+    return TRUE;
+}
+
+VOID
+NTAPI
+ReleaseFromReadAhead(
+    _In_ PVOID Context)
+{
+    return;
+}
+
+static CACHE_MANAGER_CALLBACKS Callbacks = {
+    AcquireForLazyWrite,
+    ReleaseFromLazyWrite,
+    AcquireForReadAhead,
+    ReleaseFromReadAhead,
+};
+
+static
+PVOID
+MapAndLockUserBuffer(
+    _In_ _Out_ PIRP Irp,
+    _In_ ULONG BufferLength)
+{
+    PMDL Mdl;
+
+    if (Irp->MdlAddress == NULL)
+    {
+        Mdl = IoAllocateMdl(Irp->UserBuffer, BufferLength, FALSE, FALSE, Irp);
+        if (Mdl == NULL)
+        {
+            return NULL;
+        }
+
+        _SEH2_TRY
+        {
+            MmProbeAndLockPages(Mdl, Irp->RequestorMode, IoWriteAccess);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            IoFreeMdl(Mdl);
+            Irp->MdlAddress = NULL;
+            _SEH2_YIELD(return NULL);
+        }
+        _SEH2_END;
+    }
+
+    return MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority);
+}
+
+static
+BOOLEAN
+CheckBuffer(
+    _In_ PVOID Buffer,
+    _In_ ULONG Length,
+    _In_ UCHAR Value)
+{
+    PUCHAR Ptr = Buffer;
+    ULONG i;
+
+    for (i = 0; i < Length; i++)
+    {
+        if (Ptr[i] != Value)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+Test_CcMdlRead(PFILE_OBJECT FileObject)
+{
+    LARGE_INTEGER Offset;
+    IO_STATUS_BLOCK IoStatus;
+    PMDL MdlChain = NULL, Mdl;
+    PVOID Buffer;
+
+    /* Two pages on each side of the view boundary */
+    Offset.QuadPart = VIEW_BOUNDARY - 2 * PAGE_SIZE;
+    KmtStartSeh()
+        CcMdlRead(FileObject, &Offset, 4 * PAGE_SIZE, &MdlChain, &IoStatus);
+    KmtEndSeh(STATUS_SUCCESS);
+    ok_eq_hex(IoStatus.Status, STATUS_SUCCESS);
+    ok_eq_ulongptr(IoStatus.Information, 4 * PAGE_SIZE);
+
+    if (!skip(MdlChain != NULL, "No MDL chain\n"))
+    {
+        ok_eq_ulong(MdlChain->ByteCount, 2 * PAGE_SIZE);
+        ok((MdlChain->MdlFlags & MDL_PAGES_LOCKED) != 0, "MDL not locked\n");
+
+        Mdl = MdlChain->Next;
+        ok(Mdl != NULL, "Range wasn't split at the view boundary\n");
+        if (Mdl)
+        {
+            ok_eq_ulong(Mdl->ByteCount, 2 * PAGE_SIZE);
+            ok((Mdl->MdlFlags & MDL_PAGES_LOCKED) != 0, "MDL not locked\n");
+            ok_eq_pointer(Mdl->Next, NULL);
+        }
+
+        /* The pages hold what the file system read in */
+        for (Mdl = MdlChain; Mdl; Mdl = Mdl->Next)
+        {
+            Buffer = MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
+            ok(Buffer != NULL, "Null pointer!\n");
+            if (Buffer)
+                ok(CheckBuffer(Buffer, Mdl->ByteCount, 0xBA), "Unexpected data\n");
+        }
+
+        KmtStartSeh()
+            CcMdlReadComplete(FileObject, MdlChain);
+        KmtEndSeh(STATUS_SUCCESS);
+    }
+}
+
+static
+VOID
+Test_CcMdlWrite(PFILE_OBJECT FileObject)
+{
+    LARGE_INTEGER Offset;
+    IO_STATUS_BLOCK IoStatus;
+    PMDL MdlChain = NULL, Mdl;
+    PVOID Buffer;
+    PUCHAR Data;
+    BOOLEAN Ret;
+
+    /* Too big for the stack */
+    Data = ExAllocatePoolWithTag(NonPagedPool, PAGE_SIZE, 'tdmC');
+    if (skip(Data != NULL, "No memory\n"))
+        return;
+
+    /* Write to the cache pages through the MDL */
+    Offset.QuadPart = PAGE_SIZE;
+    KmtStartSeh()
+        CcPrepareMdlWrite(FileObject, &Offset, PAGE_SIZE, &MdlChain, &IoStatus);
+    KmtEndSeh(STATUS_SUCCESS);
+    ok_eq_hex(IoStatus.Status, STATUS_SUCCESS);
+    ok_eq_ulongptr(IoStatus.Information, PAGE_SIZE);
+
+    if (!skip(MdlChain != NULL, "No MDL chain\n"))
+    {
+        ok_eq_pointer(MdlChain->Next, NULL);
+        ok((MdlChain->MdlFlags & MDL_PAGES_LOCKED) != 0, "MDL not locked\n");
+
+        for (Mdl = MdlChain; Mdl; Mdl = Mdl->Next)
+        {
+            Buffer = MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
+            ok(Buffer != NULL, "Null pointer!\n");
+            if (Buffer)
+                RtlFillMemory(Buffer, Mdl->ByteCount, 0xCD);
+        }
+
+        KmtStartSeh()
+            CcMdlWriteComplete(FileObject, &Offset, MdlChain);
+        KmtEndSeh(STATUS_SUCCESS);
+
+        /* The cache now has the new data */
+        RtlZeroMemory(Data, PAGE_SIZE);
+        Ret = FALSE;
+        KmtStartSeh()
+            Ret = CcCopyRead(FileObject, &Offset, PAGE_SIZE, TRUE, Data, &IoStatus);
+        KmtEndSeh(STATUS_SUCCESS);
+        ok_bool_true(Ret, "CcCopyRead should succeed\n");
+        ok(CheckBuffer(Data, PAGE_SIZE, 0xCD), "MDL write didn't reach the cache\n");
+
+        /* And flushing writes it */
+        WriteCalled = FALSE;
+        WriteOffset.QuadPart = MAXLONGLONG;
+        KmtStartSeh()
+            CcFlushCache(FileObject->SectionObjectPointer, &Offset, PAGE_SIZE, &IoStatus);
+        KmtEndSeh(STATUS_SUCCESS);
+        ok_eq_hex(IoStatus.Status, STATUS_SUCCESS);
+        ok(WriteCalled, "MDL write didn't dirty the cache\n");
+    }
+
+    /* An aborted write leaves the data alone */
+    MdlChain = NULL;
+    Offset.QuadPart = 2 * PAGE_SIZE;
+    KmtStartSeh()
+        CcPrepareMdlWrite(FileObject, &Offset, PAGE_SIZE, &MdlChain, &IoStatus);
+    KmtEndSeh(STATUS_SUCCESS);
+    ok_eq_hex(IoStatus.Status, STATUS_SUCCESS);
+
+    if (!skip(MdlChain != NULL, "No MDL chain\n"))
+    {
+        KmtStartSeh()
+            CcMdlWriteAbort(FileObject, MdlChain);
+        KmtEndSeh(STATUS_SUCCESS);
+
+        RtlZeroMemory(Data, PAGE_SIZE);
+        Ret = FALSE;
+        KmtStartSeh()
+            Ret = CcCopyRead(FileObject, &Offset, PAGE_SIZE, TRUE, Data, &IoStatus);
+        KmtEndSeh(STATUS_SUCCESS);
+        ok_bool_true(Ret, "CcCopyRead should succeed\n");
+        ok(CheckBuffer(Data, PAGE_SIZE, 0xBA), "Unexpected data\n");
+    }
+
+    ExFreePoolWithTag(Data, 'tdmC');
+}
+
+static
+NTSTATUS
+TestIrpHandler(
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp,
+    _In_ PIO_STACK_LOCATION IoStack)
+{
+    LARGE_INTEGER Zero = RTL_CONSTANT_LARGE_INTEGER(0LL);
+    NTSTATUS Status;
+    PTEST_FCB Fcb;
+    CACHE_UNINITIALIZE_EVENT CacheUninitEvent;
+
+    PAGED_CODE();
+
+    DPRINT("IRP %x/%x\n", IoStack->MajorFunction, IoStack->MinorFunction);
+    ASSERT(IoStack->MajorFunction == IRP_MJ_CLEANUP ||
+           IoStack->MajorFunction == IRP_MJ_CREATE ||
+           IoStack->MajorFunction == IRP_MJ_READ ||
+           IoStack->MajorFunction == IRP_MJ_WRITE);
+
+    Status = STATUS_NOT_SUPPORTED;
+    Irp->IoStatus.Information = 0;
+
+    if (IoStack->MajorFunction == IRP_MJ_CREATE)
+    {
+        ok_irql(PASSIVE_LEVEL);
+
+        if (IoStack->FileObject->FileName.Length >= 2 * sizeof(WCHAR))
+        {
+            TestDeviceObject = DeviceObject;
+            TestFileObject = IoStack->FileObject;
+        }
+        Fcb = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Fcb), 'FwrI');
+        RtlZeroMemory(Fcb, sizeof(*Fcb));
+        ExInitializeFastMutex(&Fcb->HeaderMutex);
+        FsRtlSetupAdvancedHeader(&Fcb->Header, &Fcb->HeaderMutex);
+        Fcb->Header.AllocationSize.QuadPart = TEST_FILE_SIZE;
+        Fcb->Header.FileSize.QuadPart = TEST_FILE_SIZE;
+        Fcb->Header.ValidDataLength.QuadPart = TEST_FILE_SIZE;
+        Fcb->Header.IsFastIoPossible = FastIoIsNotPossible;
+        IoStack->FileObject->FsContext = Fcb;
+        IoStack->FileObject->SectionObjectPointer = &Fcb->SectionObjectPointers;
+
+        CcInitializeCacheMap(IoStack->FileObject,
+                             (PCC_FILE_SIZES)&Fcb->Header.AllocationSize,
+                             FALSE, &Callbacks, NULL);
+
+        Irp->IoStatus.Information = FILE_OPENED;
+        Status = STATUS_SUCCESS;
+    }
+    else if (IoStack->MajorFunction == IRP_MJ_READ)
+    {
+        ULONG Length;
+        PVOID Buffer;
+
+        Length = IoStack->Parameters.Read.Length;
+
+        ok_eq_pointer(DeviceObject, TestDeviceObject);
+        ok(BooleanFlagOn(Irp->Flags, IRP_NOCACHE), "IRP not coming from Cc!\n");
+        ok((Irp->Flags & IRP_PAGING_IO) != 0, "Non paging IO\n");
+
+        Buffer = MapAndLockUserBuffer(Irp, Length);
+        ok(Buffer != NULL, "Null pointer!\n");
+        if (Buffer)
+            RtlFillMemory(Buffer, Length, 0xBA);
+
+        Irp->IoStatus.Information = Length;
+        Status = STATUS_SUCCESS;
+    }
+    else if (IoStack->MajorFunction == IRP_MJ_WRITE)
+    {
+        ULONG Length;
+        PVOID Buffer;
+        LARGE_INTEGER Offset;
+
+        Offset = IoStack->Parameters.Write.ByteOffset;
+        Length = IoStack->Parameters.Write.Length;
+
+        if (!FlagOn(Irp->Flags, IRP_NOCACHE))
+        {
+            ok_irql(PASSIVE_LEVEL);
+
+            /* The user-mode part drives the test through a cached write */
+            Test_CcMdlRead(IoStack->FileObject);
+            Test_CcMdlWrite(IoStack->FileObject);
+
+            Irp->IoStatus.Information = Length;
+            Status = STATUS_SUCCESS;
+        }
+        else
+        {
+            ok((Irp->Flags & IRP_PAGING_IO) != 0, "Non paging IO\n");
+
+            Buffer = MapAndLockUserBuffer(Irp, Length);
+            ok(Buffer != NULL, "Null pointer!\n");
+
+            /* Only the page written through the MDL is dirty */
+            if (Buffer && Offset.QuadPart <= PAGE_SIZE && Offset.QuadPart + Length >= 2 * PAGE_SIZE)
+            {
+                ok(CheckBuffer((PUCHAR)Buffer + PAGE_SIZE - Offset.QuadPart, PAGE_SIZE, 0xCD),
+                   "Unexpected data written\n");
+            }
+
+            WriteCalled = TRUE;
+            WriteOffset = Offset;
+            WriteLength = Length;
+
+            Status = STATUS_SUCCESS;
+        }
+    }
+    else if (IoStack->MajorFunction == IRP_MJ_CLEANUP)
+    {
+        ok_irql(PASSIVE_LEVEL);
+        KeInitializeEvent(&CacheUninitEvent.Event, NotificationEvent, FALSE);
+        CcUninitializeCacheMap(IoStack->FileObject, &Zero, &CacheUninitEvent);
+        KeWaitForSingleObject(&CacheUninitEvent.Event, Executive, KernelMode, FALSE, NULL);
+        Fcb = IoStack->FileObject->FsContext;
+        ExFreePoolWithTag(Fcb, 'FwrI');
+        IoStack->FileObject->FsContext = NULL;
+        Status = STATUS_SUCCESS;
+    }
+
+    Irp->IoStatus.Status = Status;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+
+    return Status;
+}
@@ -0,0 +1,38 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite Cc MDL test user-mode part
+ */
+
+#include <kmt_test.h>
+
+START_TEST(CcMdl)
+{
+    HANDLE Handle;
+    NTSTATUS Status;
+    LARGE_INTEGER ByteOffset;
+    IO_STATUS_BLOCK IoStatusBlock;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    CHAR Buffer[16] = { 0 };
+    UNICODE_STRING TestFile = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcMdl\\TestFile");
+    DWORD Error;
+
+    Error = KmtLoadAndOpenDriver(L"CcMdl", FALSE);
+    ok_eq_int(Error, ERROR_SUCCESS);
+    if (Error)
+        return;
+
+    InitializeObjectAttributes(&ObjectAttributes, &TestFile, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&Handle, FILE_ALL_ACCESS, &ObjectAttributes, &IoStatusBlock, 0, FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+
+    /* The driver runs the tests from its write handler */
+    ByteOffset.QuadPart = 0;
+    Status = NtWriteFile(Handle, NULL, NULL, NULL, &IoStatusBlock, Buffer, sizeof(Buffer), &ByteOffset, NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+
+    NtClose(Handle);
+
+    KmtCloseDriver();
+    KmtUnloadDriver();
+}
@@ -0,0 +1,125 @@
+/*
+ * PROJECT:     ReactOS kernel-mode tests
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Kernel mode tests for kernel stack recycling on thread create/exit
+ */
+
+#include <kmt_test.h>
+
+#define CHURN_THREADS 256
+
+static volatile LONG ThreadsRun;
+
+static
+VOID
+NTAPI
+EmptyThread(
+    _In_ PVOID Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+    InterlockedIncrement(&ThreadsRun);
+}
+
+static
+NTSTATUS
+QueryStackCache(
+    _Out_ PSYSTEM_KERNEL_STACK_CACHE_INFORMATION Info)
+{
+    return ZwQuerySystemInformation(SystemKernelStackCacheInformation,
+                                    Info,
+                                    sizeof(*Info),
+                                    NULL);
+}
+
+static
+NTSTATUS
+SetStackCache(
+    _In_ BOOLEAN Enable)
+{
+    SYSTEM_KERNEL_STACK_CACHE_CONTROL Control;
+
+    Control.Enable = Enable;
+    return ZwSetSystemInformation(SystemKernelStackCacheInformation,
+                                  &Control,
+                                  sizeof(Control));
+}
+
+static
+VOID
+ChurnThreads(
+    _In_ BOOLEAN Enable,
+    _Out_ PSYSTEM_KERNEL_STACK_CACHE_INFORMATION Delta)
+{
+    SYSTEM_KERNEL_STACK_CACHE_INFORMATION Before, After;
+    LARGE_INTEGER Start, End, Frequency;
+    NTSTATUS Status;
+    ULONG i;
+
+    RtlZeroMemory(Delta, sizeof(*Delta));
+    Status = SetStackCache(Enable);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    Status = QueryStackCache(&Before);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+    ok_eq_bool(Before.Enabled, Enable);
+
+    /* Create and retire short lived threads one after another, all from the
+       same processor so that they can reuse each other's stacks */
+    KeSetSystemAffinityThread((KAFFINITY)1);
+    ThreadsRun = 0;
+    Start = KeQueryPerformanceCounter(&Frequency);
+    for (i = 0; i < CHURN_THREADS; i++)
+    {
+        KmtFinishThread(KmtStartThread(EmptyThread, NULL), NULL);
+    }
+    End = KeQueryPerformanceCounter(NULL);
+    KeRevertToUserAffinityThread();
+    ok_eq_long(ThreadsRun, CHURN_THREADS);
+
+    Status = QueryStackCache(&After);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    Delta->Enabled = Enable;
+    Delta->Hits = After.Hits - Before.Hits;
+    Delta->GlobalHits = After.GlobalHits - Before.GlobalHits;
+    Delta->Misses = After.Misses - Before.Misses;
+
+    trace("Stack cache %s: %I64u us per thread, %lu hits, %lu global hits, %lu misses\n",
+          Enable ? "enabled" : "bypassed",
+          (ULONGLONG)(End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart / CHURN_THREADS,
+          Delta->Hits,
+          Delta->GlobalHits,
+          Delta->Misses);
+}
+
+START_TEST(MmKernelStack)
+{
+    SYSTEM_KERNEL_STACK_CACHE_INFORMATION Info, Cached, Bypassed;
+    NTSTATUS Status;
+
+    Status = QueryStackCache(&Info);
+    if (skip(NT_SUCCESS(Status), "No kernel stack cache information: 0x%lx\n", Status))
+        return;
+
+    /* The same loop without and with the processor caches */
+    ChurnThreads(FALSE, &Bypassed);
+    ChurnThreads(TRUE, &Cached);
+
+    /* Every stack was counted somewhere, and nothing came from the bypassed caches */
+    ok(Bypassed.GlobalHits + Bypassed.Misses >= CHURN_THREADS,
+       "Only %lu stacks were counted\n", Bypassed.GlobalHits + Bypassed.Misses);
+    ok_eq_ulong(Bypassed.Hits, 0UL);
+    ok(Cached.Hits + Cached.GlobalHits + Cached.Misses >= CHURN_THREADS,
+       "Only %lu stacks were counted\n", Cached.Hits + Cached.GlobalHits + Cached.Misses);
+
+    /* With the caches, the stacks of the retired threads get reused */
+    if (!skip(Info.MaximumPerProcessor != 0, "Small system, no processor caches\n"))
+    {
+        ok(Cached.Hits >= CHURN_THREADS / 2,
+           "Only %lu of %d stacks came from the processor cache\n", Cached.Hits, CHURN_THREADS);
+    }
+
+    /* Leave the caches as we found them */
+    Status = SetStackCache(Info.Enabled);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+}
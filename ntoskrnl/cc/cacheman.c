@@ -117,6 +117,36 @@ CcShutdownSystem(VOID)
     /* NOTHING TO DO */
 }
 
+VOID
+CcQueryCacheManagerInformation(
+    _Out_ PSYSTEM_CACHE_MANAGER_INFORMATION Information)
+{
+    /* The counters are not locked, a snapshot slightly off is fine */
+    Information->CopyReadWait = CcCopyReadWait;
+    Information->CopyReadNoWait = CcCopyReadNoWait;
+    Information->CopyReadWaitMiss = CcCopyReadWaitMiss;
+    Information->CopyReadNoWaitMiss = CcCopyReadNoWaitMiss;
+    Information->FastReadWait = CcFastReadWait;
+    Information->FastReadNoWait = CcFastReadNoWait;
+    Information->FastReadResourceMiss = CcFastReadResourceMiss;
+    Information->FastReadNotPossible = CcFastReadNotPossible;
+    Information->ReadAheadIos = CcReadAheadIos;
+    Information->ReadAheadPages = CcReadAheadPages;
+    Information->ReadAheadPagesUsed = CcReadAheadPagesUsed;
+    Information->LazyWriteIos = CcLazyWriteIos;
+    Information->LazyWritePages = CcLazyWritePages;
+    Information->DataFlushes = CcDataFlushes;
+    Information->DataPages = CcDataPages;
+    Information->DeferredWrites = CcDeferredWriteCount;
+    Information->VacbAllocations = CcVacbAllocations;
+    Information->VacbSteals = CcVacbSteals;
+    Information->PinReadWait = CcPinReadWait;
+    Information->PinReadNoWait = CcPinReadNoWait;
+    Information->PinContention = CcPinContention;
+    Information->DirtyPages = CcTotalDirtyPages;
+    Information->DirtyPageThreshold = CcDirtyPageThreshold;
+}
+
 /*
  * @unimplemented
  */
@@ -149,8 +179,23 @@ CcRemapBcb (
     return 0;
 }
 
+static
+ULONG
+CcpGetReadAheadLimit(VOID)
+{
+    ULONG_PTR Limit;
+
+    /* Don't grow windows when memory is getting tight */
+    if (MmAvailablePages <= MmThrottleTop)
+        return CC_READ_AHEAD_MIN_WINDOW;
+
+    /* Otherwise, never use more than a sixteenth of what's left */
+    Limit = ((MmAvailablePages - MmThrottleTop) / 16) << PAGE_SHIFT;
+    return (ULONG)max(min(Limit, CC_READ_AHEAD_MAX_WINDOW), CC_READ_AHEAD_MIN_WINDOW);
+}
+
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -161,7 +206,10 @@ CcScheduleReadAhead (
 	)
 {
     KIRQL OldIrql;
-    LARGE_INTEGER NewOffset;
+    LONGLONG ReadEnd;
+    ULONG Stream, Window;
+    BOOLEAN Sequential;
+    PLARGE_INTEGER StreamOffset[2], StreamEnd[2];
     PROS_SHARED_CACHE_MAP SharedCacheMap;
     PPRIVATE_CACHE_MAP PrivateCacheMap;
 
@@ -175,50 +223,93 @@ CcScheduleReadAhead (
         return;
     }
 
-    /* Round read length with read ahead mask */
-    Length = ROUND_UP(Length, PrivateCacheMap->ReadAheadMask + 1);
-    /* Compute the offset we'll reach */
-    NewOffset.QuadPart = FileOffset->QuadPart + Length;
+    ReadEnd = FileOffset->QuadPart + Length;
+    StreamOffset[0] = &PrivateCacheMap->FileOffset1;
+    StreamEnd[0] = &PrivateCacheMap->BeyondLastByte1;
+    StreamOffset[1] = &PrivateCacheMap->FileOffset2;
+    StreamEnd[1] = &PrivateCacheMap->BeyondLastByte2;
 
     /* Lock read ahead spin lock */
     KeAcquireSpinLock(&PrivateCacheMap->ReadAheadSpinLock, &OldIrql);
-    /* Easy case: the file is sequentially read */
-    if (BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY))
+
+    /* Find the stream this read continues: it has to start within or right after the previous one */
+    for (Stream = 0; Stream < 2; Stream++)
     {
-        /* If we went backward, this is no go! */
-        if (NewOffset.QuadPart < PrivateCacheMap->ReadAheadOffset[1].QuadPart)
+        if (StreamEnd[Stream]->QuadPart != 0 &&
+            FileOffset->QuadPart >= StreamOffset[Stream]->QuadPart &&
+            FileOffset->QuadPart <= (LONGLONG)ROUND_UP(StreamEnd[Stream]->QuadPart, PrivateCacheMap->ReadAheadMask + 1))
         {
-            KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
-            return;
+            break;
         }
+    }
 
-        /* FIXME: hackish, but will do the job for now */
-        PrivateCacheMap->ReadAheadOffset[1].QuadPart = NewOffset.QuadPart;
-        PrivateCacheMap->ReadAheadLength[1] = Length;
+    /* Files opened for sequential access only have a single stream, wherever it goes */
+    if (Stream == 2 && BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY))
+    {
+        Stream = BooleanFlagOn(PrivateCacheMap->UlongFlags, PRIVATE_CACHE_MAP_LAST_STREAM) ? 1 : 0;
+        PrivateCacheMap->ReadAheadOffset[Stream].QuadPart = ReadEnd;
     }
-    /* Other cases: try to find some logic in that mess... */
-    else
+
+    Sequential = (Stream != 2);
+    if (Sequential && PrivateCacheMap->ReadAheadLength[Stream] != 0)
     {
-        /* Let's check if we always read the same way (like going down in the file)
-         * and pretend it's enough for now
+        LONGLONG UsedStart, UsedEnd;
+
+        /* Account for the pages of this read that read ahead brought in,
+         * each of them once even if the reader goes through it in small steps
          */
-        if (PrivateCacheMap->FileOffset2.QuadPart >= PrivateCacheMap->FileOffset1.QuadPart &&
-            FileOffset->QuadPart >= PrivateCacheMap->FileOffset2.QuadPart)
-        {
-            /* FIXME: hackish, but will do the job for now */
-            PrivateCacheMap->ReadAheadOffset[1].QuadPart = NewOffset.QuadPart;
-            PrivateCacheMap->ReadAheadLength[1] = Length;
-        }
-        else
+        UsedStart = max(FileOffset->QuadPart, StreamEnd[Stream]->QuadPart);
+        UsedEnd = min(ReadEnd, PrivateCacheMap->ReadAheadOffset[Stream].QuadPart);
+        if (UsedEnd > UsedStart)
         {
-            /* FIXME: handle the other cases */
-            KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
-            UNIMPLEMENTED_ONCE;
-            return;
+            CcReadAheadPagesUsed += (ULONG)(BYTES_TO_PAGES(UsedEnd) - BYTES_TO_PAGES(UsedStart));
         }
     }
 
-    /* If read ahead isn't active yet */
+    if (!Sequential)
+    {
+        /* A new stream replaces the one that was read the longest time ago */
+        Stream = BooleanFlagOn(PrivateCacheMap->UlongFlags, PRIVATE_CACHE_MAP_LAST_STREAM) ? 0 : 1;
+        PrivateCacheMap->ReadAheadOffset[Stream].QuadPart = ReadEnd;
+        PrivateCacheMap->ReadAheadLength[Stream] = 0;
+    }
+
+    StreamOffset[Stream]->QuadPart = FileOffset->QuadPart;
+    StreamEnd[Stream]->QuadPart = ReadEnd;
+    if (Stream == 0)
+        InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_LAST_STREAM);
+    else
+        InterlockedOr((volatile long *)&PrivateCacheMap->UlongFlags, PRIVATE_CACHE_MAP_LAST_STREAM);
+
+    /* Random reads don't get read ahead until they turn into a stream */
+    if (!Sequential && !BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY))
+    {
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
+    }
+
+    /* The reader didn't run out of what's been read ahead yet */
+    Window = PrivateCacheMap->ReadAheadLength[Stream];
+    if (Window != 0 &&
+        PrivateCacheMap->ReadAheadOffset[Stream].QuadPart >= ReadEnd + Window / 2)
+    {
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
+    }
+
+    if (Window == 0)
+    {
+        /* Start small, but with at least the size of the reads */
+        Window = max(CC_READ_AHEAD_MIN_WINDOW, ROUND_UP(Length, PrivateCacheMap->ReadAheadMask + 1));
+    }
+    else if (!PrivateCacheMap->Flags.ReadAheadActive)
+    {
+        /* The previous read ahead kept up with the reader, go for more */
+        Window = min(Window * 2, CcpGetReadAheadLimit());
+    }
+    PrivateCacheMap->ReadAheadLength[Stream] = Window;
+
+    /* Nothing to do if read ahead is already running, it will pick up the new window */
     if (!PrivateCacheMap->Flags.ReadAheadActive)
     {
         PWORK_QUEUE_ENTRY WorkItem;
@@ -251,7 +342,6 @@ CcScheduleReadAhead (
         InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
     }
 
-    /* Done (fail) */
     KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
 }
 
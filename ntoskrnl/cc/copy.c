@@ -39,9 +39,25 @@ ULONG CcFastReadResourceMiss;
 /* Counters:
  * - Amount of pages flushed to the disk
  * - Number of flush operations
+ * - Number of calls to CcCopyRead that could wait
+ * - Number of calls to CcCopyRead that couldn't wait
+ * - Number of calls to CcCopyRead that could wait and had to read from disk
+ * - Number of calls to CcCopyRead that couldn't wait and would have had to
+ * - Number of read ahead operations that had to read from disk
+ * - Amount of pages read by read ahead
+ * - Amount of pages read ahead that were then read by the reader
+ * - Number of writes that were deferred
  */
 ULONG CcDataPages = 0;
 ULONG CcDataFlushes = 0;
+ULONG CcCopyReadWait = 0;
+ULONG CcCopyReadNoWait = 0;
+ULONG CcCopyReadWaitMiss = 0;
+ULONG CcCopyReadNoWaitMiss = 0;
+ULONG CcReadAheadIos = 0;
+ULONG CcReadAheadPages = 0;
+ULONG CcReadAheadPagesUsed = 0;
+ULONG CcDeferredWriteCount = 0;
 
 /* FUNCTIONS *****************************************************************/
 
@@ -69,6 +85,81 @@ CcInitCacheZeroPage (
     MiZeroPhysicalPage(CcZeroPage);
 }
 
+/*
+ * Drops the volume reference of a deferred write, or the one CcCanIWrite took
+ * in case it had to wait.
+ */
+static
+VOID
+CcpDereferenceDeferredVolume(
+    _In_opt_ PROS_CACHE_VOLUME Volume,
+    _In_ BOOLEAN MasterLocked)
+{
+    KIRQL OldIrql;
+
+    if (Volume == NULL)
+    {
+        return;
+    }
+
+    if (!MasterLocked)
+    {
+        OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+    }
+
+    CcRosDereferenceVolume(Volume);
+
+    if (!MasterLocked)
+    {
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+    }
+}
+
+static
+BOOLEAN
+CcpHasDeferredWritesAhead(
+    _In_opt_ PROS_CACHE_VOLUME Volume)
+{
+    KIRQL OldIrql;
+    PLIST_ENTRY ListEntry;
+    BOOLEAN Ahead;
+
+    if (IsListEmpty(&CcDeferredWrites))
+    {
+        return FALSE;
+    }
+
+    if (Volume == NULL)
+    {
+        return TRUE;
+    }
+
+    /* A new write must not overtake the deferred writes for the same volume,
+     * nor the ones waiting for the global limits. The ones only waiting for
+     * their own (slower) volume don't matter.
+     */
+    Ahead = FALSE;
+    KeAcquireSpinLock(&CcDeferredWriteSpinLock, &OldIrql);
+    for (ListEntry = CcDeferredWrites.Flink;
+         ListEntry != &CcDeferredWrites;
+         ListEntry = ListEntry->Flink)
+    {
+        PROS_DEFERRED_WRITE DeferredWrite;
+
+        DeferredWrite = CONTAINING_RECORD(ListEntry, ROS_DEFERRED_WRITE, DeferredWrite.DeferredWriteLinks);
+        if (DeferredWrite->Volume == NULL || DeferredWrite->Volume == Volume ||
+            !CcRosVolumeOverBudget(DeferredWrite->Volume,
+                                   BYTES_TO_PAGES(min(DeferredWrite->DeferredWrite.BytesToWrite, MAX_ZERO_LENGTH))))
+        {
+            Ahead = TRUE;
+            break;
+        }
+    }
+    KeReleaseSpinLock(&CcDeferredWriteSpinLock, OldIrql);
+
+    return Ahead;
+}
+
 VOID
 CcPostDeferredWrites(VOID)
 {
@@ -79,7 +170,7 @@ CcPostDeferredWrites(VOID)
     /* We'll try to write as much as we can */
     while (TRUE)
     {
-        PDEFERRED_WRITE DeferredWrite;
+        PROS_DEFERRED_WRITE DeferredWrite;
         PLIST_ENTRY ListEntry;
 
         DeferredWrite = NULL;
@@ -89,30 +180,43 @@ CcPostDeferredWrites(VOID)
         if (!ListEntry)
             break;
 
-        DeferredWrite = CONTAINING_RECORD(ListEntry, DEFERRED_WRITE, DeferredWriteLinks);
+        DeferredWrite = CONTAINING_RECORD(ListEntry, ROS_DEFERRED_WRITE, DeferredWrite.DeferredWriteLinks);
 
         /* Check if we can write */
-        if (CcCanIWrite(DeferredWrite->FileObject, DeferredWrite->BytesToWrite, FALSE, RetryForceCheckPerFile))
+        if (CcCanIWrite(DeferredWrite->DeferredWrite.FileObject,
+                        DeferredWrite->DeferredWrite.BytesToWrite,
+                        FALSE,
+                        RetryForceCheckPerFile))
         {
-            /* If we have an event, set it and go along */
-            if (DeferredWrite->Event)
+            /* If we have an event, set it and go along, the waiter drops the volume */
+            if (DeferredWrite->DeferredWrite.Event)
             {
-                KeSetEvent(DeferredWrite->Event, IO_NO_INCREMENT, FALSE);
+                KeSetEvent(DeferredWrite->DeferredWrite.Event, IO_NO_INCREMENT, FALSE);
             }
             /* Otherwise, call the write routine and free the context */
             else
             {
-                DeferredWrite->PostRoutine(DeferredWrite->Context1, DeferredWrite->Context2);
+                DeferredWrite->DeferredWrite.PostRoutine(DeferredWrite->DeferredWrite.Context1,
+                                                         DeferredWrite->DeferredWrite.Context2);
+                CcpDereferenceDeferredVolume(DeferredWrite->Volume, FALSE);
                 ExFreePoolWithTag(DeferredWrite, 'CcDw');
             }
             continue;
         }
 
         /* Keep it for later */
-        InsertHeadList(&ToInsertBack, &DeferredWrite->DeferredWriteLinks);
+        InsertHeadList(&ToInsertBack, &DeferredWrite->DeferredWrite.DeferredWriteLinks);
+
+        /* If only its volume is over budget, the others can still go */
+        if (DeferredWrite->Volume != NULL &&
+            CcRosVolumeOverBudget(DeferredWrite->Volume,
+                                  BYTES_TO_PAGES(min(DeferredWrite->DeferredWrite.BytesToWrite, MAX_ZERO_LENGTH))))
+        {
+            continue;
+        }
 
         /* If we don't accept modified pages, stop here */
-        if (!DeferredWrite->LimitModifiedPages)
+        if (!DeferredWrite->DeferredWrite.LimitModifiedPages)
         {
             break;
         }
@@ -126,91 +230,49 @@ CcPostDeferredWrites(VOID)
     }
 }
 
-VOID
-CcPerformReadAhead(
-    IN PFILE_OBJECT FileObject)
+static
+BOOLEAN
+CcpReadAheadRange(
+    _In_ PROS_SHARED_CACHE_MAP SharedCacheMap,
+    _In_ LONGLONG CurrentOffset,
+    _In_ ULONG Length)
 {
     NTSTATUS Status;
-    LONGLONG CurrentOffset;
-    KIRQL OldIrql;
-    PROS_SHARED_CACHE_MAP SharedCacheMap;
     PROS_VACB Vacb;
+    ULONG VacbOffset;
     ULONG PartialLength;
-    ULONG Length;
-    PPRIVATE_CACHE_MAP PrivateCacheMap;
-    BOOLEAN Locked;
     BOOLEAN Success;
 
-    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
-
-    /* Critical:
-     * PrivateCacheMap might disappear in-between if the handle
-     * to the file is closed (private is attached to the handle not to
-     * the file), so we need to lock the master lock while we deal with
-     * it. It won't disappear without attempting to lock such lock.
+    /* This works like CcCopyRead, with the slight difference that we don't
+     * copy data back to an user-backed buffer. We just bring data into Cc,
+     * a whole view at a time.
      */
-    OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
-    PrivateCacheMap = FileObject->PrivateCacheMap;
-    /* If the handle was closed since the read ahead was scheduled, just quit */
-    if (PrivateCacheMap == NULL)
-    {
-        KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
-        ObDereferenceObject(FileObject);
-        return;
-    }
-    /* Otherwise, extract read offset and length and release private map */
-    else
-    {
-        KeAcquireSpinLockAtDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
-        CurrentOffset = PrivateCacheMap->ReadAheadOffset[1].QuadPart;
-        Length = PrivateCacheMap->ReadAheadLength[1];
-        KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
-    }
-    KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
-
-    /* Time to go! */
-    DPRINT("Doing ReadAhead for %p\n", FileObject);
-    /* Lock the file, first */
-    if (!SharedCacheMap->Callbacks->AcquireForReadAhead(SharedCacheMap->LazyWriteContext, FALSE))
-    {
-        Locked = FALSE;
-        goto Clear;
-    }
-
-    /* Remember it's locked */
-    Locked = TRUE;
-
-    /* Don't read past the end of the file */
-    if (CurrentOffset >= SharedCacheMap->FileSize.QuadPart)
-    {
-        goto Clear;
-    }
-    if (CurrentOffset + Length > SharedCacheMap->FileSize.QuadPart)
+    while (Length > 0)
     {
-        Length = SharedCacheMap->FileSize.QuadPart - CurrentOffset;
-    }
+        VacbOffset = CurrentOffset % VACB_MAPPING_GRANULARITY;
+        PartialLength = min(Length, VACB_MAPPING_GRANULARITY - VacbOffset);
 
-    /* Next of the algorithm will lock like CcCopyData with the slight
-     * difference that we don't copy data back to an user-backed buffer
-     * We just bring data into Cc
-     */
-    PartialLength = CurrentOffset % VACB_MAPPING_GRANULARITY;
-    if (PartialLength != 0)
-    {
-        PartialLength = min(Length, VACB_MAPPING_GRANULARITY - PartialLength);
         Status = CcRosRequestVacb(SharedCacheMap,
                                   ROUND_DOWN(CurrentOffset, VACB_MAPPING_GRANULARITY),
                                   &Vacb);
         if (!NT_SUCCESS(Status))
         {
             DPRINT1("Failed to request VACB: %lx!\n", Status);
-            goto Clear;
+            return FALSE;
+        }
+
+        /* Account for what we actually read */
+        if (!MmIsDataSectionResident(SharedCacheMap->FileObject->SectionObjectPointer,
+                                     CurrentOffset,
+                                     PartialLength))
+        {
+            ++CcReadAheadIos;
+            CcReadAheadPages += BYTES_TO_PAGES(PartialLength);
         }
 
         _SEH2_TRY
         {
-            Success = CcRosEnsureVacbResident(Vacb, TRUE, FALSE,
-                    CurrentOffset % VACB_MAPPING_GRANULARITY, PartialLength);
+            Success = CcRosEnsureVacbResident(Vacb, TRUE, FALSE, VacbOffset, PartialLength);
         }
         _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
         {
@@ -218,53 +280,111 @@ CcPerformReadAhead(
         }
         _SEH2_END
 
+        CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE);
+
         if (!Success)
         {
-            CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE);
-            DPRINT1("Failed to read data: %lx!\n", Status);
-            goto Clear;
+            DPRINT1("Failed to read data at %I64d!\n", CurrentOffset);
+            return FALSE;
         }
 
-        CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE);
-
         Length -= PartialLength;
         CurrentOffset += PartialLength;
     }
 
-    while (Length > 0)
+    return TRUE;
+}
+
+VOID
+CcPerformReadAhead(
+    IN PFILE_OBJECT FileObject)
+{
+    LONGLONG CurrentOffset;
+    LONGLONG ReadAheadEnd;
+    LARGE_INTEGER Frontier;
+    KIRQL OldIrql;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
+    ULONG Length;
+    ULONG Stream;
+    PPRIVATE_CACHE_MAP PrivateCacheMap;
+    BOOLEAN Locked;
+
+    SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+
+    /* Time to go! */
+    DPRINT("Doing ReadAhead for %p\n", FileObject);
+    /* Lock the file, first */
+    if (!SharedCacheMap->Callbacks->AcquireForReadAhead(SharedCacheMap->LazyWriteContext, FALSE))
     {
-        ASSERT(CurrentOffset % VACB_MAPPING_GRANULARITY == 0);
-        PartialLength = min(VACB_MAPPING_GRANULARITY, Length);
-        Status = CcRosRequestVacb(SharedCacheMap,
-                                  CurrentOffset,
-                                  &Vacb);
-        if (!NT_SUCCESS(Status))
+        Locked = FALSE;
+        goto Clear;
+    }
+
+    /* Remember it's locked */
+    Locked = TRUE;
+
+    /* Keep going as long as one of the streams is short of its window */
+    while (TRUE)
+    {
+        /* Critical:
+         * PrivateCacheMap might disappear in-between if the handle
+         * to the file is closed (private is attached to the handle not to
+         * the file), so we need to lock the master lock while we deal with
+         * it. It won't disappear without attempting to lock such lock.
+         */
+        OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+        PrivateCacheMap = FileObject->PrivateCacheMap;
+        /* If the handle was closed since the read ahead was scheduled, just quit */
+        if (PrivateCacheMap == NULL)
         {
-            DPRINT1("Failed to request VACB: %lx!\n", Status);
-            goto Clear;
+            KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+            break;
         }
 
-        _SEH2_TRY
+        /* Otherwise, extract what is left to read and release private map */
+        KeAcquireSpinLockAtDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
+        for (Stream = 0; Stream < 2; Stream++)
         {
-            Success = CcRosEnsureVacbResident(Vacb, TRUE, FALSE, 0, PartialLength);
+            LONGLONG BeyondLastByte = (Stream == 0) ? PrivateCacheMap->BeyondLastByte1.QuadPart :
+                                                      PrivateCacheMap->BeyondLastByte2.QuadPart;
+
+            Frontier = PrivateCacheMap->ReadAheadOffset[Stream];
+            ReadAheadEnd = BeyondLastByte + PrivateCacheMap->ReadAheadLength[Stream];
+            CurrentOffset = max(Frontier.QuadPart, BeyondLastByte);
+            if (CurrentOffset < ReadAheadEnd)
+                break;
         }
-        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+
+        /* Nothing left: mark read ahead as unactive under the lock CcScheduleReadAhead
+         * checks it with, so that a window it grows from now on gets a new read ahead
+         */
+        if (Stream == 2)
+            InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
+        KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+
+        if (Stream == 2)
+            goto Release;
+
+        /* Don't read past the end of the file */
+        if (CurrentOffset < SharedCacheMap->FileSize.QuadPart)
         {
-            Success = FALSE;
+            Length = (ULONG)(min(ReadAheadEnd, SharedCacheMap->FileSize.QuadPart) - CurrentOffset);
+            if (!CcpReadAheadRange(SharedCacheMap, CurrentOffset, Length))
+                break;
         }
-        _SEH2_END
 
-        if (!Success)
+        /* Move the stream forward, unless it was restarted meanwhile */
+        OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+        PrivateCacheMap = FileObject->PrivateCacheMap;
+        if (PrivateCacheMap != NULL)
         {
-            CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE);
-            DPRINT1("Failed to read data: %lx!\n", Status);
-            goto Clear;
+            KeAcquireSpinLockAtDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
+            if (PrivateCacheMap->ReadAheadOffset[Stream].QuadPart == Frontier.QuadPart)
+                PrivateCacheMap->ReadAheadOffset[Stream].QuadPart = ReadAheadEnd;
+            KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
         }
-
-        CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE);
-
-        Length -= PartialLength;
-        CurrentOffset += PartialLength;
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
     }
 
 Clear:
@@ -280,6 +400,7 @@ Clear:
     }
     KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
 
+Release:
     /* If file was locked, release it */
     if (Locked)
     {
@@ -307,9 +428,10 @@ CcCanIWrite (
     KEVENT WaitEvent;
     ULONG Length, Pages;
     BOOLEAN PerFileDefer;
-    DEFERRED_WRITE Context;
+    ROS_DEFERRED_WRITE Context;
     PFSRTL_COMMON_FCB_HEADER Fcb;
     CC_CAN_WRITE_RETRY TryContext;
+    PROS_CACHE_VOLUME Volume;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
 
     CCTRACE(CC_API_DEBUG, "FileObject=%p BytesToWrite=%lu Wait=%d Retrying=%d\n",
@@ -339,56 +461,68 @@ CcCanIWrite (
 
     /* By default, assume limits per file won't be hit */
     PerFileDefer = FALSE;
+    Volume = NULL;
     Fcb = FileObject->FsContext;
-    /* Do we have to check for limits per file? */
-    if (TryContext >= RetryForceCheckPerFile ||
-        BooleanFlagOn(Fcb->Flags, FSRTL_FLAG_LIMIT_MODIFIED_PAGES))
+
+    /* If master is not locked, lock it now, it protects the shared cache map and its volume */
+    if (TryContext != RetryMasterLocked)
     {
-        /* If master is not locked, lock it now */
-        if (TryContext != RetryMasterLocked)
-        {
-            OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
-        }
+        OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+    }
 
-        /* Let's not assume the file is cached... */
-        if (FileObject->SectionObjectPointer != NULL &&
-            FileObject->SectionObjectPointer->SharedCacheMap != NULL)
+    /* Let's not assume the file is cached... */
+    if (FileObject->SectionObjectPointer != NULL &&
+        FileObject->SectionObjectPointer->SharedCacheMap != NULL)
+    {
+        SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+        /* Do we have to check for limits per file? */
+        if ((TryContext >= RetryForceCheckPerFile ||
+             BooleanFlagOn(Fcb->Flags, FSRTL_FLAG_LIMIT_MODIFIED_PAGES)) &&
+            SharedCacheMap->DirtyPageThreshold != 0 &&
+            SharedCacheMap->DirtyPages != 0)
         {
-            SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
-            /* Do we have limits per file set? */
-            if (SharedCacheMap->DirtyPageThreshold != 0 &&
-                SharedCacheMap->DirtyPages != 0)
+            /* Yes, check whether they are blocking */
+            if (Pages + SharedCacheMap->DirtyPages > SharedCacheMap->DirtyPageThreshold)
             {
-                /* Yes, check whether they are blocking */
-                if (Pages + SharedCacheMap->DirtyPages > SharedCacheMap->DirtyPageThreshold)
-                {
-                    PerFileDefer = TRUE;
-                }
+                PerFileDefer = TRUE;
             }
         }
 
-        /* And don't forget to release master */
-        if (TryContext != RetryMasterLocked)
+        /* And check the budget of the volume, keeping it in case we have to wait */
+        Volume = SharedCacheMap->Volume;
+        if (Volume != NULL)
         {
-            KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+            Volume->ReferenceCount++;
+            if (CcRosVolumeOverBudget(Volume, Pages))
+            {
+                PerFileDefer = TRUE;
+            }
         }
     }
 
+    /* And don't forget to release master */
+    if (TryContext != RetryMasterLocked)
+    {
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+    }
+
     /* So, now allow write if:
-     * - Not the first try or we have no throttling yet
+     * - Not the first try or we have no throttling yet for this volume
      * AND:
      * - We don't exceed threshold!
      * - We don't exceed what Mm can allow us to use
      *   + If we're above top, that's fine
      *   + If we're above bottom with limited modified pages, that's fine
      *   + Otherwise, throttle!
+     * - Neither the file nor its volume exceed their own limits
      */
-    if ((TryContext != FirstTry || IsListEmpty(&CcDeferredWrites)) &&
+    if ((TryContext != FirstTry || !CcpHasDeferredWritesAhead(Volume)) &&
         CcTotalDirtyPages + Pages < CcDirtyPageThreshold &&
         (MmAvailablePages > MmThrottleTop ||
          (MmModifiedPageListHead.Total < 1000 && MmAvailablePages > MmThrottleBottom)) &&
         !PerFileDefer)
     {
+        CcpDereferenceDeferredVolume(Volume, TryContext == RetryMasterLocked);
         return TRUE;
     }
 
@@ -397,6 +531,7 @@ CcCanIWrite (
      */
     if (!Wait)
     {
+        CcpDereferenceDeferredVolume(Volume, TryContext == RetryMasterLocked);
         return FALSE;
     }
 
@@ -413,27 +548,29 @@ CcCanIWrite (
     /* Initialize our wait event */
     KeInitializeEvent(&WaitEvent, NotificationEvent, FALSE);
 
-    /* And prepare a dummy context */
-    Context.NodeTypeCode = NODE_TYPE_DEFERRED_WRITE;
-    Context.NodeByteSize = sizeof(DEFERRED_WRITE);
-    Context.FileObject = FileObject;
-    Context.BytesToWrite = BytesToWrite;
-    Context.LimitModifiedPages = BooleanFlagOn(Fcb->Flags, FSRTL_FLAG_LIMIT_MODIFIED_PAGES);
-    Context.Event = &WaitEvent;
+    /* And prepare a dummy context, it takes over our volume reference */
+    Context.DeferredWrite.NodeTypeCode = NODE_TYPE_DEFERRED_WRITE;
+    Context.DeferredWrite.NodeByteSize = sizeof(ROS_DEFERRED_WRITE);
+    Context.DeferredWrite.FileObject = FileObject;
+    Context.DeferredWrite.BytesToWrite = BytesToWrite;
+    Context.DeferredWrite.LimitModifiedPages = BooleanFlagOn(Fcb->Flags, FSRTL_FLAG_LIMIT_MODIFIED_PAGES);
+    Context.DeferredWrite.Event = &WaitEvent;
+    Context.Volume = Volume;
+    ++CcDeferredWriteCount;
 
     /* And queue it */
     if (Retrying)
     {
         /* To the top, if that's a retry */
         ExInterlockedInsertHeadList(&CcDeferredWrites,
-                                    &Context.DeferredWriteLinks,
+                                    &Context.DeferredWrite.DeferredWriteLinks,
                                     &CcDeferredWriteSpinLock);
     }
     else
     {
         /* To the bottom, if that's a first time */
         ExInterlockedInsertTailList(&CcDeferredWrites,
-                                    &Context.DeferredWriteLinks,
+                                    &Context.DeferredWrite.DeferredWriteLinks,
                                     &CcDeferredWriteSpinLock);
     }
 
@@ -457,6 +594,8 @@ CcCanIWrite (
         CcPostDeferredWrites();
     } while (KeWaitForSingleObject(&WaitEvent, Executive, KernelMode, FALSE, &CcIdleDelay) != STATUS_SUCCESS);
 
+    /* Our context is off the list, its volume can go */
+    CcpDereferenceDeferredVolume(Volume, FALSE);
     return TRUE;
 }
 
@@ -499,6 +638,7 @@ CcCopyRead (
     LONGLONG CurrentOffset;
     LONGLONG ReadEnd = FileOffset->QuadPart + Length;
     ULONG ReadLength = 0;
+    BOOLEAN Miss = FALSE;
 
     CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu Wait=%d\n",
         FileObject, FileOffset->QuadPart, Length, Wait);
@@ -530,8 +670,18 @@ CcCopyRead (
             ULONG VacbLength = min(Length, VACB_MAPPING_GRANULARITY - VacbOffset);
             SIZE_T CopyLength = VacbLength;
 
-            if (!CcRosEnsureVacbResident(Vacb, Wait, FALSE, VacbOffset, VacbLength))
-                return FALSE;
+            if (!MmIsDataSectionResident(SharedCacheMap->FileObject->SectionObjectPointer,
+                                         CurrentOffset,
+                                         VacbLength))
+            {
+                Miss = TRUE;
+                if (!CcRosEnsureVacbResident(Vacb, Wait, FALSE, VacbOffset, VacbLength))
+                {
+                    ++CcCopyReadNoWait;
+                    ++CcCopyReadNoWaitMiss;
+                    return FALSE;
+                }
+            }
 
             _SEH2_TRY
             {
@@ -556,31 +706,25 @@ CcCopyRead (
         _SEH2_END;
     }
 
+    if (Wait)
+    {
+        ++CcCopyReadWait;
+        if (Miss) ++CcCopyReadWaitMiss;
+    }
+    else
+    {
+        ++CcCopyReadNoWait;
+        if (Miss) ++CcCopyReadNoWaitMiss;
+    }
+
     IoStatus->Status = STATUS_SUCCESS;
     IoStatus->Information = ReadLength;
 
-#if 0
-    /* If that was a successful sync read operation, let's handle read ahead */
-    if (Length == 0 && Wait)
+    /* Let read ahead have a look at it, unless the caller told us there's no point */
+    if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS))
     {
-        PPRIVATE_CACHE_MAP PrivateCacheMap = FileObject->PrivateCacheMap;
-
-        /* If file isn't random access and next read may get us cross VACB boundary,
-         * schedule next read
-         */
-        if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS) &&
-            (CurrentOffset - 1) / VACB_MAPPING_GRANULARITY != (CurrentOffset + ReadLength - 1) / VACB_MAPPING_GRANULARITY)
-        {
-            CcScheduleReadAhead(FileObject, FileOffset, ReadLength);
-        }
-
-        /* And update read history in private cache map */
-        PrivateCacheMap->FileOffset1.QuadPart = PrivateCacheMap->FileOffset2.QuadPart;
-        PrivateCacheMap->BeyondLastByte1.QuadPart = PrivateCacheMap->BeyondLastByte2.QuadPart;
-        PrivateCacheMap->FileOffset2.QuadPart = FileOffset->QuadPart;
-        PrivateCacheMap->BeyondLastByte2.QuadPart = FileOffset->QuadPart + ReadLength;
+        CcScheduleReadAhead(FileObject, FileOffset, ReadLength);
     }
-#endif
 
     return TRUE;
 }
@@ -688,14 +832,15 @@ CcDeferWrite (
     IN BOOLEAN Retrying)
 {
     KIRQL OldIrql;
-    PDEFERRED_WRITE Context;
+    PROS_DEFERRED_WRITE Context;
     PFSRTL_COMMON_FCB_HEADER Fcb;
+    PROS_SHARED_CACHE_MAP SharedCacheMap;
 
     CCTRACE(CC_API_DEBUG, "FileObject=%p PostRoutine=%p Context1=%p Context2=%p BytesToWrite=%lu Retrying=%d\n",
         FileObject, PostRoutine, Context1, Context2, BytesToWrite, Retrying);
 
     /* Try to allocate a context for queueing the write operation */
-    Context = ExAllocatePoolWithTag(NonPagedPool, sizeof(DEFERRED_WRITE), 'CcDw');
+    Context = ExAllocatePoolWithTag(NonPagedPool, sizeof(ROS_DEFERRED_WRITE), 'CcDw');
     /* If it failed, immediately execute the operation! */
     if (Context == NULL)
     {
@@ -706,29 +851,44 @@ CcDeferWrite (
     Fcb = FileObject->FsContext;
 
     /* Otherwise, initialize the context */
-    RtlZeroMemory(Context, sizeof(DEFERRED_WRITE));
-    Context->NodeTypeCode = NODE_TYPE_DEFERRED_WRITE;
-    Context->NodeByteSize = sizeof(DEFERRED_WRITE);
-    Context->FileObject = FileObject;
-    Context->PostRoutine = PostRoutine;
-    Context->Context1 = Context1;
-    Context->Context2 = Context2;
-    Context->BytesToWrite = BytesToWrite;
-    Context->LimitModifiedPages = BooleanFlagOn(Fcb->Flags, FSRTL_FLAG_LIMIT_MODIFIED_PAGES);
+    RtlZeroMemory(Context, sizeof(ROS_DEFERRED_WRITE));
+    Context->DeferredWrite.NodeTypeCode = NODE_TYPE_DEFERRED_WRITE;
+    Context->DeferredWrite.NodeByteSize = sizeof(ROS_DEFERRED_WRITE);
+    Context->DeferredWrite.FileObject = FileObject;
+    Context->DeferredWrite.PostRoutine = PostRoutine;
+    Context->DeferredWrite.Context1 = Context1;
+    Context->DeferredWrite.Context2 = Context2;
+    Context->DeferredWrite.BytesToWrite = BytesToWrite;
+    Context->DeferredWrite.LimitModifiedPages = BooleanFlagOn(Fcb->Flags, FSRTL_FLAG_LIMIT_MODIFIED_PAGES);
+    ++CcDeferredWriteCount;
+
+    /* Keep the volume of the file, it is dropped once the write is posted */
+    OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+    if (FileObject->SectionObjectPointer != NULL &&
+        FileObject->SectionObjectPointer->SharedCacheMap != NULL)
+    {
+        SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+        Context->Volume = SharedCacheMap->Volume;
+        if (Context->Volume != NULL)
+        {
+            Context->Volume->ReferenceCount++;
+        }
+    }
+    KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
 
     /* And queue it */
     if (Retrying)
     {
         /* To the top, if that's a retry */
         ExInterlockedInsertHeadList(&CcDeferredWrites,
-                                    &Context->DeferredWriteLinks,
+                                    &Context->DeferredWrite.DeferredWriteLinks,
                                     &CcDeferredWriteSpinLock);
     }
     else
     {
         /* To the bottom, if that's a first time */
         ExInterlockedInsertTailList(&CcDeferredWrites,
-                                    &Context->DeferredWriteLinks,
+                                    &Context->DeferredWrite.DeferredWriteLinks,
                                     &CcDeferredWriteSpinLock);
     }
 
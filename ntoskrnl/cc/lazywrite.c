@@ -114,23 +114,41 @@ CcScanDpc(
 }
 
 VOID
-CcWriteBehind(VOID)
+CcWriteBehind(
+    IN PROS_CACHE_VOLUME Volume)
 {
+    KIRQL OldIrql;
     ULONG Target, Count;
 
-    Target = CcTotalDirtyPages / 8;
+    /* Our target is one-eighth of the dirty pages of the volume,
+     * or what gets it back well within its budget if it is over
+     */
+    OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+    Target = Volume->DirtyPages / 8;
+    if (Volume->DirtyPages >= Volume->DirtyPageThreshold)
+    {
+        Target = max(Target, Volume->DirtyPages - Volume->DirtyPageThreshold / 2);
+    }
+    KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+
     if (Target != 0)
     {
         /* Flush! */
-        DPRINT("Lazy writer starting (%d)\n", Target);
-        CcRosFlushDirtyPages(Target, &Count, FALSE, TRUE);
+        DPRINT("Lazy writer starting (%p, %d)\n", Volume, Target);
+        CcRosFlushDirtyPages(Target, &Count, FALSE, TRUE, Volume);
 
         /* And update stats */
-        CcLazyWritePages += Count;
-        ++CcLazyWriteIos;
-        DPRINT("Lazy writer done (%d)\n", Count);
+        InterlockedExchangeAdd((PLONG)&CcLazyWritePages, Count);
+        InterlockedIncrement((PLONG)&CcLazyWriteIos);
+        DPRINT("Lazy writer done (%p, %d)\n", Volume, Count);
     }
 
+    /* The volume can be scheduled again */
+    OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+    Volume->InLazyWrite = FALSE;
+    CcRosDereferenceVolume(Volume);
+    KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+
     /* Make sure we're not throttling writes after this */
     while (MmAvailablePages < MmThrottleTop)
     {
@@ -145,14 +163,14 @@ CcWriteBehind(VOID)
 VOID
 CcLazyWriteScan(VOID)
 {
-    ULONG Target;
     KIRQL OldIrql;
     PLIST_ENTRY ListEntry;
-    LIST_ENTRY ToPost;
+    LIST_ENTRY ToPost, WriteBehindItems;
     PWORK_QUEUE_ENTRY WorkItem;
 
     /* Do we have entries to queue after we're done? */
     InitializeListHead(&ToPost);
+    InitializeListHead(&WriteBehindItems);
     OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
     if (LazyWriter.OtherWork)
     {
@@ -164,21 +182,44 @@ CcLazyWriteScan(VOID)
         }
         LazyWriter.OtherWork = FALSE;
     }
-    KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
 
-    /* Our target is one-eighth of the dirty pages */
-    Target = CcTotalDirtyPages / 8;
-    if (Target != 0)
+    /* Schedule a write-behind operation per volume with stuff to flush.
+     * They run in parallel, so that a slow device doesn't delay the others.
+     */
+    for (ListEntry = CcVolumeListHead.Flink;
+         ListEntry != &CcVolumeListHead;
+         ListEntry = ListEntry->Flink)
     {
-        /* There is stuff to flush, schedule a write-behind operation */
+        PROS_CACHE_VOLUME Volume = CONTAINING_RECORD(ListEntry, ROS_CACHE_VOLUME, VolumeLinks);
+
+        /* Nothing to do, or still busy with the previous run */
+        if (Volume->DirtyPages == 0 || Volume->InLazyWrite)
+        {
+            continue;
+        }
 
         /* Allocate a work item */
         WorkItem = ExAllocateFromNPagedLookasideList(&CcTwilightLookasideList);
-        if (WorkItem != NULL)
+        if (WorkItem == NULL)
         {
-            WorkItem->Function = WriteBehind;
-            CcPostWorkQueue(WorkItem, &CcRegularWorkQueue);
+            break;
         }
+
+        /* The volume stays around until the work item ran */
+        Volume->InLazyWrite = TRUE;
+        Volume->ReferenceCount++;
+
+        WorkItem->Function = WriteBehind;
+        WorkItem->Parameters.WriteVolume.Volume = Volume;
+        InsertTailList(&WriteBehindItems, &WorkItem->WorkQueueLinks);
+    }
+    KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+
+    while (!IsListEmpty(&WriteBehindItems))
+    {
+        ListEntry = RemoveHeadList(&WriteBehindItems);
+        WorkItem = CONTAINING_RECORD(ListEntry, WORK_QUEUE_ENTRY, WorkQueueLinks);
+        CcPostWorkQueue(WorkItem, &CcRegularWorkQueue);
     }
 
     /* Post items that were due for end of run */
@@ -318,7 +359,7 @@ CcWorkerThread(
 
             case WriteBehind:
                 PsGetCurrentThread()->MemoryMaker = 1;
-                CcWriteBehind();
+                CcWriteBehind(WorkItem->Parameters.WriteVolume.Volume);
                 PsGetCurrentThread()->MemoryMaker = 0;
                 WritePerformed = TRUE;
                 break;
@@ -13,8 +13,162 @@
 #define NDEBUG
 #include <debug.h>
 
+/* GLOBALS *******************************************************************/
+
+ULONG CcMdlReadWait = 0;
+
 /* FUNCTIONS *****************************************************************/
 
+/*
+ * Returns the view an MDL built by CcpBuildMdlChain describes.
+ * The MDL holds a reference on it, so it can't go away while we look it up.
+ */
+static
+PROS_VACB
+CcpGetMdlVacb(
+    _In_ PROS_SHARED_CACHE_MAP SharedCacheMap,
+    _In_ PMDL Mdl)
+{
+    PMM_SECTION_SEGMENT Segment;
+    LARGE_INTEGER FileOffset;
+    PROS_VACB Vacb;
+    KIRQL OldIrql;
+
+    /* Its pages are locked, so the first one still knows where in the file the MDL starts */
+    Segment = MmGetSectionAssociation(MmGetMdlPfnArray(Mdl)[0], &FileOffset);
+    if (!Segment)
+        return NULL;
+    MmDereferenceSegment(Segment);
+    FileOffset.QuadPart += MmGetMdlByteOffset(Mdl);
+
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
+    Vacb = CcRosLookupVacbIndex(SharedCacheMap, FileOffset.QuadPart);
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
+
+    ASSERT(Vacb == NULL ||
+           ((PUCHAR)MmGetMdlVirtualAddress(Mdl) >= (PUCHAR)Vacb->BaseAddress &&
+            (PUCHAR)MmGetMdlVirtualAddress(Mdl) < (PUCHAR)Vacb->BaseAddress + VACB_MAPPING_GRANULARITY));
+    return Vacb;
+}
+
+/*
+ * Unlocks and frees a chain built by CcpBuildMdlChain, and releases the views
+ * its MDLs kept referenced.
+ */
+static
+VOID
+CcpFreeMdlChain(
+    _In_ PROS_SHARED_CACHE_MAP SharedCacheMap,
+    _In_opt_ PMDL MdlChain,
+    _In_ BOOLEAN Dirty)
+{
+    PROS_VACB Vacb;
+    PMDL Mdl;
+
+    while ((Mdl = MdlChain))
+    {
+        MdlChain = Mdl->Next;
+
+        Vacb = CcpGetMdlVacb(SharedCacheMap, Mdl);
+        ASSERT(Vacb != NULL);
+
+        MmUnlockPages(Mdl);
+        IoFreeMdl(Mdl);
+
+        if (Vacb)
+        {
+            CcRosReleaseVacb(SharedCacheMap, Vacb, Dirty, FALSE);
+        }
+    }
+}
+
+/*
+ * Describes the cached data of a file range with a chain of locked MDLs, one per view.
+ * Each MDL keeps its view referenced, so the pages can't be paged out of the
+ * segment while the caller works on them. Completing the chain releases the views.
+ */
+static
+VOID
+CcpBuildMdlChain(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ PLARGE_INTEGER FileOffset,
+    _In_ ULONG Length,
+    _In_ LOCK_OPERATION Operation,
+    _Inout_ PMDL *MdlChain,
+    _Out_ PIO_STATUS_BLOCK IoStatus)
+{
+    PROS_SHARED_CACHE_MAP SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    LONGLONG CurrentOffset = FileOffset->QuadPart;
+    PMDL *Tail, NewChain = NULL, Mdl;
+    ULONG Information = 0;
+    PROS_VACB Vacb;
+    NTSTATUS Status;
+
+    IoStatus->Status = STATUS_SUCCESS;
+    IoStatus->Information = 0;
+
+    if (!SharedCacheMap)
+        ExRaiseStatus(STATUS_INVALID_PARAMETER);
+
+    /* New MDLs go to the end of the caller's chain */
+    Tail = &NewChain;
+
+    while (Length > 0)
+    {
+        ULONG VacbOffset = CurrentOffset % VACB_MAPPING_GRANULARITY;
+        ULONG VacbLength = min(Length, VACB_MAPPING_GRANULARITY - VacbOffset);
+
+        Status = CcRosGetVacb(SharedCacheMap, CurrentOffset, &Vacb);
+        if (!NT_SUCCESS(Status))
+        {
+            CcpFreeMdlChain(SharedCacheMap, NewChain, FALSE);
+            ExRaiseStatus(Status);
+        }
+
+        Mdl = NULL;
+        _SEH2_TRY
+        {
+            CcRosEnsureVacbResident(Vacb, TRUE, FALSE, VacbOffset, VacbLength);
+
+            Mdl = IoAllocateMdl((PUCHAR)Vacb->BaseAddress + VacbOffset, VacbLength, FALSE, FALSE, NULL);
+            if (!Mdl)
+                ExRaiseStatus(STATUS_INSUFFICIENT_RESOURCES);
+
+            MmProbeAndLockPages(Mdl, KernelMode, Operation);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        if (!NT_SUCCESS(Status))
+        {
+            CcRosReleaseVacb(SharedCacheMap, Vacb, FALSE, FALSE);
+            if (Mdl)
+                IoFreeMdl(Mdl);
+            CcpFreeMdlChain(SharedCacheMap, NewChain, FALSE);
+            ExRaiseStatus(Status);
+        }
+
+        /* The MDL keeps our reference on the view */
+        *Tail = Mdl;
+        Tail = &Mdl->Next;
+
+        Information += VacbLength;
+        CurrentOffset += VacbLength;
+        Length -= VacbLength;
+    }
+
+    /* Hand the whole range over at once */
+    Tail = MdlChain;
+    while (*Tail)
+        Tail = &(*Tail)->Next;
+    *Tail = NewChain;
+
+    IoStatus->Information = Information;
+}
+
 /*
  * @implemented
  */
@@ -31,7 +185,15 @@ CcMdlRead (
     CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu\n",
         FileObject, FileOffset->QuadPart, Length);
 
-    UNIMPLEMENTED;
+    ++CcMdlReadWait;
+
+    CcpBuildMdlChain(FileObject, FileOffset, Length, IoReadAccess, MdlChain, IoStatus);
+
+    /* Servers stream files through here, keep the cache ahead of them */
+    if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS))
+    {
+        CcScheduleReadAhead(FileObject, FileOffset, (ULONG)IoStatus->Information);
+    }
 }
 
 /*
@@ -58,15 +220,10 @@ CcMdlReadComplete2 (
     IN PMDL MemoryDescriptorList
 )
 {
-    PMDL Mdl;
+    PROS_SHARED_CACHE_MAP SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
 
-    /* Free MDLs */
-    while ((Mdl = MemoryDescriptorList))
-    {
-        MemoryDescriptorList = Mdl->Next;
-        MmUnlockPages(Mdl);
-        IoFreeMdl(Mdl);
-    }
+    /* Free MDLs and release their views */
+    CcpFreeMdlChain(SharedCacheMap, MemoryDescriptorList, FALSE);
 }
 
 /*
@@ -157,11 +314,46 @@ CcMdlWriteComplete2 (
     IN PLARGE_INTEGER FileOffset,
     IN PMDL MdlChain)
 {
-    UNIMPLEMENTED;
+    PROS_SHARED_CACHE_MAP SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+    LONGLONG CurrentOffset = FileOffset->QuadPart;
+    IO_STATUS_BLOCK IoStatus;
+    NTSTATUS Status;
+    ULONG Length = 0;
+    PMDL Mdl;
+
+    CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d MdlChain=%p\n",
+        FileObject, FileOffset->QuadPart, MdlChain);
+
+    /* The data was written straight to the cache pages, so Mm and the lazy writer have to learn about it */
+    for (Mdl = MdlChain; Mdl; Mdl = Mdl->Next)
+    {
+        Status = MmMakeSegmentDirty(FileObject->SectionObjectPointer, CurrentOffset, Mdl->ByteCount);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Failed to dirty %I64d (%lu bytes): 0x%lx\n", CurrentOffset, Mdl->ByteCount, Status);
+        }
+
+        CurrentOffset += Mdl->ByteCount;
+        Length += Mdl->ByteCount;
+    }
+
+    /* Releasing the views marks them dirty */
+    CcpFreeMdlChain(SharedCacheMap, MdlChain, TRUE);
+
+    IoStatus.Status = STATUS_SUCCESS;
+    if (FileObject->Flags & FO_WRITE_THROUGH)
+    {
+        CcFlushCache(FileObject->SectionObjectPointer, FileOffset, Length, &IoStatus);
+    }
+
+    if (!NT_SUCCESS(IoStatus.Status))
+    {
+        ExRaiseStatus(IoStatus.Status);
+    }
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -169,11 +361,16 @@ CcMdlWriteAbort (
     IN PFILE_OBJECT FileObject,
     IN PMDL MdlChain)
 {
-    UNIMPLEMENTED;
+    PROS_SHARED_CACHE_MAP SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+
+    CCTRACE(CC_API_DEBUG, "FileObject=%p MdlChain=%p\n", FileObject, MdlChain);
+
+    /* Nothing was written, just give the pages and the views back */
+    CcpFreeMdlChain(SharedCacheMap, MdlChain, FALSE);
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -187,5 +384,5 @@ CcPrepareMdlWrite (
     CCTRACE(CC_API_DEBUG, "FileObject=%p FileOffset=%I64d Length=%lu\n",
         FileObject, FileOffset->QuadPart, Length);
 
-    UNIMPLEMENTED;
+    CcpBuildMdlChain(FileObject, FileOffset, Length, IoWriteAccess, MdlChain, IoStatus);
 }
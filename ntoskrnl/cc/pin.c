@@ -24,15 +24,46 @@ extern NPAGED_LOOKASIDE_LIST iBcbLookasideList;
  * - Number of calls to CcPinRead that could wait
  * - Number of calls to CcPinRead that couldn't wait
  * - Number of calls to CcPinMappedDataCount
+ * - Number of pins of a BCB that was held by someone else
  */
 ULONG CcMapDataWait = 0;
 ULONG CcMapDataNoWait = 0;
 ULONG CcPinReadWait = 0;
 ULONG CcPinReadNoWait = 0;
 ULONG CcPinMappedDataCount = 0;
+ULONG CcPinContention = 0;
 
 /* FUNCTIONS *****************************************************************/
 
+static
+BOOLEAN
+CcpAcquireBcbLock(
+    _In_ PINTERNAL_BCB iBcb,
+    _In_ ULONG Flags)
+{
+    BOOLEAN Exclusive = BooleanFlagOn(Flags, PIN_EXCLUSIVE);
+    BOOLEAN Result;
+
+    /* Try without blocking first, so that we know when somebody else holds it */
+    if (Exclusive)
+        Result = ExAcquireResourceExclusiveLite(&iBcb->Lock, FALSE);
+    else
+        Result = ExAcquireSharedStarveExclusive(&iBcb->Lock, FALSE);
+
+    if (Result)
+        return TRUE;
+
+    InterlockedIncrement((PLONG)&CcPinContention);
+
+    if (!BooleanFlagOn(Flags, PIN_WAIT))
+        return FALSE;
+
+    if (Exclusive)
+        return ExAcquireResourceExclusiveLite(&iBcb->Lock, TRUE);
+    else
+        return ExAcquireSharedStarveExclusive(&iBcb->Lock, TRUE);
+}
+
 static
 PINTERNAL_BCB
 NTAPI
@@ -45,9 +76,20 @@ CcpFindBcb(
     PINTERNAL_BCB Bcb;
     BOOLEAN Found = FALSE;
     PLIST_ENTRY NextEntry;
+    PROS_VACB Vacb;
 
-    for (NextEntry = SharedCacheMap->BcbList.Flink;
-         NextEntry != &SharedCacheMap->BcbList;
+    /* BCBs never cross a view, so only the BCBs of the VACB holding the offset can match.
+     * A VACB without BCBs can be freed at any time, so keep the lock while we walk its list. */
+    KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
+    Vacb = CcRosLookupVacbIndex(SharedCacheMap, FileOffset->QuadPart);
+    if (Vacb == NULL)
+    {
+        KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
+        return NULL;
+    }
+
+    for (NextEntry = Vacb->BcbList.Flink;
+         NextEntry != &Vacb->BcbList;
          NextEntry = NextEntry->Flink)
     {
         Bcb = CONTAINING_RECORD(NextEntry, INTERNAL_BCB, BcbEntry);
@@ -63,6 +105,7 @@ CcpFindBcb(
             }
         }
     }
+    KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
 
     return (Found ? Bcb : NULL);
 }
@@ -200,7 +243,7 @@ CcpGetAppropriateBcb(
             ASSERT(Result);
         }
 
-        InsertTailList(&SharedCacheMap->BcbList, &iBcb->BcbEntry);
+        InsertTailList(&Vacb->BcbList, &iBcb->BcbEntry);
         KeReleaseSpinLock(&SharedCacheMap->BcbSpinLock, OldIrql);
     }
 
@@ -242,11 +285,7 @@ CcpPinData(
         ++NewBcb->RefCount;
         KeReleaseSpinLock(&SharedCacheMap->BcbSpinLock, OldIrql);
 
-        if (BooleanFlagOn(Flags, PIN_EXCLUSIVE))
-            Result = ExAcquireResourceExclusiveLite(&NewBcb->Lock, BooleanFlagOn(Flags, PIN_WAIT));
-        else
-            Result = ExAcquireSharedStarveExclusive(&NewBcb->Lock, BooleanFlagOn(Flags, PIN_WAIT));
-
+        Result = CcpAcquireBcbLock(NewBcb, Flags);
         if (!Result)
         {
             CcpDereferenceBcb(SharedCacheMap, NewBcb);
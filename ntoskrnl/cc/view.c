@@ -59,6 +59,13 @@ LIST_ENTRY CcDeferredWrites;
 KSPIN_LOCK CcDeferredWriteSpinLock;
 LIST_ENTRY CcCleanSharedCacheMapList;
 
+/* Counters:
+ * - Number of VACBs created
+ * - Number of unused VACBs freed to make room for others
+ */
+ULONG CcVacbAllocations = 0;
+ULONG CcVacbSteals = 0;
+
 #if DBG
 ULONG CcRosVacbIncRefCount_(PROS_VACB vacb, PCSTR file, INT line)
 {
@@ -113,6 +120,247 @@ ULONG CcRosVacbGetRefCount_(PROS_VACB vacb, PCSTR file, INT line)
 
 /* FUNCTIONS *****************************************************************/
 
+static
+PROS_VACB_INDEX_BLOCK
+CcRosAllocateVacbIndexBlock(VOID)
+{
+    PROS_VACB_INDEX_BLOCK Block;
+
+    Block = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Block), TAG_VACB_INDEX);
+    if (Block)
+    {
+        RtlZeroMemory(Block, sizeof(*Block));
+    }
+
+    return Block;
+}
+
+static
+VOID
+CcRosFreeVacbIndexBlocks(
+    _In_ PROS_VACB_INDEX_BLOCK Block,
+    _In_ ULONG Level)
+{
+    ULONG i;
+
+    if (Level > 0)
+    {
+        for (i = 0; i < CC_VACB_INDEX_ENTRIES; i++)
+        {
+            if (Block->Entries[i])
+                CcRosFreeVacbIndexBlocks(Block->Entries[i], Level - 1);
+        }
+    }
+
+    ExFreePoolWithTag(Block, TAG_VACB_INDEX);
+}
+
+/* Must be called with the CacheMapLock held */
+PROS_VACB
+CcRosLookupVacbIndex(
+    _In_ PROS_SHARED_CACHE_MAP SharedCacheMap,
+    _In_ LONGLONG FileOffset)
+{
+    ULONGLONG Key = (ULONGLONG)FileOffset / VACB_MAPPING_GRANULARITY;
+    PROS_VACB_INDEX_BLOCK Block = SharedCacheMap->VacbIndex;
+    ULONG Level;
+
+    if (!Block || (Key >> (SharedCacheMap->VacbIndexLevels * CC_VACB_INDEX_SHIFT)) != 0)
+        return NULL;
+
+    for (Level = SharedCacheMap->VacbIndexLevels - 1; Level > 0; Level--)
+    {
+        Block = Block->Entries[(Key >> (Level * CC_VACB_INDEX_SHIFT)) & (CC_VACB_INDEX_ENTRIES - 1)];
+        if (!Block)
+            return NULL;
+    }
+
+    return Block->Entries[Key & (CC_VACB_INDEX_ENTRIES - 1)];
+}
+
+static
+BOOLEAN
+CcRosInsertVacbIndex(
+    _In_ PROS_SHARED_CACHE_MAP SharedCacheMap,
+    _In_ PROS_VACB Vacb)
+{
+    ULONGLONG Key = (ULONGLONG)Vacb->FileOffset.QuadPart / VACB_MAPPING_GRANULARITY;
+    PROS_VACB_INDEX_BLOCK Path[CC_VACB_INDEX_MAX_LEVELS];
+    PROS_VACB_INDEX_BLOCK Block, *Slot;
+    ULONG Level, OldLevels;
+
+    OldLevels = SharedCacheMap->VacbIndexLevels;
+    if (!SharedCacheMap->VacbIndex)
+    {
+        SharedCacheMap->VacbIndex = CcRosAllocateVacbIndexBlock();
+        if (!SharedCacheMap->VacbIndex)
+            return FALSE;
+        SharedCacheMap->VacbIndexLevels = 1;
+    }
+
+    /* Add levels on top until the tree covers the offset */
+    while ((Key >> (SharedCacheMap->VacbIndexLevels * CC_VACB_INDEX_SHIFT)) != 0)
+    {
+        ASSERT(SharedCacheMap->VacbIndexLevels < CC_VACB_INDEX_MAX_LEVELS);
+        Block = CcRosAllocateVacbIndexBlock();
+        if (!Block)
+            goto RemoveLevels;
+        Block->Entries[0] = SharedCacheMap->VacbIndex;
+        Block->Count = 1;
+        SharedCacheMap->VacbIndex = Block;
+        SharedCacheMap->VacbIndexLevels++;
+    }
+
+    Block = SharedCacheMap->VacbIndex;
+    for (Level = SharedCacheMap->VacbIndexLevels - 1; Level > 0; Level--)
+    {
+        Path[Level] = Block;
+        Slot = (PROS_VACB_INDEX_BLOCK*)&Block->Entries[(Key >> (Level * CC_VACB_INDEX_SHIFT)) & (CC_VACB_INDEX_ENTRIES - 1)];
+        if (!*Slot)
+        {
+            *Slot = CcRosAllocateVacbIndexBlock();
+            if (!*Slot)
+                goto RemoveBlocks;
+            Block->Count++;
+        }
+        Block = *Slot;
+    }
+
+    ASSERT(Block->Entries[Key & (CC_VACB_INDEX_ENTRIES - 1)] == NULL);
+    Block->Entries[Key & (CC_VACB_INDEX_ENTRIES - 1)] = Vacb;
+    Block->Count++;
+    return TRUE;
+
+RemoveBlocks:
+    /* Release the blocks we created on the way down, they are still empty */
+    for (Level++; Level < SharedCacheMap->VacbIndexLevels; Level++)
+    {
+        Slot = (PROS_VACB_INDEX_BLOCK*)&Path[Level]->Entries[(Key >> (Level * CC_VACB_INDEX_SHIFT)) & (CC_VACB_INDEX_ENTRIES - 1)];
+        if ((*Slot)->Count != 0)
+            break;
+
+        ExFreePoolWithTag(*Slot, TAG_VACB_INDEX);
+        *Slot = NULL;
+        Path[Level]->Count--;
+    }
+
+RemoveLevels:
+    /* Then the levels we added on top, the old root is their only entry again */
+    while (SharedCacheMap->VacbIndexLevels > max(OldLevels, 1))
+    {
+        Block = SharedCacheMap->VacbIndex;
+        ASSERT(Block->Count == 1);
+        SharedCacheMap->VacbIndex = Block->Entries[0];
+        SharedCacheMap->VacbIndexLevels--;
+        ExFreePoolWithTag(Block, TAG_VACB_INDEX);
+    }
+
+    /* And the root if it was created for this VACB */
+    if (OldLevels == 0)
+    {
+        ASSERT(SharedCacheMap->VacbIndex->Count == 0);
+        ExFreePoolWithTag(SharedCacheMap->VacbIndex, TAG_VACB_INDEX);
+        SharedCacheMap->VacbIndex = NULL;
+        SharedCacheMap->VacbIndexLevels = 0;
+    }
+
+    return FALSE;
+}
+
+static
+VOID
+CcRosRemoveVacbIndex(
+    _In_ PROS_SHARED_CACHE_MAP SharedCacheMap,
+    _In_ PROS_VACB Vacb)
+{
+    ULONGLONG Key = (ULONGLONG)Vacb->FileOffset.QuadPart / VACB_MAPPING_GRANULARITY;
+    PROS_VACB_INDEX_BLOCK Path[CC_VACB_INDEX_MAX_LEVELS];
+    PROS_VACB_INDEX_BLOCK Block = SharedCacheMap->VacbIndex;
+    ULONG Level;
+
+    ASSERT(CcRosLookupVacbIndex(SharedCacheMap, Vacb->FileOffset.QuadPart) == Vacb);
+
+    for (Level = SharedCacheMap->VacbIndexLevels - 1; Level > 0; Level--)
+    {
+        Path[Level] = Block;
+        Block = Block->Entries[(Key >> (Level * CC_VACB_INDEX_SHIFT)) & (CC_VACB_INDEX_ENTRIES - 1)];
+    }
+    Path[0] = Block;
+    Block->Entries[Key & (CC_VACB_INDEX_ENTRIES - 1)] = NULL;
+
+    /* Release the blocks that became empty, bottom up */
+    for (Level = 0; Level < SharedCacheMap->VacbIndexLevels; Level++)
+    {
+        if (--Path[Level]->Count != 0)
+            break;
+
+        ExFreePoolWithTag(Path[Level], TAG_VACB_INDEX);
+        if (Level == SharedCacheMap->VacbIndexLevels - 1)
+        {
+            SharedCacheMap->VacbIndex = NULL;
+            SharedCacheMap->VacbIndexLevels = 0;
+            break;
+        }
+
+        Path[Level + 1]->Entries[(Key >> ((Level + 1) * CC_VACB_INDEX_SHIFT)) & (CC_VACB_INDEX_ENTRIES - 1)] = NULL;
+    }
+}
+
+static
+PROS_VACB
+CcRosFindVacbAtOrBelow(
+    _In_ PROS_VACB_INDEX_BLOCK Block,
+    _In_ ULONG Level,
+    _In_ ULONGLONG Key)
+{
+    ULONG i = (ULONG)(Key >> (Level * CC_VACB_INDEX_SHIFT)) & (CC_VACB_INDEX_ENTRIES - 1);
+    PROS_VACB Found;
+
+    for (;;)
+    {
+        if (Block->Entries[i])
+        {
+            if (Level == 0)
+                return Block->Entries[i];
+
+            Found = CcRosFindVacbAtOrBelow(Block->Entries[i], Level - 1, Key);
+            if (Found)
+                return Found;
+        }
+
+        if (i == 0)
+            return NULL;
+        i--;
+
+        /* Everything left of the key's own entry is below it */
+        Key = MAXULONGLONG;
+    }
+}
+
+/* Returns the VACB right before the given one in file order, if any. CacheMapLock must be held */
+static
+PROS_VACB
+CcRosFindPreviousVacb(
+    _In_ PROS_SHARED_CACHE_MAP SharedCacheMap,
+    _In_ PROS_VACB Vacb)
+{
+    ULONGLONG Key = (ULONGLONG)Vacb->FileOffset.QuadPart / VACB_MAPPING_GRANULARITY;
+
+    if (Key == 0 || !SharedCacheMap->VacbIndex)
+        return NULL;
+
+    return CcRosFindVacbAtOrBelow(SharedCacheMap->VacbIndex, SharedCacheMap->VacbIndexLevels - 1, Key - 1);
+}
+
+/* Removes a VACB from its shared cache map. CacheMapLock must be held */
+VOID
+CcRosUnlinkVacb(
+    _In_ PROS_VACB Vacb)
+{
+    CcRosRemoveVacbIndex(Vacb->SharedCacheMap, Vacb);
+    RemoveEntryList(&Vacb->CacheMapVacbListEntry);
+}
+
 VOID
 CcRosTraceCacheMap (
     PROS_SHARED_CACHE_MAP SharedCacheMap,
@@ -245,9 +493,21 @@ CcRosDeleteFileCache (
     RemoveEntryList(&SharedCacheMap->SharedCacheMapLinks);
 
     KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
+
+    /* Its dirty pages are not accounted to the volume anymore */
+    CcRosDereferenceVolume(SharedCacheMap->Volume);
+    SharedCacheMap->Volume = NULL;
+
     KeReleaseQueuedSpinLock(LockQueueMasterLock, *OldIrql);
 
     /* Now that we're out of the locks, free everything for real */
+    if (SharedCacheMap->VacbIndex)
+    {
+        CcRosFreeVacbIndexBlocks(SharedCacheMap->VacbIndex, SharedCacheMap->VacbIndexLevels - 1);
+        SharedCacheMap->VacbIndex = NULL;
+        SharedCacheMap->VacbIndexLevels = 0;
+    }
+
     while (!IsListEmpty(&SharedCacheMap->CacheMapVacbListHead))
     {
         PROS_VACB Vacb = CONTAINING_RECORD(RemoveHeadList(&SharedCacheMap->CacheMapVacbListHead), ROS_VACB, CacheMapVacbListEntry);
@@ -305,12 +565,56 @@ CcRosDeleteFileCache (
     return STATUS_SUCCESS;
 }
 
+static
+PROS_VACB
+CcRosReferenceNextDirtyVacb (
+    _In_ PROS_VACB Vacb)
+/*
+ * FUNCTION: Returns the VACB following Vacb in the file, with a reference,
+ * if it is dirty and contiguous
+ */
+{
+    KIRQL OldIrql;
+    PLIST_ENTRY NextEntry;
+    PROS_VACB Next = NULL;
+    PROS_SHARED_CACHE_MAP SharedCacheMap = Vacb->SharedCacheMap;
+
+    OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+    KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
+
+    /* The list is sorted by file offset */
+    NextEntry = Vacb->CacheMapVacbListEntry.Flink;
+    if (NextEntry != &SharedCacheMap->CacheMapVacbListHead)
+    {
+        Next = CONTAINING_RECORD(NextEntry, ROS_VACB, CacheMapVacbListEntry);
+        if (Next->Dirty &&
+            Next->FileOffset.QuadPart == Vacb->FileOffset.QuadPart + VACB_MAPPING_GRANULARITY)
+        {
+            CcRosVacbIncRefCount(Next);
+        }
+        else
+        {
+            Next = NULL;
+        }
+    }
+
+    KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
+    KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+
+    return Next;
+}
+
 NTSTATUS
 CcRosFlushDirtyPages (
     ULONG Target,
     PULONG Count,
     BOOLEAN Wait,
-    BOOLEAN CalledFromLazy)
+    BOOLEAN CalledFromLazy,
+    PROS_CACHE_VOLUME Volume)
+/*
+ * FUNCTION: Flushes dirty VACBs, only the ones of Volume if not NULL.
+ * Dirty VACBs following the first one of a file are written in the same batch.
+ */
 {
     PLIST_ENTRY current_entry;
     NTSTATUS Status;
@@ -349,10 +653,16 @@ CcRosFlushDirtyPages (
                                     DirtyVacbListEntry);
         current_entry = current_entry->Flink;
 
-        CcRosVacbIncRefCount(current);
-
         SharedCacheMap = current->SharedCacheMap;
 
+        /* Another worker takes care of the other volumes */
+        if (Volume != NULL && SharedCacheMap->Volume != Volume)
+        {
+            continue;
+        }
+
+        CcRosVacbIncRefCount(current);
+
         /* When performing lazy write, don't handle temporary files */
         if (CalledFromLazy && BooleanFlagOn(SharedCacheMap->FileObject->Flags, FO_TEMPORARY_FILE))
         {
@@ -399,8 +709,35 @@ CcRosFlushDirtyPages (
         }
 
         IO_STATUS_BLOCK Iosb;
-        Status = CcRosFlushVacb(current, &Iosb);
+        ULONG PagesFreed = 0;
+        ULONGLONG Elapsed = KeQueryInterruptTime();
+
+        while (TRUE)
+        {
+            PROS_VACB next;
+
+            Status = CcRosFlushVacb(current, &Iosb);
+            if (NT_SUCCESS(Status) || (Status == STATUS_END_OF_FILE) ||
+                (Status == STATUS_MEDIA_WRITE_PROTECTED))
+            {
+                /* How many pages did we free? */
+                PagesFreed += Iosb.Information / PAGE_SIZE;
+            }
 
+            if (!NT_SUCCESS(Status) || (!Wait && PagesFreed >= Target))
+                break;
+
+            /* We own the file already, so write the following dirty views with it.
+             * The device gets them in order, mostly contiguous. */
+            next = CcRosReferenceNextDirtyVacb(current);
+            if (next == NULL)
+                break;
+
+            CcRosVacbDecRefCount(current);
+            current = next;
+        }
+
+        Elapsed = KeQueryInterruptTime() - Elapsed;
         SharedCacheMap->Callbacks->ReleaseFromLazyWrite(SharedCacheMap->LazyWriteContext);
 
         /* We release the VACB before acquiring the lock again, because
@@ -412,6 +749,9 @@ CcRosFlushDirtyPages (
 
         SharedCacheMap->Flags &= ~SHARED_CACHE_MAP_IN_LAZYWRITE;
 
+        /* Feed the write rate of the volume */
+        CcRosVolumeWriteCompleted(SharedCacheMap->Volume, PagesFreed, Elapsed);
+
         if (--SharedCacheMap->OpenCount == 0)
             CcRosDeleteFileCache(SharedCacheMap->FileObject, SharedCacheMap, &OldIrql);
 
@@ -420,12 +760,9 @@ CcRosFlushDirtyPages (
         {
             DPRINT1("CC: Failed to flush VACB.\n");
         }
-        else
-        {
-            ULONG PagesFreed;
 
-            /* How many pages did we free? */
-            PagesFreed = Iosb.Information / PAGE_SIZE;
+        if (PagesFreed != 0)
+        {
             (*Count) += PagesFreed;
 
             if (!Wait)
@@ -515,7 +852,7 @@ retry:
             {
                 Page = (PFN_NUMBER)(MmGetPhysicalAddress((PUCHAR)current->BaseAddress + (i * PAGE_SIZE)).QuadPart >> PAGE_SHIFT);
 
-                MmPageOutPhysicalAddress(Page);
+                MmPageOutPhysicalAddress(Page, NULL);
             }
 
             /* Reacquire the locks */
@@ -537,11 +874,13 @@ retry:
             ASSERT(!current->MappedCount);
             ASSERT(Refs == 1);
 
-            RemoveEntryList(&current->CacheMapVacbListEntry);
+            CcRosUnlinkVacb(current);
             RemoveEntryList(&current->VacbLruListEntry);
             InitializeListHead(&current->VacbLruListEntry);
             InsertHeadList(&FreeList, &current->CacheMapVacbListEntry);
 
+            ++CcVacbSteals;
+
             /* Calculate how many pages we freed for Mm */
             PagesFreed = min(VACB_MAPPING_GRANULARITY / PAGE_SIZE, Target);
             Target -= PagesFreed;
@@ -557,7 +896,7 @@ retry:
     if ((Target > 0) && !FlushedPages)
     {
         /* Flush dirty pages to disk */
-        CcRosFlushDirtyPages(Target, &PagesFreed, FALSE, FALSE);
+        CcRosFlushDirtyPages(Target, &PagesFreed, FALSE, FALSE, NULL);
         FlushedPages = TRUE;
 
         /* We can only swap as many pages as we flushed */
@@ -625,7 +964,6 @@ CcRosLookupVacb (
     PROS_SHARED_CACHE_MAP SharedCacheMap,
     LONGLONG FileOffset)
 {
-    PLIST_ENTRY current_entry;
     PROS_VACB current;
     KIRQL oldIrql;
 
@@ -637,30 +975,16 @@ CcRosLookupVacb (
     oldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
     KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
 
-    current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
-    while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
+    current = CcRosLookupVacbIndex(SharedCacheMap, FileOffset);
+    if (current)
     {
-        current = CONTAINING_RECORD(current_entry,
-                                    ROS_VACB,
-                                    CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
-                           VACB_MAPPING_GRANULARITY,
-                           FileOffset))
-        {
-            CcRosVacbIncRefCount(current);
-            KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
-            KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
-            return current;
-        }
-        if (current->FileOffset.QuadPart > FileOffset)
-            break;
-        current_entry = current_entry->Flink;
+        CcRosVacbIncRefCount(current);
     }
 
     KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
     KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
 
-    return NULL;
+    return current;
 }
 
 VOID
@@ -681,6 +1005,7 @@ CcRosMarkDirtyVacb (
     /* FIXME: There is no reason to account for the whole VACB. */
     CcTotalDirtyPages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
     Vacb->SharedCacheMap->DirtyPages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+    SharedCacheMap->Volume->DirtyPages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
     CcRosVacbIncRefCount(Vacb);
 
     /* Move to the tail of the LRU list */
@@ -724,6 +1049,7 @@ CcRosUnmarkDirtyVacb (
 
     CcTotalDirtyPages -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
     Vacb->SharedCacheMap->DirtyPages -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
+    SharedCacheMap->Volume->DirtyPages -= VACB_MAPPING_GRANULARITY / PAGE_SIZE;
 
     CcRosVacbDecRefCount(Vacb);
 
@@ -766,10 +1092,11 @@ CcRosFreeOneUnusedVacb(
             ASSERT(Refs == 1);
 
             /* Reset it, this is the one we want to free */
-            RemoveEntryList(&current->CacheMapVacbListEntry);
+            CcRosUnlinkVacb(current);
             InitializeListHead(&current->CacheMapVacbListEntry);
             RemoveEntryList(&current->VacbLruListEntry);
             InitializeListHead(&current->VacbLruListEntry);
+            ++CcVacbSteals;
 
             to_free = current;
         }
@@ -802,7 +1129,6 @@ CcRosCreateVacb (
 {
     PROS_VACB current;
     PROS_VACB previous;
-    PLIST_ENTRY current_entry;
     NTSTATUS Status;
     KIRQL oldIrql;
     ULONG Refs;
@@ -827,6 +1153,7 @@ CcRosCreateVacb (
     InitializeListHead(&current->CacheMapVacbListEntry);
     InitializeListHead(&current->DirtyVacbListEntry);
     InitializeListHead(&current->VacbLruListEntry);
+    InitializeListHead(&current->BcbList);
 
     CcRosVacbIncRefCount(current);
 
@@ -867,48 +1194,43 @@ CcRosCreateVacb (
      * our newly created VACB and return the existing one.
      */
     KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
-    current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
-    previous = NULL;
-    while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
+    current = CcRosLookupVacbIndex(SharedCacheMap, FileOffset);
+    if (current)
     {
-        current = CONTAINING_RECORD(current_entry,
-                                    ROS_VACB,
-                                    CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
-                           VACB_MAPPING_GRANULARITY,
-                           FileOffset))
-        {
-            CcRosVacbIncRefCount(current);
-            KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
+        CcRosVacbIncRefCount(current);
+        KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
 #if DBG
-            if (SharedCacheMap->Trace)
-            {
-                DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
-                        SharedCacheMap,
-                        (*Vacb),
-                        current);
-            }
+        if (SharedCacheMap->Trace)
+        {
+            DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
+                    SharedCacheMap,
+                    (*Vacb),
+                    current);
+        }
 #endif
-            KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
 
-            Refs = CcRosVacbDecRefCount(*Vacb);
-            ASSERT(Refs == 0);
+        Refs = CcRosVacbDecRefCount(*Vacb);
+        ASSERT(Refs == 0);
 
-            *Vacb = current;
-            return STATUS_SUCCESS;
-        }
-        if (current->FileOffset.QuadPart < FileOffset)
-        {
-            ASSERT(previous == NULL ||
-                   previous->FileOffset.QuadPart < current->FileOffset.QuadPart);
-            previous = current;
-        }
-        if (current->FileOffset.QuadPart > FileOffset)
-            break;
-        current_entry = current_entry->Flink;
+        *Vacb = current;
+        return STATUS_SUCCESS;
     }
     /* There was no existing VACB. */
     current = *Vacb;
+    if (!CcRosInsertVacbIndex(SharedCacheMap, current))
+    {
+        KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
+
+        Refs = CcRosVacbDecRefCount(current);
+        ASSERT(Refs == 0);
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    /* Keep the list sorted by file offset, the index gives us the neighbour */
+    previous = CcRosFindPreviousVacb(SharedCacheMap, current);
     if (previous)
     {
         InsertHeadList(&previous->CacheMapVacbListEntry, &current->CacheMapVacbListEntry);
@@ -919,6 +1241,7 @@ CcRosCreateVacb (
     }
     KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
     InsertTailList(&VacbLruListHead, &current->VacbLruListEntry);
+    ++CcVacbAllocations;
 
     /* Reference it to allow release */
     CcRosVacbIncRefCount(current);
@@ -1079,6 +1402,7 @@ CcRosInternalFreeVacb (
     ASSERT(IsListEmpty(&Vacb->CacheMapVacbListEntry));
     ASSERT(IsListEmpty(&Vacb->DirtyVacbListEntry));
     ASSERT(IsListEmpty(&Vacb->VacbLruListEntry));
+    ASSERT(IsListEmpty(&Vacb->BcbList));
 
     /* Delete the mapping */
     Status = MmUnmapViewInSystemSpace(Vacb->BaseAddress);
@@ -1312,6 +1636,13 @@ CcRosInitializeFileCache (
             return STATUS_INSUFFICIENT_RESOURCES;
         }
         RtlZeroMemory(SharedCacheMap, sizeof(*SharedCacheMap));
+        SharedCacheMap->Volume = CcRosReferenceVolume(FileObject);
+        if (SharedCacheMap->Volume == NULL)
+        {
+            ExFreeToNPagedLookasideList(&SharedCacheMapLookasideList, SharedCacheMap);
+            KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
         SharedCacheMap->NodeTypeCode = NODE_TYPE_SHARED_MAP;
         SharedCacheMap->NodeByteSize = sizeof(*SharedCacheMap);
         SharedCacheMap->FileObject = FileObject;
@@ -1382,6 +1713,7 @@ CcRosInitializeFileCache (
                 RemoveEntryList(&SharedCacheMap->SharedCacheMapLinks);
 
                 FileObject->SectionObjectPointer->SharedCacheMap = NULL;
+                CcRosDereferenceVolume(SharedCacheMap->Volume);
                 ObDereferenceObject(FileObject);
                 ExFreeToNPagedLookasideList(&SharedCacheMapLookasideList, SharedCacheMap);
             }
@@ -1483,6 +1815,7 @@ CcInitView (
     InitializeListHead(&VacbLruListHead);
     InitializeListHead(&CcDeferredWrites);
     InitializeListHead(&CcCleanSharedCacheMapList);
+    InitializeListHead(&CcVolumeListHead);
     KeInitializeSpinLock(&CcDeferredWriteSpinLock);
     ExInitializeNPagedLookasideList(&iBcbLookasideList,
                                     NULL,
@@ -1575,6 +1908,8 @@ ExpKdbgExtFileCache(ULONG Argc, PCHAR Argv[])
 BOOLEAN
 ExpKdbgExtDefWrites(ULONG Argc, PCHAR Argv[])
 {
+    PLIST_ENTRY ListEntry;
+
     KdbpPrint("CcTotalDirtyPages:\t%lu (%lu Kb)\n", CcTotalDirtyPages,
               (CcTotalDirtyPages * PAGE_SIZE) / 1024);
     KdbpPrint("CcDirtyPageThreshold:\t%lu (%lu Kb)\n", CcDirtyPageThreshold,
@@ -1601,6 +1936,20 @@ ExpKdbgExtDefWrites(ULONG Argc, PCHAR Argv[])
         KdbpPrint("CcTotalDirtyPages below the threshold, writes should not be throttled\n");
     }
 
+    KdbpPrint("\nVolume\t\tDevice\t\tDirty\tThreshold\tRate\tWritten\tFlushes\n");
+    /* No need to lock the master lock here, we're in DBG */
+    for (ListEntry = CcVolumeListHead.Flink;
+         ListEntry != &CcVolumeListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        PROS_CACHE_VOLUME Volume = CONTAINING_RECORD(ListEntry, ROS_CACHE_VOLUME, VolumeLinks);
+
+        KdbpPrint("%p\t%p\t%lu\t%lu\t\t%lu\t%lu\t%lu%s\n",
+                  Volume, Volume->DeviceObject, Volume->DirtyPages, Volume->DirtyPageThreshold,
+                  Volume->WriteRate, Volume->PagesWritten, Volume->FlushCount,
+                  CcRosVolumeOverBudget(Volume, 0) ? " (throttled)" : "");
+    }
+
     return TRUE;
 }
 
@@ -0,0 +1,145 @@
+/*
+ * PROJECT:     ReactOS Kernel
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Per volume dirty page accounting and write throttling
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS ********************************************************************/
+
+/* Volumes with at least one shared cache map, protected by the master lock */
+LIST_ENTRY CcVolumeListHead;
+
+/* FUNCTIONS ******************************************************************/
+
+static
+ULONG
+CcRosGetDefaultVolumeThreshold(VOID)
+{
+    /* Until we know how fast the device writes, give it half of the global budget */
+    return max(CcDirtyPageThreshold / 2, CC_VOLUME_MIN_DIRTY_PAGES);
+}
+
+/*
+ * Returns the volume the file lives on, with a reference.
+ * Must be called with the master lock held.
+ */
+PROS_CACHE_VOLUME
+CcRosReferenceVolume(
+    _In_ PFILE_OBJECT FileObject)
+{
+    PLIST_ENTRY ListEntry;
+    PDEVICE_OBJECT DeviceObject;
+    PROS_CACHE_VOLUME Volume;
+
+    /* The device the file system sends the writes to identifies the volume */
+    DeviceObject = IoGetRelatedDeviceObject(FileObject);
+
+    for (ListEntry = CcVolumeListHead.Flink;
+         ListEntry != &CcVolumeListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Volume = CONTAINING_RECORD(ListEntry, ROS_CACHE_VOLUME, VolumeLinks);
+        if (Volume->DeviceObject == DeviceObject)
+        {
+            Volume->ReferenceCount++;
+            return Volume;
+        }
+    }
+
+    Volume = ExAllocatePoolWithTag(NonPagedPool, sizeof(*Volume), TAG_CACHE_VOLUME);
+    if (Volume == NULL)
+    {
+        return NULL;
+    }
+
+    RtlZeroMemory(Volume, sizeof(*Volume));
+    Volume->DeviceObject = DeviceObject;
+    Volume->ReferenceCount = 1;
+    Volume->DirtyPageThreshold = CcRosGetDefaultVolumeThreshold();
+    InsertTailList(&CcVolumeListHead, &Volume->VolumeLinks);
+
+    DPRINT("New volume %p for device %p\n", Volume, DeviceObject);
+
+    return Volume;
+}
+
+/*
+ * Must be called with the master lock held.
+ */
+VOID
+CcRosDereferenceVolume(
+    _In_ PROS_CACHE_VOLUME Volume)
+{
+    ASSERT(Volume->ReferenceCount != 0);
+
+    if (--Volume->ReferenceCount != 0)
+    {
+        return;
+    }
+
+    /* Every shared cache map on it is gone, so are their dirty pages */
+    ASSERT(Volume->DirtyPages == 0);
+    ASSERT(!Volume->InLazyWrite);
+
+    RemoveEntryList(&Volume->VolumeLinks);
+    ExFreePoolWithTag(Volume, TAG_CACHE_VOLUME);
+}
+
+/*
+ * Accounts a batch of pages written to the volume in Elapsed (100ns units),
+ * and derives its dirty page budget from the write rate.
+ * Must be called with the master lock held.
+ */
+VOID
+CcRosVolumeWriteCompleted(
+    _In_ PROS_CACHE_VOLUME Volume,
+    _In_ ULONG Pages,
+    _In_ ULONGLONG Elapsed)
+{
+    ULONGLONG Rate, Threshold;
+
+    Volume->PagesWritten += Pages;
+    Volume->FlushCount++;
+
+    /* Nothing reached the device (or too fast to be measured), no sample */
+    if (Pages == 0 || Elapsed == 0)
+    {
+        return;
+    }
+
+    Rate = ((ULONGLONG)Pages * 10 * 1000 * 1000) / Elapsed;
+    if (Volume->WriteRate != 0)
+    {
+        /* Smooth it, a single batch may have been slowed down by something else */
+        Rate = (3 * (ULONGLONG)Volume->WriteRate + Rate) / 4;
+    }
+    Volume->WriteRate = (ULONG)min(Rate, MAXULONG);
+
+    /* Allow as many dirty pages as the device can write in a few seconds */
+    Threshold = (ULONGLONG)Volume->WriteRate * CC_VOLUME_DIRTY_SECONDS;
+    Threshold = min(Threshold, CcDirtyPageThreshold);
+    Volume->DirtyPageThreshold = (ULONG)max(Threshold, CC_VOLUME_MIN_DIRTY_PAGES);
+
+    DPRINT("Volume %p: %lu pages/s, threshold %lu\n",
+           Volume, Volume->WriteRate, Volume->DirtyPageThreshold);
+}
+
+/*
+ * Whether writing Pages more pages to the volume would exceed its budget.
+ * The master lock doesn't need to be held, the answer is a hint anyway.
+ */
+BOOLEAN
+CcRosVolumeOverBudget(
+    _In_ PROS_CACHE_VOLUME Volume,
+    _In_ ULONG Pages)
+{
+    return (Volume->DirtyPages + Pages >= Volume->DirtyPageThreshold);
+}
+
+/* EOF */
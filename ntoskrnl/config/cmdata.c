@@ -290,6 +290,34 @@ DATA_SEG("INITDATA") CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL,
         NULL
     },
+    {
+        L"Session Manager\\Memory Management",
+        L"FaultAroundPages",
+        &MmFaultAroundPages,
+        NULL,
+        NULL
+    },
+    {
+        L"Session Manager\\Memory Management",
+        L"PageStoreMaximumPages",
+        &MmPageStoreMaximumPages,
+        NULL,
+        NULL
+    },
+    {
+        L"Session Manager\\Memory Management\\PrefetchParameters",
+        L"EnablePrefetcher",
+        &MmEnablePrefetcher,
+        NULL,
+        NULL
+    },
+    {
+        L"Session Manager\\Memory Management",
+        L"EnablePageCombining",
+        &MmEnablePageCombining,
+        NULL,
+        NULL
+    },
     {
         L"Session Manager\\Memory Management",
         L"PagedPoolSize",
@@ -535,6 +563,13 @@ DATA_SEG("INITDATA") CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL,
         NULL
     },
+    {
+        L"Session Manager\\Kernel",
+        L"SchedulerTraceRecords",
+        &KiSchedulerTraceRecords,
+        NULL,
+        NULL
+    },
     {
         L"Session Manager\\Kernel",
         L"ObUnsecureGlobalNames",
@@ -707,6 +707,10 @@ QSI_DEF(SystemPerformanceInformation)
     Spi->IoReadOperationCount = IoReadOperationCount;
     Spi->IoWriteOperationCount = IoWriteOperationCount;
     Spi->IoOtherOperationCount = IoOtherOperationCount;
+    Spi->TransitionCount = 0;
+    Spi->DemandZeroCount = 0;
+    Spi->PageReadCount = 0;
+    Spi->PageReadIoCount = 0;
     for (i = 0; i < KeNumberProcessors; i ++)
     {
         Prcb = KiProcessorBlock[i];
@@ -718,6 +722,10 @@ QSI_DEF(SystemPerformanceInformation)
             Spi->IoReadOperationCount += Prcb->IoReadOperationCount;
             Spi->IoWriteOperationCount += Prcb->IoWriteOperationCount;
             Spi->IoOtherOperationCount += Prcb->IoOtherOperationCount;
+            Spi->TransitionCount += Prcb->MmTransitionCount;
+            Spi->DemandZeroCount += Prcb->MmDemandZeroCount;
+            Spi->PageReadCount += Prcb->MmPageReadCount;
+            Spi->PageReadIoCount += Prcb->MmPageReadIoCount;
         }
     }
 
@@ -734,11 +742,7 @@ QSI_DEF(SystemPerformanceInformation)
     Spi->PeakCommitment = MmPeakCommitment;
     Spi->PageFaultCount = 0; /* FIXME */
     Spi->CopyOnWriteCount = 0; /* FIXME */
-    Spi->TransitionCount = 0; /* FIXME */
     Spi->CacheTransitionCount = 0; /* FIXME */
-    Spi->DemandZeroCount = 0; /* FIXME */
-    Spi->PageReadCount = 0; /* FIXME */
-    Spi->PageReadIoCount = 0; /* FIXME */
     Spi->CacheReadCount = 0; /* FIXME */
     Spi->CacheIoCount = 0; /* FIXME */
     Spi->DirtyPagesWriteCount = 0; /* FIXME */
@@ -773,15 +777,15 @@ QSI_DEF(SystemPerformanceInformation)
     Spi->ResidentPagedPoolPage = 0; /* FIXME */
 
     Spi->ResidentSystemDriverPage = 0; /* FIXME */
-    Spi->CcFastReadNoWait = 0; /* FIXME */
-    Spi->CcFastReadWait = 0; /* FIXME */
-    Spi->CcFastReadResourceMiss = 0; /* FIXME */
-    Spi->CcFastReadNotPossible = 0; /* FIXME */
+    Spi->CcFastReadNoWait = CcFastReadNoWait;
+    Spi->CcFastReadWait = CcFastReadWait;
+    Spi->CcFastReadResourceMiss = CcFastReadResourceMiss;
+    Spi->CcFastReadNotPossible = CcFastReadNotPossible;
 
     Spi->CcFastMdlReadNoWait = 0; /* FIXME */
-    Spi->CcFastMdlReadWait = 0; /* FIXME */
+    Spi->CcFastMdlReadWait = CcFastMdlReadWait;
     Spi->CcFastMdlReadResourceMiss = 0; /* FIXME */
-    Spi->CcFastMdlReadNotPossible = 0; /* FIXME */
+    Spi->CcFastMdlReadNotPossible = CcFastMdlReadNotPossible;
 
     Spi->CcMapDataNoWait = CcMapDataNoWait;
     Spi->CcMapDataWait = CcMapDataWait;
@@ -793,16 +797,16 @@ QSI_DEF(SystemPerformanceInformation)
     Spi->CcPinReadWait = CcPinReadWait;
     Spi->CcPinReadNoWaitMiss = 0; /* FIXME */
     Spi->CcPinReadWaitMiss = 0; /* FIXME */
-    Spi->CcCopyReadNoWait = 0; /* FIXME */
-    Spi->CcCopyReadWait = 0; /* FIXME */
-    Spi->CcCopyReadNoWaitMiss = 0; /* FIXME */
-    Spi->CcCopyReadWaitMiss = 0; /* FIXME */
+    Spi->CcCopyReadNoWait = CcCopyReadNoWait;
+    Spi->CcCopyReadWait = CcCopyReadWait;
+    Spi->CcCopyReadNoWaitMiss = CcCopyReadNoWaitMiss;
+    Spi->CcCopyReadWaitMiss = CcCopyReadWaitMiss;
 
     Spi->CcMdlReadNoWait = 0; /* FIXME */
-    Spi->CcMdlReadWait = 0; /* FIXME */
+    Spi->CcMdlReadWait = CcMdlReadWait;
     Spi->CcMdlReadNoWaitMiss = 0; /* FIXME */
     Spi->CcMdlReadWaitMiss = 0; /* FIXME */
-    Spi->CcReadAheadIos = 0; /* FIXME */
+    Spi->CcReadAheadIos = CcReadAheadIos;
     Spi->CcLazyWriteIos = CcLazyWriteIos;
     Spi->CcLazyWritePages = CcLazyWritePages;
     Spi->CcDataFlushes = CcDataFlushes;
@@ -2824,6 +2828,246 @@ QSI_DEF(SystemFirmwareTableInformation)
     return Status;
 }
 
+/* Class 0x100 - Queued spinlock statistics (ReactOS specific) */
+QSI_DEF(SystemQueuedSpinLockInformation)
+{
+    DPRINT("NtQuerySystemInformation - SystemQueuedSpinLockInformation\n");
+
+    return KeQueryQueuedSpinLockStatistics(Buffer, Size, ReqSize);
+}
+
+SSI_DEF(SystemQueuedSpinLockInformation)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+    PSYSTEM_QUEUED_SPINLOCK_CONTROL Control =
+        (PSYSTEM_QUEUED_SPINLOCK_CONTROL)Buffer;
+
+    /* Check size of a buffer, it must match our expectations */
+    if (sizeof(SYSTEM_QUEUED_SPINLOCK_CONTROL) != Size)
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* Check who is calling */
+    if (PreviousMode != KernelMode)
+    {
+        /* Check access rights */
+        if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, PreviousMode))
+        {
+            return STATUS_PRIVILEGE_NOT_HELD;
+        }
+    }
+
+    return KeSetQueuedSpinLockStatistics(Control->EnableStatistics,
+                                         Control->ResetStatistics);
+}
+
+/* Class 0x101 - DPC routine statistics (ReactOS specific) */
+QSI_DEF(SystemDpcRoutineInformation)
+{
+    DPRINT("NtQuerySystemInformation - SystemDpcRoutineInformation\n");
+
+    return KeQueryDpcStatistics(Buffer, Size, ReqSize);
+}
+
+SSI_DEF(SystemDpcRoutineInformation)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+    PSYSTEM_DPC_ROUTINE_CONTROL Control = (PSYSTEM_DPC_ROUTINE_CONTROL)Buffer;
+
+    /* Check size of a buffer, it must match our expectations */
+    if (sizeof(SYSTEM_DPC_ROUTINE_CONTROL) != Size)
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* Check who is calling */
+    if (PreviousMode != KernelMode)
+    {
+        /* Check access rights */
+        if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, PreviousMode))
+        {
+            return STATUS_PRIVILEGE_NOT_HELD;
+        }
+    }
+
+    return KeSetDpcStatistics(Control->EnableStatistics,
+                              Control->ResetStatistics);
+}
+
+/* Class 0x102 - Call stack samples (ReactOS specific) */
+QSI_DEF(SystemStackProfileInformation)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+
+    DPRINT("NtQuerySystemInformation - SystemStackProfileInformation\n");
+
+    /* The samples expose kernel addresses */
+    if (PreviousMode != KernelMode)
+    {
+        if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, PreviousMode))
+        {
+            return STATUS_PRIVILEGE_NOT_HELD;
+        }
+    }
+
+    return KeQueryStackProfile(Buffer, Size, ReqSize);
+}
+
+SSI_DEF(SystemStackProfileInformation)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+    PSYSTEM_STACK_PROFILE_CONTROL Control = (PSYSTEM_STACK_PROFILE_CONTROL)Buffer;
+
+    /* Check size of a buffer, it must match our expectations */
+    if (sizeof(SYSTEM_STACK_PROFILE_CONTROL) != Size)
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* Check who is calling */
+    if (PreviousMode != KernelMode)
+    {
+        /* Check access rights */
+        if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, PreviousMode))
+        {
+            return STATUS_PRIVILEGE_NOT_HELD;
+        }
+    }
+
+    return KeSetStackProfile(Control->Enable,
+                             Control->CaptureUserStacks,
+                             Control->Interval,
+                             Control->SamplesPerProcessor);
+}
+
+/* Class 0x103 - Scheduler trace (ReactOS specific) */
+QSI_DEF(SystemSchedulerTraceInformation)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+
+    DPRINT("NtQuerySystemInformation - SystemSchedulerTraceInformation\n");
+
+    /* Check who is calling */
+    if (PreviousMode != KernelMode)
+    {
+        /* Check access rights */
+        if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, PreviousMode))
+        {
+            return STATUS_PRIVILEGE_NOT_HELD;
+        }
+    }
+
+    return KeQuerySchedulerTrace(Buffer, Size, ReqSize);
+}
+
+SSI_DEF(SystemSchedulerTraceInformation)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+    PSYSTEM_SCHEDULER_TRACE_CONTROL Control = (PSYSTEM_SCHEDULER_TRACE_CONTROL)Buffer;
+
+    /* Check size of a buffer, it must match our expectations */
+    if (sizeof(SYSTEM_SCHEDULER_TRACE_CONTROL) != Size)
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* Check who is calling */
+    if (PreviousMode != KernelMode)
+    {
+        /* Check access rights */
+        if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, PreviousMode))
+        {
+            return STATUS_PRIVILEGE_NOT_HELD;
+        }
+    }
+
+    return KeSetSchedulerTrace(Control->Enable, Control->Reset);
+}
+
+/* Class 0x104 - Kernel stack cache (ReactOS specific) */
+QSI_DEF(SystemKernelStackCacheInformation)
+{
+    PSYSTEM_KERNEL_STACK_CACHE_INFORMATION Info = (PSYSTEM_KERNEL_STACK_CACHE_INFORMATION)Buffer;
+
+    DPRINT("NtQuerySystemInformation - SystemKernelStackCacheInformation\n");
+
+    *ReqSize = sizeof(SYSTEM_KERNEL_STACK_CACHE_INFORMATION);
+    if (Size < sizeof(SYSTEM_KERNEL_STACK_CACHE_INFORMATION))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    MmQueryKernelStackCacheInformation(Info);
+    return STATUS_SUCCESS;
+}
+
+SSI_DEF(SystemKernelStackCacheInformation)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+    PSYSTEM_KERNEL_STACK_CACHE_CONTROL Control = (PSYSTEM_KERNEL_STACK_CACHE_CONTROL)Buffer;
+
+    /* Check size of a buffer, it must match our expectations */
+    if (sizeof(SYSTEM_KERNEL_STACK_CACHE_CONTROL) != Size)
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* Check who is calling */
+    if (PreviousMode != KernelMode)
+    {
+        /* Check access rights */
+        if (!SeSinglePrivilegeCheck(SeProfileSingleProcessPrivilege, PreviousMode))
+        {
+            return STATUS_PRIVILEGE_NOT_HELD;
+        }
+    }
+
+    MmSetKernelStackCache(Control->Enable);
+    return STATUS_SUCCESS;
+}
+
+/* Class 0x105 - Page combining statistics (ReactOS specific) */
+QSI_DEF(SystemPageCombiningInformation)
+{
+    PSYSTEM_PAGE_COMBINING_INFORMATION Info = (PSYSTEM_PAGE_COMBINING_INFORMATION)Buffer;
+
+    DPRINT("NtQuerySystemInformation - SystemPageCombiningInformation\n");
+
+    *ReqSize = sizeof(SYSTEM_PAGE_COMBINING_INFORMATION);
+    if (Size < sizeof(SYSTEM_PAGE_COMBINING_INFORMATION))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    MmQueryPageCombiningInformation(Info);
+    return STATUS_SUCCESS;
+}
+
+SSI_DEF(SystemPageCombiningInformation)
+{
+    KPROCESSOR_MODE PreviousMode = KeGetPreviousMode();
+    PSYSTEM_PAGE_COMBINING_CONTROL Control = (PSYSTEM_PAGE_COMBINING_CONTROL)Buffer;
+
+    /* Check size of a buffer, it must match our expectations */
+    if (sizeof(SYSTEM_PAGE_COMBINING_CONTROL) != Size)
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* Check who is calling */
+    if (PreviousMode != KernelMode)
+    {
+        /* Check access rights */
+        if (!SeSinglePrivilegeCheck(SeProfileSingleProcessPrivilege, PreviousMode))
+        {
+            return STATUS_PRIVILEGE_NOT_HELD;
+        }
+    }
+
+    MmSetPageCombining(Control->Enable, Control->ScanNow);
+    return STATUS_SUCCESS;
+}
+
+/* Class 0x106 - Cache manager counters (ReactOS specific) */
+QSI_DEF(SystemCacheManagerInformation)
+{
+    PSYSTEM_CACHE_MANAGER_INFORMATION Info = (PSYSTEM_CACHE_MANAGER_INFORMATION)Buffer;
+
+    DPRINT("NtQuerySystemInformation - SystemCacheManagerInformation\n");
+
+    *ReqSize = sizeof(SYSTEM_CACHE_MANAGER_INFORMATION);
+    if (Size < sizeof(SYSTEM_CACHE_MANAGER_INFORMATION))
+        return STATUS_INFO_LENGTH_MISMATCH;
+
+    CcQueryCacheManagerInformation(Info);
+    return STATUS_SUCCESS;
+}
+
 /* Query/Set Calls Table */
 typedef
 struct _QSSI_CALLS
@@ -2923,6 +3167,13 @@ CallQS[] =
     SI_XX(SystemWow64SharedInformationObsolete), /* FIXME: not implemented */
     SI_XX(SystemRegisterFirmwareTableInformationHandler), /* FIXME: not implemented */
     SI_QX(SystemFirmwareTableInformation),
+    SI_QS(SystemQueuedSpinLockInformation),
+    SI_QS(SystemDpcRoutineInformation),
+    SI_QS(SystemStackProfileInformation),
+    SI_QS(SystemSchedulerTraceInformation),
+    SI_QS(SystemKernelStackCacheInformation),
+    SI_QS(SystemPageCombiningInformation),
+    SI_QX(SystemCacheManagerInformation),
 };
 
 C_ASSERT(SystemBasicInformation == 0);
@@ -121,6 +121,7 @@ FsRtlCopyRead(IN PFILE_OBJECT FileObject,
             FsRtlIncrementCcFastReadResourceMiss();
             return FALSE;
         }
+        CcFastReadNoWait++;
     }
 
     /* Check if this is a fast I/O cached file */
@@ -72,6 +72,11 @@ KiSaveXState(
     {
         _xsaves64(Buffer, ComponentMask);
     }
+    else if (KeFeatureBits & KF_XSAVEC)
+    {
+        /* The save area layout is compacted whenever XSAVEC is available */
+        _xsavec64(Buffer, ComponentMask);
+    }
     else if (KeFeatureBits & KF_XSAVEOPT)
     {
         _xsaveopt64(Buffer, ComponentMask);
@@ -99,6 +104,7 @@ KiRestoreXState(
     }
     else if (KeFeatureBits & KF_XSTATE)
     {
+        /* Handles both the standard and the compacted (XSAVEC) format */
         _xrstor64(Buffer, ComponentMask);
     }
     else
@@ -107,6 +113,21 @@ KiRestoreXState(
     }
 }
 
+FORCEINLINE
+ULONG64
+KiGetXStateInUse(VOID)
+{
+    /* XGETBV(1) returns XCR0 & XINUSE, i.e. the user components that are
+       not in their initial configuration */
+    if (KeFeatureBits & KF_XINUSE)
+    {
+        return _xgetbv(1);
+    }
+
+    /* Without it we have to assume that everything is in use */
+    return ~0ULL;
+}
+
 #if defined(__GNUC__)
 
 static __inline__ __attribute__((always_inline)) void __lgdt(void *Source)
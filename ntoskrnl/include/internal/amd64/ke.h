@@ -416,6 +416,15 @@ VOID KiDebugServiceTrap(VOID);
 VOID KiDpcInterrupt(VOID);
 VOID KiIpiInterrupt(VOID);
 
+VOID
+NTAPI
+KiIpiProcessRequests(VOID);
+
+VOID
+FASTCALL
+KeZeroPagesNonTemporal(IN PVOID Address,
+                       IN ULONG Size);
+
 VOID KiGdtPrepareForApplicationProcessorInit(ULONG Id);
 VOID Ki386InitializeLdt(VOID);
 VOID Ki386SetProcessorFeatures(VOID);
@@ -52,6 +52,7 @@ extern LIST_ENTRY CcRegularWorkQueue;
 extern LIST_ENTRY CcPostTickWorkQueue;
 extern NPAGED_LOOKASIDE_LIST CcTwilightLookasideList;
 extern LARGE_INTEGER CcIdleDelay;
+extern LIST_ENTRY CcVolumeListHead;
 
 //
 // Counters
@@ -63,8 +64,20 @@ extern ULONG CcMapDataNoWait;
 extern ULONG CcPinReadWait;
 extern ULONG CcPinReadNoWait;
 extern ULONG CcPinMappedDataCount;
+extern ULONG CcMdlReadWait;
 extern ULONG CcDataPages;
 extern ULONG CcDataFlushes;
+extern ULONG CcCopyReadWait;
+extern ULONG CcCopyReadNoWait;
+extern ULONG CcCopyReadWaitMiss;
+extern ULONG CcCopyReadNoWaitMiss;
+extern ULONG CcReadAheadIos;
+extern ULONG CcReadAheadPages;
+extern ULONG CcReadAheadPagesUsed;
+extern ULONG CcDeferredWriteCount;
+extern ULONG CcVacbAllocations;
+extern ULONG CcVacbSteals;
+extern ULONG CcPinContention;
 
 typedef struct _PF_SCENARIO_ID
 {
@@ -167,6 +180,58 @@ typedef struct _PFSN_PREFETCHER_GLOBALS
     LONG ActivePrefetches;
 } PFSN_PREFETCHER_GLOBALS, *PPFSN_PREFETCHER_GLOBALS;
 
+/*
+ * The VACBs of a shared cache map are indexed by FileOffset / VACB_MAPPING_GRANULARITY
+ * in a radix tree of blocks of CC_VACB_INDEX_ENTRIES entries. The tree only gets as
+ * deep as the highest offset needs: one block covers the first 32MB of a file, two
+ * levels cover 4GB. Entries of the last level are VACBs, the others are blocks.
+ */
+#define CC_VACB_INDEX_SHIFT         7
+#define CC_VACB_INDEX_ENTRIES       (1 << CC_VACB_INDEX_SHIFT)
+#define CC_VACB_INDEX_MAX_LEVELS    ((64 + CC_VACB_INDEX_SHIFT - 1) / CC_VACB_INDEX_SHIFT)
+
+typedef struct _ROS_VACB_INDEX_BLOCK
+{
+    /* Number of entries in use, the block is freed when it drops to 0 */
+    ULONG Count;
+    PVOID Entries[CC_VACB_INDEX_ENTRIES];
+} ROS_VACB_INDEX_BLOCK, *PROS_VACB_INDEX_BLOCK;
+
+/*
+ * Dirty pages are also accounted per volume, so that a slow device doesn't throttle
+ * the writers of the others. The dirty page budget of a volume is what it can write
+ * in CC_VOLUME_DIRTY_SECONDS at the rate measured by the lazy writer.
+ * All the fields are protected by the master lock.
+ */
+#define CC_VOLUME_DIRTY_SECONDS     4
+#define CC_VOLUME_MIN_DIRTY_PAGES   (4 * VACB_MAPPING_GRANULARITY / PAGE_SIZE)
+
+typedef struct _ROS_CACHE_VOLUME
+{
+    LIST_ENTRY VolumeLinks;
+    PDEVICE_OBJECT DeviceObject;
+    ULONG ReferenceCount;
+    ULONG DirtyPages;
+    ULONG DirtyPageThreshold;
+    /* Write throughput in pages per second, 0 until measured */
+    ULONG WriteRate;
+    /* Counters */
+    ULONG PagesWritten;
+    ULONG FlushCount;
+    /* A write-behind work item is queued or running for this volume */
+    BOOLEAN InLazyWrite;
+} ROS_CACHE_VOLUME, *PROS_CACHE_VOLUME;
+
+/*
+ * A deferred write keeps a reference to the volume its file was on when it was
+ * queued, the shared cache map can go away while it waits.
+ */
+typedef struct _ROS_DEFERRED_WRITE
+{
+    DEFERRED_WRITE DeferredWrite;
+    PROS_CACHE_VOLUME Volume;
+} ROS_DEFERRED_WRITE, *PROS_DEFERRED_WRITE;
+
 typedef struct _ROS_SHARED_CACHE_MAP
 {
     CSHORT NodeTypeCode;
@@ -191,6 +256,10 @@ typedef struct _ROS_SHARED_CACHE_MAP
 
     /* ROS specific */
     LIST_ENTRY CacheMapVacbListHead;
+    /* Index of the VACBs in the list above, protected by CacheMapLock */
+    PROS_VACB_INDEX_BLOCK VacbIndex;
+    ULONG VacbIndexLevels;
+    PROS_CACHE_VOLUME Volume;
     BOOLEAN PinAccess;
     KSPIN_LOCK CacheMapLock;
     KGUARDED_MUTEX FlushCacheLock;
@@ -225,6 +294,8 @@ typedef struct _ROS_VACB
     volatile ULONG ReferenceCount;
     /* Pointer to the shared cache map for the file which this view maps data for. */
     PROS_SHARED_CACHE_MAP SharedCacheMap;
+    /* BCBs within this view, protected by the shared cache map BcbSpinLock. */
+    LIST_ENTRY BcbList;
     /* Pointer to the next VACB in a chain. */
 } ROS_VACB, *PROS_VACB;
 
@@ -263,6 +334,10 @@ typedef struct _WORK_QUEUE_ENTRY
             SHARED_CACHE_MAP *SharedCacheMap;
         } Write;
         struct
+        {
+            PROS_CACHE_VOLUME Volume;
+        } WriteVolume;
+        struct
         {
             KEVENT *Event;
         } Event;
@@ -284,6 +359,17 @@ typedef enum _WORK_QUEUE_FUNCTIONS
 
 extern LAZY_WRITER LazyWriter;
 
+/*
+ * Read ahead follows up to two interleaved sequential streams per private cache map.
+ * For stream N, FileOffsetN/BeyondLastByteN is its last read, ReadAheadOffset[N-1]
+ * how far it has been read ahead and ReadAheadLength[N-1] its current window.
+ * The window doubles each time the reader consumes half of it while the previous
+ * read ahead is already done, up to a limit that shrinks with available memory.
+ */
+#define PRIVATE_CACHE_MAP_LAST_STREAM   (1 << 18)
+#define CC_READ_AHEAD_MIN_WINDOW        (64 * 1024)
+#define CC_READ_AHEAD_MAX_WINDOW        (4 * 1024 * 1024)
+
 #define NODE_TYPE_DEFERRED_WRITE 0x02FC
 #define NODE_TYPE_PRIVATE_MAP    0x02FE
 #define NODE_TYPE_SHARED_MAP     0x02FF
@@ -345,12 +431,28 @@ CODE_SEG("INIT")
 BOOLEAN
 CcInitializeCacheManager(VOID);
 
+VOID
+CcQueryCacheManagerInformation(
+    _Out_ PSYSTEM_CACHE_MANAGER_INFORMATION Information
+);
+
 PROS_VACB
 CcRosLookupVacb(
     PROS_SHARED_CACHE_MAP SharedCacheMap,
     LONGLONG FileOffset
 );
 
+PROS_VACB
+CcRosLookupVacbIndex(
+    _In_ PROS_SHARED_CACHE_MAP SharedCacheMap,
+    _In_ LONGLONG FileOffset
+);
+
+VOID
+CcRosUnlinkVacb(
+    _In_ PROS_VACB Vacb
+);
+
 VOID
 NTAPI
 CcInitCacheZeroPage(VOID);
@@ -369,12 +471,36 @@ CcRosFlushDirtyPages(
     ULONG Target,
     PULONG Count,
     BOOLEAN Wait,
-    BOOLEAN CalledFromLazy
+    BOOLEAN CalledFromLazy,
+    PROS_CACHE_VOLUME Volume
 );
 
 VOID
 CcRosDereferenceCache(PFILE_OBJECT FileObject);
 
+PROS_CACHE_VOLUME
+CcRosReferenceVolume(
+    _In_ PFILE_OBJECT FileObject
+);
+
+VOID
+CcRosDereferenceVolume(
+    _In_ PROS_CACHE_VOLUME Volume
+);
+
+VOID
+CcRosVolumeWriteCompleted(
+    _In_ PROS_CACHE_VOLUME Volume,
+    _In_ ULONG Pages,
+    _In_ ULONGLONG Elapsed
+);
+
+BOOLEAN
+CcRosVolumeOverBudget(
+    _In_ PROS_CACHE_VOLUME Volume,
+    _In_ ULONG Pages
+);
+
 VOID
 CcRosReferenceCache(PFILE_OBJECT FileObject);
 
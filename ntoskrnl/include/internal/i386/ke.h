@@ -671,6 +671,13 @@ KiExitV86Mode(
     IN PKTRAP_FRAME TrapFrame
 );
 
+BOOLEAN
+FASTCALL
+KiReadProfileUserPointer(
+    IN PULONG_PTR Address,
+    OUT PULONG_PTR Value
+);
+
 DECLSPEC_NORETURN
 VOID
 NTAPI
@@ -741,6 +748,8 @@ extern VOID __cdecl KiTrap13(VOID);
 extern VOID __cdecl KiFastCallEntry(VOID);
 extern VOID NTAPI ExpInterlockedPopEntrySListFault(VOID);
 extern VOID NTAPI ExpInterlockedPopEntrySListResume(VOID);
+extern VOID NTAPI KiReadProfileUserPointerFault(VOID);
+extern VOID NTAPI KiReadProfileUserPointerResume(VOID);
 extern VOID __cdecl CopyParams(VOID);
 extern VOID __cdecl ReadBatch(VOID);
 extern CHAR KiSystemCallExitBranch[];
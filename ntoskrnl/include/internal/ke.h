@@ -68,6 +68,9 @@ typedef struct _KI_SAMPLE_MAP
 
 #define MAX_TIMER_DPCS                      16
 
+/* Maximum number of entries for KeFlushMultipleTb */
+#define KI_MAXIMUM_FLUSH_COUNT              32
+
 typedef struct _DPC_QUEUE_ENTRY
 {
     PKDPC Dpc;
@@ -83,6 +86,23 @@ typedef struct _KNMI_HANDLER_CALLBACK
     PVOID Handle;
 } KNMI_HANDLER_CALLBACK, *PKNMI_HANDLER_CALLBACK;
 
+//
+// The i386 HAL implements the raising queued spinlock exports on top of plain
+// spinlocks, so real MCS queued spinlocks are only used on amd64 SMP builds
+//
+#if defined(_M_AMD64) && defined(CONFIG_SMP)
+#define KI_QUEUED_SPINLOCKS
+#endif
+
+typedef struct _KI_QUEUED_LOCK_STATISTICS
+{
+    ULONG64 AcquireCount;
+    ULONG64 ContentionCount;
+    ULONG64 SpinCycles;
+    ULONG64 MaxHoldCycles;
+    ULONG64 AcquireTimeStamp;
+} KI_QUEUED_LOCK_STATISTICS, *PKI_QUEUED_LOCK_STATISTICS;
+
 typedef PCHAR
 (NTAPI *PKE_BUGCHECK_UNICODE_TO_ANSI)(
     IN PUNICODE_STRING Unicode,
@@ -135,7 +155,12 @@ extern LIST_ENTRY KeBugcheckCallbackListHead, KeBugcheckReasonCallbackListHead;
 extern KSPIN_LOCK BugCheckCallbackLock;
 extern KDPC KiTimerExpireDpc;
 extern KTIMER_TABLE_ENTRY KiTimerTableListHead[TIMER_TABLE_SIZE];
+extern LIST_ENTRY KiTimerOverflowListHead[TIMER_TABLE_SIZE];
+extern ULARGE_INTEGER KiTimerOverflowTime[TIMER_TABLE_SIZE];
 extern FAST_MUTEX KiGenericCallDpcMutex;
+extern FAST_MUTEX KiStackProfileMutex;
+extern BOOLEAN KiSchedulerTraceEnabled;
+extern ULONG KiSchedulerTraceRecords;
 extern LIST_ENTRY KiProfileListHead, KiProfileSourceListHead;
 extern KSPIN_LOCK KiProfileLock;
 extern LIST_ENTRY KiProcessListHead;
@@ -286,6 +311,13 @@ KiInsertTimerTable(
     IN ULONG Hand
 );
 
+VOID
+FASTCALL
+KiCascadeTimerTableEntry(
+    IN ULONG Hand,
+    IN ULONGLONG InterruptTime
+);
+
 VOID
 FASTCALL
 KiTimerListExpire(
@@ -378,6 +410,10 @@ KiIpiSignalPacketDoneAndStall(
     IN volatile PULONG ReverseStall
 );
 
+VOID
+FASTCALL
+KiIpiStallOnPacketTargets(VOID);
+
 /* next file ***************************************************************/
 
 UCHAR
@@ -817,6 +853,14 @@ VOID
 NTAPI
 KeFlushCurrentTb(VOID);
 
+VOID
+NTAPI
+KeFlushMultipleTb(
+    _In_ ULONG Number,
+    _In_reads_(Number) PVOID *Virtual,
+    _In_ BOOLEAN AllProcessors
+);
+
 BOOLEAN
 NTAPI
 KeInvalidateAllCaches(VOID);
@@ -1010,6 +1054,27 @@ KeReleaseQueuedSpinLockFromDpcLevel(
     _Inout_ PKSPIN_LOCK_QUEUE LockQueue
 );
 
+BOOLEAN
+FASTCALL
+KiTryToAcquireQueuedSpinLockAtDpcLevel(
+    _Inout_ PKSPIN_LOCK_QUEUE LockQueue
+);
+
+NTSTATUS
+NTAPI
+KeQueryQueuedSpinLockStatistics(
+    _Out_writes_bytes_to_(Length, *ReturnLength) PSYSTEM_QUEUED_SPINLOCK_INFORMATION Information,
+    _In_ ULONG Length,
+    _Out_ PULONG ReturnLength
+);
+
+NTSTATUS
+NTAPI
+KeSetQueuedSpinLockStatistics(
+    _In_ BOOLEAN Enable,
+    _In_ BOOLEAN Reset
+);
+
 VOID
 NTAPI
 KiRestoreProcessorControlState(
@@ -1040,6 +1105,95 @@ KiRetireDpcList(
     IN PKPRCB Prcb
 );
 
+VOID
+NTAPI
+KiExecuteDpc(
+    IN PVOID Context
+);
+
+VOID
+NTAPI
+KiStartDpcThread(
+    IN PKPRCB Prcb
+);
+
+VOID
+FASTCALL
+KiIdleSignalDpcThread(
+    IN PKPRCB Prcb
+);
+
+VOID
+NTAPI
+KiDpcWatchdogTimeout(
+    IN PKPRCB Prcb
+);
+
+NTSTATUS
+NTAPI
+KeQueryDpcStatistics(
+    _Out_writes_bytes_to_(Length, *ReturnLength) PSYSTEM_DPC_ROUTINE_INFORMATION Information,
+    _In_ ULONG Length,
+    _Out_ PULONG ReturnLength
+);
+
+NTSTATUS
+NTAPI
+KeSetDpcStatistics(
+    _In_ BOOLEAN Enable,
+    _In_ BOOLEAN Reset
+);
+
+NTSTATUS
+NTAPI
+KeQueryStackProfile(
+    _Out_writes_bytes_to_(Length, *ReturnLength) PSYSTEM_STACK_PROFILE_INFORMATION Information,
+    _In_ ULONG Length,
+    _Out_ PULONG ReturnLength
+);
+
+NTSTATUS
+NTAPI
+KeSetStackProfile(
+    _In_ BOOLEAN Enable,
+    _In_ BOOLEAN CaptureUserStacks,
+    _In_ ULONG Interval,
+    _In_ ULONG SamplesPerProcessor
+);
+
+VOID
+FASTCALL
+KiTraceSchedulerEvent(
+    IN UCHAR Event,
+    IN PKTHREAD Thread,
+    IN PKTHREAD OtherThread OPTIONAL,
+    IN UCHAR Priority,
+    IN UCHAR Reason,
+    IN LONG Data
+);
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+KiInitializeSchedulerTrace(
+    VOID
+);
+
+NTSTATUS
+NTAPI
+KeQuerySchedulerTrace(
+    _Out_writes_bytes_to_(Length, *ReturnLength) PSYSTEM_SCHEDULER_TRACE_INFORMATION Information,
+    _In_ ULONG Length,
+    _Out_ PULONG ReturnLength
+);
+
+NTSTATUS
+NTAPI
+KeSetSchedulerTrace(
+    _In_ BOOLEAN Enable,
+    _In_ BOOLEAN Reset
+);
+
 VOID
 NTAPI
 KiQuantumEnd(
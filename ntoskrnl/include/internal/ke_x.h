@@ -232,6 +232,17 @@ KiReleasePrcbLock(IN PKPRCB Prcb)
     UNREFERENCED_PARAMETER(Prcb);
 }
 
+//
+// This routine protects against multiple CPU acquires, it's meaningless on UP.
+//
+FORCEINLINE
+BOOLEAN
+KiTryAcquirePrcbLock(IN PKPRCB Prcb)
+{
+    UNREFERENCED_PARAMETER(Prcb);
+    return TRUE;
+}
+
 //
 // This routine protects against multiple CPU acquires, it's meaningless on UP.
 //
@@ -476,6 +487,25 @@ KiReleasePrcbLock(IN PKPRCB Prcb)
     InterlockedAnd((PLONG)&Prcb->PrcbLock, 0);
 }
 
+//
+// This routine attempts to acquire the PRCB lock of another processor without
+// spinning. It is used when a PRCB lock is already held, so that two CPUs
+// scanning each other's ready queues can never deadlock.
+//
+FORCEINLINE
+BOOLEAN
+KiTryAcquirePrcbLock(IN PKPRCB Prcb)
+{
+    /* Make sure we're at a safe level to touch the PRCB lock */
+    ASSERT(KeGetCurrentIrql() >= DISPATCH_LEVEL);
+
+    /* Don't bother with the interlocked operation if it's already owned */
+    if (Prcb->PrcbLock) return FALSE;
+
+    /* Try to acquire it and check the result */
+    return (InterlockedExchange((PLONG)&Prcb->PrcbLock, 1) == 0);
+}
+
 //
 // This routine acquires the thread lock so that only one caller can touch
 // volatile thread data.
@@ -883,6 +913,17 @@ KiComputeTimerTableIndex(IN ULONGLONG DueTime)
     return (DueTime / KeMaximumIncrement) & (TIMER_TABLE_SIZE - 1);
 }
 
+//
+// Returns the interrupt time it takes for the clock hand to go once around
+// the timer table. Timers due further away are kept in the overflow lists.
+//
+FORCEINLINE
+ULONGLONG
+KiTimerTableRevolution(VOID)
+{
+    return (ULONGLONG)TIMER_TABLE_SIZE * KeMaximumIncrement;
+}
+
 //
 // Called from KiCompleteTimer, KiInsertTreeTimer, KeSetSystemTime
 // to remove timer entries
@@ -893,20 +934,43 @@ KiRemoveEntryTimer(IN PKTIMER Timer)
 {
     ULONG Hand;
     PKTIMER_TABLE_ENTRY TableEntry;
+    PKTIMER FirstTimer;
+    ULONGLONG Time;
+    BOOLEAN Enable;
+
+    /*
+     * Remove the timer from the timer list. Note that Header.Hand is too
+     * small to hold the full index, so recompute it.
+     */
+    Hand = KiComputeTimerTableIndex(Timer->DueTime.QuadPart);
+    RemoveEntryList(&Timer->TimerListEntry);
+
+    /* Nothing is left to cascade once the overflow list is empty */
+    if (IsListEmpty(&KiTimerOverflowListHead[Hand]))
+    {
+        KiTimerOverflowTime[Hand].QuadPart = MAXULONGLONG;
+    }
 
-    /* Remove the timer from the timer list and check if it's empty */
-    Hand = Timer->Header.Hand;
-    if (RemoveEntryList(&Timer->TimerListEntry))
+    /*
+     * The entry is due when its first sorted timer is, or when its overflow
+     * list must be cascaded, whichever comes first. The time we removed may
+     * have been either of them.
+     */
+    TableEntry = &KiTimerTableListHead[Hand];
+    Time = KiTimerOverflowTime[Hand].QuadPart;
+    if (!IsListEmpty(&TableEntry->Entry))
     {
-        /* Get the respective timer table entry */
-        TableEntry = &KiTimerTableListHead[Hand];
-        if (&TableEntry->Entry == TableEntry->Entry.Flink)
-        {
-            /* Set the entry to an infinite absolute time */
-            TableEntry->Time.HighPart = 0xFFFFFFFF;
-        }
+        FirstTimer = CONTAINING_RECORD(TableEntry->Entry.Flink,
+                                       KTIMER,
+                                       TimerListEntry);
+        Time = min(Time, FirstTimer->DueTime.QuadPart);
     }
 
+    /* The clock interrupt reads this without the timer lock, don't let it see half of it */
+    Enable = KeDisableInterrupts();
+    TableEntry->Time.QuadPart = Time;
+    KeRestoreInterrupts(Enable);
+
     /* Clear the list entries on dbg builds so we can tell the timer is gone */
 #if DBG
     Timer->TimerListEntry.Flink = NULL;
@@ -1003,9 +1067,8 @@ FORCEINLINE
 VOID
 KxRemoveTreeTimer(IN PKTIMER Timer)
 {
-    ULONG Hand = Timer->Header.Hand;
+    ULONG Hand = KiComputeTimerTableIndex(Timer->DueTime.QuadPart);
     PKSPIN_LOCK_QUEUE LockQueue;
-    PKTIMER_TABLE_ENTRY TimerEntry;
 
     /* Acquire timer lock */
     LockQueue = KiAcquireTimerLock(Hand);
@@ -1013,17 +1076,8 @@ KxRemoveTreeTimer(IN PKTIMER Timer)
     /* Set the timer as non-inserted */
     Timer->Header.Inserted = FALSE;
 
-    /* Remove it from the timer list */
-    if (RemoveEntryList(&Timer->TimerListEntry))
-    {
-        /* Get the entry and check if it's empty */
-        TimerEntry = &KiTimerTableListHead[Hand];
-        if (IsListEmpty(&TimerEntry->Entry))
-        {
-            /* Clear the time then */
-            TimerEntry->Time.HighPart = 0xFFFFFFFF;
-        }
-    }
+    /* Remove it from the timer list or from the overflow list */
+    KiRemoveEntryTimer(Timer);
 
     /* Release the timer lock */
     KiReleaseTimerLock(LockQueue);
@@ -1712,6 +1766,29 @@ KiCpuIdEx(
 }
 #endif /* _M_IX86 || _M_AMD64 */
 
+//
+// Records a scheduler trace event, if tracing is on
+//
+FORCEINLINE
+VOID
+KiTraceScheduler(IN SYSTEM_SCHEDULER_TRACE_EVENT Event,
+                 IN PKTHREAD Thread,
+                 IN PKTHREAD OtherThread OPTIONAL,
+                 IN KPRIORITY Priority,
+                 IN ULONG Reason,
+                 IN LONG Data)
+{
+    if (KiSchedulerTraceEnabled)
+    {
+        KiTraceSchedulerEvent((UCHAR)Event,
+                              Thread,
+                              OtherThread,
+                              (UCHAR)Priority,
+                              (UCHAR)Reason,
+                              Data);
+    }
+}
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
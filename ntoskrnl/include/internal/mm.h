@@ -51,6 +51,8 @@ extern PMMPTE MmDebugPte; // internal
 
 extern KSPIN_LOCK MmPfnLock;
 
+extern ULONG MmFaultAroundPages;
+
 struct _KTRAP_FRAME;
 struct _EPROCESS;
 struct _MM_RMAP_ENTRY;
@@ -64,6 +66,15 @@ typedef ULONG_PTR SWAPENTRY;
 #define MI_CHARGE_PAGED_POOL_QUOTA                  0x80000
 #define MI_CHARGE_NON_PAGED_POOL_QUOTA              0x10000
 
+//
+// Page priorities (ProcessPagePriority) and the section view fault-around
+// window they scale
+//
+#define MM_LOWEST_PAGE_PRIORITY                     0
+#define MM_DEFAULT_PAGE_PRIORITY                    5
+#define MM_HIGHEST_PAGE_PRIORITY                    7
+#define MM_MAXIMUM_FAULT_AROUND_PAGES               64
+
 //
 // Special IRQL value (found in assertions)
 //
@@ -122,6 +133,9 @@ typedef ULONG_PTR SWAPENTRY;
 
 #define MAX_PAGING_FILES                    (16)
 
+/* Maximum number of pages moved by a single paging file I/O */
+#define MM_PAGEFILE_CLUSTER_PAGES           (16)
+
 // FIXME: use ALIGN_UP_BY
 #define MM_ROUND_UP(x,s)                    \
     ((PVOID)(((ULONG_PTR)(x)+(s)-1) & ~((ULONG_PTR)(s)-1)))
@@ -224,6 +238,8 @@ typedef struct _MM_SECTION_SEGMENT
     ULONGLONG LastPage;
 
 	RTL_GENERIC_TABLE PageTable;
+
+    LIST_ENTRY ViewListHead;    /* process views of this segment, protected by Lock */
 } MM_SECTION_SEGMENT, *PMM_SECTION_SEGMENT;
 
 typedef struct _MM_IMAGE_SECTION_OBJECT
@@ -264,6 +280,8 @@ typedef struct _MEMORY_AREA
         LONGLONG ViewOffset;
         PMM_SECTION_SEGMENT Segment;
         LIST_ENTRY RegionListHead;
+        LIST_ENTRY ViewListEntry;
+        struct _EPROCESS *Process;
     } SectionData;
 } MEMORY_AREA, *PMEMORY_AREA;
 
@@ -525,10 +543,21 @@ typedef struct _MMPAGING_FILE
     PFILE_OBJECT FileObject;
     UNICODE_STRING PageFileName;
     PRTL_BITMAP Bitmap;
+    ULONG AllocationHint;
     HANDLE FileHandle;
 }
 MMPAGING_FILE, *PMMPAGING_FILE;
 
+/* Dirty private pages being paged out, written to the paging file together */
+typedef struct _MM_PAGEOUT_CLUSTER
+{
+    ULONG Count;
+    PEPROCESS Processes[MM_PAGEFILE_CLUSTER_PAGES];
+    PVOID Addresses[MM_PAGEFILE_CLUSTER_PAGES];
+    SWAPENTRY SwapEntries[MM_PAGEFILE_CLUSTER_PAGES];
+    PFN_NUMBER Pages[MM_PAGEFILE_CLUSTER_PAGES];
+} MM_PAGEOUT_CLUSTER, *PMM_PAGEOUT_CLUSTER;
+
 extern PMMPAGING_FILE MmPagingFile[MAX_PAGING_FILES];
 
 typedef VOID
@@ -735,6 +764,19 @@ MmReadFromSwapPage(
     PFN_NUMBER Page
 );
 
+NTSTATUS
+NTAPI
+MmReadFromSwapPages(
+    _In_ SWAPENTRY SwapEntry,
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _In_ ULONG PageCount);
+
+BOOLEAN
+NTAPI
+MmIsNextSwapEntry(
+    _In_ SWAPENTRY SwapEntry,
+    _In_ SWAPENTRY NextEntry);
+
 NTSTATUS
 NTAPI
 MmWriteToSwapPage(
@@ -742,6 +784,14 @@ MmWriteToSwapPage(
     PFN_NUMBER Page
 );
 
+VOID
+NTAPI
+MmWriteToSwapPages(
+    _In_ ULONG PageCount,
+    _In_reads_(PageCount) SWAPENTRY *SwapEntries,
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _Out_writes_(PageCount) NTSTATUS *Statuses);
+
 VOID
 NTAPI
 MmShowOutOfSpaceMessagePagingFile(VOID);
@@ -753,6 +803,79 @@ MiReadPageFile(
     _In_ ULONG PageFileIndex,
     _In_ ULONG_PTR PageFileOffset);
 
+NTSTATUS
+NTAPI
+MiReadPageFileCluster(
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _In_ ULONG PageCount,
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset);
+
+VOID
+NTAPI
+MiWriteToPageFile(
+    _In_ ULONG PageCount,
+    _In_reads_(PageCount) SWAPENTRY *SwapEntries,
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _Out_writes_(PageCount) NTSTATUS *Statuses);
+
+/* pagestore.c ***************************************************************/
+
+extern ULONG MmPageStoreMaximumPages;
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+MmInitializePageStore(VOID);
+
+BOOLEAN
+NTAPI
+MmStorePage(
+    _In_ SWAPENTRY SwapEntry,
+    _In_ PFN_NUMBER Page);
+
+BOOLEAN
+NTAPI
+MmLoadPageFromStore(
+    _In_ SWAPENTRY SwapEntry,
+    _In_ PFN_NUMBER Page);
+
+VOID
+NTAPI
+MmRemovePageFromStore(
+    _In_ SWAPENTRY SwapEntry);
+
+VOID
+NTAPI
+MmTrimPageStore(VOID);
+
+/* prefetch.c ****************************************************************/
+
+extern ULONG MmEnablePrefetcher;
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+MmInitializeLaunchPrefetcher(VOID);
+
+VOID
+NTAPI
+MmStartLaunchTrace(
+    _In_ PEPROCESS Process,
+    _In_ PFILE_OBJECT ImageFileObject);
+
+VOID
+NTAPI
+MmRecordLaunchFault(
+    _In_ PEPROCESS Process,
+    _In_ PMM_SECTION_SEGMENT Segment,
+    _In_ LONGLONG Offset);
+
+VOID
+NTAPI
+MmEndLaunchTrace(
+    _In_ PEPROCESS Process);
+
 /* process.c ****************************************************************/
 
 NTSTATUS
@@ -865,6 +988,26 @@ NTAPI
 MmDeleteKernelStack(PVOID Stack,
                     BOOLEAN GuiStack);
 
+VOID
+NTAPI
+MmTrimDeadKernelStacks(VOID);
+
+VOID
+NTAPI
+MmQueryKernelStackCacheInformation(
+    _Out_ PSYSTEM_KERNEL_STACK_CACHE_INFORMATION Information);
+
+VOID
+NTAPI
+MmSetKernelStackCache(
+    _In_ BOOLEAN Enable);
+
+/* pfnlist.c ****************************************************************/
+
+VOID
+NTAPI
+MmTrimProcessorPageCaches(VOID);
+
 /* balance.c / pagefile.c******************************************************/
 
 FORCEINLINE VOID UpdateTotalCommittedPages(LONG Delta)
@@ -973,6 +1116,52 @@ MmDeleteRmap(
     PVOID Address
 );
 
+VOID
+NTAPI
+MmInsertSegmentMapping(
+    PFN_NUMBER Page,
+    struct _EPROCESS *Process,
+    PVOID Address
+);
+
+VOID
+NTAPI
+MmDeleteSegmentMapping(
+    PFN_NUMBER Page,
+    struct _EPROCESS *Process,
+    PVOID Address
+);
+
+VOID
+NTAPI
+MmInsertSegmentView(
+    PMEMORY_AREA MemoryArea,
+    struct _EPROCESS *Process
+);
+
+VOID
+NTAPI
+MmRemoveSegmentView(
+    PMEMORY_AREA MemoryArea
+);
+
+#define MM_SEGMENT_VIEW_BATCH 16
+
+typedef struct _MM_SEGMENT_VIEW_MAPPING
+{
+    struct _EPROCESS *Process;
+    PVOID Address;
+} MM_SEGMENT_VIEW_MAPPING, *PMM_SEGMENT_VIEW_MAPPING;
+
+ULONG
+NTAPI
+MmReferenceSegmentViews(
+    _In_ PMM_SECTION_SEGMENT Segment,
+    _In_ PLARGE_INTEGER Offset,
+    _Inout_ PULONG Skip,
+    _Out_writes_(MM_SEGMENT_VIEW_BATCH) PMM_SEGMENT_VIEW_MAPPING Mappings
+);
+
 CODE_SEG("INIT")
 VOID
 NTAPI
@@ -980,7 +1169,15 @@ MmInitializeRmapList(VOID);
 
 NTSTATUS
 NTAPI
-MmPageOutPhysicalAddress(PFN_NUMBER Page);
+MmPageOutPhysicalAddress(
+    _In_ PFN_NUMBER Page,
+    _Inout_opt_ PMM_PAGEOUT_CLUSTER Cluster);
+
+VOID
+NTAPI
+MmFlushPageOutCluster(
+    _Inout_ PMM_PAGEOUT_CLUSTER Cluster,
+    _Out_opt_ PULONG NrFreedPages);
 
 PMM_SECTION_SEGMENT
 NTAPI
@@ -1106,7 +1303,8 @@ MiUnmapPageInHyperSpace(IN PEPROCESS Process,
 
 PVOID
 NTAPI
-MiMapPagesInZeroSpace(IN PMMPFN Pfn1,
+MiMapPagesInZeroSpace(IN PMMPTE ZeroingPte,
+                      IN PMMPFN Pfn1,
                       IN PFN_NUMBER NumberOfPages);
 
 VOID
@@ -1529,6 +1727,14 @@ MmMakeDataSectionResident(
     _In_ ULONG Length,
     _In_ PLARGE_INTEGER ValidDataLength);
 
+NTSTATUS
+NTAPI
+MmPrefetchFilePages(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ BOOLEAN Image,
+    _In_ LONGLONG FileOffset,
+    _In_ ULONG Length);
+
 BOOLEAN
 NTAPI
 MmPurgeSegment(
@@ -1748,6 +1954,26 @@ ExReturnPoolQuota(
     IN PVOID P);
 
 
+/* combine.c *****************************************************************/
+
+extern ULONG MmEnablePageCombining;
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+MmInitializePageCombining(VOID);
+
+VOID
+NTAPI
+MmQueryPageCombiningInformation(
+    _Out_ PSYSTEM_PAGE_COMBINING_INFORMATION Information);
+
+VOID
+NTAPI
+MmSetPageCombining(
+    _In_ BOOLEAN Enable,
+    _In_ BOOLEAN ScanNow);
+
 /* mmsup.c *****************************************************************/
 
 NTSTATUS
@@ -1814,6 +2040,37 @@ VOID
 NTAPI
 MiInitializeWorkingSetList(_Inout_ PMMSUPPORT WorkingSet);
 
+_Requires_exclusive_lock_held_(Vm->WorkingSetMutex)
+VOID
+NTAPI
+MiInsertInWorkingSetList(
+    _Inout_ PMMSUPPORT Vm,
+    _In_ PVOID Address,
+    _In_ ULONG Protection);
+
+_Requires_exclusive_lock_held_(Vm->WorkingSetMutex)
+VOID
+NTAPI
+MiRemoveFromWorkingSetList(
+    _Inout_ PMMSUPPORT Vm,
+    _In_ PVOID Address);
+
+_Requires_exclusive_lock_held_(Vm->WorkingSetMutex)
+VOID
+NTAPI
+MiShrinkWorkingSetList(
+    _Inout_ PMMSUPPORT Vm);
+
+_Requires_exclusive_lock_held_(Vm->WorkingSetMutex)
+VOID
+NTAPI
+MiEmptyWorkingSet(
+    _Inout_ PMMSUPPORT Vm);
+
+VOID
+NTAPI
+MmWorkingSetManager(VOID);
+
 #ifdef __cplusplus
 } // extern "C"
 
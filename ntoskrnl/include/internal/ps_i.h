@@ -327,7 +327,12 @@ static const INFORMATION_CLASS_INFO PsProcessInfoClass[] =
     IQS_NONE,
 
     /* ProcessPagePriority */
-    IQS_NONE,
+    IQS_SAME
+    (
+        PAGE_PRIORITY_INFORMATION,
+        ULONG,
+        ICIF_QUERY | ICIF_SET
+    ),
 
     /* ProcessInstrumentationCallback */
     IQS_NONE,
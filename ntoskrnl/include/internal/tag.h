@@ -16,6 +16,8 @@
 #define TAG_SHARED_CACHE_MAP        'cScC'
 #define TAG_PRIVATE_CACHE_MAP       'cPcC'
 #define TAG_BCB                     'cBcC'
+#define TAG_VACB_INDEX              'iVcC'
+#define TAG_CACHE_VOLUME            'oVcC'
 
 /* Executive Tags */
 #define TAG_CALLBACK_ROUTINE_BLOCK  'brbC'
@@ -40,6 +42,7 @@
 /* Kernel Tags */
 #define TAG_KNMI                    'IMNK'
 #define TAG_KERNEL                  '  eK'
+#define TAG_SCHEDULER_TRACE         'rTcS'
 #define TAG_FLOATING_POINT_FX       'xFpF'
 #define TAG_FLOATING_POINT_CONTEXT  'oCpF'
 
@@ -113,6 +116,11 @@
 #define TAG_MM                  '  mM'
 #define TAG_MM_SECTION_SEGMENT  'SSMM'
 #define TAG_SECTION_PAGE_TABLE  'TPSM'
+#define TAG_MM_PAGE_STORE       'SCmM'
+#define TAG_MM_LARGE_PAGES      'PLmM'
+#define TAG_MM_PREFETCH         'FPmM'
+#define TAG_MM_REGION_LIST      'LRmM'
+#define TAG_MM_PAGE_COMBINE     'CPmM'
 
 /* Object Manager Tags */
 #define OB_NAME_TAG             'mNbO'
@@ -254,6 +254,7 @@ KiGetFeatureBits(VOID)
         if (ExtFlags.Ebx.Bits.SMAP) FeatureBits |= KF_SMAP;
         if (ExtFlags.Ebx.Bits.AVX2) FeatureBits |= KF_AVX2;
         if (ExtFlags.Ebx.Bits.AVX512F) FeatureBits |= KF_AVX512F;
+        if (ExtFlags.Ebx.Bits.EnhancedRepMovsbStosb) FeatureBits |= KF_ERMS;
     }
 
     /* Check if CPUID_EXTENDED_STATE (0x0D) is supported */
@@ -266,7 +267,9 @@ KiGetFeatureBits(VOID)
             CPUID_EXTENDED_STATE_SUB_LEAF);
 
         if (ExtStateSub.Eax.Bits.XSAVEOPT) FeatureBits |= KF_XSAVEOPT;
+        if (ExtStateSub.Eax.Bits.XSAVEC)  FeatureBits |= KF_XSAVEC;
         if (ExtStateSub.Eax.Bits.XSAVES)  FeatureBits |= KF_XSAVES;
+        if (ExtStateSub.Eax.Bits.XGETBV)  FeatureBits |= KF_XINUSE;
     }
 
     /* Check extended cpuid features */
@@ -408,6 +411,9 @@ KiReportCpuFeatures(IN PKPRCB Prcb)
     print_kf_bit(KF_SSSE3);
     print_kf_bit(KF_SSE4_1);
     print_kf_bit(KF_SSE4_2);
+    print_kf_bit(KF_ERMS);
+    print_kf_bit(KF_XINUSE);
+    print_kf_bit(KF_XSAVEC);
     print_kf_bit(KF_AVX);
     print_kf_bit(KF_AVX2);
     print_kf_bit(KF_AVX512F);
@@ -656,24 +662,165 @@ KiRestoreProcessorState(
     KiRestoreProcessorControlState(&Prcb->ProcessorState);
 }
 
+#ifdef CONFIG_SMP
+static
+VOID
+NTAPI
+KiFlushTargetEntireTb(
+    _In_ PKIPI_CONTEXT PacketContext,
+    _In_opt_ PVOID Ignored1,
+    _In_opt_ PVOID Ignored2,
+    _In_opt_ PVOID Ignored3)
+{
+    /* Signal this packet as done */
+    KiIpiSignalPacketDone(PacketContext);
+
+    /* Flush the TB for the Current CPU */
+    KeFlushCurrentTb();
+}
+
+static
+VOID
+NTAPI
+KiFlushTargetMultipleTb(
+    _In_ PKIPI_CONTEXT PacketContext,
+    _In_opt_ PVOID Ignored,
+    _In_ PVOID Virtual,
+    _In_ PVOID Number)
+{
+    PVOID *VirtualList = (PVOID*)Virtual;
+    ULONG i, Count = *(PULONG)Number;
+
+    /* Invalidate all the entries, the list lives on the sender's stack */
+    for (i = 0; i < Count; i++)
+    {
+        KeInvalidateTlbEntry(VirtualList[i]);
+    }
+
+    /* Now we can signal this packet as done */
+    KiIpiSignalPacketDone(PacketContext);
+}
+
+FORCEINLINE
+KAFFINITY
+KiGetTbFlushTargets(
+    _In_ PKPRCB Prcb,
+    _In_ BOOLEAN AllProcessors)
+{
+    KAFFINITY TargetAffinity;
+
+    /* Either all processors, or only those running the current process */
+    if (AllProcessors)
+    {
+        TargetAffinity = KeActiveProcessors;
+    }
+    else
+    {
+        TargetAffinity = Prcb->CurrentThread->ApcState.Process->ActiveProcessors;
+    }
+
+    /* Exclude ourselves */
+    return TargetAffinity & ~Prcb->SetMember;
+}
+#endif
+
 VOID
 NTAPI
 KeFlushEntireTb(IN BOOLEAN Invalid,
                 IN BOOLEAN AllProcessors)
 {
     KIRQL OldIrql;
+#ifdef CONFIG_SMP
+    KAFFINITY TargetAffinity;
+    PKPRCB Prcb;
+#endif
 
-    // FIXME: halfplemented
     /* Raise the IRQL for the TB Flush */
     OldIrql = KeRaiseIrqlToSynchLevel();
 
-    /* Flush the TB for the Current CPU, and update the flush stamp */
+#ifdef CONFIG_SMP
+    /* Send an IPI TB flush to the other processors */
+    Prcb = KeGetCurrentPrcb();
+    TargetAffinity = KiGetTbFlushTargets(Prcb, AllProcessors);
+    if (TargetAffinity)
+    {
+        KiIpiSendPacket(TargetAffinity,
+                        KiFlushTargetEntireTb,
+                        NULL,
+                        0,
+                        NULL);
+    }
+#endif
+
+    /* Flush the TB for the Current CPU */
     KeFlushCurrentTb();
 
+#ifdef CONFIG_SMP
+    /* Wait for the other processors to finish */
+    if (TargetAffinity) KiIpiStallOnPacketTargets();
+#endif
+
     /* Update the flush stamp and return to original IRQL */
     InterlockedExchangeAdd(&KiTbFlushTimeStamp, 1);
     KeLowerIrql(OldIrql);
+}
+
+/*!
+ * \brief Flushes a list of virtual addresses from the TB.
+ *
+ * All remote processors are flushed with a single IPI packet, sent either
+ * to all processors or only to those currently running the current process.
+ *
+ * \param Number - Number of entries in the list, at most KI_MAXIMUM_FLUSH_COUNT.
+ * \param Virtual - List of virtual addresses to flush.
+ * \param AllProcessors - Whether the addresses are global (system space).
+ */
+VOID
+NTAPI
+KeFlushMultipleTb(
+    _In_ ULONG Number,
+    _In_reads_(Number) PVOID *Virtual,
+    _In_ BOOLEAN AllProcessors)
+{
+    KIRQL OldIrql;
+    ULONG i;
+#ifdef CONFIG_SMP
+    KAFFINITY TargetAffinity;
+    PKPRCB Prcb;
+#endif
 
+    ASSERT(Number <= KI_MAXIMUM_FLUSH_COUNT);
+
+    /* Raise the IRQL for the TB Flush */
+    OldIrql = KeRaiseIrqlToSynchLevel();
+
+#ifdef CONFIG_SMP
+    /* Send one IPI for the whole list to the other processors */
+    Prcb = KeGetCurrentPrcb();
+    TargetAffinity = KiGetTbFlushTargets(Prcb, AllProcessors);
+    if (TargetAffinity)
+    {
+        KiIpiSendPacket(TargetAffinity,
+                        KiFlushTargetMultipleTb,
+                        NULL,
+                        (ULONG_PTR)Virtual,
+                        &Number);
+    }
+#endif
+
+    /* Flush the entries on the current CPU */
+    for (i = 0; i < Number; i++)
+    {
+        KeInvalidateTlbEntry(Virtual[i]);
+    }
+
+#ifdef CONFIG_SMP
+    /* Wait for the other processors to finish */
+    if (TargetAffinity) KiIpiStallOnPacketTargets();
+#endif
+
+    /* Return to original IRQL */
+    KeLowerIrql(OldIrql);
 }
 
 NTSTATUS
@@ -39,6 +39,140 @@ KiIpiSend(
     }
 }
 
+/*!
+ * \brief Sends a request packet to a set of processors.
+ *
+ * The packet is posted into the sender's slot of each target's request
+ * mailbox, so multiple processors can send packets concurrently without a
+ * global lock, and a single IPI is sent to the whole target set.
+ * The caller must be at or above DISPATCH_LEVEL, and has to wait for the
+ * packet to be completed with KiIpiStallOnPacketTargets before sending the
+ * next one.
+ */
+VOID
+NTAPI
+KiIpiSendPacket(
+    _In_ KAFFINITY TargetProcessors,
+    _In_ PKIPI_WORKER WorkerFunction,
+    _In_opt_ PKIPI_BROADCAST_WORKER BroadcastFunction,
+    _In_ ULONG_PTR Context,
+    _In_opt_ PULONG Count)
+{
+#ifdef CONFIG_SMP
+    PKPRCB Prcb = KeGetCurrentPrcb();
+    PKPRCB TargetPrcb;
+    PREQUEST_MAILBOX Mailbox;
+    KAFFINITY RemainingSet;
+    ULONG Processor;
+
+    ASSERT(KeGetCurrentIrql() >= DISPATCH_LEVEL);
+    ASSERT((TargetProcessors & Prcb->SetMember) == 0);
+
+    /* The previous packet must have been completed */
+    ASSERT(Prcb->TargetSet == 0);
+    Prcb->TargetSet = TargetProcessors;
+
+    /* Post the packet to every target */
+    RemainingSet = TargetProcessors;
+    while (RemainingSet)
+    {
+        NT_VERIFY(BitScanForwardAffinity(&Processor, RemainingSet) != 0);
+        RemainingSet &= ~AFFINITY_MASK(Processor);
+        TargetPrcb = KiProcessorBlock[Processor];
+
+        /* Fill our mailbox slot on the target */
+        Mailbox = &TargetPrcb->RequestMailbox[Prcb->Number];
+        Mailbox->RequestPacket.WorkerRoutine = WorkerFunction;
+        Mailbox->RequestPacket.CurrentPacket[0] = BroadcastFunction;
+        Mailbox->RequestPacket.CurrentPacket[1] = (PVOID)Context;
+        Mailbox->RequestPacket.CurrentPacket[2] = Count;
+
+        /* Let the target know that we have a packet for it */
+        InterlockedBitTestAndSet64((PLONG64)&TargetPrcb->SenderSummary, Prcb->Number);
+    }
+
+    /* Send one IPI for the whole set */
+    HalRequestIpi(TargetProcessors);
+#else
+    UNREFERENCED_PARAMETER(TargetProcessors);
+    UNREFERENCED_PARAMETER(WorkerFunction);
+    UNREFERENCED_PARAMETER(BroadcastFunction);
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(Count);
+#endif
+}
+
+/*!
+ * \brief Signals the sender of a packet that this processor is done with it.
+ *
+ * \param PacketContext - The context that was passed to the worker routine.
+ */
+VOID
+FASTCALL
+KiIpiSignalPacketDone(
+    _In_ PKIPI_CONTEXT PacketContext)
+{
+    PKPRCB SenderPrcb = (PKPRCB)PacketContext;
+
+    /* Remove ourselves from the sender's target set */
+    InterlockedBitTestAndReset64((PLONG64)&SenderPrcb->TargetSet,
+                                 KeGetCurrentProcessorNumber());
+}
+
+/*!
+ * \brief Waits until all targets of the current packet have completed it.
+ */
+VOID
+FASTCALL
+KiIpiStallOnPacketTargets(VOID)
+{
+#ifdef CONFIG_SMP
+    PKPRCB Prcb = KeGetCurrentPrcb();
+
+    /* IPIs are delivered above SYNCH_LEVEL, so we can't deadlock here */
+    while (*(volatile KAFFINITY*)&Prcb->TargetSet)
+    {
+        YieldProcessor();
+    }
+#endif
+}
+
+/*!
+ * \brief Processes the request packets posted to the current processor.
+ *
+ * Called from KiIpiInterrupt at IPI_LEVEL.
+ */
+VOID
+NTAPI
+KiIpiProcessRequests(VOID)
+{
+#ifdef CONFIG_SMP
+    PKPRCB Prcb = KeGetCurrentPrcb();
+    PREQUEST_MAILBOX Mailbox;
+    KAFFINITY SenderSummary;
+    PKIPI_WORKER WorkerRoutine;
+    ULONG Sender;
+
+    ASSERT(KeGetCurrentIrql() == IPI_LEVEL);
+
+    /* Grab all pending senders at once */
+    SenderSummary = (KAFFINITY)InterlockedExchange64((PLONG64)&Prcb->SenderSummary, 0);
+    while (SenderSummary)
+    {
+        NT_VERIFY(BitScanForwardAffinity(&Sender, SenderSummary) != 0);
+        SenderSummary &= ~AFFINITY_MASK(Sender);
+
+        /* Call the worker, it signals the sender when it's done */
+        Mailbox = &Prcb->RequestMailbox[Sender];
+        WorkerRoutine = (PKIPI_WORKER)Mailbox->RequestPacket.WorkerRoutine;
+        WorkerRoutine((PKIPI_CONTEXT)KiProcessorBlock[Sender],
+                      Mailbox->RequestPacket.CurrentPacket[0],
+                      Mailbox->RequestPacket.CurrentPacket[1],
+                      Mailbox->RequestPacket.CurrentPacket[2]);
+    }
+#endif
+}
+
 ULONG_PTR
 NTAPI
 KeIpiGenericCall(
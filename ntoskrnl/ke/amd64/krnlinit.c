@@ -259,6 +259,11 @@ KiInitializeKernel(IN PKPROCESS InitProcess,
         InitializeListHead(&KiTimerTableListHead[i].Entry);
         KiTimerTableListHead[i].Time.HighPart = 0xFFFFFFFF;
         KiTimerTableListHead[i].Time.LowPart = 0;
+
+        /* Initialize the overflow list for far away timers as well */
+        InitializeListHead(&KiTimerOverflowListHead[i]);
+        KiTimerOverflowTime[i].HighPart = 0xFFFFFFFF;
+        KiTimerOverflowTime[i].LowPart = 0;
     }
 
     /* Initialize the Swap event and all swap lists */
@@ -270,6 +275,9 @@ KiInitializeKernel(IN PKPROCESS InitProcess,
     /* Initialize the mutex for generic DPC calls */
     ExInitializeFastMutex(&KiGenericCallDpcMutex);
 
+    /* Initialize the mutex for the call stack sampler */
+    ExInitializeFastMutex(&KiStackProfileMutex);
+
     /* Initialize the syscall table */
     KeServiceDescriptorTable[0].Base = MainSSDT;
     KeServiceDescriptorTable[0].Count = NULL;
@@ -48,15 +48,21 @@ KiInitializeContextThread(IN PKTHREAD Thread,
     PKTRAP_FRAME TrapFrame;
     ULONG ContextFlags;
     PVOID InitialStack;
+    SIZE_T XStateLength;
+
+    /* System threads never have their extended state switched (their
+       NpxState is 0), so they only get the legacy area and the header */
+    XStateLength = KeXStateLength;
+    if (!Context) XStateLength = min(XStateLength, sizeof(XSAVE_AREA));
 
     /* Allocate space on the stack for the XSAVE area */
-    InitialStack = (PUCHAR)Thread->InitialStack - KeXStateLength;
+    InitialStack = (PUCHAR)Thread->InitialStack - XStateLength;
     InitialStack = ALIGN_DOWN_POINTER_BY(InitialStack, 64);
     Thread->InitialStack = InitialStack;
 
     /* Initialize the state save area */
     Thread->StateSaveArea = InitialStack;
-    RtlZeroMemory(Thread->StateSaveArea, KeXStateLength);
+    RtlZeroMemory(Thread->StateSaveArea, XStateLength);
     Thread->StateSaveArea->MxCsr = INITIAL_MXCSR;
     Thread->StateSaveArea->ControlWord = INITIAL_FPCSR;
 
@@ -67,11 +73,12 @@ KiInitializeContextThread(IN PKTHREAD Thread,
         PXSAVE_AREA XSaveArea = (PXSAVE_AREA)Thread->StateSaveArea;
         XSaveArea->Header.Mask |= XSTATE_MASK_LEGACY_FLOATING_POINT;
 
-        /* Special initialization for XSAVES */
-        if (KeFeatureBits & KF_XSAVES)
+        /* Special initialization for the compacted format */
+        if (KeFeatureBits & (KF_XSAVES | KF_XSAVEC))
         {
             /* Set bit 63 in XCOMP_BV to mark the area as compacted.
-               XRSTORS requires this and will #GP otherwise.
+               XRSTORS requires this and will #GP otherwise, XRSTOR
+               uses it to pick the compacted layout.
                Also mark legacy FP as compacted. */
             XSaveArea->Header.CompactionMask |= 0x8000000000000000ULL |
                                                 XSTATE_MASK_LEGACY_FLOATING_POINT;
@@ -167,6 +174,34 @@ KiInitializeContextThread(IN PKTHREAD Thread,
     StartFrame->Reserved = 0;
 }
 
+FORCEINLINE
+ULONG64
+KiGetXStateRestoreMask(
+    _In_ PKTHREAD NewThread)
+{
+    PXSAVE_AREA XSaveArea = (PXSAVE_AREA)NewThread->StateSaveArea;
+    ULONG64 SkipMask;
+
+    /* Without XSAVE there is nothing to be clever about */
+    if (!(KeFeatureBits & KF_XSTATE)) return NewThread->NpxState;
+
+    /* A user component that is in its initial configuration in the saved
+       state (clear in XSTATE_BV) would be initialized by XRSTOR. If the
+       registers are in the initial configuration already (clear in XINUSE),
+       there is no point in touching them, so leave them out. Supervisor
+       components are not reported by XINUSE and are always restored. */
+    SkipMask = SharedUserData->XState.EnabledFeatures &
+               ~XSaveArea->Header.Mask &
+               ~KiGetXStateInUse();
+
+    /* XINUSE doesn't track MXCSR, which XRSTOR only loads along with the
+       SSE or AVX components. Always restore the legacy state, or the new
+       thread could run with the rounding and exception modes of the old. */
+    SkipMask &= ~XSTATE_MASK_LEGACY;
+
+    return NewThread->NpxState & ~SkipMask;
+}
+
 BOOLEAN
 KiSwapContextResume(
     _In_ BOOLEAN ApcBypass,
@@ -189,7 +224,8 @@ KiSwapContextResume(
     /* Load new thread's extended state */
     if (NewThread->NpxState != 0)
     {
-        KiRestoreXState(NewThread->StateSaveArea, NewThread->NpxState);
+        KiRestoreXState(NewThread->StateSaveArea,
+                        KiGetXStateRestoreMask(NewThread));
     }
 
     /* Now we are the new thread. Check if it's in a new process */
@@ -216,6 +252,14 @@ KiSwapContextResume(
     Pcr->ContextSwitches++;
     NewThread->ContextSwitches++;
 
+    /* Trace the switch */
+    KiTraceScheduler(SchedulerTraceContextSwitch,
+                     OldThread,
+                     NewThread,
+                     NewThread->Priority,
+                     OldThread->WaitReason,
+                     OldThread->State);
+
     /* DPCs shouldn't be active */
     if (Pcr->Prcb.DpcRoutineActive)
     {
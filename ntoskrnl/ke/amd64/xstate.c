@@ -245,7 +245,8 @@ KiInitializeXStateConfiguration(
 
         if (SharedUserData->XState.AllFeatureSize == 0)
         {
-            KeFeatureBits &= ~KF_XSTATE;
+            KeFeatureBits &= ~(KF_XSTATE | KF_XSAVEOPT | KF_XSAVEC |
+                               KF_XSAVES | KF_XINUSE);
             return;
         }
 
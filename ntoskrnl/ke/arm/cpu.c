@@ -140,6 +140,31 @@ KeFlushEntireTb(IN BOOLEAN Invalid,
     KeLowerIrql(OldIrql);
 }
 
+VOID
+NTAPI
+KeFlushMultipleTb(IN ULONG Number,
+                  IN PVOID *Virtual,
+                  IN BOOLEAN AllProcessors)
+{
+    KIRQL OldIrql;
+    ULONG i;
+
+    //
+    // Raise the IRQL for the TB Flush
+    //
+    OldIrql = KeRaiseIrqlToSynchLevel();
+
+    //
+    // Flush each entry on the Current CPU
+    //
+    for (i = 0; i < Number; i++) KiFlushSingleTb(TRUE, Virtual[i]);
+
+    //
+    // Return to Original IRQL
+    //
+    KeLowerIrql(OldIrql);
+}
+
 /*
  * @implemented
  */
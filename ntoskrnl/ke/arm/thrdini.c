@@ -176,6 +176,9 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+        /* Wake up the DPC thread if a threaded DPC was queued to us */
+        KiIdleSignalDpcThread(Prcb);
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
@@ -240,6 +243,14 @@ KiSwapContextExit(IN PKTHREAD OldThread,
     /* Increase thread context switches */
     NewThread->ContextSwitches++;
 
+    /* Trace the switch */
+    KiTraceScheduler(SchedulerTraceContextSwitch,
+                     OldThread,
+                     NewThread,
+                     NewThread->Priority,
+                     OldThread->WaitReason,
+                     OldThread->State);
+
     /* DPCs shouldn't be active */
     if (Pcr->Prcb.DpcRoutineActive)
     {
@@ -179,7 +179,7 @@ KeBalanceSetManager(IN PVOID Context)
                 //ExAdjustLookasideDepth();
 
                 /* Call the working set manager */
-                //MmWorkingSetManager();
+                MmWorkingSetManager();
 
                 /* FIXME: Outswap stacks */
 
@@ -37,7 +37,7 @@ KeSetSystemTime(IN PLARGE_INTEGER NewTime,
     PKTIMER Timer;
     PKSPIN_LOCK_QUEUE LockQueue;
     LIST_ENTRY TempList, TempList2;
-    ULONG Hand, i;
+    ULONG Hand, i, j;
 
     /* Sanity checks */
     ASSERT((NewTime->HighPart & 0xF0000000) == 0);
@@ -79,24 +79,30 @@ KeSetSystemTime(IN PLARGE_INTEGER NewTime,
     /* Loop current timers */
     for (i = 0; i < TIMER_TABLE_SIZE; i++)
     {
-        /* Loop the entries in this table and lock the timers */
-        ListHead = &KiTimerTableListHead[i].Entry;
+        /* Lock the timers of this entry */
         LockQueue = KiAcquireTimerLock(i);
-        NextEntry = ListHead->Flink;
-        while (NextEntry != ListHead)
-        {
-            /* Get the timer */
-            Timer = CONTAINING_RECORD(NextEntry, KTIMER, TimerListEntry);
-            NextEntry = NextEntry->Flink;
 
-            /* Is it absolute? */
-            if (Timer->Header.Absolute)
+        /* Loop the table entry first, then its overflow list */
+        for (j = 0; j < 2; j++)
+        {
+            ListHead = (j == 0) ? &KiTimerTableListHead[i].Entry :
+                                  &KiTimerOverflowListHead[i];
+            NextEntry = ListHead->Flink;
+            while (NextEntry != ListHead)
             {
-                /* Remove it from the timer list */
-                KiRemoveEntryTimer(Timer);
-
-                /* Insert it into our temporary list */
-                InsertTailList(&TempList, &Timer->TimerListEntry);
+                /* Get the timer */
+                Timer = CONTAINING_RECORD(NextEntry, KTIMER, TimerListEntry);
+                NextEntry = NextEntry->Flink;
+
+                /* Is it absolute? */
+                if (Timer->Header.Absolute)
+                {
+                    /* Remove it from the timer list */
+                    KiRemoveEntryTimer(Timer);
+
+                    /* Insert it into our temporary list */
+                    InsertTailList(&TempList, &Timer->TimerListEntry);
+                }
             }
         }
 
@@ -20,14 +20,262 @@ ULONG KiMaximumDpcQueueDepth = 4;
 ULONG KiMinimumDpcRate = 3;
 ULONG KiAdjustDpcThreshold = 20;
 ULONG KiIdealDpcRate = 20;
-BOOLEAN KeThreadDpcEnable;
+BOOLEAN KeThreadDpcEnable = TRUE;
 FAST_MUTEX KiGenericCallDpcMutex;
 KDPC KiTimerExpireDpc;
 ULONG KiTimeLimitIsrMicroseconds;
 ULONG KiDPCTimeout = 110;
 
+/* DPC routine statistics */
+#define KI_DPC_STATISTICS_TABLE_SIZE    256
+#define KI_DPC_QUEUE_STAMP_COUNT        8
+
+typedef struct _KI_DPC_QUEUE_STAMP
+{
+    PKDPC Dpc;
+    LONGLONG QueueTime;
+} KI_DPC_QUEUE_STAMP, *PKI_DPC_QUEUE_STAMP;
+
+typedef struct _KI_DPC_QUEUE_STAMPS
+{
+    ULONG Count;
+    KI_DPC_QUEUE_STAMP Stamp[KI_DPC_QUEUE_STAMP_COUNT];
+} KI_DPC_QUEUE_STAMPS, *PKI_DPC_QUEUE_STAMPS;
+
+BOOLEAN KiDpcStatisticsEnabled;
+LARGE_INTEGER KiDpcStatisticsFrequency;
+SYSTEM_DPC_ROUTINE_ENTRY KiDpcRoutineStatistics[KI_DPC_STATISTICS_TABLE_SIZE];
+KI_DPC_QUEUE_STAMPS KiDpcQueueStamps[MAXIMUM_PROCESSORS][2];
+PKDEFERRED_ROUTINE KiDpcCurrentRoutine[MAXIMUM_PROCESSORS];
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
+static
+PSYSTEM_DPC_ROUTINE_ENTRY
+KiLookupDpcStatistics(IN PVOID DeferredRoutine)
+{
+    PSYSTEM_DPC_ROUTINE_ENTRY Entry;
+    PVOID Owner;
+    ULONG Hash, i;
+
+    /* Open addressing on the routine address */
+    Hash = (ULONG)((ULONG_PTR)DeferredRoutine >> 4);
+    for (i = 0; i < KI_DPC_STATISTICS_TABLE_SIZE; i++)
+    {
+        Entry = &KiDpcRoutineStatistics[(Hash + i) & (KI_DPC_STATISTICS_TABLE_SIZE - 1)];
+
+        /* Check if this slot is ours, or claim it if it's still free */
+        Owner = Entry->DeferredRoutine;
+        if (Owner == DeferredRoutine) return Entry;
+        if ((Owner == NULL) &&
+            ((InterlockedCompareExchangePointer(&Entry->DeferredRoutine,
+                                                DeferredRoutine,
+                                                NULL) == NULL) ||
+             (Entry->DeferredRoutine == DeferredRoutine)))
+        {
+            return Entry;
+        }
+    }
+
+    /* The table is full */
+    return NULL;
+}
+
+FORCEINLINE
+ULONG
+KiDpcHistogramBucket(IN ULONG Microseconds)
+{
+    ULONG Bucket;
+
+    /* Bucket 0 is below one microsecond, then one bucket per power of two */
+    if (!Microseconds) return 0;
+    BitScanReverse(&Bucket, Microseconds);
+    return min(Bucket + 1, SYSTEM_DPC_HISTOGRAM_BUCKETS - 1);
+}
+
+FORCEINLINE
+ULONG
+KiDpcElapsedMicroseconds(IN LONGLONG Start,
+                         IN LONGLONG End)
+{
+    ULONGLONG Elapsed;
+
+    /* Convert the performance counter delta */
+    if ((End <= Start) || !(KiDpcStatisticsFrequency.QuadPart)) return 0;
+    Elapsed = ((ULONGLONG)(End - Start) * 1000000) /
+              (ULONGLONG)KiDpcStatisticsFrequency.QuadPart;
+    return (ULONG)min(Elapsed, MAXULONG);
+}
+
+static
+VOID
+KiUpdateMaximum(IN PULONG Maximum,
+                IN ULONG Value)
+{
+    ULONG Current;
+
+    /* Only ever raise the maximum */
+    Current = *(volatile ULONG*)Maximum;
+    while (Value > Current)
+    {
+        Current = InterlockedCompareExchange((PLONG)Maximum, Value, Current);
+    }
+}
+
+static
+VOID
+KiRecordDpcStatistics(IN PKDEFERRED_ROUTINE DeferredRoutine,
+                      IN LONGLONG QueueTime,
+                      IN LONGLONG StartTime,
+                      IN LONGLONG EndTime)
+{
+    PSYSTEM_DPC_ROUTINE_ENTRY Entry;
+    ULONG RunTime, Latency;
+
+    /* Find the entry for this routine */
+    Entry = KiLookupDpcStatistics(DeferredRoutine);
+    if (!Entry) return;
+
+    /* Account the execution time */
+    RunTime = KiDpcElapsedMicroseconds(StartTime, EndTime);
+    InterlockedIncrement((PLONG)&Entry->ExecutionCount);
+    ExInterlockedAddLargeStatistic(&Entry->TotalRunTime, RunTime);
+    InterlockedIncrement((PLONG)&Entry->RunTimeHistogram[KiDpcHistogramBucket(RunTime)]);
+    KiUpdateMaximum(&Entry->MaximumRunTime, RunTime);
+
+    /* Account the queue latency, if we know when it was queued */
+    if (QueueTime)
+    {
+        Latency = KiDpcElapsedMicroseconds(QueueTime, StartTime);
+        InterlockedIncrement((PLONG)&Entry->LatencyHistogram[KiDpcHistogramBucket(Latency)]);
+        KiUpdateMaximum(&Entry->MaximumLatency, Latency);
+    }
+}
+
+FORCEINLINE
+PKI_DPC_QUEUE_STAMPS
+KiGetDpcQueueStamps(IN PKPRCB Prcb,
+                    IN PKDPC_DATA DpcData)
+{
+    /* One set of stamps per DPC queue, protected by the queue's lock */
+    return &KiDpcQueueStamps[Prcb->Number][DpcData - &Prcb->DpcData[DPC_NORMAL]];
+}
+
+FORCEINLINE
+VOID
+KiStampQueuedDpc(IN PKPRCB Prcb,
+                 IN PKDPC_DATA DpcData,
+                 IN PKDPC Dpc)
+{
+    PKI_DPC_QUEUE_STAMPS Stamps;
+    ULONG i;
+
+    /* Remember when the DPC was queued, if we have room for it */
+    Stamps = KiGetDpcQueueStamps(Prcb, DpcData);
+    for (i = 0; i < KI_DPC_QUEUE_STAMP_COUNT; i++)
+    {
+        if (!Stamps->Stamp[i].Dpc)
+        {
+            Stamps->Stamp[i].Dpc = Dpc;
+            Stamps->Stamp[i].QueueTime = KeQueryPerformanceCounter(NULL).QuadPart;
+            Stamps->Count++;
+            break;
+        }
+    }
+}
+
+FORCEINLINE
+LONGLONG
+KiTakeDpcQueueStamp(IN PKPRCB Prcb,
+                    IN PKDPC_DATA DpcData,
+                    IN PKDPC Dpc)
+{
+    PKI_DPC_QUEUE_STAMPS Stamps;
+    LONGLONG QueueTime = 0;
+    ULONG i;
+
+    /* Find the stamp of this DPC, and release it */
+    Stamps = KiGetDpcQueueStamps(Prcb, DpcData);
+    if (!Stamps->Count) return 0;
+    for (i = 0; i < KI_DPC_QUEUE_STAMP_COUNT; i++)
+    {
+        if (Stamps->Stamp[i].Dpc == Dpc)
+        {
+            QueueTime = Stamps->Stamp[i].QueueTime;
+            Stamps->Stamp[i].Dpc = NULL;
+            Stamps->Count--;
+            break;
+        }
+    }
+
+    return QueueTime;
+}
+
+FORCEINLINE
+VOID
+KiCallDpcRoutine(IN PKPRCB Prcb,
+                 IN PKDPC Dpc,
+                 IN PKDEFERRED_ROUTINE DeferredRoutine,
+                 IN PVOID DeferredContext,
+                 IN PVOID SystemArgument1,
+                 IN PVOID SystemArgument2,
+                 IN LONGLONG QueueTime)
+{
+    LONGLONG StartTime, EndTime;
+
+    /* Clear DPC Time and remember the routine for the DPC watchdog */
+    Prcb->DebugDpcTime = 0;
+    KiDpcCurrentRoutine[Prcb->Number] = DeferredRoutine;
+
+    /* Check if we need to time the DPC */
+    if (KiDpcStatisticsEnabled)
+    {
+        /* Call the DPC */
+        StartTime = KeQueryPerformanceCounter(NULL).QuadPart;
+        DeferredRoutine(Dpc, DeferredContext, SystemArgument1, SystemArgument2);
+        EndTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+        /* And account it */
+        KiRecordDpcStatistics(DeferredRoutine, QueueTime, StartTime, EndTime);
+    }
+    else
+    {
+        /* Call the DPC */
+        DeferredRoutine(Dpc, DeferredContext, SystemArgument1, SystemArgument2);
+    }
+
+    /* The DPC is done */
+    KiDpcCurrentRoutine[Prcb->Number] = NULL;
+}
+
+VOID
+NTAPI
+KiDpcWatchdogTimeout(IN PKPRCB Prcb)
+{
+    PKDEFERRED_ROUTINE DeferredRoutine;
+    PSYSTEM_DPC_ROUTINE_ENTRY Entry;
+
+    /* Account the timeout against the running routine */
+    DeferredRoutine = KiDpcCurrentRoutine[Prcb->Number];
+    if ((DeferredRoutine) && (KiDpcStatisticsEnabled))
+    {
+        Entry = KiLookupDpcStatistics(DeferredRoutine);
+        if (Entry) InterlockedIncrement((PLONG)&Entry->WatchdogCount);
+    }
+
+#if DBG
+    /* Let the user know */
+    DbgPrint("*** DPC routine %p > 1 sec --- This is not a break in KeUpdateSystemTime\n",
+             DeferredRoutine);
+
+    /* Break if debugger is enabled */
+    if (KdDebuggerEnabled) DbgBreakPoint();
+#endif
+
+    /* Clear state */
+    Prcb->DebugDpcTime = 0;
+}
+
 VOID
 NTAPI
 KiCheckTimerTable(IN ULARGE_INTEGER CurrentTime)
@@ -131,6 +379,14 @@ KiTimerExpiration(IN PKDPC Dpc,
         /* Get the current index */
         Index = (Index + 1) & (TIMER_TABLE_SIZE - 1);
 
+        /* Move far away timers whose last revolution started into the table */
+        if (KiTimerOverflowTime[Index].QuadPart <= InterruptTime.QuadPart)
+        {
+            LockQueue = KiAcquireTimerLock(Index);
+            KiCascadeTimerTableEntry(Index, InterruptTime.QuadPart);
+            KiReleaseTimerLock(LockQueue);
+        }
+
         /* Get list pointers and loop the list */
         ListHead = &KiTimerTableListHead[Index].Entry;
         while (ListHead != ListHead->Flink)
@@ -225,16 +481,14 @@ KiTimerExpiration(IN PKDPC Dpc,
                     /* Start looping all DPC Entries */
                     for (i = 0; DpcCalls; DpcCalls--, i++)
                     {
-#if DBG
-                        /* Clear DPC Time */
-                        Prcb->DebugDpcTime = 0;
-#endif
-
                         /* Call the DPC */
-                        DpcEntry[i].Routine(DpcEntry[i].Dpc,
-                                            DpcEntry[i].Context,
-                                            UlongToPtr(SystemTime.LowPart),
-                                            UlongToPtr(SystemTime.HighPart));
+                        KiCallDpcRoutine(Prcb,
+                                         DpcEntry[i].Dpc,
+                                         DpcEntry[i].Routine,
+                                         DpcEntry[i].Context,
+                                         UlongToPtr(SystemTime.LowPart),
+                                         UlongToPtr(SystemTime.HighPart),
+                                         0);
                     }
 
                     /* Reset accounting */
@@ -254,10 +508,11 @@ KiTimerExpiration(IN PKDPC Dpc,
                     ASSERT(KiTimerTableListHead[Index].Time.QuadPart <=
                            Timer->DueTime.QuadPart);
 
-                    /* Update the time */
+                    /* Update the time, the overflow list may need it earlier */
                     _disable();
                     KiTimerTableListHead[Index].Time.QuadPart =
-                        Timer->DueTime.QuadPart;
+                        min(Timer->DueTime.QuadPart,
+                            KiTimerOverflowTime[Index].QuadPart);
                     _enable();
                 }
 
@@ -273,16 +528,14 @@ KiTimerExpiration(IN PKDPC Dpc,
                     /* Start looping all DPC Entries */
                     for (i = 0; DpcCalls; DpcCalls--, i++)
                     {
-#if DBG
-                        /* Clear DPC Time */
-                        Prcb->DebugDpcTime = 0;
-#endif
-
                         /* Call the DPC */
-                        DpcEntry[i].Routine(DpcEntry[i].Dpc,
-                                            DpcEntry[i].Context,
-                                            UlongToPtr(SystemTime.LowPart),
-                                            UlongToPtr(SystemTime.HighPart));
+                        KiCallDpcRoutine(Prcb,
+                                         DpcEntry[i].Dpc,
+                                         DpcEntry[i].Routine,
+                                         DpcEntry[i].Context,
+                                         UlongToPtr(SystemTime.LowPart),
+                                         UlongToPtr(SystemTime.HighPart),
+                                         0);
                     }
 
                     /* Reset accounting */
@@ -311,16 +564,14 @@ KiTimerExpiration(IN PKDPC Dpc,
         /* Start looping all DPC Entries */
         for (i = 0; DpcCalls; DpcCalls--, i++)
         {
-#if DBG
-            /* Clear DPC Time */
-            Prcb->DebugDpcTime = 0;
-#endif
-
             /* Call the DPC */
-            DpcEntry[i].Routine(DpcEntry[i].Dpc,
-                                DpcEntry[i].Context,
-                                UlongToPtr(SystemTime.LowPart),
-                                UlongToPtr(SystemTime.HighPart));
+            KiCallDpcRoutine(Prcb,
+                             DpcEntry[i].Dpc,
+                             DpcEntry[i].Routine,
+                             DpcEntry[i].Context,
+                             UlongToPtr(SystemTime.LowPart),
+                             UlongToPtr(SystemTime.HighPart),
+                             0);
         }
 
         /* Lower IRQL if we need to */
@@ -438,16 +689,14 @@ KiTimerListExpire(IN PLIST_ENTRY ExpiredListHead,
         /* Start looping all DPC Entries */
         for (i = 0; DpcCalls; DpcCalls--, i++)
         {
-#if DBG
-            /* Clear DPC Time */
-            Prcb->DebugDpcTime = 0;
-#endif
-
             /* Call the DPC */
-            DpcEntry[i].Routine(DpcEntry[i].Dpc,
-                                DpcEntry[i].Context,
-                                UlongToPtr(SystemTime.LowPart),
-                                UlongToPtr(SystemTime.HighPart));
+            KiCallDpcRoutine(Prcb,
+                             DpcEntry[i].Dpc,
+                             DpcEntry[i].Routine,
+                             DpcEntry[i].Context,
+                             UlongToPtr(SystemTime.LowPart),
+                             UlongToPtr(SystemTime.HighPart),
+                             0);
         }
 
         /* Lower IRQL */
@@ -567,6 +816,7 @@ KiRetireDpcList(IN PKPRCB Prcb)
     PKDEFERRED_ROUTINE DeferredRoutine;
     PVOID DeferredContext, SystemArgument1, SystemArgument2;
     ULONG_PTR TimerHand;
+    LONGLONG QueueTime;
 #ifdef CONFIG_SMP
     KIRQL OldIrql;
 #endif
@@ -618,10 +868,8 @@ KiRetireDpcList(IN PKPRCB Prcb)
                 /* Decrease the queue depth */
                 DpcData->DpcQueueDepth--;
 
-#if DBG
-                /* Clear DPC Time */
-                Prcb->DebugDpcTime = 0;
-#endif
+                /* Get the time it was queued at */
+                QueueTime = KiTakeDpcQueueStamp(Prcb, DpcData, Dpc);
 
                 /* Release the lock */
                 KeReleaseSpinLockFromDpcLevel(&DpcData->DpcLock);
@@ -630,10 +878,13 @@ KiRetireDpcList(IN PKPRCB Prcb)
                 _enable();
 
                 /* Call the DPC */
-                DeferredRoutine(Dpc,
-                                DeferredContext,
-                                SystemArgument1,
-                                SystemArgument2);
+                KiCallDpcRoutine(Prcb,
+                                 Dpc,
+                                 DeferredRoutine,
+                                 DeferredContext,
+                                 SystemArgument1,
+                                 SystemArgument2,
+                                 QueueTime);
                 ASSERT(KeGetCurrentIrql() == DISPATCH_LEVEL);
 
                 /* Disable interrupts and keep looping */
@@ -673,6 +924,226 @@ KiRetireDpcList(IN PKPRCB Prcb)
     } while (DpcData->DpcQueueDepth != 0);
 }
 
+VOID
+FASTCALL
+KiIdleSignalDpcThread(IN PKPRCB Prcb)
+{
+    /*
+     * The idle loop runs at DISPATCH_LEVEL, so the dispatch interrupt that
+     * KeInsertQueueDpc requested for a threaded DPC never gets to KiQuantumEnd.
+     * Called with interrupts disabled, returns with interrupts disabled.
+     */
+    if (!Prcb->DpcSetEventRequest) return;
+
+    /* We're idle, there's no quantum to end */
+    Prcb->QuantumEnd = FALSE;
+
+    /* Signal the DPC thread, it becomes our next thread */
+    _enable();
+    if (InterlockedExchange(&Prcb->DpcSetEventRequest, 0))
+    {
+        KeSetEvent(&Prcb->DpcEvent, 0, FALSE);
+    }
+    _disable();
+}
+
+VOID
+NTAPI
+KiExecuteDpc(IN PVOID Context)
+{
+    PKPRCB Prcb = Context;
+    PKDPC_DATA DpcData;
+    PLIST_ENTRY ListHead, DpcEntry;
+    PKDPC Dpc;
+    PKDEFERRED_ROUTINE DeferredRoutine;
+    PVOID DeferredContext, SystemArgument1, SystemArgument2;
+    LONGLONG QueueTime;
+    BOOLEAN Enable;
+
+    /* Stay on our processor, above any other thread */
+    KeSetSystemAffinityThread(Prcb->SetMember);
+    KeSetPriorityThread(KeGetCurrentThread(), HIGH_PRIORITY);
+
+    /* Get the threaded DPC data */
+    DpcData = &Prcb->DpcData[DPC_THREADED];
+    ListHead = &DpcData->DpcListHead;
+
+    /* Threaded DPCs can now be queued to us */
+    Prcb->ThreadDpcEnable = TRUE;
+
+    /* Main loop */
+    for (;;)
+    {
+        /* Wait for work */
+        KeWaitForSingleObject(&Prcb->DpcEvent,
+                              Executive,
+                              KernelMode,
+                              FALSE,
+                              NULL);
+
+        /* Disable interrupts and lock the DPC data */
+        Enable = KeDisableInterrupts();
+        KiAcquireSpinLock(&DpcData->DpcLock);
+
+        /* The request is being handled */
+        Prcb->DpcThreadRequested = FALSE;
+        Prcb->DpcThreadActive = TRUE;
+
+        /* Loop while we have entries in the queue */
+        while (TRUE)
+        {
+            /* Check if the queue is empty */
+            DpcEntry = ListHead->Flink;
+            if (DpcEntry == ListHead)
+            {
+                /* Go back to sleep, while still holding the lock */
+                ASSERT(DpcData->DpcQueueDepth == 0);
+                Prcb->DpcThreadActive = FALSE;
+                KiReleaseSpinLock(&DpcData->DpcLock);
+                KeRestoreInterrupts(Enable);
+                break;
+            }
+
+            /* Remove the DPC from the list */
+            RemoveEntryList(DpcEntry);
+            Dpc = CONTAINING_RECORD(DpcEntry, KDPC, DpcListEntry);
+
+            /* Clear its DPC data and save its parameters */
+            Dpc->DpcData = NULL;
+            DeferredRoutine = Dpc->DeferredRoutine;
+            DeferredContext = Dpc->DeferredContext;
+            SystemArgument1 = Dpc->SystemArgument1;
+            SystemArgument2 = Dpc->SystemArgument2;
+
+            /* Decrease the queue depth */
+            DpcData->DpcQueueDepth--;
+
+            /* Get the time it was queued at */
+            QueueTime = KiTakeDpcQueueStamp(Prcb, DpcData, Dpc);
+
+            /* Release the lock and re-enable interrupts */
+            KiReleaseSpinLock(&DpcData->DpcLock);
+            KeRestoreInterrupts(Enable);
+
+            /* Call the DPC */
+            KiCallDpcRoutine(Prcb,
+                             Dpc,
+                             DeferredRoutine,
+                             DeferredContext,
+                             SystemArgument1,
+                             SystemArgument2,
+                             QueueTime);
+            ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+            /* Disable interrupts, lock the DPC data and keep looping */
+            Enable = KeDisableInterrupts();
+            KiAcquireSpinLock(&DpcData->DpcLock);
+        }
+    }
+}
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+KiStartDpcThread(IN PKPRCB Prcb)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    HANDLE ThreadHandle;
+    PETHREAD Thread;
+    NTSTATUS Status;
+
+    /* Create the DPC thread for this processor */
+    InitializeObjectAttributes(&ObjectAttributes,
+                               NULL,
+                               OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    Status = PsCreateSystemThread(&ThreadHandle,
+                                  THREAD_ALL_ACCESS,
+                                  &ObjectAttributes,
+                                  NULL,
+                                  NULL,
+                                  KiExecuteDpc,
+                                  Prcb);
+    if (!NT_SUCCESS(Status))
+    {
+        /* Threaded DPCs will keep running as normal DPCs on this processor */
+        DPRINT1("Failed to create DPC thread for CPU %u: 0x%lx\n", Prcb->Number, Status);
+        return;
+    }
+
+    /* Keep a pointer to it */
+    Status = ObReferenceObjectByHandle(ThreadHandle,
+                                       THREAD_ALL_ACCESS,
+                                       PsThreadType,
+                                       KernelMode,
+                                       (PVOID*)&Thread,
+                                       NULL);
+    if (NT_SUCCESS(Status)) Prcb->DpcThread = &Thread->Tcb;
+
+    /* Close the handle */
+    ObCloseHandle(ThreadHandle, KernelMode);
+}
+
+NTSTATUS
+NTAPI
+KeQueryDpcStatistics(
+    _Out_writes_bytes_to_(Length, *ReturnLength) PSYSTEM_DPC_ROUTINE_INFORMATION Information,
+    _In_ ULONG Length,
+    _Out_ PULONG ReturnLength)
+{
+    PSYSTEM_DPC_ROUTINE_ENTRY Entry;
+    ULONG i, Count, RequiredLength;
+
+    /* Count the routines we know about */
+    for (i = 0, Count = 0; i < KI_DPC_STATISTICS_TABLE_SIZE; i++)
+    {
+        if (KiDpcRoutineStatistics[i].DeferredRoutine) Count++;
+    }
+
+    /* Check if the buffer is large enough */
+    RequiredLength = FIELD_OFFSET(SYSTEM_DPC_ROUTINE_INFORMATION, Routines[Count]);
+    *ReturnLength = RequiredLength;
+    if (Length < RequiredLength) return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* Fill out the header */
+    Information->StatisticsEnabled = KiDpcStatisticsEnabled;
+    Information->ThreadedDpcsEnabled = KeGetCurrentPrcb()->ThreadDpcEnable;
+
+    /* Copy the routines, more may have shown up since we counted them */
+    Entry = Information->Routines;
+    for (i = 0; (i < KI_DPC_STATISTICS_TABLE_SIZE) && (Count); i++)
+    {
+        if (!KiDpcRoutineStatistics[i].DeferredRoutine) continue;
+        *Entry++ = KiDpcRoutineStatistics[i];
+        Count--;
+    }
+
+    /* Return how many we copied */
+    Information->NumberOfRoutines = (ULONG)(Entry - Information->Routines);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+KeSetDpcStatistics(
+    _In_ BOOLEAN Enable,
+    _In_ BOOLEAN Reset)
+{
+    /* Stop collecting while we reset the counters */
+    KiDpcStatisticsEnabled = FALSE;
+    if (Reset)
+    {
+        /* DPCs may still be updating them, which is fine for statistics */
+        RtlZeroMemory(KiDpcRoutineStatistics, sizeof(KiDpcRoutineStatistics));
+    }
+
+    /* Enable collection if requested */
+    if (Enable) KeQueryPerformanceCounter(&KiDpcStatisticsFrequency);
+    KiDpcStatisticsEnabled = Enable;
+    return STATUS_SUCCESS;
+}
+
 VOID
 NTAPI
 KiInitializeDpc(IN PKDPC Dpc,
@@ -791,14 +1262,22 @@ KeInsertQueueDpc(IN PKDPC Dpc,
             InsertTailList(&DpcData->DpcListHead, &Dpc->DpcListEntry);
         }
 
+        /* Remember when it was queued, for the latency statistics */
+        if (KiDpcStatisticsEnabled) KiStampQueuedDpc(Prcb, DpcData, Dpc);
+
         /* Check if this is the DPC on the threaded list */
         if (&Prcb->DpcData[DPC_THREADED] == DpcData)
         {
             /* Make sure a threaded DPC isn't already active */
             if (!(Prcb->DpcThreadActive) && !(Prcb->DpcThreadRequested))
             {
-                /* FIXME: Setup Threaded DPC */
-                UNIMPLEMENTED_FATAL("Threaded DPC not supported\n");
+                /* Have the DPC thread woken up at the next dispatch interrupt */
+                InterlockedExchange(&Prcb->DpcSetEventRequest, TRUE);
+                Prcb->DpcThreadRequested = TRUE;
+                Prcb->QuantumEnd = TRUE;
+
+                /* Set DPC inserted */
+                DpcInserted = TRUE;
             }
         }
         else
@@ -878,7 +1357,9 @@ NTAPI
 KeRemoveQueueDpc(IN PKDPC Dpc)
 {
     PKDPC_DATA DpcData;
+    PKPRCB Prcb;
     BOOLEAN Enable;
+    ULONG i;
     ASSERT_DPC(Dpc);
 
     /* Disable interrupts */
@@ -898,6 +1379,18 @@ KeRemoveQueueDpc(IN PKDPC Dpc)
             DpcData->DpcQueueDepth--;
             RemoveEntryList(&Dpc->DpcListEntry);
             Dpc->DpcData = NULL;
+
+            /* Drop its queue stamp from the processor it was queued on */
+            for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+            {
+                Prcb = KiProcessorBlock[i];
+                if ((DpcData == &Prcb->DpcData[DPC_NORMAL]) ||
+                    (DpcData == &Prcb->DpcData[DPC_THREADED]))
+                {
+                    KiTakeDpcQueueStamp(Prcb, DpcData, Dpc);
+                    break;
+                }
+            }
         }
 
         /* Release the lock */
@@ -1636,8 +1636,7 @@ KeFlushEntireTb(IN BOOLEAN Invalid,
         /* Sanity check */
         ASSERT(Prcb == KeGetCurrentPrcb());
 
-        /* FIXME: TODO */
-        ASSERTMSG("Not yet implemented\n", FALSE);
+        KiIpiStallOnPacketTargets();
     }
 #endif
 
@@ -1646,6 +1645,89 @@ KeFlushEntireTb(IN BOOLEAN Invalid,
     KeLowerIrql(OldIrql);
 }
 
+VOID
+NTAPI
+KiFlushTargetMultipleTb(IN PKIPI_CONTEXT PacketContext,
+                        IN PVOID Ignored,
+                        IN PVOID Virtual,
+                        IN PVOID Number)
+{
+    PVOID *VirtualList = (PVOID*)Virtual;
+    ULONG i, Count = *(PULONG)Number;
+
+    /* Invalidate all the entries, the list lives on the sender's stack */
+    for (i = 0; i < Count; i++)
+    {
+        KeInvalidateTlbEntry(VirtualList[i]);
+    }
+
+    /* Now we can signal this packet as done */
+    KiIpiSignalPacketDone(PacketContext);
+}
+
+VOID
+NTAPI
+KeFlushMultipleTb(IN ULONG Number,
+                  IN PVOID *Virtual,
+                  IN BOOLEAN AllProcessors)
+{
+    KIRQL OldIrql;
+    ULONG i;
+#ifdef CONFIG_SMP
+    KAFFINITY TargetAffinity;
+    PKPRCB Prcb = KeGetCurrentPrcb();
+#endif
+
+    ASSERT(Number <= KI_MAXIMUM_FLUSH_COUNT);
+
+    /* Raise the IRQL for the TB Flush */
+    OldIrql = KeRaiseIrqlToSynchLevel();
+
+#ifdef CONFIG_SMP
+    /* Get the processors to flush, and exclude ourselves */
+    if (AllProcessors)
+    {
+        TargetAffinity = KeActiveProcessors;
+    }
+    else
+    {
+        TargetAffinity = Prcb->CurrentThread->ApcState.Process->ActiveProcessors;
+    }
+    TargetAffinity &= ~Prcb->SetMember;
+
+    /* Make sure this is MP */
+    if (TargetAffinity)
+    {
+        /* Send a single IPI for the whole list to the other processors */
+        KiIpiSendPacket(TargetAffinity,
+                        KiFlushTargetMultipleTb,
+                        NULL,
+                        (ULONG_PTR)Virtual,
+                        &Number);
+    }
+#endif
+
+    /* Flush the entries on the current CPU */
+    for (i = 0; i < Number; i++)
+    {
+        KeInvalidateTlbEntry(Virtual[i]);
+    }
+
+#ifdef CONFIG_SMP
+    /* If this is MP, wait for the other processors to finish */
+    if (TargetAffinity)
+    {
+        /* Sanity check */
+        ASSERT(Prcb == KeGetCurrentPrcb());
+
+        KiIpiStallOnPacketTargets();
+    }
+#endif
+
+    /* Return to original IRQL */
+    KeLowerIrql(OldIrql);
+}
+
 /*
  * @implemented
  */
@@ -283,6 +283,18 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+        /* Wake up the DPC thread if a threaded DPC was queued to us */
+        KiIdleSignalDpcThread(Prcb);
+
+#ifdef CONFIG_SMP
+        /* Look for work on the other processors if we were asked to */
+        if (Prcb->IdleSchedule)
+        {
+            /* This picks up our own ready queue too */
+            KiIdleSchedule(Prcb);
+        }
+#endif
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
@@ -376,6 +388,14 @@ KiSwapContextExit(IN PKTHREAD OldThread,
     /* Increase thread context switches */
     NewThread->ContextSwitches++;
 
+    /* Trace the switch */
+    KiTraceScheduler(SchedulerTraceContextSwitch,
+                     OldThread,
+                     NewThread,
+                     NewThread->Priority,
+                     OldThread->WaitReason,
+                     OldThread->State);
+
     /* Load data from switch frame */
     Pcr->NtTib.ExceptionList = SwitchFrame->ExceptionList;
 
@@ -254,4 +254,26 @@ _KiSystemCallTrampoline@12:
     leave
 
     ret 12
+
+/*
+BOOLEAN
+FASTCALL
+KiReadProfileUserPointer(IN PULONG_PTR Address,
+                         OUT PULONG_PTR Value);
+*/
+PUBLIC @KiReadProfileUserPointer@8
+PUBLIC _KiReadProfileUserPointerFault@0
+PUBLIC _KiReadProfileUserPointerResume@0
+@KiReadProfileUserPointer@8:
+
+    /* Assume success */
+    mov eax, 1
+
+    /* A page fault on this read resumes below with eax cleared */
+_KiReadProfileUserPointerFault@0:
+    mov ecx, [ecx]
+    mov [edx], ecx
+_KiReadProfileUserPointerResume@0:
+    ret
+
 END
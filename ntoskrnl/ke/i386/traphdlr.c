@@ -1343,6 +1343,14 @@ KiTrap0EHandler(IN PKTRAP_FRAME TrapFrame)
     /* Save CR2 */
     Cr2 = __readcr2();
 
+    /* The stack profiler can't take page faults, fail its read instead */
+    if (TrapFrame->Eip == (ULONG_PTR)KiReadProfileUserPointerFault)
+    {
+        TrapFrame->Eax = FALSE;
+        TrapFrame->Eip = (ULONG_PTR)KiReadProfileUserPointerResume;
+        KiEoiHelper(TrapFrame);
+    }
+
     /* Enable interrupts */
     _enable();
 
@@ -20,6 +20,14 @@ extern KSPIN_LOCK KiReverseStallIpiLock;
 
 #ifndef _M_AMD64
 
+/*!
+ * \brief Runs the function of KeIpiGenericCall on a target processor.
+ *
+ * Every target checks in by decrementing the count, then waits for the
+ * sender to clear it so that all processors call the function together.
+ * The count lives on the sender's stack, which stays valid until every
+ * target has signaled the packet done.
+ */
 VOID
 NTAPI
 KiIpiGenericCallTarget(IN PKIPI_CONTEXT PacketContext,
@@ -27,8 +35,18 @@ KiIpiGenericCallTarget(IN PKIPI_CONTEXT PacketContext,
                        IN PVOID Argument,
                        IN PVOID Count)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("Not yet implemented\n", FALSE);
+    /* Tell the sender we are ready */
+    InterlockedDecrement((PLONG)Count);
+
+    /* Wait until it lets everyone go */
+    while (*(volatile ULONG*)Count != 0)
+    {
+        YieldProcessor();
+    }
+
+    /* Call the function and let the sender return */
+    ((PKIPI_BROADCAST_WORKER)BroadcastFunction)((ULONG_PTR)Argument);
+    KiIpiSignalPacketDone(PacketContext);
 }
 
 VOID
@@ -36,10 +54,42 @@ FASTCALL
 KiIpiSend(IN KAFFINITY TargetProcessors,
           IN ULONG IpiRequest)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    KAFFINITY RemainingSet;
+    ULONG Processor;
+
+    /* Only the software interrupt requests are sent without a packet */
+    ASSERT((IpiRequest == IPI_APC) || (IpiRequest == IPI_DPC));
+
+    /* Flag the request on every target */
+    RemainingSet = TargetProcessors;
+    while (RemainingSet)
+    {
+        NT_VERIFY(BitScanForwardAffinity(&Processor, RemainingSet) != 0);
+        RemainingSet &= ~AFFINITY_MASK(Processor);
+        InterlockedOr((PLONG)&KiProcessorBlock[Processor]->RequestSummary, IpiRequest);
+    }
+
+    /* Send one IPI for the whole set */
+    HalRequestIpi(TargetProcessors);
+#else
+    UNREFERENCED_PARAMETER(TargetProcessors);
+    UNREFERENCED_PARAMETER(IpiRequest);
+#endif
 }
 
+/*!
+ * \brief Sends a request packet to a set of processors.
+ *
+ * The packet lives in the sender's PRCB until every target has signaled it
+ * done. Each target takes one packet at a time through its SignalDone slot,
+ * so the sender may have to wait for the target to pick up the packet of
+ * another sender first. That target gets its IPI as soon as its slot is
+ * claimed, and IPIs are delivered above SYNCH_LEVEL, so this can't deadlock.
+ * The caller must be at or above DISPATCH_LEVEL, and has to wait for the
+ * packet to be completed with KiIpiStallOnPacketTargets before sending the
+ * next one.
+ */
 VOID
 NTAPI
 KiIpiSendPacket(IN KAFFINITY TargetProcessors,
@@ -48,97 +98,111 @@ KiIpiSendPacket(IN KAFFINITY TargetProcessors,
                 IN ULONG_PTR Context,
                 IN PULONG Count)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    PKPRCB Prcb = KeGetCurrentPrcb();
+    PKPRCB TargetPrcb;
+    KAFFINITY RemainingSet;
+    ULONG Processor;
+
+    ASSERT(KeGetCurrentIrql() >= DISPATCH_LEVEL);
+    ASSERT((TargetProcessors & Prcb->SetMember) == 0);
+
+    /* The previous packet must have been completed */
+    ASSERT(Prcb->TargetSet == 0);
+
+    /* Fill the packet */
+    Prcb->WorkerRoutine = WorkerFunction;
+    Prcb->CurrentPacket[0] = (PVOID)BroadcastFunction;
+    Prcb->CurrentPacket[1] = (PVOID)Context;
+    Prcb->CurrentPacket[2] = Count;
+    Prcb->TargetSet = TargetProcessors;
+
+    /* Post it to every target */
+    RemainingSet = TargetProcessors;
+    while (RemainingSet)
+    {
+        NT_VERIFY(BitScanForwardAffinity(&Processor, RemainingSet) != 0);
+        RemainingSet &= ~AFFINITY_MASK(Processor);
+        TargetPrcb = KiProcessorBlock[Processor];
+
+        /* Wait for the target to pick up the packet of the previous sender */
+        while (InterlockedCompareExchangePointer((PVOID*)&TargetPrcb->SignalDone,
+                                                 Prcb,
+                                                 NULL) != NULL)
+        {
+            YieldProcessor();
+        }
+
+        /* Let the target know that it has a packet */
+        InterlockedOr((PLONG)&TargetPrcb->RequestSummary, IPI_PACKET_READY);
+        HalRequestIpi(AFFINITY_MASK(Processor));
+    }
+#else
+    UNREFERENCED_PARAMETER(TargetProcessors);
+    UNREFERENCED_PARAMETER(WorkerFunction);
+    UNREFERENCED_PARAMETER(BroadcastFunction);
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(Count);
+#endif
 }
 
+/*!
+ * \brief Signals the sender of a packet that this processor is done with it.
+ *
+ * \param PacketContext - The context that was passed to the worker routine.
+ */
 VOID
 FASTCALL
 KiIpiSignalPacketDone(IN PKIPI_CONTEXT PacketContext)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("Not yet implemented\n", FALSE);
+    PKPRCB SenderPrcb = (PKPRCB)PacketContext;
+
+    /* Remove ourselves from the sender's target set */
+    InterlockedBitTestAndReset((PLONG)&SenderPrcb->TargetSet,
+                               KeGetCurrentProcessorNumber());
 }
 
+/*!
+ * \brief Signals the sender of a packet that this processor is done with it,
+ * then waits for the sender to change the reverse stall value.
+ *
+ * \param PacketContext - The context that was passed to the worker routine.
+ * \param ReverseStall - The value the sender changes to release the target.
+ */
 VOID
 FASTCALL
 KiIpiSignalPacketDoneAndStall(IN PKIPI_CONTEXT PacketContext,
                               IN volatile PULONG ReverseStall)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("Not yet implemented\n", FALSE);
-}
+    ULONG StallValue;
 
-#if 0
-VOID
-NTAPI
-KiIpiSendRequest(IN KAFFINITY TargetSet,
-                 IN ULONG IpiRequest)
-{
-#ifdef CONFIG_SMP
-    LONG i;
-    PKPRCB Prcb;
-    KAFFINITY Current;
+    /* Read it before the sender can see us done and change it */
+    StallValue = *ReverseStall;
+    KiIpiSignalPacketDone(PacketContext);
 
-    for (i = 0, Current = 1; i < KeNumberProcessors; i++, Current <<= 1)
+    while (*ReverseStall == StallValue)
     {
-        if (TargetSet & Current)
-        {
-            /* Get the PRCB for this CPU */
-            Prcb = KiProcessorBlock[i];
-
-            InterlockedBitTestAndSet((PLONG)&Prcb->IpiFrozen, IpiRequest);
-            HalRequestIpi(i);
-        }
+        YieldProcessor();
     }
-#endif
 }
 
+/*!
+ * \brief Waits until all targets of the current packet have completed it.
+ */
 VOID
-NTAPI
-KiIpiSendPacket(IN KAFFINITY TargetSet,
-                IN PKIPI_BROADCAST_WORKER WorkerRoutine,
-                IN ULONG_PTR Argument,
-                IN ULONG Count,
-                IN BOOLEAN Synchronize)
+FASTCALL
+KiIpiStallOnPacketTargets(VOID)
 {
 #ifdef CONFIG_SMP
-    KAFFINITY Processor;
-    LONG i;
-    PKPRCB Prcb, CurrentPrcb;
-    KIRQL oldIrql;
-
-    ASSERT(KeGetCurrentIrql() == SYNCH_LEVEL);
-
-    CurrentPrcb = KeGetCurrentPrcb();
-    (void)InterlockedExchangeUL(&CurrentPrcb->TargetSet, TargetSet);
-    (void)InterlockedExchangeUL(&CurrentPrcb->WorkerRoutine, (ULONG_PTR)WorkerRoutine);
-    (void)InterlockedExchangePointer(&CurrentPrcb->CurrentPacket[0], Argument);
-    (void)InterlockedExchangeUL(&CurrentPrcb->CurrentPacket[1], Count);
-    (void)InterlockedExchangeUL(&CurrentPrcb->CurrentPacket[2], Synchronize ? 1 : 0);
+    PKPRCB Prcb = KeGetCurrentPrcb();
 
-    for (i = 0, Processor = 1; i < KeNumberProcessors; i++, Processor <<= 1)
+    /* IPIs are delivered above SYNCH_LEVEL, so we can't deadlock here */
+    while (*(volatile KAFFINITY*)&Prcb->TargetSet)
     {
-        if (TargetSet & Processor)
-        {
-            Prcb = KiProcessorBlock[i];
-            while (0 != InterlockedCompareExchangeUL(&Prcb->SignalDone, (LONG)CurrentPrcb, 0));
-            InterlockedBitTestAndSet((PLONG)&Prcb->IpiFrozen, IPI_SYNCH_REQUEST);
-            if (Processor != CurrentPrcb->SetMember)
-            {
-                HalRequestIpi(i);
-            }
-        }
-    }
-    if (TargetSet & CurrentPrcb->SetMember)
-    {
-        KeRaiseIrql(IPI_LEVEL, &oldIrql);
-        KiIpiServiceRoutine(NULL, NULL);
-        KeLowerIrql(oldIrql);
+        YieldProcessor();
     }
 #endif
 }
-#endif
 
 /* PUBLIC FUNCTIONS **********************************************************/
 
@@ -151,40 +215,44 @@ KiIpiServiceRoutine(IN PKTRAP_FRAME TrapFrame,
                     IN PKEXCEPTION_FRAME ExceptionFrame)
 {
 #ifdef CONFIG_SMP
-    PKPRCB Prcb;
+    PKPRCB Prcb, SenderPrcb;
+    PKIPI_WORKER WorkerRoutine;
+    PVOID Packet[3];
+    ULONG RequestSummary;
+
     ASSERT(KeGetCurrentIrql() == IPI_LEVEL);
 
     Prcb = KeGetCurrentPrcb();
 
-    if (InterlockedBitTestAndReset((PLONG)&Prcb->IpiFrozen, IPI_APC))
+    /* Grab all pending requests at once */
+    RequestSummary = InterlockedExchange((PLONG)&Prcb->RequestSummary, 0);
+
+    if (RequestSummary & IPI_APC)
     {
         HalRequestSoftwareInterrupt(APC_LEVEL);
     }
 
-    if (InterlockedBitTestAndReset((PLONG)&Prcb->IpiFrozen, IPI_DPC))
+    if (RequestSummary & IPI_DPC)
     {
         Prcb->DpcInterruptRequested = TRUE;
         HalRequestSoftwareInterrupt(DISPATCH_LEVEL);
     }
 
-    if (InterlockedBitTestAndReset((PLONG)&Prcb->IpiFrozen, IPI_SYNCH_REQUEST))
+    if (RequestSummary & IPI_PACKET_READY)
     {
-#if defined(_M_ARM) || defined(_M_AMD64)
-        DbgBreakPoint();
-#else
-        (void)InterlockedDecrementUL(&Prcb->SignalDone->CurrentPacket[1]);
-        if (InterlockedCompareExchangeUL(&Prcb->SignalDone->CurrentPacket[2], 0, 0))
-        {
-            while (0 != InterlockedCompareExchangeUL(&Prcb->SignalDone->CurrentPacket[1], 0, 0));
-        }
-        ((VOID (NTAPI*)(PVOID))(Prcb->SignalDone->WorkerRoutine))(Prcb->SignalDone->CurrentPacket[0]);
-        InterlockedBitTestAndReset((PLONG)&Prcb->SignalDone->TargetSet, KeGetCurrentProcessorNumber());
-        if (InterlockedCompareExchangeUL(&Prcb->SignalDone->CurrentPacket[2], 0, 0))
-        {
-            while (0 != InterlockedCompareExchangeUL(&Prcb->SignalDone->TargetSet, 0, 0));
-        }
-        (void)InterlockedExchangePointer((PVOID*)&Prcb->SignalDone, NULL);
-#endif // _M_ARM
+        /* The packet stays in the sender's PRCB until we signal it done */
+        SenderPrcb = (PKPRCB)Prcb->SignalDone;
+        ASSERT(SenderPrcb != NULL);
+        WorkerRoutine = SenderPrcb->WorkerRoutine;
+        Packet[0] = SenderPrcb->CurrentPacket[0];
+        Packet[1] = SenderPrcb->CurrentPacket[1];
+        Packet[2] = SenderPrcb->CurrentPacket[2];
+
+        /* Free the slot for the next sender */
+        InterlockedExchangePointer((PVOID*)&Prcb->SignalDone, NULL);
+
+        /* Call the worker, it signals the sender when it's done */
+        WorkerRoutine((PKIPI_CONTEXT)SenderPrcb, Packet[0], Packet[1], Packet[2]);
     }
 #endif
    return TRUE;
@@ -260,8 +328,8 @@ KeIpiGenericCall(IN PKIPI_BROADCAST_WORKER Function,
         /* Sanity check */
         ASSERT(Prcb == KeGetCurrentPrcb());
 
-        /* FIXME: TODO */
-        ASSERTMSG("Not yet implemented\n", FALSE);
+        /* The count on our stack must stay valid until they are done with it */
+        KiIpiStallOnPacketTargets();
     }
 #endif
 
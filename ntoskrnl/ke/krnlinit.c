@@ -89,6 +89,11 @@ KiInitSystem(VOID)
         InitializeListHead(&KiTimerTableListHead[i].Entry);
         KiTimerTableListHead[i].Time.HighPart = 0xFFFFFFFF;
         KiTimerTableListHead[i].Time.LowPart = 0;
+
+        /* Initialize the overflow list for far away timers as well */
+        InitializeListHead(&KiTimerOverflowListHead[i]);
+        KiTimerOverflowTime[i].HighPart = 0xFFFFFFFF;
+        KiTimerOverflowTime[i].LowPart = 0;
     }
 
     /* Initialize the Swap event and all swap lists */
@@ -100,6 +105,9 @@ KiInitSystem(VOID)
     /* Initialize the mutex for generic DPC calls */
     ExInitializeFastMutex(&KiGenericCallDpcMutex);
 
+    /* Initialize the mutex for the call stack sampler */
+    ExInitializeFastMutex(&KiStackProfileMutex);
+
     /* Initialize the syscall table */
     KeServiceDescriptorTable[0].Base = MainSSDT;
     KeServiceDescriptorTable[0].Count = NULL;
@@ -200,6 +208,11 @@ KiInitSpinLocks(IN PKPRCB Prcb,
     KeInitializeSpinLock(&Prcb->DpcData[DPC_NORMAL].DpcLock);
     Prcb->DpcData[DPC_NORMAL].DpcQueueDepth = 0;
     Prcb->DpcData[DPC_NORMAL].DpcCount = 0;
+    InitializeListHead(&Prcb->DpcData[DPC_THREADED].DpcListHead);
+    KeInitializeSpinLock(&Prcb->DpcData[DPC_THREADED].DpcLock);
+    Prcb->DpcData[DPC_THREADED].DpcQueueDepth = 0;
+    Prcb->DpcData[DPC_THREADED].DpcCount = 0;
+    KeInitializeEvent(&Prcb->DpcEvent, SynchronizationEvent, FALSE);
     Prcb->DpcRoutineActive = FALSE;
     Prcb->MaximumDpcQueueDepth = KiMaximumDpcQueueDepth;
     Prcb->MinimumDpcRate = KiMinimumDpcRate;
@@ -291,11 +304,19 @@ BOOLEAN
 NTAPI
 KeInitSystem(VOID)
 {
+    ULONG i;
+
+    /* Start the scheduler trace */
+    KiInitializeSchedulerTrace();
+
     /* Check if Threaded DPCs are enabled */
     if (KeThreadDpcEnable)
     {
-        /* FIXME: TODO */
-        DPRINT1("Threaded DPCs not yet supported\n");
+        /* Start the DPC thread of each processor */
+        for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+        {
+            KiStartDpcThread(KiProcessorBlock[i]);
+        }
     }
 
     /* Initialize non-portable parts of the kernel */
@@ -21,6 +21,33 @@ KSPIN_LOCK KiProfileLock;
 ULONG KiProfileTimeInterval = 78125; /* Default resolution 7.8ms (sysinternals) */
 ULONG KiProfileAlignmentFixupInterval;
 
+/* Call stack sampling */
+#define KI_STACK_PROFILE_DEFAULT_SAMPLES    512
+#define KI_STACK_PROFILE_MAXIMUM_SAMPLES    16384
+
+typedef struct _KI_STACK_PROFILE_RING
+{
+    volatile ULONG Head;
+    volatile ULONG Tail;
+    volatile LONG Dropped;
+    ULONG Mask;
+    SYSTEM_STACK_PROFILE_SAMPLE Samples[ANYSIZE_ARRAY];
+} KI_STACK_PROFILE_RING, *PKI_STACK_PROFILE_RING;
+
+BOOLEAN KiStackProfileEnabled;
+BOOLEAN KiStackProfileUserStacks;
+ULONG KiStackProfileRingSize;
+PKI_STACK_PROFILE_RING KiStackProfileRing[MAXIMUM_PROCESSORS];
+FAST_MUTEX KiStackProfileMutex;
+
+#ifdef _M_AMD64
+/* The function table of the kernel image, the only one we can look up at profile IRQL */
+static PRUNTIME_FUNCTION KiStackProfileFunctionTable;
+static ULONG KiStackProfileFunctionCount;
+static ULONG64 KiStackProfileImageBase;
+static ULONG64 KiStackProfileImageEnd;
+#endif
+
 /* FUNCTIONS *****************************************************************/
 
 VOID
@@ -201,8 +228,11 @@ KeStopProfile(IN PKPROFILE Profile)
     /* Release the profile lock */
     KeReleaseSpinLockFromDpcLevel(&KiProfileLock);
 
-    /* Stop the profile interrupt */
-    HalStopProfileInterrupt(Profile->Source);
+    /* Stop the profile interrupt, unless the stack sampler still needs it */
+    if (!(KiStackProfileEnabled) || (Profile->Source != ProfileTime))
+    {
+        HalStopProfileInterrupt(Profile->Source);
+    }
 
     /* Lower back to original IRQL */
     KeLowerIrql(OldIrql);
@@ -299,6 +329,534 @@ KeProfileInterrupt(IN PKTRAP_FRAME TrapFrame)
     KeProfileInterruptWithSource(TrapFrame, ProfileTime);
 }
 
+static
+UCHAR
+KiCaptureProfileFrames(IN ULONG_PTR FramePointer,
+                       IN ULONG_PTR StackLow,
+                       IN ULONG_PTR StackHigh,
+                       IN BOOLEAN UserStack,
+                       OUT PVOID *Frames,
+                       IN ULONG Count)
+{
+#ifdef _M_IX86
+    ULONG_PTR NextFrame, ReturnAddress;
+    ULONG i = 0;
+
+    /* Follow the EBP chain for as long as it stays inside the stack */
+    while ((i < Count) &&
+           (FramePointer >= StackLow) &&
+           (FramePointer <= (StackHigh - 2 * sizeof(ULONG_PTR))) &&
+           !(FramePointer & (sizeof(ULONG_PTR) - 1)))
+    {
+        /* Get the caller's frame and the return address */
+        if (UserStack)
+        {
+            /*
+             * We can't take page faults at profile IRQL, and the process can
+             * unmap its stack at any time, so the reads must be able to fail.
+             */
+            if (!(KiReadProfileUserPointer((PULONG_PTR)FramePointer, &NextFrame)) ||
+                !(KiReadProfileUserPointer((PULONG_PTR)FramePointer + 1, &ReturnAddress)))
+            {
+                break;
+            }
+        }
+        else
+        {
+            NextFrame = ((PULONG_PTR)FramePointer)[0];
+            ReturnAddress = ((PULONG_PTR)FramePointer)[1];
+        }
+        if (!ReturnAddress) break;
+        Frames[i++] = (PVOID)ReturnAddress;
+
+        /* Frames must move up the stack */
+        if (NextFrame <= FramePointer) break;
+        FramePointer = NextFrame;
+    }
+
+    return (UCHAR)i;
+#else
+    /*
+     * There is no frame chain to follow. amd64 unwinds kernel stacks with
+     * KiUnwindProfileFrames, but user stacks would need the module list of
+     * the process, so only the interrupted PCs are recorded.
+     */
+    UNREFERENCED_PARAMETER(FramePointer);
+    UNREFERENCED_PARAMETER(StackLow);
+    UNREFERENCED_PARAMETER(StackHigh);
+    UNREFERENCED_PARAMETER(UserStack);
+    UNREFERENCED_PARAMETER(Frames);
+    UNREFERENCED_PARAMETER(Count);
+    return 0;
+#endif
+}
+
+#ifdef _M_AMD64
+static
+VOID
+KiInitializeProfileUnwind(VOID)
+{
+    PIMAGE_NT_HEADERS NtHeaders;
+    PRUNTIME_FUNCTION FunctionTable;
+    ULONG Size;
+
+    if (KiStackProfileFunctionTable) return;
+
+    /* The kernel image never goes away, so its table can be used without a lock */
+    NtHeaders = RtlImageNtHeader((PVOID)PsNtosImageBase);
+    FunctionTable = RtlImageDirectoryEntryToData((PVOID)PsNtosImageBase,
+                                                 TRUE,
+                                                 IMAGE_DIRECTORY_ENTRY_EXCEPTION,
+                                                 &Size);
+    if (!(NtHeaders) || !(FunctionTable)) return;
+
+    KiStackProfileImageBase = PsNtosImageBase;
+    KiStackProfileImageEnd = PsNtosImageBase + NtHeaders->OptionalHeader.SizeOfImage;
+    KiStackProfileFunctionCount = Size / sizeof(RUNTIME_FUNCTION);
+    KiStackProfileFunctionTable = FunctionTable;
+}
+
+static
+PRUNTIME_FUNCTION
+KiLookupProfileFunctionEntry(IN ULONG64 ControlPc)
+{
+    PRUNTIME_FUNCTION FunctionEntry;
+    ULONG IndexLo, IndexHi, IndexMid;
+    ULONG Rva = (ULONG)(ControlPc - KiStackProfileImageBase);
+
+    /* Binary search the table, like RtlLookupFunctionEntry does */
+    IndexLo = 0;
+    IndexHi = KiStackProfileFunctionCount;
+    while (IndexHi > IndexLo)
+    {
+        IndexMid = (IndexLo + IndexHi) / 2;
+        FunctionEntry = &KiStackProfileFunctionTable[IndexMid];
+
+        if (Rva < FunctionEntry->BeginAddress)
+        {
+            IndexHi = IndexMid;
+        }
+        else if (Rva >= FunctionEntry->EndAddress)
+        {
+            IndexLo = IndexMid + 1;
+        }
+        else
+        {
+            return FunctionEntry;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * RtlWalkFrameChain looks up modules under the loaded module spinlock, which
+ * can't be taken at profile IRQL. So we unwind with the function table of the
+ * kernel image only, and stop at the first return address outside of it.
+ */
+static
+UCHAR
+KiUnwindProfileFrames(IN PKTRAP_FRAME TrapFrame,
+                      IN ULONG64 StackLow,
+                      IN ULONG64 StackHigh,
+                      OUT PVOID *Frames,
+                      IN ULONG Count)
+{
+    CONTEXT Context;
+    PRUNTIME_FUNCTION FunctionEntry;
+    PVOID HandlerData;
+    ULONG64 EstablisherFrame;
+    ULONG i = 0;
+
+    if (!KiStackProfileFunctionTable) return 0;
+
+    /* Prologs only save the nonvolatile registers, Rbp can be the frame pointer */
+    RtlZeroMemory(&Context, sizeof(Context));
+    Context.Rip = TrapFrame->Rip;
+    Context.Rsp = TrapFrame->Rsp;
+    Context.Rbp = TrapFrame->Rbp;
+
+    while ((i < Count) &&
+           (Context.Rip >= KiStackProfileImageBase) &&
+           (Context.Rip < KiStackProfileImageEnd) &&
+           (Context.Rsp >= StackLow) &&
+           (Context.Rsp < StackHigh) &&
+           !(Context.Rsp & (sizeof(ULONG64) - 1)))
+    {
+        FunctionEntry = KiLookupProfileFunctionEntry(Context.Rip);
+        if (FunctionEntry)
+        {
+            RtlVirtualUnwind(UNW_FLAG_NHANDLER,
+                             KiStackProfileImageBase,
+                             Context.Rip,
+                             FunctionEntry,
+                             &Context,
+                             &HandlerData,
+                             &EstablisherFrame,
+                             NULL);
+        }
+        else
+        {
+            /* Leaf function, the return address is on top of the stack */
+            Context.Rip = *(PULONG64)Context.Rsp;
+            Context.Rsp += sizeof(ULONG64);
+        }
+
+        /* Record the caller, even if we can't unwind it */
+        if (!Context.Rip) break;
+        Frames[i++] = (PVOID)Context.Rip;
+    }
+
+    return (UCHAR)i;
+}
+#endif
+
+static
+UCHAR
+KiCaptureProfileKernelStack(IN PKTRAP_FRAME TrapFrame,
+                            OUT PVOID *Frames,
+                            IN ULONG Count)
+{
+    PKTHREAD Thread = KeGetCurrentThread();
+    ULONG_PTR FramePointer, StackLow, StackHigh;
+
+    /* The interrupted instruction is the first frame */
+    Frames[0] = (PVOID)KeGetTrapFramePc(TrapFrame);
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+    /* Find out which kernel stack the frame chain lives on */
+#ifdef _M_IX86
+    FramePointer = TrapFrame->Ebp;
+#else
+    FramePointer = TrapFrame->Rsp;
+#endif
+    StackLow = (ULONG_PTR)Thread->StackLimit;
+    StackHigh = (ULONG_PTR)Thread->StackBase;
+    if ((FramePointer < StackLow) || (FramePointer >= StackHigh))
+    {
+        StackHigh = (ULONG_PTR)KeGetCurrentPrcb()->DpcStack;
+        StackLow = StackHigh - KERNEL_STACK_SIZE;
+    }
+#else
+    FramePointer = StackLow = StackHigh = 0;
+    UNREFERENCED_PARAMETER(Thread);
+#endif
+
+    /* Add the callers */
+#ifdef _M_AMD64
+    return 1 + KiUnwindProfileFrames(TrapFrame,
+                                     StackLow,
+                                     StackHigh,
+                                     &Frames[1],
+                                     Count - 1);
+#else
+    return 1 + KiCaptureProfileFrames(FramePointer,
+                                      StackLow,
+                                      StackHigh,
+                                      FALSE,
+                                      &Frames[1],
+                                      Count - 1);
+#endif
+}
+
+static
+UCHAR
+KiCaptureProfileUserStack(IN PKTRAP_FRAME TrapFrame,
+                          OUT PVOID *Frames,
+                          IN ULONG Count)
+{
+    PKTHREAD Thread = KeGetCurrentThread();
+    PNT_TIB Tib;
+    ULONG_PTR StackLow, StackHigh;
+
+    /* System threads have no user stack, and attached threads see another address space */
+    Tib = Thread->Teb;
+    if (!(Tib) || !(Count) || (KeIsAttachedProcess())) return 0;
+
+    /* If we interrupted kernel mode, the user state is in the thread's first trap frame */
+    if (KeGetTrapFramePc(TrapFrame) > (ULONG_PTR)MmHighestUserAddress)
+    {
+        TrapFrame = KeGetTrapFrame(Thread);
+        if (KeGetTrapFramePc(TrapFrame) > (ULONG_PTR)MmHighestUserAddress) return 0;
+    }
+
+    /* The user instruction is the first frame */
+    Frames[0] = (PVOID)KeGetTrapFramePc(TrapFrame);
+    if (!KiStackProfileUserStacks) return 1;
+
+#ifdef _M_IX86
+    /* The TEB is user memory too, read it the same way as the stack */
+    if (!(KiReadProfileUserPointer((PULONG_PTR)&Tib->StackLimit, &StackLow)) ||
+        !(KiReadProfileUserPointer((PULONG_PTR)&Tib->StackBase, &StackHigh)))
+    {
+        return 1;
+    }
+
+    /* The process controls its TEB, don't let it point us at kernel memory */
+    StackHigh = min(StackHigh, (ULONG_PTR)MmHighestUserAddress + 1);
+    if (StackHigh <= StackLow) return 1;
+
+    /* Add the callers */
+    return 1 + KiCaptureProfileFrames(TrapFrame->Ebp,
+                                      StackLow,
+                                      StackHigh,
+                                      TRUE,
+                                      &Frames[1],
+                                      Count - 1);
+#else
+    /* Only i386 has a frame chain and a fault safe read, see KiCaptureProfileFrames */
+    UNREFERENCED_PARAMETER(StackLow);
+    UNREFERENCED_PARAMETER(StackHigh);
+    return 1;
+#endif
+}
+
+static
+VOID
+KiRecordStackSample(IN PKTRAP_FRAME TrapFrame)
+{
+    PKI_STACK_PROFILE_RING Ring;
+    PSYSTEM_STACK_PROFILE_SAMPLE Sample;
+    ULONG Head, Processor;
+    UCHAR KernelFrames = 0;
+
+    /* Get this processor's ring, we are its only writer */
+    Processor = KeGetCurrentProcessorNumber();
+    Ring = KiStackProfileRing[Processor];
+    if (!Ring) return;
+
+    /* Drop the sample if the reader is behind */
+    Head = Ring->Head;
+    if ((Head - Ring->Tail) > Ring->Mask)
+    {
+        InterlockedIncrement(&Ring->Dropped);
+        return;
+    }
+
+    /* Fill out the sample */
+    Sample = &Ring->Samples[Head & Ring->Mask];
+    Sample->InterruptTime = KeQueryInterruptTime();
+    Sample->UniqueProcess = PsGetCurrentProcessId();
+    Sample->UniqueThread = PsGetCurrentThreadId();
+    Sample->Processor = (USHORT)Processor;
+    Sample->Reserved = 0;
+
+    /* Capture the kernel stack, if we interrupted kernel mode */
+    if (KeGetTrapFramePc(TrapFrame) > (ULONG_PTR)MmHighestUserAddress)
+    {
+        KernelFrames = KiCaptureProfileKernelStack(TrapFrame,
+                                                   Sample->Frames,
+                                                   SYSTEM_STACK_PROFILE_MAX_FRAMES);
+    }
+    Sample->KernelFrameCount = KernelFrames;
+
+    /* And the user stack after it */
+    Sample->UserFrameCount = KiCaptureProfileUserStack(TrapFrame,
+                                                       &Sample->Frames[KernelFrames],
+                                                       SYSTEM_STACK_PROFILE_MAX_FRAMES - KernelFrames);
+
+    /* Publish it */
+    KeMemoryBarrier();
+    Ring->Head = Head + 1;
+}
+
+static
+VOID
+KiFlushStackProfileSamplers(VOID)
+{
+    ULONG i;
+
+    /*
+     * Run on every processor once. Getting scheduled there means that no
+     * profile interrupt is still in the middle of writing to the rings.
+     */
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        KeSetSystemAffinityThread(AFFINITY_MASK(i));
+    }
+    KeRevertToUserAffinityThread();
+}
+
+static
+VOID
+KiFreeStackProfileRings(VOID)
+{
+    ULONG i;
+
+    /* Free all the rings */
+    for (i = 0; i < MAXIMUM_PROCESSORS; i++)
+    {
+        if (KiStackProfileRing[i])
+        {
+            ExFreePoolWithTag(KiStackProfileRing[i], 'kfrP');
+            KiStackProfileRing[i] = NULL;
+        }
+    }
+    KiStackProfileRingSize = 0;
+}
+
+NTSTATUS
+NTAPI
+KeQueryStackProfile(
+    _Out_writes_bytes_to_(Length, *ReturnLength) PSYSTEM_STACK_PROFILE_INFORMATION Information,
+    _In_ ULONG Length,
+    _Out_ PULONG ReturnLength)
+{
+    PKI_STACK_PROFILE_RING Ring;
+    ULONG i, Tail, Count = 0, MaximumCount, Dropped = 0;
+
+    /* We need at least the header */
+    *ReturnLength = FIELD_OFFSET(SYSTEM_STACK_PROFILE_INFORMATION, Samples);
+    if (Length < *ReturnLength) return STATUS_INFO_LENGTH_MISMATCH;
+    MaximumCount = (Length - *ReturnLength) / sizeof(SYSTEM_STACK_PROFILE_SAMPLE);
+
+    /* Only one reader at a time */
+    ExAcquireFastMutex(&KiStackProfileMutex);
+    _SEH2_TRY
+    {
+        /* Drain as many samples as fit, processor by processor */
+        for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+        {
+            Ring = KiStackProfileRing[i];
+            if (!Ring) continue;
+
+            Tail = Ring->Tail;
+            while ((Count < MaximumCount) && (Tail != Ring->Head))
+            {
+                /* Make sure we see the sample the interrupt published */
+                KeMemoryBarrier();
+                Information->Samples[Count++] = Ring->Samples[Tail & Ring->Mask];
+
+                /* Hand the slot back */
+                KeMemoryBarrier();
+                Ring->Tail = ++Tail;
+            }
+
+            Dropped += InterlockedExchange(&Ring->Dropped, 0);
+        }
+
+        /* Fill out the header */
+        Information->Enabled = KiStackProfileEnabled;
+        Information->CaptureUserStacks = KiStackProfileUserStacks;
+        Information->Interval = KeQueryIntervalProfile(ProfileTime);
+        Information->DroppedSamples = Dropped;
+        Information->NumberOfSamples = Count;
+    }
+    _SEH2_FINALLY
+    {
+        ExReleaseFastMutex(&KiStackProfileMutex);
+    }
+    _SEH2_END;
+
+    /* Return how much we wrote */
+    *ReturnLength += Count * sizeof(SYSTEM_STACK_PROFILE_SAMPLE);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+KeSetStackProfile(
+    _In_ BOOLEAN Enable,
+    _In_ BOOLEAN CaptureUserStacks,
+    _In_ ULONG Interval,
+    _In_ ULONG SamplesPerProcessor)
+{
+    PKPROFILE_SOURCE_OBJECT CurrentSource;
+    PLIST_ENTRY NextEntry;
+    BOOLEAN SourceInUse = FALSE;
+    NTSTATUS Status = STATUS_SUCCESS;
+    KIRQL OldIrql;
+    ULONG i, RingSize;
+
+    /* Round the ring size up to a power of two */
+    if (!SamplesPerProcessor) SamplesPerProcessor = KI_STACK_PROFILE_DEFAULT_SAMPLES;
+    SamplesPerProcessor = min(SamplesPerProcessor, KI_STACK_PROFILE_MAXIMUM_SAMPLES);
+    for (RingSize = 1; RingSize < SamplesPerProcessor; RingSize <<= 1);
+
+    ExAcquireFastMutex(&KiStackProfileMutex);
+
+    /* Check if we're being stopped */
+    if (!Enable)
+    {
+        if (KiStackProfileEnabled)
+        {
+            /* Stop sampling, the rings are kept so they can still be drained */
+            KiStackProfileEnabled = FALSE;
+
+            /* Check if a regular profile still uses the timer source */
+            KeRaiseIrql(KiProfileIrql, &OldIrql);
+            KeAcquireSpinLockAtDpcLevel(&KiProfileLock);
+            for (NextEntry = KiProfileSourceListHead.Flink;
+                 NextEntry != &KiProfileSourceListHead;
+                 NextEntry = NextEntry->Flink)
+            {
+                CurrentSource = CONTAINING_RECORD(NextEntry,
+                                                  KPROFILE_SOURCE_OBJECT,
+                                                  ListEntry);
+                if (CurrentSource->Source == ProfileTime) SourceInUse = TRUE;
+            }
+            KeReleaseSpinLockFromDpcLevel(&KiProfileLock);
+
+            /* If not, stop the profile interrupt */
+            if (!SourceInUse) HalStopProfileInterrupt(ProfileTime);
+            KeLowerIrql(OldIrql);
+        }
+
+        goto Quickie;
+    }
+
+    /* The ring size can only change while we are stopped */
+    if (!(KiStackProfileEnabled) && (KiStackProfileRingSize != RingSize))
+    {
+        /* Make sure nobody is still writing to the old rings */
+        KiFlushStackProfileSamplers();
+        KiFreeStackProfileRings();
+
+        /* Allocate new ones */
+        for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+        {
+            KiStackProfileRing[i] = ExAllocatePoolWithTag(NonPagedPool,
+                                                          FIELD_OFFSET(KI_STACK_PROFILE_RING,
+                                                                       Samples[RingSize]),
+                                                          'kfrP');
+            if (!KiStackProfileRing[i])
+            {
+                KiFreeStackProfileRings();
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto Quickie;
+            }
+
+            KiStackProfileRing[i]->Head = 0;
+            KiStackProfileRing[i]->Tail = 0;
+            KiStackProfileRing[i]->Dropped = 0;
+            KiStackProfileRing[i]->Mask = RingSize - 1;
+        }
+        KiStackProfileRingSize = RingSize;
+    }
+
+#ifdef _M_AMD64
+    /* Kernel stacks are unwound with the function table of the kernel image */
+    KiInitializeProfileUnwind();
+#endif
+
+    /* Update the settings */
+    KiStackProfileUserStacks = CaptureUserStacks;
+    if (Interval) KeSetIntervalProfile(Interval, ProfileTime);
+
+    /* Start sampling */
+    if (!KiStackProfileEnabled)
+    {
+        KeRaiseIrql(KiProfileIrql, &OldIrql);
+        KiStackProfileEnabled = TRUE;
+        HalStartProfileInterrupt(ProfileTime);
+        KeLowerIrql(OldIrql);
+    }
+
+Quickie:
+    ExReleaseFastMutex(&KiStackProfileMutex);
+    return Status;
+}
+
 VOID
 NTAPI
 KiParseProfileList(IN PKTRAP_FRAME TrapFrame,
@@ -359,6 +917,12 @@ KeProfileInterruptWithSource(IN PKTRAP_FRAME TrapFrame,
     /* We have to parse 2 lists. Per-Process and System-Wide */
     KiParseProfileList(TrapFrame, Source, &Process->ProfileListHead);
     KiParseProfileList(TrapFrame, Source, &KiProfileListHead);
+
+    /* Take a call stack sample if the sampler is running */
+    if ((Source == ProfileTime) && (KiStackProfileEnabled))
+    {
+        KiRecordStackSample(TrapFrame);
+    }
 }
 
 /*
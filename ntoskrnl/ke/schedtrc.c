@@ -0,0 +1,237 @@
+/*
+ * PROJECT:         ReactOS Kernel
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            ntoskrnl/ke/schedtrc.c
+ * PURPOSE:         Scheduler Event Tracing
+ */
+
+/* INCLUDES ******************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS *******************************************************************/
+
+#define KI_SCHEDULER_TRACE_DEFAULT_RECORDS  2048
+#define KI_SCHEDULER_TRACE_MAXIMUM_RECORDS  65536
+
+typedef struct _KI_SCHEDULER_TRACE_RING
+{
+    volatile LONG Head;
+    ULONG Mask;
+    SYSTEM_SCHEDULER_TRACE_RECORD Records[ANYSIZE_ARRAY];
+} KI_SCHEDULER_TRACE_RING, *PKI_SCHEDULER_TRACE_RING;
+
+BOOLEAN KiSchedulerTraceEnabled;
+ULONG KiSchedulerTraceRecords = KI_SCHEDULER_TRACE_DEFAULT_RECORDS;
+PKI_SCHEDULER_TRACE_RING KiSchedulerTraceRing[MAXIMUM_PROCESSORS];
+
+/* PRIVATE FUNCTIONS *********************************************************/
+
+FORCEINLINE
+ULONGLONG
+KiQuerySchedulerTraceTime(VOID)
+{
+#if defined(_M_IX86) || defined(_M_AMD64)
+    /* Cycle counter, cheap enough to take on every event */
+    return __rdtsc();
+#else
+    return KeQueryInterruptTime();
+#endif
+}
+
+FORCEINLINE
+ULONG
+KiGetTraceThreadId(IN PKTHREAD Thread)
+{
+    /* Idle threads and missing threads show up as 0 */
+    if (!Thread) return 0;
+    return HandleToUlong(CONTAINING_RECORD(Thread, ETHREAD, Tcb)->Cid.UniqueThread);
+}
+
+VOID
+FASTCALL
+KiTraceSchedulerEvent(IN UCHAR Event,
+                      IN PKTHREAD Thread,
+                      IN PKTHREAD OtherThread OPTIONAL,
+                      IN UCHAR Priority,
+                      IN UCHAR Reason,
+                      IN LONG Data)
+{
+    PKI_SCHEDULER_TRACE_RING Ring;
+    PSYSTEM_SCHEDULER_TRACE_RECORD Record;
+    ULONG Processor, Sequence;
+
+    /* Get this processor's ring */
+    Processor = KeGetCurrentProcessorNumber();
+    Ring = KiSchedulerTraceRing[Processor];
+    if (!Ring) return;
+
+    /*
+     * Reserve a slot, overwriting the oldest record. Interrupts may nest
+     * on top of us, so the slot is marked invalid until we are done.
+     */
+    Sequence = (ULONG)InterlockedIncrement(&Ring->Head);
+    Record = &Ring->Records[(Sequence - 1) & Ring->Mask];
+    Record->Sequence = 0;
+    KeMemoryBarrierWithoutFence();
+
+    /* Fill it out */
+    Record->TimeStamp = KiQuerySchedulerTraceTime();
+    Record->Event = Event;
+    Record->Processor = (UCHAR)Processor;
+    Record->Priority = Priority;
+    Record->Reason = Reason;
+    Record->ThreadId = KiGetTraceThreadId(Thread);
+    Record->OtherThreadId = KiGetTraceThreadId(OtherThread);
+    Record->ProcessId = HandleToUlong(CONTAINING_RECORD(Thread, ETHREAD, Tcb)->Cid.UniqueProcess);
+    Record->Data = Data;
+
+    /* And publish it */
+    KeMemoryBarrier();
+    Record->Sequence = Sequence;
+}
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+KiInitializeSchedulerTrace(VOID)
+{
+    ULONG i, Records;
+
+    /* Check if tracing was turned off */
+    if (!KiSchedulerTraceRecords) return;
+
+    /* Round the ring size up to a power of two */
+    Records = min(KiSchedulerTraceRecords, KI_SCHEDULER_TRACE_MAXIMUM_RECORDS);
+    for (KiSchedulerTraceRecords = 1;
+         KiSchedulerTraceRecords < Records;
+         KiSchedulerTraceRecords <<= 1);
+
+    /* Allocate a ring for each processor */
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        KiSchedulerTraceRing[i] =
+            ExAllocatePoolZero(NonPagedPool,
+                               FIELD_OFFSET(KI_SCHEDULER_TRACE_RING,
+                                            Records[KiSchedulerTraceRecords]),
+                               TAG_SCHEDULER_TRACE);
+        if (!KiSchedulerTraceRing[i])
+        {
+            /* Tracing is a nice to have, just leave it off */
+            DPRINT1("Failed to allocate the scheduler trace buffers\n");
+            while (i--)
+            {
+                ExFreePoolWithTag(KiSchedulerTraceRing[i], TAG_SCHEDULER_TRACE);
+                KiSchedulerTraceRing[i] = NULL;
+            }
+            return;
+        }
+
+        KiSchedulerTraceRing[i]->Mask = KiSchedulerTraceRecords - 1;
+    }
+
+    /* Tracing is always on */
+    KiSchedulerTraceEnabled = TRUE;
+}
+
+NTSTATUS
+NTAPI
+KeQuerySchedulerTrace(
+    _Out_writes_bytes_to_(Length, *ReturnLength) PSYSTEM_SCHEDULER_TRACE_INFORMATION Information,
+    _In_ ULONG Length,
+    _Out_ PULONG ReturnLength)
+{
+    PKI_SCHEDULER_TRACE_RING Ring;
+    SYSTEM_SCHEDULER_TRACE_RECORD Record;
+    ULONG i, Head, Index, Count = 0, MaximumCount, RequiredLength;
+
+    /* The caller gets the whole window of every processor */
+    RequiredLength = FIELD_OFFSET(SYSTEM_SCHEDULER_TRACE_INFORMATION, Records);
+    if (KiSchedulerTraceRing[0])
+    {
+        RequiredLength += KeNumberProcessors *
+                          KiSchedulerTraceRecords *
+                          sizeof(SYSTEM_SCHEDULER_TRACE_RECORD);
+    }
+    *ReturnLength = RequiredLength;
+    if (Length < RequiredLength) return STATUS_INFO_LENGTH_MISMATCH;
+    MaximumCount = (Length - FIELD_OFFSET(SYSTEM_SCHEDULER_TRACE_INFORMATION, Records)) /
+                   sizeof(SYSTEM_SCHEDULER_TRACE_RECORD);
+
+    /* Fill out the header */
+    Information->Enabled = KiSchedulerTraceEnabled;
+#if defined(_M_IX86) || defined(_M_AMD64)
+    Information->CycleTimeStamps = TRUE;
+    Information->TimeStampFrequency = (ULONGLONG)KeGetCurrentPrcb()->MHz * 1000000;
+#else
+    Information->CycleTimeStamps = FALSE;
+    Information->TimeStampFrequency = 10000000;
+#endif
+    Information->NumberOfProcessors = KeNumberProcessors;
+    Information->RecordsPerProcessor = KiSchedulerTraceRing[0] ? KiSchedulerTraceRecords : 0;
+
+    /* Copy each processor's window, oldest first */
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Ring = KiSchedulerTraceRing[i];
+        if (!Ring) continue;
+
+        Head = (ULONG)Ring->Head;
+        Index = (Head > KiSchedulerTraceRecords) ? (Head - KiSchedulerTraceRecords) : 0;
+        for (; (Index != Head) && (Count < MaximumCount); Index++)
+        {
+            /* Take a private copy first, the writer may lap us */
+            Record = Ring->Records[Index & Ring->Mask];
+            KeMemoryBarrier();
+
+            /* Skip records that are still being written or were overwritten */
+            if ((Record.Sequence != Index + 1) ||
+                (Ring->Records[Index & Ring->Mask].Sequence != Index + 1))
+            {
+                continue;
+            }
+
+            Information->Records[Count++] = Record;
+        }
+    }
+
+    /* Return how much we wrote */
+    Information->NumberOfRecords = Count;
+    *ReturnLength = FIELD_OFFSET(SYSTEM_SCHEDULER_TRACE_INFORMATION, Records) +
+                    Count * sizeof(SYSTEM_SCHEDULER_TRACE_RECORD);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+KeSetSchedulerTrace(
+    _In_ BOOLEAN Enable,
+    _In_ BOOLEAN Reset)
+{
+    ULONG i;
+
+    /* We can't turn on tracing if we have no buffers */
+    if ((Enable) && !(KiSchedulerTraceRing[0])) return STATUS_NOT_SUPPORTED;
+
+    /* Stop tracing while we reset the buffers */
+    KiSchedulerTraceEnabled = FALSE;
+    if (Reset)
+    {
+        /* Anybody still writing will just leave one stale record behind */
+        for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+        {
+            if (!KiSchedulerTraceRing[i]) continue;
+            RtlZeroMemory(KiSchedulerTraceRing[i]->Records,
+                          KiSchedulerTraceRecords * sizeof(SYSTEM_SCHEDULER_TRACE_RECORD));
+            KiSchedulerTraceRing[i]->Head = 0;
+        }
+    }
+
+    /* Turn tracing back on if requested */
+    KiSchedulerTraceEnabled = Enable;
+    return STATUS_SUCCESS;
+}
+
+/* EOF */
@@ -15,84 +15,226 @@
 #define LQ_WAIT     1
 #define LQ_OWN      2
 
+/* GLOBALS *******************************************************************/
+
+#ifdef KI_QUEUED_SPINLOCKS
+BOOLEAN KiQueuedLockStatisticsEnabled;
+KI_QUEUED_LOCK_STATISTICS KiQueuedLockStatistics[LockQueueMaximumLock];
+KI_QUEUED_LOCK_STATISTICS KiInStackLockStatistics[MAXIMUM_PROCESSORS];
+#endif
+
 /* PRIVATE FUNCTIONS *********************************************************/
 
-#if 0
+#ifdef KI_QUEUED_SPINLOCKS
+
 //
-// FIXME: The queued spinlock routines are broken.
+// Real MCS queued spinlocks. The KSPIN_LOCK holds the tail of the queue of
+// waiters, and each waiter spins on its own KSPIN_LOCK_QUEUE entry, so the
+// lock is handed over in FIFO order and only the next owner's cache line is
+// touched on release. The low bits of the entry's Lock pointer hold the
+// LQ_WAIT and LQ_OWN state.
 //
 
-VOID
-FASTCALL
-KeAcquireQueuedSpinLockAtDpcLevel(IN PKSPIN_LOCK_QUEUE LockHandle)
+FORCEINLINE
+PKI_QUEUED_LOCK_STATISTICS
+KiGetQueuedLockStatistics(
+    _In_ PKSPIN_LOCK_QUEUE LockQueue,
+    _Out_ PBOOLEAN Numbered)
 {
-#ifdef CONFIG_SMP
-    PKSPIN_LOCK_QUEUE Prev;
+    PKPRCB Prcb = KeGetCurrentPrcb();
+    ULONG_PTR Offset;
 
-    /* Set the new lock */
-    Prev = (PKSPIN_LOCK_QUEUE)
-           InterlockedExchange((PLONG)LockHandle->Next,
-                               (LONG)LockHandle);
-    if (!Prev)
+    /* Numbered locks live in the PRCB, and are only touched by their owner */
+    Offset = (ULONG_PTR)LockQueue - (ULONG_PTR)&Prcb->LockQueue[0];
+    if (Offset < sizeof(Prcb->LockQueue))
     {
-        /* There was nothing there before. We now own it */
-         *LockHandle->Lock |= LQ_OWN;
-        return;
+        *Numbered = TRUE;
+        return &KiQueuedLockStatistics[Offset / sizeof(KSPIN_LOCK_QUEUE)];
     }
 
-    /* Set the wait flag */
-     *LockHandle->Lock |= LQ_WAIT;
-
-    /* Link us */
-    Prev->Next = (PKSPIN_LOCK_QUEUE)LockHandle;
+    /* In-stack handles are accounted per processor */
+    *Numbered = FALSE;
+    return &KiInStackLockStatistics[Prcb->Number];
+}
 
-    /* Loop and wait */
-    while (*LockHandle->Lock & LQ_WAIT)
-        YieldProcessor();
+FORCEINLINE
+VOID
+KxAcquireQueuedSpinLock(
+    _Inout_ PKSPIN_LOCK_QUEUE LockQueue)
+{
+    PKSPIN_LOCK SpinLock = LockQueue->Lock;
+    PKSPIN_LOCK_QUEUE Predecessor;
+    PKI_QUEUED_LOCK_STATISTICS Statistics;
+    ULONG64 SpinStart = 0;
+    BOOLEAN Numbered;
+
+    /* The queue entry must not be in use */
+    ASSERT(((ULONG_PTR)SpinLock & (LQ_WAIT | LQ_OWN)) == 0);
+    LockQueue->Next = NULL;
+
+    /* Put ourselves at the tail of the queue */
+    Predecessor = InterlockedExchangePointer((PVOID*)SpinLock, LockQueue);
+    if (Predecessor != NULL)
+    {
+#if DBG
+        /* Make sure that we don't own the lock already */
+        if (Predecessor == LockQueue)
+        {
+            /* We do, bugcheck! */
+            KeBugCheckEx(SPIN_LOCK_ALREADY_OWNED, (ULONG_PTR)SpinLock, 0, 0, 0);
+        }
 #endif
+
+        /* Remember when we started spinning */
+        if (KiQueuedLockStatisticsEnabled) SpinStart = __rdtsc();
+
+        /* Mark us as waiting, then link us behind the previous tail */
+        LockQueue->Lock = (PKSPIN_LOCK)((ULONG_PTR)SpinLock | LQ_WAIT);
+        InterlockedExchangePointer((PVOID*)&Predecessor->Next, LockQueue);
+
+        /* Spin on our own entry until the lock is handed over to us */
+        while ((ULONG_PTR)(*(volatile PKSPIN_LOCK*)&LockQueue->Lock) & LQ_WAIT)
+        {
+            /* Yield and keep looping */
+            YieldProcessor();
+        }
+    }
+
+    /* We own the lock now */
+    LockQueue->Lock = (PKSPIN_LOCK)((ULONG_PTR)SpinLock | LQ_OWN);
+    KeMemoryBarrierWithoutFence();
+
+    /* Update the statistics, this is protected by the lock itself */
+    if (KiQueuedLockStatisticsEnabled)
+    {
+        Statistics = KiGetQueuedLockStatistics(LockQueue, &Numbered);
+        Statistics->AcquireCount++;
+        if (Predecessor != NULL)
+        {
+            Statistics->ContentionCount++;
+            if (SpinStart) Statistics->SpinCycles += __rdtsc() - SpinStart;
+        }
+
+        /* Hold times can only be tracked for numbered locks */
+        if (Numbered) Statistics->AcquireTimeStamp = __rdtsc();
+    }
 }
 
+FORCEINLINE
 VOID
-FASTCALL
-KeReleaseQueuedSpinLockFromDpcLevel(IN PKSPIN_LOCK_QUEUE LockHandle)
+KxReleaseQueuedSpinLock(
+    _Inout_ PKSPIN_LOCK_QUEUE LockQueue)
 {
-#ifdef CONFIG_SMP
-    KSPIN_LOCK LockVal;
-    PKSPIN_LOCK_QUEUE Waiter;
+    PKSPIN_LOCK SpinLock;
+    PKSPIN_LOCK_QUEUE Successor;
+    PKI_QUEUED_LOCK_STATISTICS Statistics;
+    ULONG64 HoldCycles;
+    BOOLEAN Numbered;
 
-    /* Remove own and wait flags */
-    *LockHandle->Lock &= ~(LQ_OWN | LQ_WAIT);
-    LockVal = *LockHandle->Lock;
+#if DBG
+    /* Make sure that we actually own the lock */
+    if (!((ULONG_PTR)LockQueue->Lock & LQ_OWN))
+    {
+        /* We don't, bugcheck */
+        KeBugCheckEx(SPIN_LOCK_NOT_OWNED, (ULONG_PTR)LockQueue->Lock, 0, 0, 0);
+    }
+#endif
 
-    /* Check if we already own it */
-    if (LockVal == (KSPIN_LOCK)LockHandle)
+    /* Account the hold time while we still own the lock */
+    if (KiQueuedLockStatisticsEnabled)
     {
-        /* Disown it */
-        LockVal = (KSPIN_LOCK)
-                  InterlockedCompareExchangePointer(LockHandle->Lock,
-                                                    NULL,
-                                                    LockHandle);
+        Statistics = KiGetQueuedLockStatistics(LockQueue, &Numbered);
+        if (Numbered && Statistics->AcquireTimeStamp)
+        {
+            HoldCycles = __rdtsc() - Statistics->AcquireTimeStamp;
+            if (HoldCycles > Statistics->MaxHoldCycles)
+            {
+                Statistics->MaxHoldCycles = HoldCycles;
+            }
+            Statistics->AcquireTimeStamp = 0;
+        }
     }
-    if (LockVal == (KSPIN_LOCK)LockHandle) return;
 
-    /* Need to wait for it */
-    Waiter = LockHandle->Next;
-    while (!Waiter)
+    /* Clear our state bits */
+    SpinLock = (PKSPIN_LOCK)((ULONG_PTR)LockQueue->Lock & ~(LQ_WAIT | LQ_OWN));
+    LockQueue->Lock = SpinLock;
+
+    /* Check if anyone is queued behind us */
+    Successor = *(volatile PKSPIN_LOCK_QUEUE*)&LockQueue->Next;
+    if (Successor == NULL)
     {
-        YieldProcessor();
-        Waiter = LockHandle->Next;
+        /* Nobody is linked yet. If we're still the tail, the lock is free */
+        if (InterlockedCompareExchangePointer((PVOID*)SpinLock,
+                                              NULL,
+                                              LockQueue) == LockQueue)
+        {
+            return;
+        }
+
+        /* Someone is queueing up, wait until it linked itself behind us */
+        while ((Successor = *(volatile PKSPIN_LOCK_QUEUE*)&LockQueue->Next) == NULL)
+        {
+            /* Yield and keep looping */
+            YieldProcessor();
+        }
     }
 
-    /* It's gone */
-    *(ULONG_PTR*)&Waiter->Lock ^= (LQ_OWN | LQ_WAIT);
-    LockHandle->Next = NULL;
-#endif
+    /* Unlink ourselves and hand the lock over to the next waiter */
+    LockQueue->Next = NULL;
+    KeMemoryBarrierWithoutFence();
+    *(volatile PKSPIN_LOCK*)&Successor->Lock = (PKSPIN_LOCK)((ULONG_PTR)SpinLock | LQ_OWN);
+}
+
+FORCEINLINE
+BOOLEAN
+KxTryToAcquireQueuedSpinLock(
+    _Inout_ PKSPIN_LOCK_QUEUE LockQueue)
+{
+    PKSPIN_LOCK SpinLock = LockQueue->Lock;
+    PKI_QUEUED_LOCK_STATISTICS Statistics;
+    BOOLEAN Numbered;
+
+    /* Don't bother if the lock is obviously busy */
+    if (*(volatile KSPIN_LOCK*)SpinLock) return FALSE;
+
+    /* Try to become the owner without waiting in the queue */
+    LockQueue->Next = NULL;
+    if (InterlockedCompareExchangePointer((PVOID*)SpinLock,
+                                          LockQueue,
+                                          NULL) != NULL)
+    {
+        return FALSE;
+    }
+
+    /* We own it now */
+    LockQueue->Lock = (PKSPIN_LOCK)((ULONG_PTR)SpinLock | LQ_OWN);
+    KeMemoryBarrierWithoutFence();
+
+    /* Update the statistics */
+    if (KiQueuedLockStatisticsEnabled)
+    {
+        Statistics = KiGetQueuedLockStatistics(LockQueue, &Numbered);
+        Statistics->AcquireCount++;
+        if (Numbered) Statistics->AcquireTimeStamp = __rdtsc();
+    }
+
+    return TRUE;
 }
 
 #else
 //
-// HACK: Hacked to work like normal spinlocks
+// HACK: Hacked to work like normal spinlocks. The i386 HAL implements the
+// raising queued spinlock routines on top of plain spinlocks, so the kernel
+// has to use the same representation there.
 //
+#define KxAcquireQueuedSpinLock(LockQueue) \
+    KxAcquireSpinLock((LockQueue)->Lock)
+#define KxReleaseQueuedSpinLock(LockQueue) \
+    KxReleaseSpinLock((LockQueue)->Lock)
+#define KxTryToAcquireQueuedSpinLock(LockQueue) \
+    KeTryToAcquireSpinLockAtDpcLevel((LockQueue)->Lock)
+
+#endif // KI_QUEUED_SPINLOCKS
 
 _IRQL_requires_min_(DISPATCH_LEVEL)
 _Acquires_nonreentrant_lock_(*LockHandle->Lock)
@@ -115,7 +257,7 @@ KeAcquireQueuedSpinLockAtDpcLevel(_Inout_ PKSPIN_LOCK_QUEUE LockHandle)
 #endif
 
     /* Do the inlined function */
-    KxAcquireSpinLock(LockHandle->Lock);
+    KxAcquireQueuedSpinLock(LockHandle);
 }
 
 _IRQL_requires_min_(DISPATCH_LEVEL)
@@ -139,10 +281,98 @@ KeReleaseQueuedSpinLockFromDpcLevel(_Inout_ PKSPIN_LOCK_QUEUE LockHandle)
 #endif
 
     /* Do the inlined function */
-    KxReleaseSpinLock(LockHandle->Lock);
+    KxReleaseQueuedSpinLock(LockHandle);
+}
+
+BOOLEAN
+FASTCALL
+KiTryToAcquireQueuedSpinLockAtDpcLevel(IN PKSPIN_LOCK_QUEUE LockQueue)
+{
+    ASSERT(KeGetCurrentIrql() >= DISPATCH_LEVEL);
+
+    /* Do the inlined function */
+    return KxTryToAcquireQueuedSpinLock(LockQueue);
+}
+
+NTSTATUS
+NTAPI
+KeQueryQueuedSpinLockStatistics(
+    _Out_writes_bytes_to_(Length, *ReturnLength) PSYSTEM_QUEUED_SPINLOCK_INFORMATION Information,
+    _In_ ULONG Length,
+    _Out_ PULONG ReturnLength)
+{
+#ifdef KI_QUEUED_SPINLOCKS
+    PSYSTEM_QUEUED_SPINLOCK_ENTRY Entry;
+    ULONG i, RequiredLength;
+
+    /* We return all numbered locks, plus one entry for in-stack handles */
+    RequiredLength = FIELD_OFFSET(SYSTEM_QUEUED_SPINLOCK_INFORMATION,
+                                  Locks[LockQueueMaximumLock + 1]);
+    *ReturnLength = RequiredLength;
+    if (Length < RequiredLength) return STATUS_INFO_LENGTH_MISMATCH;
+
+    /* Fill out the header */
+    Information->StatisticsEnabled = KiQueuedLockStatisticsEnabled;
+    Information->NumberOfLocks = LockQueueMaximumLock + 1;
+
+    /* Copy the numbered locks */
+    for (i = 0; i < LockQueueMaximumLock; i++)
+    {
+        Entry = &Information->Locks[i];
+        Entry->LockNumber = i;
+        Entry->Reserved = 0;
+        Entry->AcquireCount = KiQueuedLockStatistics[i].AcquireCount;
+        Entry->ContentionCount = KiQueuedLockStatistics[i].ContentionCount;
+        Entry->SpinCycles = KiQueuedLockStatistics[i].SpinCycles;
+        Entry->MaxHoldCycles = KiQueuedLockStatistics[i].MaxHoldCycles;
+    }
+
+    /* Sum up the in-stack handles of all processors */
+    Entry = &Information->Locks[LockQueueMaximumLock];
+    RtlZeroMemory(Entry, sizeof(*Entry));
+    Entry->LockNumber = SYSTEM_QUEUED_SPINLOCK_IN_STACK;
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Entry->AcquireCount += KiInStackLockStatistics[i].AcquireCount;
+        Entry->ContentionCount += KiInStackLockStatistics[i].ContentionCount;
+        Entry->SpinCycles += KiInStackLockStatistics[i].SpinCycles;
+    }
+
+    return STATUS_SUCCESS;
+#else
+    /* Queued spinlocks are plain spinlocks on this build */
+    UNREFERENCED_PARAMETER(Information);
+    UNREFERENCED_PARAMETER(Length);
+    *ReturnLength = 0;
+    return STATUS_NOT_SUPPORTED;
+#endif
 }
 
+NTSTATUS
+NTAPI
+KeSetQueuedSpinLockStatistics(
+    _In_ BOOLEAN Enable,
+    _In_ BOOLEAN Reset)
+{
+#ifdef KI_QUEUED_SPINLOCKS
+    /* Stop collecting while we reset the counters */
+    KiQueuedLockStatisticsEnabled = FALSE;
+    if (Reset)
+    {
+        /* Owners may still be updating them, which is fine for statistics */
+        RtlZeroMemory(KiQueuedLockStatistics, sizeof(KiQueuedLockStatistics));
+        RtlZeroMemory(KiInStackLockStatistics, sizeof(KiInStackLockStatistics));
+    }
+
+    /* Enable collection if requested */
+    KiQueuedLockStatisticsEnabled = Enable;
+    return STATUS_SUCCESS;
+#else
+    UNREFERENCED_PARAMETER(Enable);
+    UNREFERENCED_PARAMETER(Reset);
+    return STATUS_NOT_SUPPORTED;
 #endif
+}
 
 /* PUBLIC FUNCTIONS **********************************************************/
 
@@ -366,25 +596,9 @@ KeAcquireInStackQueuedSpinLockAtDpcLevel(IN PKSPIN_LOCK SpinLock,
     /* Set it up properly */
     LockHandle->LockQueue.Next = NULL;
     LockHandle->LockQueue.Lock = SpinLock;
-#ifdef CONFIG_SMP
-#if 0
-    KeAcquireQueuedSpinLockAtDpcLevel(LockHandle->LockQueue.Next);
-#else
-    /* Make sure we are at DPC or above! */
-    if (KeGetCurrentIrql() < DISPATCH_LEVEL)
-    {
-        /* We aren't -- bugcheck */
-        KeBugCheckEx(IRQL_NOT_GREATER_OR_EQUAL,
-                     (ULONG_PTR)LockHandle->LockQueue.Lock,
-                     KeGetCurrentIrql(),
-                     0,
-                     0);
-    }
-#endif
-#endif
 
-    /* Acquire the lock */
-    KxAcquireSpinLock(LockHandle->LockQueue.Lock); // HACK
+    /* Call the internal function */
+    KeAcquireQueuedSpinLockAtDpcLevel(&LockHandle->LockQueue);
 }
 
 /*
@@ -394,26 +608,8 @@ VOID
 FASTCALL
 KeReleaseInStackQueuedSpinLockFromDpcLevel(IN PKLOCK_QUEUE_HANDLE LockHandle)
 {
-#ifdef CONFIG_SMP
-#if 0
     /* Call the internal function */
-    KeReleaseQueuedSpinLockFromDpcLevel(LockHandle->LockQueue.Next);
-#else
-    /* Make sure we are at DPC or above! */
-    if (KeGetCurrentIrql() < DISPATCH_LEVEL)
-    {
-        /* We aren't -- bugcheck */
-        KeBugCheckEx(IRQL_NOT_GREATER_OR_EQUAL,
-                     (ULONG_PTR)LockHandle->LockQueue.Lock,
-                     KeGetCurrentIrql(),
-                     0,
-                     0);
-    }
-#endif
-#endif
-
-    /* Release the lock */
-    KxReleaseSpinLock(LockHandle->LockQueue.Lock); // HACK
+    KeReleaseQueuedSpinLockFromDpcLevel(&LockHandle->LockQueue);
 }
 
 /*
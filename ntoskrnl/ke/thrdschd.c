@@ -20,20 +20,193 @@
     InterlockedOr((PLONG)Destination, SetMember);
 #endif
 
+#ifdef _WIN64
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd64((PLONG64)Destination, ~(LONG64)(SetMember));
+#else
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd((PLONG)Destination, ~(LONG)(SetMember));
+#endif
+
 /* GLOBALS *******************************************************************/
 
 KAFFINITY KiIdleSummary;
 KAFFINITY KiIdleSMTSummary;
 
+/*
+ * Number of clock ticks during which a thread that was just made ready on
+ * another node is considered cache-hot, and therefore not worth stealing.
+ */
+ULONG KiStealCacheHotTicks = 1;
+
 /* FUNCTIONS *****************************************************************/
 
+#ifdef CONFIG_SMP
+static
+PKTHREAD
+KiStealReadyThread(
+    _In_ PKPRCB Prcb,
+    _In_ PKPRCB TargetPrcb,
+    _In_ BOOLEAN RemoteNode)
+{
+    ULONG PrioritySet;
+    ULONG Priority;
+    PLIST_ENTRY ListHead, ListEntry;
+    PKTHREAD Thread;
+
+    /* Loop the target's ready summary from the highest priority down */
+    PrioritySet = TargetPrcb->ReadySummary;
+    while (PrioritySet != 0)
+    {
+        BitScanReverse(&Priority, PrioritySet);
+        PrioritySet ^= PRIORITY_MASK(Priority);
+
+        /* Scan the list for a thread that is allowed to run on this CPU */
+        ListHead = &TargetPrcb->DispatcherReadyListHead[Priority];
+        for (ListEntry = ListHead->Flink;
+             ListEntry != ListHead;
+             ListEntry = ListEntry->Flink)
+        {
+            Thread = CONTAINING_RECORD(ListEntry, KTHREAD, WaitListEntry);
+            ASSERT(Thread->Priority == (SCHAR)Priority);
+            ASSERT(Thread->NextProcessor == TargetPrcb->Number);
+
+            /* Honor the hard affinity */
+            if (!(Thread->Affinity & Prcb->SetMember)) continue;
+
+            /* Leave threads that just got ready on their node to warm up */
+            if ((RemoteNode) &&
+                ((KeTickCount.LowPart - Thread->WaitTime) < KiStealCacheHotTicks))
+            {
+                continue;
+            }
+
+            /* Remove it from the target's queue */
+            if (RemoveEntryList(&Thread->WaitListEntry))
+            {
+                /* The list is empty now, reset the ready summary */
+                TargetPrcb->ReadySummary ^= PRIORITY_MASK(Priority);
+            }
+
+            /* It will run here now */
+            Thread->NextProcessor = Prcb->Number;
+            return Thread;
+        }
+    }
+
+    /* Nothing could be stolen */
+    return NULL;
+}
+
+static
+PKTHREAD
+KiSearchForNewThread(
+    _In_ PKPRCB Prcb,
+    _In_ KAFFINITY ProcessorSet,
+    _In_ BOOLEAN RemoteNode,
+    _Inout_ PBOOLEAN Contended)
+{
+    PKPRCB TargetPrcb;
+    PKTHREAD Thread;
+    ULONG Processor;
+
+    /* Never scan ourselves */
+    ProcessorSet &= ~Prcb->SetMember;
+
+    /* Loop all processors in the set */
+    while (ProcessorSet != 0)
+    {
+        BitScanForwardAffinity(&Processor, ProcessorSet);
+        ProcessorSet &= ~AFFINITY_MASK(Processor);
+
+        /* Check if this processor has anything ready */
+        TargetPrcb = KiProcessorBlock[Processor];
+        if (!TargetPrcb || !TargetPrcb->ReadySummary) continue;
+
+        /* Don't wait for busy processors, but remember to try again on the next pass */
+        if (!KiTryAcquirePrcbLock(TargetPrcb))
+        {
+            *Contended = TRUE;
+            continue;
+        }
+
+        /* Try to steal a thread from it */
+        Thread = KiStealReadyThread(Prcb, TargetPrcb, RemoteNode);
+        KiReleasePrcbLock(TargetPrcb);
+        if (Thread) return Thread;
+    }
+
+    /* Nothing found */
+    return NULL;
+}
+#endif // CONFIG_SMP
+
 PKTHREAD
 FASTCALL
 KiIdleSchedule(IN PKPRCB Prcb)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("SMP: Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    PKTHREAD Thread;
+    KAFFINITY ActiveSet, NodeSet, SmtSet;
+    BOOLEAN Contended = FALSE;
+
+    /* This is only called from the idle loop */
+    ASSERT(Prcb == KeGetCurrentPrcb());
+    ASSERT(KeGetCurrentIrql() >= DISPATCH_LEVEL);
+
+    /* Acquire our own PRCB lock and clear the idle schedule request */
+    KiAcquirePrcbLock(Prcb);
+    Prcb->IdleSchedule = FALSE;
+
+    /* Someone may have readied a thread for us in the meantime */
+    if (Prcb->NextThread == NULL)
+    {
+        /* Check our own queue first */
+        Thread = KiSelectReadyThread(0, Prcb);
+        if (Thread == NULL)
+        {
+            /*
+             * Steal from the closest processors first: SMT siblings share
+             * all caches, processors of the same node share the last level
+             * cache and memory, everything else comes last.
+             */
+            ActiveSet = KeActiveProcessors;
+            SmtSet = Prcb->MultiThreadProcessorSet & ActiveSet;
+            NodeSet = Prcb->ParentNode->ProcessorMask & ActiveSet & ~SmtSet;
+
+            Thread = KiSearchForNewThread(Prcb, SmtSet, FALSE, &Contended);
+            if (!Thread) Thread = KiSearchForNewThread(Prcb, NodeSet, FALSE, &Contended);
+            if (!Thread)
+            {
+                Thread = KiSearchForNewThread(Prcb,
+                                              ActiveSet & ~(SmtSet | NodeSet),
+                                              TRUE,
+                                              &Contended);
+            }
+
+            /* A processor we skipped may still have work for us, look again later */
+            if (!Thread && Contended) Prcb->IdleSchedule = TRUE;
+        }
+
+        /* Check if we found something to run */
+        if (Thread)
+        {
+            /* Make it our next thread, we are not idle anymore */
+            Thread->State = Standby;
+            Prcb->NextThread = Thread;
+            InterlockedAndSetMember(&KiIdleSummary, Prcb->SetMember);
+        }
+    }
+
+    /* Release the lock and return the next thread, if any */
+    Thread = Prcb->NextThread;
+    KiReleasePrcbLock(Prcb);
+    return Thread;
+#else
+    /* There is nothing to steal on UP systems */
+    UNREFERENCED_PARAMETER(Prcb);
     return NULL;
+#endif // CONFIG_SMP
 }
 
 VOID
@@ -351,15 +524,23 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
     {
         /* Set the next thread as the current thread */
         NextThread = Prcb->CurrentThread;
-        if (OldPriority > NextThread->Priority)
+        if ((OldPriority > NextThread->Priority) ||
+            (NextThread == Prcb->IdleThread))
         {
             /* Preempt it if it's already running */
-            if (NextThread->State == Running) NextThread->Preempted = TRUE;
+            if ((NextThread->State == Running) &&
+                (NextThread != Prcb->IdleThread))
+            {
+                NextThread->Preempted = TRUE;
+            }
 
             /* Set the thread on standby and as the next thread */
             Thread->State = Standby;
             Prcb->NextThread = Thread;
 
+            /* The target processor is not idle anymore */
+            InterlockedAndSetMember(&KiIdleSummary, Prcb->SetMember);
+
             /* Release the lock */
             KiReleasePrcbLock(Prcb);
 
@@ -458,8 +639,9 @@ KiSwapThread(IN PKTHREAD CurrentThread,
         }
         else
         {
-            /* Set the idle summary */
+            /* Set the idle summary and let the idle thread look for work */
             InterlockedOrSetMember(&KiIdleSummary, Prcb->SetMember);
+            Prcb->IdleSchedule = TRUE;
 
             /* Schedule the idle thread */
             NextThread = Prcb->IdleThread;
@@ -503,6 +685,14 @@ KiReadyThread(IN PKTHREAD Thread)
 {
     IN PKPROCESS Process = Thread->ApcState.Process;
 
+    /* Trace the readying */
+    KiTraceScheduler(SchedulerTraceReadyThread,
+                     Thread,
+                     KeGetCurrentThread(),
+                     Thread->Priority,
+                     0,
+                     Thread->NextProcessor);
+
     /* Check if the process is paged out */
     if (Process->State != ProcessInMemory)
     {
@@ -594,6 +784,14 @@ KiSetPriorityThread(IN PKTHREAD Thread,
     /* Check if priority changed */
     if (Thread->Priority != Priority)
     {
+        /* Trace the change */
+        KiTraceScheduler(SchedulerTraceSetPriority,
+                         Thread,
+                         KeGetCurrentThread(),
+                         Priority,
+                         0,
+                         Thread->Priority);
+
         /* Loop priority setting in case we need to start over */
         for (;;)
         {
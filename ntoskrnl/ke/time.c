@@ -18,6 +18,9 @@ LONG KiTickOffset;
 ULONG KeTimeAdjustment;
 BOOLEAN KiTimeAdjustmentEnabled = FALSE;
 
+/* Tick count of the last run time update, per processor (dynamic tick) */
+static ULONG KiLastRunTimeTick[MAXIMUM_PROCESSORS];
+
 /* FUNCTIONS ******************************************************************/
 
 FORCEINLINE
@@ -132,6 +135,7 @@ KeUpdateRunTime(IN PKTRAP_FRAME TrapFrame,
 {
     PKTHREAD Thread = KeGetCurrentThread();
     PKPRCB Prcb = KeGetCurrentPrcb();
+    ULONG TickCount, SkippedTicks;
 
     /* Check if this tick is being skipped */
     if (Prcb->SkipTick)
@@ -144,6 +148,20 @@ KeUpdateRunTime(IN PKTRAP_FRAME TrapFrame,
     /* Increase interrupt count */
     Prcb->InterruptCount++;
 
+    /*
+     * The HAL doesn't send clock IPIs to idle processors. Whatever ticks were
+     * skipped since the last update were spent in the idle loop.
+     */
+    TickCount = KeTickCount.LowPart;
+    SkippedTicks = TickCount - KiLastRunTimeTick[Prcb->Number] - 1;
+    if ((KiLastRunTimeTick[Prcb->Number] != 0) && ((LONG)SkippedTicks > 0))
+    {
+        /* Account them as idle time */
+        Prcb->KernelTime += SkippedTicks;
+        Prcb->IdleThread->KernelTime += SkippedTicks;
+    }
+    KiLastRunTimeTick[Prcb->Number] = TickCount;
+
     /* Check if we came from user mode */
 #ifndef _M_ARM
     if (KiUserTrap(TrapFrame) || (TrapFrame->EFlags & EFLAGS_V86_MASK))
@@ -174,23 +192,15 @@ KeUpdateRunTime(IN PKTRAP_FRAME TrapFrame,
             /* Handle being in a DPC */
             Prcb->DpcTime++;
 
-#if DBG
             /* Update the DPC time */
             Prcb->DebugDpcTime++;
 
             /* Check if we have timed out */
             if (Prcb->DebugDpcTime == KiDPCTimeout)
             {
-                /* We did! */
-                DbgPrint("*** DPC routine > 1 sec --- This is not a break in KeUpdateSystemTime\n");
-
-                /* Break if debugger is enabled */
-                if (KdDebuggerEnabled) DbgBreakPoint();
-
-                /* Clear state */
-                Prcb->DebugDpcTime = 0;
+                /* We did! Let the DPC watchdog handle it */
+                KiDpcWatchdogTimeout(Prcb);
             }
-#endif
         }
     }
 
@@ -15,6 +15,8 @@
 /* GLOBALS *******************************************************************/
 
 KTIMER_TABLE_ENTRY KiTimerTableListHead[TIMER_TABLE_SIZE];
+LIST_ENTRY KiTimerOverflowListHead[TIMER_TABLE_SIZE];
+ULARGE_INTEGER KiTimerOverflowTime[TIMER_TABLE_SIZE];
 LARGE_INTEGER KiTimeIncrementReciprocal;
 UCHAR KiTimeIncrementShiftCount;
 BOOLEAN KiEnableTimerWatchdog = FALSE;
@@ -58,23 +60,16 @@ KiInsertTreeTimer(IN PKTIMER Timer,
     return Inserted;
 }
 
+static
 BOOLEAN
-FASTCALL
-KiInsertTimerTable(IN PKTIMER Timer,
-                   IN ULONG Hand)
+KiInsertSortedTimer(IN PKTIMER Timer,
+                    IN ULONG Hand)
 {
     ULONGLONG InterruptTime;
     ULONGLONG DueTime = Timer->DueTime.QuadPart;
     BOOLEAN Expired = FALSE;
     PLIST_ENTRY ListHead, NextEntry;
     PKTIMER CurrentTimer;
-    DPRINT("KiInsertTimerTable(): Timer %p, Hand: %lu\n", Timer, Hand);
-
-    /* Check if the period is zero */
-    if (!Timer->Period) Timer->Header.SignalState = FALSE;
-
-    /* Sanity check */
-    ASSERT(Hand == KiComputeTimerTableIndex(DueTime));
 
     /* Loop the timer list backwards */
     ListHead = &KiTimerTableListHead[Hand].Entry;
@@ -97,8 +92,9 @@ KiInsertTimerTable(IN PKTIMER Timer,
     /* Check if we didn't find it in the list */
     if (NextEntry == ListHead)
     {
-        /* Set the time */
-        KiTimerTableListHead[Hand].Time.QuadPart = DueTime;
+        /* Set the time, unless the overflow list has to be cascaded first */
+        KiTimerTableListHead[Hand].Time.QuadPart =
+            min(DueTime, KiTimerOverflowTime[Hand].QuadPart);
 
         /* Make sure it hasn't expired already */
         InterruptTime = KeQueryInterruptTime();
@@ -109,6 +105,96 @@ KiInsertTimerTable(IN PKTIMER Timer,
     return Expired;
 }
 
+BOOLEAN
+FASTCALL
+KiInsertTimerTable(IN PKTIMER Timer,
+                   IN ULONG Hand)
+{
+    ULONGLONG DueTime = Timer->DueTime.QuadPart;
+    ULONGLONG CascadeTime;
+    DPRINT("KiInsertTimerTable(): Timer %p, Hand: %lu\n", Timer, Hand);
+
+    /* Check if the period is zero */
+    if (!Timer->Period) Timer->Header.SignalState = FALSE;
+
+    /* Sanity check */
+    ASSERT(Hand == KiComputeTimerTableIndex(DueTime));
+
+    /* Check if the timer is due before the hand comes around again */
+    if (DueTime < (KeQueryInterruptTime() + KiTimerTableRevolution()))
+    {
+        /* It is, insert it in order in the table itself */
+        return KiInsertSortedTimer(Timer, Hand);
+    }
+
+    /*
+     * It isn't. Park it unsorted in the overflow list of its entry, which
+     * makes inserting and cancelling long timers O(1). It only has to be
+     * moved into the table once its last revolution starts.
+     */
+    InsertTailList(&KiTimerOverflowListHead[Hand], &Timer->TimerListEntry);
+
+    /* Make sure the clock checks this entry when the timer needs to move */
+    CascadeTime = DueTime - KiTimerTableRevolution();
+    if (CascadeTime < KiTimerOverflowTime[Hand].QuadPart)
+    {
+        KiTimerOverflowTime[Hand].QuadPart = CascadeTime;
+    }
+    if (CascadeTime < KiTimerTableListHead[Hand].Time.QuadPart)
+    {
+        KiTimerTableListHead[Hand].Time.QuadPart = CascadeTime;
+    }
+
+    /* This timer can't have expired yet */
+    return FALSE;
+}
+
+VOID
+FASTCALL
+KiCascadeTimerTableEntry(IN ULONG Hand,
+                         IN ULONGLONG InterruptTime)
+{
+    ULONGLONG Revolution = KiTimerTableRevolution();
+    ULONGLONG CascadeTime, NextCascadeTime = MAXULONGLONG;
+    PLIST_ENTRY ListHead, NextEntry;
+    PKTIMER Timer;
+    ASSERT(KeGetCurrentIrql() >= DISPATCH_LEVEL);
+
+    /* Loop the overflow list of this entry */
+    ListHead = &KiTimerOverflowListHead[Hand];
+    NextEntry = ListHead->Flink;
+    while (NextEntry != ListHead)
+    {
+        /* Get the timer and move to the next one */
+        Timer = CONTAINING_RECORD(NextEntry, KTIMER, TimerListEntry);
+        NextEntry = NextEntry->Flink;
+
+        /* Check if it's due within the next revolution, with a tick of slack */
+        if (Timer->DueTime.QuadPart < (InterruptTime + Revolution + KeMaximumIncrement))
+        {
+            /* Move it into the sorted table */
+            RemoveEntryList(&Timer->TimerListEntry);
+            KiInsertSortedTimer(Timer, Hand);
+        }
+        else
+        {
+            /* It stays here, remember when it needs to be looked at again */
+            CascadeTime = Timer->DueTime.QuadPart - Revolution;
+            if (CascadeTime < NextCascadeTime) NextCascadeTime = CascadeTime;
+        }
+    }
+
+    /* Update the overflow time, or make it infinite if the list is empty */
+    _disable();
+    KiTimerOverflowTime[Hand].QuadPart = NextCascadeTime;
+    if (IsListEmpty(&KiTimerTableListHead[Hand].Entry))
+    {
+        /* Nothing left in the table itself, only the overflow time matters */
+        KiTimerTableListHead[Hand].Time.QuadPart = NextCascadeTime;
+    }
+    _enable();
+}
+
 BOOLEAN
 FASTCALL
 KiSignalTimer(IN PKTIMER Timer)
@@ -364,7 +364,23 @@ KeDelayExecutionThread(IN KPROCESSOR_MODE WaitMode,
             ASSERT(Thread->WaitIrql <= DISPATCH_LEVEL);
             KiSetThreadSwapBusy(Thread);
             KxInsertTimer(Timer, Hand);
+
+            /* Trace the wait */
+            KiTraceScheduler(SchedulerTraceWaitBegin,
+                             Thread,
+                             NULL,
+                             Thread->Priority,
+                             Thread->WaitReason,
+                             0);
+
+            /* Swap the thread */
             WaitStatus = (NTSTATUS)KiSwapThread(Thread, KeGetCurrentPrcb());
+            KiTraceScheduler(SchedulerTraceWaitEnd,
+                             Thread,
+                             NULL,
+                             Thread->Priority,
+                             Thread->WaitReason,
+                             WaitStatus);
 
             /* Check if were swapped ok */
             if (WaitStatus != STATUS_KERNEL_APC)
@@ -543,8 +559,22 @@ KeWaitForSingleObject(IN PVOID Object,
                 KiReleaseDispatcherLockFromSynchLevel();
             }
 
+            /* Trace the wait */
+            KiTraceScheduler(SchedulerTraceWaitBegin,
+                             Thread,
+                             NULL,
+                             Thread->Priority,
+                             Thread->WaitReason,
+                             1);
+
             /* Do the actual swap */
             WaitStatus = (NTSTATUS)KiSwapThread(Thread, KeGetCurrentPrcb());
+            KiTraceScheduler(SchedulerTraceWaitEnd,
+                             Thread,
+                             NULL,
+                             Thread->Priority,
+                             Thread->WaitReason,
+                             WaitStatus);
 
             /* Check if we were executing an APC */
             if (WaitStatus != STATUS_KERNEL_APC) return WaitStatus;
@@ -835,8 +865,22 @@ KeWaitForMultipleObjects(IN ULONG Count,
                 KiReleaseDispatcherLockFromSynchLevel();
             }
 
+            /* Trace the wait */
+            KiTraceScheduler(SchedulerTraceWaitBegin,
+                             Thread,
+                             NULL,
+                             Thread->Priority,
+                             Thread->WaitReason,
+                             Count);
+
             /* Swap the thread */
             WaitStatus = (NTSTATUS)KiSwapThread(Thread, KeGetCurrentPrcb());
+            KiTraceScheduler(SchedulerTraceWaitEnd,
+                             Thread,
+                             NULL,
+                             Thread->Priority,
+                             Thread->WaitReason,
+                             WaitStatus);
 
             /* Check if we were executing an APC */
             if (WaitStatus != STATUS_KERNEL_APC) return WaitStatus;
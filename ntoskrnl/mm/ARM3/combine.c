@@ -0,0 +1,708 @@
+/*
+ * PROJECT:     ReactOS Kernel
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Combining of identical private pages
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+#define MODULE_INVOLVED_IN_ARM3
+#include <mm/ARM3/miarm.h>
+
+/* GLOBALS ********************************************************************/
+
+/*
+ * When enabled, a system thread walks the private committed memory of every
+ * process and hashes the resident pages. The second time a page content is
+ * seen, that page is write protected and kept as a combined page: a prototype
+ * PFN whose prototype PTE lives in MiCombinePtes, and which holds one extra
+ * share on behalf of the table. Identical pages found afterwards are mapped
+ * copy on write to it and freed. A write fault gives the process a private
+ * copy back. Combined pages nobody maps anymore are freed after each pass.
+ *
+ * Only pages that hash like a combined page or like one seen before are write
+ * protected. They are protected in batches, with one flush of the process TB
+ * per batch before they are compared.
+ *
+ * The table is only changed by the scanner thread, under the PFN lock.
+ */
+
+#define MI_COMBINE_SCAN_SECONDS     30
+#define MI_COMBINE_MINIMUM_SLOTS    1024
+#define MI_COMBINE_MAXIMUM_SLOTS    65536
+#define MI_COMBINE_SEEN_BITS        (128 * 1024)
+#define MI_COMBINE_NO_SLOT          MAXULONG
+
+typedef struct _MI_COMBINE_ENTRY
+{
+    ULONG Hash;
+    ULONG Next;
+} MI_COMBINE_ENTRY, *PMI_COMBINE_ENTRY;
+
+/* Pages of one page table that were write protected to be compared */
+typedef struct _MI_COMBINE_BATCH
+{
+    ULONG Count;
+    ULONG Scanned;
+    PMMPTE PointerPte[MM_MAXIMUM_FLUSH_COUNT];
+    MMPTE OriginalPte[MM_MAXIMUM_FLUSH_COUNT];
+    ULONG Hash[MM_MAXIMUM_FLUSH_COUNT];
+    MMPTE_FLUSH_LIST FlushList;
+} MI_COMBINE_BATCH, *PMI_COMBINE_BATCH;
+
+ULONG MmEnablePageCombining;
+PMMPTE MiCombinePtes;
+ULONG MiCombineSize;
+
+static PMI_COMBINE_ENTRY MiCombineEntries;
+static PULONG MiCombineBuckets;
+static RTL_BITMAP MiCombineSlots;
+static RTL_BITMAP MiCombineSeen;
+static KEVENT MiCombineEvent;
+
+static ULONG MiCombineScans;
+static ULONG_PTR MiCombinedPages;
+static ULONGLONG MiCombinePagesScanned;
+static ULONGLONG MiCombinePagesMerged;
+static ULONGLONG MiCombinePagesUnmerged;
+
+/* PRIVATE FUNCTIONS **********************************************************/
+
+static
+BOOLEAN
+MiAllocateCombineTable(VOID)
+{
+    ULONG Size, i;
+    PULONG SlotBuffer, SeenBuffer;
+
+    /* One slot per 32 physical pages, in a power of two so that hashes can be masked */
+    Size = MI_COMBINE_MINIMUM_SLOTS;
+    while ((Size < MI_COMBINE_MAXIMUM_SLOTS) && ((Size * 2) <= (MmNumberOfPhysicalPages / 32)))
+    {
+        Size *= 2;
+    }
+
+    MiCombineEntries = ExAllocatePoolWithTag(NonPagedPool, Size * sizeof(MI_COMBINE_ENTRY), TAG_MM_PAGE_COMBINE);
+    MiCombineBuckets = ExAllocatePoolWithTag(NonPagedPool, Size * sizeof(ULONG), TAG_MM_PAGE_COMBINE);
+    SlotBuffer = ExAllocatePoolWithTag(NonPagedPool, Size / 8, TAG_MM_PAGE_COMBINE);
+    SeenBuffer = ExAllocatePoolWithTag(NonPagedPool, MI_COMBINE_SEEN_BITS / 8, TAG_MM_PAGE_COMBINE);
+    MiCombinePtes = ExAllocatePoolWithTag(NonPagedPool, Size * sizeof(MMPTE), TAG_MM_PAGE_COMBINE);
+    if (!MiCombineEntries || !MiCombineBuckets || !SlotBuffer || !SeenBuffer || !MiCombinePtes)
+    {
+        if (MiCombineEntries) ExFreePoolWithTag(MiCombineEntries, TAG_MM_PAGE_COMBINE);
+        if (MiCombineBuckets) ExFreePoolWithTag(MiCombineBuckets, TAG_MM_PAGE_COMBINE);
+        if (SlotBuffer) ExFreePoolWithTag(SlotBuffer, TAG_MM_PAGE_COMBINE);
+        if (SeenBuffer) ExFreePoolWithTag(SeenBuffer, TAG_MM_PAGE_COMBINE);
+        if (MiCombinePtes) ExFreePoolWithTag(MiCombinePtes, TAG_MM_PAGE_COMBINE);
+        MiCombineEntries = NULL;
+        MiCombineBuckets = NULL;
+        MiCombinePtes = NULL;
+        return FALSE;
+    }
+
+    RtlZeroMemory(MiCombinePtes, Size * sizeof(MMPTE));
+    for (i = 0; i < Size; i++) MiCombineBuckets[i] = MI_COMBINE_NO_SLOT;
+    RtlInitializeBitMap(&MiCombineSlots, SlotBuffer, Size);
+    RtlClearAllBits(&MiCombineSlots);
+    RtlInitializeBitMap(&MiCombineSeen, SeenBuffer, MI_COMBINE_SEEN_BITS);
+
+    /* The table is only looked at once the size is known */
+    MiCombineSize = Size;
+    return TRUE;
+}
+
+static
+ULONG
+MiHashPage(IN PVOID Address)
+{
+    PULONG Data = Address;
+    ULONG Hash = 2166136261;
+    ULONG i;
+
+    /* FNV-1a, one ULONG at a time */
+    for (i = 0; i < PAGE_SIZE / sizeof(ULONG); i++)
+    {
+        Hash = (Hash ^ Data[i]) * 16777619;
+    }
+
+    return Hash;
+}
+
+static
+BOOLEAN
+MiIsCombineCandidate(IN MMPTE TempPte)
+{
+    PMMPFN Pfn1;
+
+    /* Only private read/write pages which are not already copy on write */
+    if (!TempPte.u.Hard.Valid ||
+        !MI_IS_PAGE_WRITEABLE(&TempPte) ||
+        MI_IS_PAGE_COPY_ON_WRITE(&TempPte))
+    {
+        return FALSE;
+    }
+
+    Pfn1 = MiGetPfnEntry(PFN_FROM_PTE(&TempPte));
+    if (!Pfn1 || MI_IS_ROS_PFN(Pfn1) || Pfn1->u3.e1.PrototypePte) return FALSE;
+
+    /* Pages that are locked or not plain memory stay as they are */
+    return (Pfn1->u3.e1.PageLocation == ActiveAndValid) &&
+           (Pfn1->u2.ShareCount == 1) &&
+           (Pfn1->u3.e2.ReferenceCount == 1) &&
+           (Pfn1->u3.e1.CacheAttribute == MiCached) &&
+           ((Pfn1->OriginalPte.u.Soft.Protection == MM_READWRITE) ||
+            (Pfn1->OriginalPte.u.Soft.Protection == MM_EXECUTE_READWRITE));
+}
+
+static
+VOID
+MiMakeCombinedPte(IN OUT PMMPTE TempPte,
+                  IN PFN_NUMBER PageFrameIndex)
+{
+    TempPte->u.Hard.PageFrameNumber = PageFrameIndex;
+#ifdef CONFIG_SMP
+    TempPte->u.Hard.Writable = 0;
+#endif
+    TempPte->u.Hard.Write = 0;
+    TempPte->u.Hard.CopyOnWrite = 1;
+}
+
+static
+BOOLEAN
+MiIsHashCombined(IN ULONG Hash)
+{
+    ULONG Slot;
+
+    /* Only the scanner thread changes the table, so it can look at it unlocked */
+    for (Slot = MiCombineBuckets[Hash & (MiCombineSize - 1)];
+         Slot != MI_COMBINE_NO_SLOT;
+         Slot = MiCombineEntries[Slot].Next)
+    {
+        if (MiCombineEntries[Slot].Hash == Hash) return TRUE;
+    }
+
+    return FALSE;
+}
+
+static
+VOID
+MiProtectCombineCandidate(IN PMMPTE PointerPte,
+                          IN OUT PMI_COMBINE_BATCH Batch)
+{
+    MMPTE TempPte, NewPte;
+    PFN_NUMBER PageFrameIndex;
+    PVOID Address;
+    ULONG Hash, SeenBit;
+    KIRQL OldIrql;
+
+    ASSERT(Batch->Count < MM_MAXIMUM_FLUSH_COUNT);
+
+    /* Cheap checks first, they are made again under the PFN lock */
+    TempPte = *PointerPte;
+    if (!MiIsCombineCandidate(TempPte)) return;
+    PageFrameIndex = PFN_FROM_PTE(&TempPte);
+    Address = MiPteToAddress(PointerPte);
+
+    /* The working set lock keeps the page mapped while it is hashed */
+    Hash = MiHashPage(Address);
+    Batch->Scanned++;
+
+    /* Only pages that can be merged or kept are worth write protecting */
+    if (!MiIsHashCombined(Hash))
+    {
+        SeenBit = Hash & (MI_COMBINE_SEEN_BITS - 1);
+        if (!RtlCheckBit(&MiCombineSeen, SeenBit))
+        {
+            RtlSetBit(&MiCombineSeen, SeenBit);
+            return;
+        }
+
+        /* Seen before in this pass, keep it if the table has room */
+        if (MiCombinedPages >= MiCombineSize) return;
+    }
+
+    OldIrql = MiAcquirePfnLock();
+
+    TempPte = *PointerPte;
+    if (!MiIsCombineCandidate(TempPte) || (PFN_FROM_PTE(&TempPte) != PageFrameIndex))
+    {
+        MiReleasePfnLock(OldIrql);
+        return;
+    }
+
+    /* Write protect the page, so that it cannot change while it is compared */
+    NewPte = TempPte;
+    MiMakeCombinedPte(&NewPte, PageFrameIndex);
+    if (InterlockedCompareExchangePte(PointerPte, NewPte.u.Long, TempPte.u.Long) != TempPte.u.Long)
+    {
+        /* The processor just set the dirty bit, leave the page for the next pass */
+        MiReleasePfnLock(OldIrql);
+        return;
+    }
+
+    MiReleasePfnLock(OldIrql);
+
+    /* It is compared once no processor can write to it anymore */
+    Batch->PointerPte[Batch->Count] = PointerPte;
+    Batch->OriginalPte[Batch->Count] = TempPte;
+    Batch->Hash[Batch->Count] = Hash;
+    Batch->Count++;
+    MiInsertPteFlushList(&Batch->FlushList, Address);
+}
+
+static
+PFN_NUMBER
+MiCombineProtectedPte(IN PEPROCESS Process,
+                      IN PMMPTE PointerPte,
+                      IN MMPTE TempPte,
+                      IN ULONG Hash,
+                      IN OUT PMMPTE_FLUSH_LIST FlushList)
+{
+    MMPTE NewPte;
+    PFN_NUMBER PageFrameIndex, CombinedPageFrameIndex;
+    PMMPFN Pfn1, Pfn2;
+    PVOID Address, CombinedAddress;
+    ULONG Slot, Bucket;
+    KIRQL OldIrql, HyperIrql;
+    BOOLEAN Match;
+
+    PageFrameIndex = PFN_FROM_PTE(&TempPte);
+    Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
+    Address = MiPteToAddress(PointerPte);
+
+    OldIrql = MiAcquirePfnLock();
+
+    /* The working set lock kept the PTE as it is, but the page may have been locked since */
+    ASSERT(PFN_FROM_PTE(PointerPte) == PageFrameIndex);
+    if ((Pfn1->u2.ShareCount != 1) || (Pfn1->u3.e2.ReferenceCount != 1))
+    {
+        MI_UPDATE_VALID_PTE(PointerPte, TempPte);
+        MiReleasePfnLock(OldIrql);
+        return 0;
+    }
+
+    Bucket = Hash & (MiCombineSize - 1);
+    for (Slot = MiCombineBuckets[Bucket];
+         Slot != MI_COMBINE_NO_SLOT;
+         Slot = MiCombineEntries[Slot].Next)
+    {
+        if (MiCombineEntries[Slot].Hash != Hash) continue;
+
+        CombinedPageFrameIndex = PFN_FROM_PTE(&MiCombinePtes[Slot]);
+        Pfn2 = MI_PFN_ELEMENT(CombinedPageFrameIndex);
+        if (Pfn2->OriginalPte.u.Soft.Protection != Pfn1->OriginalPte.u.Soft.Protection) continue;
+
+        CombinedAddress = MiMapPageInHyperSpace(Process, CombinedPageFrameIndex, &HyperIrql);
+        Match = (RtlCompareMemory(Address, CombinedAddress, PAGE_SIZE) == PAGE_SIZE);
+        MiUnmapPageInHyperSpace(Process, CombinedAddress, HyperIrql);
+        if (!Match) continue;
+
+        /* Combined pages are not in working sets, take the private copy out */
+        if (Pfn1->u1.WsIndex != 0) MiRemoveFromWorkingSetList(&Process->Vm, Address);
+
+        /* Map the combined page instead. The page table keeps the share of a valid PTE */
+        NewPte = TempPte;
+        MiMakeCombinedPte(&NewPte, CombinedPageFrameIndex);
+        MI_ERASE_PTE(PointerPte);
+        MI_WRITE_VALID_PTE(PointerPte, NewPte);
+        Pfn2->u2.ShareCount++;
+
+        /* The private copy is freed once no processor reads it anymore */
+        MI_SET_PFN_DELETED(Pfn1);
+        MiInsertPteFlushList(FlushList, Address);
+
+        MiCombinePagesMerged++;
+        MiReleasePfnLock(OldIrql);
+        return PageFrameIndex;
+    }
+
+    /* Nothing to merge with. Keep the page if its content was seen before in this pass */
+    if (RtlCheckBit(&MiCombineSeen, Hash & (MI_COMBINE_SEEN_BITS - 1)))
+    {
+        Slot = RtlFindClearBitsAndSet(&MiCombineSlots, 1, 0);
+        if (Slot != MI_COMBINE_NO_SLOT)
+        {
+            /* The page is read only now, so hash what it really holds */
+            Hash = MiHashPage(Address);
+            Bucket = Hash & (MiCombineSize - 1);
+
+            NewPte = ValidKernelPte;
+            NewPte.u.Hard.PageFrameNumber = PageFrameIndex;
+            MiCombinePtes[Slot] = NewPte;
+
+            /* Turn it into a prototype PFN, with a share for the table */
+            if (Pfn1->u1.WsIndex != 0) MiRemoveFromWorkingSetList(&Process->Vm, Address);
+            Pfn1->PteAddress = &MiCombinePtes[Slot];
+            Pfn1->u4.PteFrame = (PFN_NUMBER)(MmGetPhysicalAddress(&MiCombinePtes[Slot]).QuadPart >> PAGE_SHIFT);
+            Pfn1->u3.e1.PrototypePte = 1;
+            Pfn1->u2.ShareCount++;
+
+            MiCombineEntries[Slot].Hash = Hash;
+            MiCombineEntries[Slot].Next = MiCombineBuckets[Bucket];
+            MiCombineBuckets[Bucket] = Slot;
+
+            MiCombinedPages++;
+            MiCombinePagesMerged++;
+            MiReleasePfnLock(OldIrql);
+            return 0;
+        }
+    }
+    RtlSetBit(&MiCombineSeen, Hash & (MI_COMBINE_SEEN_BITS - 1));
+
+    /* Give the write access back, which needs no flush */
+    MI_UPDATE_VALID_PTE(PointerPte, TempPte);
+    MiReleasePfnLock(OldIrql);
+    return 0;
+}
+
+static
+VOID
+MiFlushCombineBatch(IN PEPROCESS Process,
+                    IN OUT PMI_COMBINE_BATCH Batch)
+{
+    PFN_NUMBER Pages[MM_MAXIMUM_FLUSH_COUNT];
+    ULONG i, Count = 0;
+    KIRQL OldIrql;
+
+    if ((Batch->Count == 0) && (Batch->Scanned == 0)) return;
+
+    if (Batch->Count != 0)
+    {
+        /* Only the processors running the process can have the pages writable in their TB */
+        MiFlushPteList(&Batch->FlushList, FALSE);
+        MiInitializePteFlushList(&Batch->FlushList);
+
+        for (i = 0; i < Batch->Count; i++)
+        {
+            Pages[Count] = MiCombineProtectedPte(Process,
+                                                 Batch->PointerPte[i],
+                                                 Batch->OriginalPte[i],
+                                                 Batch->Hash[i],
+                                                 &Batch->FlushList);
+            if (Pages[Count] != 0) Count++;
+        }
+
+        /* The private copies that were merged can go once nobody reads them anymore */
+        MiFlushPteList(&Batch->FlushList, FALSE);
+        MiInitializePteFlushList(&Batch->FlushList);
+    }
+
+    OldIrql = MiAcquirePfnLock();
+    for (i = 0; i < Count; i++)
+    {
+        MiDecrementShareCount(MI_PFN_ELEMENT(Pages[i]), Pages[i]);
+    }
+    MiCombinePagesScanned += Batch->Scanned;
+    MiReleasePfnLock(OldIrql);
+
+    Batch->Count = 0;
+    Batch->Scanned = 0;
+}
+
+static
+VOID
+MiScanProcessForCombining(IN PEPROCESS Process)
+{
+    PETHREAD Thread = PsGetCurrentThread();
+    MI_COMBINE_BATCH Batch;
+    PMMVAD Vad;
+    PMMPTE PointerPte, LastPte;
+
+    Batch.Count = 0;
+    Batch.Scanned = 0;
+    MiInitializePteFlushList(&Batch.FlushList);
+
+    MmLockAddressSpace(&Process->Vm);
+    if (Process->VmDeleted)
+    {
+        MmUnlockAddressSpace(&Process->Vm);
+        return;
+    }
+
+    /* Start with the lowest VAD */
+    Vad = (PMMVAD)Process->VadRoot.BalancedRoot.RightChild;
+    while (Vad && Vad->LeftChild) Vad = Vad->LeftChild;
+
+    for (; Vad; Vad = (PMMVAD)MiGetNextNode((PMMADDRESS_NODE)Vad))
+    {
+        /* Only ARM3 private memory */
+        if (MI_IS_MEMORY_AREA_VAD(Vad) ||
+            !Vad->u.VadFlags.PrivateMemory ||
+            (Vad->u.VadFlags.VadType != VadNone))
+        {
+            continue;
+        }
+
+        PointerPte = MiAddressToPte((PVOID)(Vad->StartingVpn << PAGE_SHIFT));
+        LastPte = MiAddressToPte((PVOID)(Vad->EndingVpn << PAGE_SHIFT));
+        while (PointerPte <= LastPte)
+        {
+            /* Do one page table at a time, so that faults are not held up for long */
+            MiLockProcessWorkingSet(Process, Thread);
+            do
+            {
+                if (!MmIsAddressValid(PointerPte))
+                {
+                    /* No page table here, move on to the next one */
+                    PointerPte = MiPdeToPte(MiPteToPde(PointerPte) + 1);
+                    break;
+                }
+
+                MiProtectCombineCandidate(PointerPte, &Batch);
+                if (Batch.Count == MM_MAXIMUM_FLUSH_COUNT) MiFlushCombineBatch(Process, &Batch);
+                PointerPte++;
+            } while ((PointerPte <= LastPte) && !MiIsPteOnPdeBoundary(PointerPte));
+
+            /* The protected pages must be dealt with before faults can see them */
+            MiFlushCombineBatch(Process, &Batch);
+            MiUnlockProcessWorkingSet(Process, Thread);
+        }
+    }
+
+    MmUnlockAddressSpace(&Process->Vm);
+}
+
+static
+VOID
+MiScanForCombining(VOID)
+{
+    PLIST_ENTRY ListEntry;
+    PMMSUPPORT Vm;
+    PEPROCESS Process;
+    KIRQL OldIrql;
+
+    /* Only pages seen twice in the same pass get combined */
+    RtlClearAllBits(&MiCombineSeen);
+
+    OldIrql = MiAcquireExpansionLock();
+    for (ListEntry = MmWorkingSetExpansionHead.Flink;
+         ListEntry != &MmWorkingSetExpansionHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Vm = CONTAINING_RECORD(ListEntry, MMSUPPORT, WorkingSetExpansionLinks);
+
+        /* Session & system space have no private memory to combine */
+        if ((Vm == MmGetKernelAddressSpace()) || !MI_IS_PROCESS_WORKING_SET(Vm))
+            continue;
+
+        /* Make sure the process is not terminating and attach to it */
+        Process = CONTAINING_RECORD(Vm, EPROCESS, Vm);
+        if (!ExAcquireRundownProtection(&Process->RundownProtect))
+            continue;
+
+        MiReleaseExpansionLock(OldIrql);
+
+        ASSERT(!KeIsAttachedProcess());
+        KeAttachProcess(&Process->Pcb);
+        MiScanProcessForCombining(Process);
+        KeDetachProcess();
+
+        OldIrql = MiAcquireExpansionLock();
+        ExReleaseRundownProtection(&Process->RundownProtect);
+    }
+    MiReleaseExpansionLock(OldIrql);
+
+    MiCombineScans++;
+}
+
+static
+VOID
+MiFreeUnusedCombinedPages(VOID)
+{
+    PFN_NUMBER PageFrameIndex;
+    PMMPFN Pfn1;
+    PULONG Link;
+    ULONG Bucket, Slot;
+    KIRQL OldIrql;
+
+    for (Bucket = 0; Bucket < MiCombineSize; Bucket++)
+    {
+        OldIrql = MiAcquirePfnLock();
+
+        Link = &MiCombineBuckets[Bucket];
+        while (*Link != MI_COMBINE_NO_SLOT)
+        {
+            Slot = *Link;
+            PageFrameIndex = PFN_FROM_PTE(&MiCombinePtes[Slot]);
+            Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
+
+            /* Keep it if anything besides the table still uses it */
+            if ((Pfn1->u2.ShareCount != 1) || (Pfn1->u3.e2.ReferenceCount != 1))
+            {
+                Link = &MiCombineEntries[Slot].Next;
+                continue;
+            }
+
+            *Link = MiCombineEntries[Slot].Next;
+            MiCombinePtes[Slot].u.Long = 0;
+            RtlClearBit(&MiCombineSlots, Slot);
+            MiCombinedPages--;
+
+            /* It is a private page again, drop the table's share to free it */
+            Pfn1->u3.e1.PrototypePte = 0;
+            MI_SET_PFN_DELETED(Pfn1);
+            MiDecrementShareCount(Pfn1, PageFrameIndex);
+        }
+
+        MiReleasePfnLock(OldIrql);
+    }
+}
+
+static
+VOID
+NTAPI
+MiPageCombiningThread(IN PVOID Context)
+{
+    LARGE_INTEGER Timeout;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    Timeout.QuadPart = Int32x32To64(MI_COMBINE_SCAN_SECONDS, -10 * 1000 * 1000);
+    for (;;)
+    {
+        KeWaitForSingleObject(&MiCombineEvent, Executive, KernelMode, FALSE, &Timeout);
+
+        if (MmEnablePageCombining)
+        {
+            if (!MiCombinePtes && !MiAllocateCombineTable())
+            {
+                DPRINT1("Not enough memory for the page combining table\n");
+                continue;
+            }
+
+            MiScanForCombining();
+        }
+
+        /* Combined pages are released even after combining was turned off */
+        if (MiCombinedPages) MiFreeUnusedCombinedPages();
+    }
+}
+
+/* PUBLIC FUNCTIONS ***********************************************************/
+
+NTSTATUS
+NTAPI
+MiUncombinePte(
+    _In_ PEPROCESS Process,
+    _In_ PMMPTE PointerPte)
+{
+    MMPTE TempPte;
+    PFN_NUMBER PageFrameIndex, CombinedPageFrameIndex;
+    PMMPFN Pfn1;
+    ULONG Protection;
+    KIRQL OldIrql;
+
+    ASSERT(Process == PsGetCurrentProcess());
+    ASSERT(MM_ANY_WS_LOCK_HELD_EXCLUSIVE(PsGetCurrentThread()));
+
+    OldIrql = MiAcquirePfnLock();
+
+    TempPte = *PointerPte;
+    ASSERT(TempPte.u.Hard.Valid == 1);
+    CombinedPageFrameIndex = PFN_FROM_PTE(&TempPte);
+    Pfn1 = MI_PFN_ELEMENT(CombinedPageFrameIndex);
+    ASSERT(MiIsCombinedPfn(Pfn1));
+    Protection = Pfn1->OriginalPte.u.Soft.Protection;
+
+    MI_SET_USAGE(MI_USAGE_COW);
+    MI_SET_PROCESS(Process);
+
+    /* Allocate a new page and copy it */
+    PageFrameIndex = MiRemoveAnyPage(MI_GET_NEXT_PROCESS_COLOR(Process));
+    if (PageFrameIndex == 0)
+    {
+        MiReleasePfnLock(OldIrql);
+        return STATUS_NO_MEMORY;
+    }
+    MiCopyPfn(PageFrameIndex, CombinedPageFrameIndex);
+
+    /* Drop the combined page, and leave the protection for the new PFN to pick up */
+    MiDeletePte(PointerPte, MiPteToAddress(PointerPte), Process, Pfn1->PteAddress, NULL);
+    MI_MAKE_SOFTWARE_PTE(&TempPte, Protection);
+    MI_WRITE_INVALID_PTE(PointerPte, TempPte);
+    MiInitializePfn(PageFrameIndex, PointerPte, TRUE);
+
+    /* And map the private copy */
+    MI_MAKE_HARDWARE_PTE_USER(&TempPte, PointerPte, Protection, PageFrameIndex);
+    MI_MAKE_DIRTY_PAGE(&TempPte);
+    MI_WRITE_VALID_PTE(PointerPte, TempPte);
+
+    MiCombinePagesUnmerged++;
+    MiReleasePfnLock(OldIrql);
+
+    /* The private copy belongs to the working set */
+    MiInsertInWorkingSetList(&Process->Vm, MiPteToAddress(PointerPte), Protection);
+    return STATUS_SUCCESS;
+}
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+MmInitializePageCombining(VOID)
+{
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+
+    KeInitializeEvent(&MiCombineEvent, SynchronizationEvent, FALSE);
+
+    Status = PsCreateSystemThread(&ThreadHandle,
+                                  THREAD_ALL_ACCESS,
+                                  NULL,
+                                  NULL,
+                                  NULL,
+                                  MiPageCombiningThread,
+                                  NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Failed to start the page combining thread: 0x%lx\n", Status);
+        return;
+    }
+
+    ZwClose(ThreadHandle);
+}
+
+VOID
+NTAPI
+MmQueryPageCombiningInformation(
+    _Out_ PSYSTEM_PAGE_COMBINING_INFORMATION Information)
+{
+    ULONGLONG Scanned, Merged, Unmerged;
+    ULONG_PTR CombinedPages;
+    KIRQL OldIrql;
+
+    /* Take a consistent snapshot, the caller's buffer may be pageable */
+    OldIrql = MiAcquirePfnLock();
+    Scanned = MiCombinePagesScanned;
+    Merged = MiCombinePagesMerged;
+    Unmerged = MiCombinePagesUnmerged;
+    CombinedPages = MiCombinedPages;
+    MiReleasePfnLock(OldIrql);
+
+    Information->Enabled = (MmEnablePageCombining != 0);
+    Information->NumberOfScans = MiCombineScans;
+    Information->CombinedPages = CombinedPages;
+    Information->PagesScanned = Scanned;
+    Information->PagesMerged = Merged;
+    Information->PagesUnmerged = Unmerged;
+}
+
+VOID
+NTAPI
+MmSetPageCombining(
+    _In_ BOOLEAN Enable,
+    _In_ BOOLEAN ScanNow)
+{
+    MmEnablePageCombining = Enable;
+
+    /* Don't wait for the next period */
+    if (Enable && ScanNow)
+    {
+        KeSetEvent(&MiCombineEvent, IO_NO_INCREMENT, FALSE);
+    }
+}
+
+/* EOF */
@@ -26,6 +26,18 @@ ULONG MmLargePageDriverBufferLength = -1;
 LIST_ENTRY MiLargePageDriverList;
 BOOLEAN MiLargePageAllDrivers;
 
+#ifdef _M_AMD64
+/* Number of small pages that make up one large page */
+#define MI_LARGE_PAGE_PFNS (PDE_MAPPED_VA >> PAGE_SHIFT)
+
+/* How often we let the balancer free memory before giving up on a large page */
+#define MI_LARGE_PAGE_ALLOCATION_RETRIES 2
+
+VOID
+NTAPI
+MmRebalanceMemoryConsumersAndWait(VOID);
+#endif
+
 /* FUNCTIONS ******************************************************************/
 
 CODE_SEG("INIT")
@@ -101,4 +113,162 @@ MiInitializeDriverLargePageList(VOID)
     }
 }
 
+#ifdef _M_AMD64
+
+static
+PFN_NUMBER
+MiAllocateLargePage(VOID)
+{
+    PFN_NUMBER PageFrameIndex, i;
+    ULONG Retries = 0;
+
+    /* Look for a free run of pages that is aligned like a large page */
+    while (TRUE)
+    {
+        PageFrameIndex = MiFindContiguousPages(0,
+                                               MmHighestPhysicalPage,
+                                               MI_LARGE_PAGE_PFNS,
+                                               MI_LARGE_PAGE_PFNS,
+                                               MmCached);
+        if (PageFrameIndex) break;
+
+        /*
+         * Physical memory is too fragmented. Have the balancer page out user
+         * memory and trim the cache, so that free pages can merge into an
+         * aligned run, and then try again.
+         */
+        if (Retries++ == MI_LARGE_PAGE_ALLOCATION_RETRIES) return 0;
+        DPRINT("No free large page, rebalancing memory (attempt %lu)\n", Retries);
+        MmRebalanceMemoryConsumersAndWait();
+    }
+
+    /* User memory always starts out zeroed */
+    for (i = 0; i < MI_LARGE_PAGE_PFNS; i++)
+    {
+        MiZeroPhysicalPage(PageFrameIndex + i);
+    }
+
+    return PageFrameIndex;
+}
+
+VOID
+NTAPI
+MiFreeLargePage(IN PFN_NUMBER PageFrameIndex)
+{
+    PMMPFN Pfn1;
+    PFN_NUMBER i;
+
+    /* The PFN lock must be held */
+    MI_ASSERT_PFN_LOCK_HELD();
+
+    /* This must be a large page we handed out */
+    Pfn1 = MiGetPfnEntry(PageFrameIndex);
+    ASSERT(Pfn1->u3.e1.StartOfAllocation == 1);
+    ASSERT((Pfn1 + MI_LARGE_PAGE_PFNS - 1)->u3.e1.EndOfAllocation == 1);
+    Pfn1->u3.e1.StartOfAllocation = 0;
+    (Pfn1 + MI_LARGE_PAGE_PFNS - 1)->u3.e1.EndOfAllocation = 0;
+
+    /* Give each page back, pages locked for I/O go once they are unlocked */
+    for (i = 0; i < MI_LARGE_PAGE_PFNS; i++, Pfn1++)
+    {
+        ASSERT(Pfn1->u2.ShareCount == 1);
+        ASSERT(Pfn1->u3.e1.PageLocation == ActiveAndValid);
+        MI_SET_PFN_DELETED(Pfn1);
+        MiDecrementShareCount(Pfn1, PageFrameIndex + i);
+    }
+}
+
+NTSTATUS
+NTAPI
+MiAllocateLargePages(IN PFN_NUMBER LargePageCount,
+                     OUT PPFN_NUMBER PageFrameIndexes)
+{
+    PFN_NUMBER i;
+    KIRQL OldIrql;
+
+    /* Grab all the pages up front, before anything gets locked */
+    for (i = 0; i < LargePageCount; i++)
+    {
+        PageFrameIndexes[i] = MiAllocateLargePage();
+        if (!PageFrameIndexes[i])
+        {
+            /* We could not get all of them, give back what we have */
+            DPRINT1("Out of large pages after %Iu of %Iu\n", i, LargePageCount);
+            OldIrql = MiAcquirePfnLock();
+            while (i--) MiFreeLargePage(PageFrameIndexes[i]);
+            MiReleasePfnLock(OldIrql);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+MiFreeLargePages(IN PFN_NUMBER LargePageCount,
+                 IN PPFN_NUMBER PageFrameIndexes)
+{
+    PFN_NUMBER i;
+    KIRQL OldIrql;
+
+    /* These were never mapped, just free them */
+    OldIrql = MiAcquirePfnLock();
+    for (i = 0; i < LargePageCount; i++)
+    {
+        MiFreeLargePage(PageFrameIndexes[i]);
+    }
+    MiReleasePfnLock(OldIrql);
+}
+
+VOID
+NTAPI
+MiMapLargePages(IN PEPROCESS Process,
+                IN PMMVAD Vad,
+                IN PPFN_NUMBER PageFrameIndexes)
+{
+    PETHREAD CurrentThread = PsGetCurrentThread();
+    PMMPDE PointerPde, LastPde;
+    MMPDE TempPde;
+
+    /* The VAD must cover whole large pages */
+    ASSERT(Vad->u.VadFlags.VadType == VadLargePages);
+    ASSERT((Vad->StartingVpn & (MI_LARGE_PAGE_PFNS - 1)) == 0);
+    ASSERT(((Vad->EndingVpn + 1) & (MI_LARGE_PAGE_PFNS - 1)) == 0);
+    PointerPde = MiAddressToPde((PVOID)(Vad->StartingVpn << PAGE_SHIFT));
+    LastPde = MiAddressToPde((PVOID)(Vad->EndingVpn << PAGE_SHIFT));
+
+    MiLockProcessWorkingSetUnsafe(Process, CurrentThread);
+    while (PointerPde <= LastPde)
+    {
+        /* Build the page directories above us, but no page table */
+        if (!MiPdeToPxe(PointerPde)->u.Hard.Valid)
+        {
+            MiMakeSystemAddressValid(MiPdeToPpe(PointerPde), Process);
+        }
+        if (!MiPdeToPpe(PointerPde)->u.Hard.Valid)
+        {
+            MiMakeSystemAddressValid(PointerPde, Process);
+        }
+
+        /* Nobody can have faulted in a page table here */
+        ASSERT(PointerPde->u.Long == 0);
+
+        /* Write a large PDE with the protection of the VAD */
+        MI_MAKE_HARDWARE_PTE_USER((PMMPTE)&TempPde,
+                                  (PMMPTE)PointerPde,
+                                  Vad->u.VadFlags.Protection,
+                                  *PageFrameIndexes++);
+        TempPde.u.Hard.LargePage = 1;
+        MI_WRITE_VALID_PDE(PointerPde, TempPde);
+
+        /* The page directory has one more entry in use */
+        MiIncrementPageTableReferences(MiPdeToPte(PointerPde));
+        PointerPde++;
+    }
+    MiUnlockProcessWorkingSetUnsafe(Process, CurrentThread);
+}
+
+#endif
+
 /* EOF */
@@ -938,7 +938,7 @@ MmProbeAndLockPages(IN PMDL Mdl,
     NTSTATUS Status = STATUS_SUCCESS;
     PEPROCESS CurrentProcess;
     NTSTATUS ProbeStatus;
-    PMMPTE PointerPte, LastPte;
+    PMMPTE PointerPte, LastPte, MappingPte;
     PMMPDE PointerPde;
 #if (_MI_PAGING_LEVELS >= 3)
     PMMPDE PointerPpe;
@@ -1011,9 +1011,6 @@ MmProbeAndLockPages(IN PMDL Mdl,
     TotalPages = LockPages;
     StartAddress = Address;
 
-    /* Large pages not supported */
-    ASSERT(!MI_IS_PHYSICAL_ADDRESS(Address));
-
     //
     // Now probe them
     //
@@ -1196,7 +1193,7 @@ MmProbeAndLockPages(IN PMDL Mdl,
                (PointerPpe->u.Hard.Valid == 0) ||
 #endif
                (PointerPde->u.Hard.Valid == 0) ||
-               (PointerPte->u.Hard.Valid == 0))
+               (!MI_IS_PAGE_LARGE(PointerPde) && (PointerPte->u.Hard.Valid == 0)))
         {
             //
             // What kind of lock were we using?
@@ -1247,6 +1244,11 @@ MmProbeAndLockPages(IN PMDL Mdl,
             }
         }
 
+        //
+        // Large pages have no PTE, the PDE maps the page
+        //
+        MappingPte = MI_IS_PAGE_LARGE(PointerPde) ? (PMMPTE)PointerPde : PointerPte;
+
         //
         // Check if this was a write or modify
         //
@@ -1255,12 +1257,12 @@ MmProbeAndLockPages(IN PMDL Mdl,
             //
             // Check if the PTE is not writable
             //
-            if (MI_IS_PAGE_WRITEABLE(PointerPte) == FALSE)
+            if (MI_IS_PAGE_WRITEABLE(MappingPte) == FALSE)
             {
                 //
                 // Check if it's copy on write
                 //
-                if (MI_IS_PAGE_COPY_ON_WRITE(PointerPte))
+                if (MI_IS_PAGE_COPY_ON_WRITE(MappingPte))
                 {
                     //
                     // Get the base address and allow a change for user-mode
@@ -1333,7 +1335,14 @@ MmProbeAndLockPages(IN PMDL Mdl,
         //
         // Grab the PFN
         //
-        PageFrameIndex = PFN_FROM_PTE(PointerPte);
+        PageFrameIndex = PFN_FROM_PTE(MappingPte);
+        if (MappingPte != PointerPte)
+        {
+            //
+            // Get the small page inside the large page
+            //
+            PageFrameIndex += MiAddressToPteOffset(MiPteToAddress(PointerPte));
+        }
         Pfn1 = MiGetPfnEntry(PageFrameIndex);
         if (Pfn1)
         {
@@ -443,6 +443,19 @@ typedef struct _MI_LARGE_PAGE_RANGES
     PFN_NUMBER LastFrame;
 } MI_LARGE_PAGE_RANGES, *PMI_LARGE_PAGE_RANGES;
 
+//
+// Deferred TB flush list, used to flush the TB of all processors with a
+// single IPI once a batch of PTEs has been torn down. Once more than
+// MM_MAXIMUM_FLUSH_COUNT entries are inserted, the entire TB is flushed.
+//
+#define MM_MAXIMUM_FLUSH_COUNT KI_MAXIMUM_FLUSH_COUNT
+
+typedef struct _MMPTE_FLUSH_LIST
+{
+    ULONG Count;
+    PVOID FlushVa[MM_MAXIMUM_FLUSH_COUNT];
+} MMPTE_FLUSH_LIST, *PMMPTE_FLUSH_LIST;
+
 typedef struct _MMVIEW
 {
     ULONG_PTR Entry;
@@ -637,6 +650,8 @@ extern PFN_NUMBER MmSystemPageDirectory[PPE_PER_PAGE];
 extern PMMPTE MmSharedUserDataPte;
 extern LIST_ENTRY MmProcessList;
 extern KEVENT MmZeroingPageEvent;
+extern ULONG MmZeroedPageHits;
+extern ULONG MmZeroedPageMisses;
 extern ULONG MmSystemPageColor;
 extern ULONG MmProcessColorSeed;
 extern PMMWSL MmWorkingSetList;
@@ -650,7 +665,9 @@ extern PVOID MiSessionPoolStart;   // 0xBD000000
 extern PVOID MiSessionViewStart;   // 0xBE000000
 extern PVOID MiSessionSpaceWs;
 extern ULONG MmMaximumDeadKernelStacks;
+extern ULONG MmMaximumProcessorDeadKernelStacks;
 extern SLIST_HEADER MmDeadStackSListHead;
+extern SLIST_HEADER MiProcessorDeadStackSListHead[MAXIMUM_PROCESSORS];
 extern MM_AVL_TABLE MmSectionBasedRoot;
 extern KGUARDED_MUTEX MmSectionBasedMutex;
 extern PVOID MmHighSectionBase;
@@ -1109,6 +1126,31 @@ MiIsRosSectionObject(IN PSECTION Section)
 
 #define MI_IS_ROS_PFN(x)     ((x)->u4.AweAllocation == TRUE)
 
+extern PMMPTE MiCombinePtes;
+extern ULONG MiCombineSize;
+
+//
+// Private pages merged by the page combining scanner share a prototype PFN
+// whose prototype PTE lives in the combine table
+//
+FORCEINLINE
+BOOLEAN
+MiIsCombinedPfn(IN PMMPFN Pfn1)
+{
+    PMMPTE PointerPte = (PMMPTE)((ULONG_PTR)Pfn1->PteAddress & ~0x1);
+
+    return (Pfn1->u3.e1.PrototypePte == 1) &&
+           (PointerPte >= MiCombinePtes) &&
+           (PointerPte < MiCombinePtes + MiCombineSize);
+}
+
+NTSTATUS
+NTAPI
+MiUncombinePte(
+    _In_ PEPROCESS Process,
+    _In_ PMMPTE PointerPte
+);
+
 VOID
 NTAPI
 MiDecrementReferenceCount(
@@ -2112,6 +2154,20 @@ MiRemoveZeroPage(
     IN ULONG Color
 );
 
+PFN_NUMBER
+NTAPI
+MiRemovePageFromProcessorCache(
+    IN MMLISTS ListName,
+    IN ULONG Color
+);
+
+VOID
+NTAPI
+MiInitializeCachedPfn(
+    IN PFN_NUMBER PageFrameIndex,
+    IN PMMPTE PointerPte
+);
+
 VOID
 NTAPI
 MiZeroPhysicalPage(
@@ -2166,6 +2222,36 @@ MiSyncCachedRanges(
     VOID
 );
 
+#ifdef _M_AMD64
+NTSTATUS
+NTAPI
+MiAllocateLargePages(
+    IN PFN_NUMBER LargePageCount,
+    OUT PPFN_NUMBER PageFrameIndexes
+);
+
+VOID
+NTAPI
+MiFreeLargePages(
+    IN PFN_NUMBER LargePageCount,
+    IN PPFN_NUMBER PageFrameIndexes
+);
+
+VOID
+NTAPI
+MiFreeLargePage(
+    IN PFN_NUMBER PageFrameIndex
+);
+
+VOID
+NTAPI
+MiMapLargePages(
+    IN PEPROCESS Process,
+    IN PMMVAD Vad,
+    IN PPFN_NUMBER PageFrameIndexes
+);
+#endif
+
 BOOLEAN
 NTAPI
 MiIsPfnInUse(
@@ -2279,6 +2365,13 @@ MiRemoveNode(
     IN PMM_AVL_TABLE Table
 );
 
+VOID
+NTAPI
+MiUpdateNodeGaps(
+    IN PMMADDRESS_NODE Node,
+    IN PMM_AVL_TABLE Table
+);
+
 PMMADDRESS_NODE
 NTAPI
 MiGetPreviousNode(
@@ -2335,7 +2428,8 @@ MiDeletePte(
     IN PMMPTE PointerPte,
     IN PVOID VirtualAddress,
     IN PEPROCESS CurrentProcess,
-    IN PMMPTE PrototypePte
+    IN PMMPTE PrototypePte,
+    IN PMMPTE_FLUSH_LIST FlushList OPTIONAL
 );
 
 ULONG
@@ -2534,6 +2628,56 @@ MiDecrementPageTableReferences(IN PVOID Address)
 } // extern "C"
 #endif
 
+FORCEINLINE
+VOID
+MiInitializePteFlushList(
+    _Out_ PMMPTE_FLUSH_LIST FlushList)
+{
+    FlushList->Count = 0;
+}
+
+FORCEINLINE
+VOID
+MiInsertPteFlushList(
+    _Inout_ PMMPTE_FLUSH_LIST FlushList,
+    _In_ PVOID VirtualAddress)
+{
+    /* Remember the address, unless the list already overflowed */
+    if (FlushList->Count < MM_MAXIMUM_FLUSH_COUNT)
+    {
+        FlushList->FlushVa[FlushList->Count] = VirtualAddress;
+    }
+
+    /* Saturate the count, so that we know we need a full flush */
+    if (FlushList->Count <= MM_MAXIMUM_FLUSH_COUNT)
+    {
+        FlushList->Count++;
+    }
+}
+
+FORCEINLINE
+VOID
+MiFlushPteList(
+    _Inout_ PMMPTE_FLUSH_LIST FlushList,
+    _In_ BOOLEAN AllProcessors)
+{
+    /* Nothing to do if the list is empty */
+    if (FlushList->Count == 0) return;
+
+    /* Flush the whole TB if there were too many entries */
+    if (FlushList->Count > MM_MAXIMUM_FLUSH_COUNT)
+    {
+        KeFlushEntireTb(TRUE, AllProcessors);
+    }
+    else
+    {
+        KeFlushMultipleTb(FlushList->Count, FlushList->FlushVa, AllProcessors);
+    }
+
+    /* The list can be reused now */
+    FlushList->Count = 0;
+}
+
 FORCEINLINE
 VOID
 MiDeletePde(
@@ -2543,17 +2687,32 @@ MiDeletePde(
     /* Only for user-mode ones */
     ASSERT(MiIsUserPde(PointerPde));
 
-    /* Kill this one as a PTE */
-    MiDeletePte((PMMPTE)PointerPde, MiPdeToPte(PointerPde), CurrentProcess, NULL);
+#ifdef _M_AMD64
+    /* Large pages have no page table, the PDE maps the pages themselves */
+    if (MI_IS_PAGE_LARGE(PointerPde))
+    {
+        PFN_NUMBER PageFrameIndex = PFN_FROM_PDE(PointerPde);
+
+        /* Unmap them and flush the TB before they can be reused */
+        MI_ERASE_PTE((PMMPTE)PointerPde);
+        KeFlushEntireTb(TRUE, FALSE);
+        MiFreeLargePage(PageFrameIndex);
+    }
+    else
+#endif
+    {
+        /* Kill this one as a PTE */
+        MiDeletePte((PMMPTE)PointerPde, MiPdeToPte(PointerPde), CurrentProcess, NULL, NULL);
+    }
 #if _MI_PAGING_LEVELS >= 3
     /* Cascade down */
     if (MiDecrementPageTableReferences(MiPdeToPte(PointerPde)) == 0)
     {
-        MiDeletePte(MiPdeToPpe(PointerPde), PointerPde, CurrentProcess, NULL);
+        MiDeletePte(MiPdeToPpe(PointerPde), PointerPde, CurrentProcess, NULL, NULL);
 #if _MI_PAGING_LEVELS == 4
         if (MiDecrementPageTableReferences(PointerPde) == 0)
         {
-            MiDeletePte(MiPdeToPxe(PointerPde), MiPdeToPpe(PointerPde), CurrentProcess, NULL);
+            MiDeletePte(MiPdeToPxe(PointerPde), MiPdeToPpe(PointerPde), CurrentProcess, NULL, NULL);
         }
 #endif
     }
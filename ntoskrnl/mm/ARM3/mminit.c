@@ -1566,6 +1566,7 @@ MmDumpArmPfnDatabase(IN BOOLEAN StatusOnly)
     DbgPrint("Active:               %5d pages\t[%6d KB]\n", ActivePages,  (ActivePages    << PAGE_SHIFT) / 1024);
     DbgPrint("Free:                 %5d pages\t[%6d KB]\n", FreePages,    (FreePages      << PAGE_SHIFT) / 1024);
     DbgPrint("Other:                %5d pages\t[%6d KB]\n", OtherPages,   (OtherPages     << PAGE_SHIFT) / 1024);
+    DbgPrint("Zeroed list:          %5lu hits\t%5lu misses\n", MmZeroedPageHits, MmZeroedPageMisses);
     DbgPrint("-----------------------------------------\n");
 #if MI_TRACE_PFNS
     OtherPages = UsageBucket[MI_USAGE_BOOT_DRIVER];
@@ -2159,8 +2160,12 @@ MmArmInitSystem(IN ULONG Phase,
         /* Set up the zero page event */
         KeInitializeEvent(&MmZeroingPageEvent, NotificationEvent, FALSE);
 
-        /* Initialize the dead stack S-LIST */
+        /* Initialize the dead stack S-LISTs */
         InitializeSListHead(&MmDeadStackSListHead);
+        for (i = 0; i < MAXIMUM_PROCESSORS; i++)
+        {
+            InitializeSListHead(&MiProcessorDeadStackSListHead[i]);
+        }
 
         //
         // Check if this is a machine with less than 19MB of RAM
@@ -2426,6 +2431,7 @@ MmArmInitSystem(IN ULONG Phase,
             /* Set small system */
             MmSystemSize = MmSmallSystem;
             MmMaximumDeadKernelStacks = 0;
+            MmMaximumProcessorDeadKernelStacks = 0;
         }
         else if (MmNumberOfPhysicalPages <= ((19 * _1MB) / PAGE_SIZE))
         {
@@ -2433,6 +2439,7 @@ MmArmInitSystem(IN ULONG Phase,
             MmSystemSize = MmSmallSystem;
             MmSystemCacheWsMinimum += 100;
             MmMaximumDeadKernelStacks = 2;
+            MmMaximumProcessorDeadKernelStacks = 0;
         }
         else
         {
@@ -2479,7 +2486,11 @@ MmArmInitSystem(IN ULONG Phase,
         /* Now setup the shared user data fields */
         ASSERT(SharedUserData->NumberOfPhysicalPages == 0);
         SharedUserData->NumberOfPhysicalPages = MmNumberOfPhysicalPages;
+#ifdef _M_AMD64
+        SharedUserData->LargePageMinimum = PDE_MAPPED_VA;
+#else
         SharedUserData->LargePageMinimum = 0;
+#endif
 
         /* Check for workstation (Wi for WinNT) */
         if (MmProductType == '\0i\0W')
@@ -37,7 +37,7 @@ MmMapUserAddressesToPage(IN PVOID BaseAddress,
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 NTSTATUS
 NTAPI
@@ -55,8 +55,12 @@ MmAdjustWorkingSetSize(IN SIZE_T WorkingSetMinimumInBytes,
     if ((WorkingSetMinimumInBytes == -1) &&
         (WorkingSetMaximumInBytes == -1))
     {
-        UNIMPLEMENTED;
-        return STATUS_NOT_IMPLEMENTED;
+        /* Trim every page that can be trimmed, whatever its age */
+        Ws = &PsGetCurrentProcess()->Vm;
+        MiLockWorkingSet(PsGetCurrentThread(), Ws);
+        MiEmptyWorkingSet(Ws);
+        MiUnlockWorkingSet(PsGetCurrentThread(), Ws);
+        return STATUS_SUCCESS;
     }
 
     /* Assume success */
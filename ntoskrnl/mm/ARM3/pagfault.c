@@ -277,6 +277,13 @@ MiCheckVirtualAddress(IN PVOID VirtualAddress,
             /* ReactOS does not handle AWE VADs yet */
             ASSERT(Vad->u.VadFlags.VadType != VadAwe);
 
+            /* Large pages are mapped when they are allocated, there is nothing to fault in */
+            if (Vad->u.VadFlags.VadType == VadLargePages)
+            {
+                *ProtectCode = MM_NOACCESS;
+                return NULL;
+            }
+
             /* This must be a TEB/PEB VAD */
             if (Vad->u.VadFlags.MemCommit)
             {
@@ -624,8 +631,22 @@ MiResolveDemandZeroFault(IN PVOID Address,
         Color = MI_GET_NEXT_PROCESS_COLOR(Process);
         ASSERT(Color != 0xFFFFFFFF);
 
-        /* We'll need a zero page */
-        NeedZero = TRUE;
+        /* User PTEs come from this processor's page cache, which doesn't need the PFN lock */
+        if (PointerPte <= MiHighestUserPte)
+        {
+            PageFrameNumber = MiRemovePageFromProcessorCache(ZeroedPageList, Color);
+            if (PageFrameNumber)
+            {
+                /* Page guaranteed to be zero-filled */
+                NeedZero = FALSE;
+            }
+            else
+            {
+                /* A free page will do too, we'll zero it */
+                PageFrameNumber = MiRemovePageFromProcessorCache(FreePageList, Color);
+                NeedZero = TRUE;
+            }
+        }
     }
     else
     {
@@ -644,84 +665,96 @@ MiResolveDemandZeroFault(IN PVOID Address,
         Color = 0xFFFFFFFF;
     }
 
-    /* Check if the PFN database should be acquired */
-    if (OldIrql == MM_NOIRQL)
+    if (PageFrameNumber)
     {
-        /* Acquire it and remember we should release it after */
-        OldIrql = MiAcquirePfnLock();
-        HaveLock = TRUE;
+        /* The page came from the processor cache, set it up without the PFN lock */
+        MiInitializeCachedPfn(PageFrameNumber, PointerPte);
+
+        /* Increment demand zero faults and update performance counters */
+        InterlockedIncrement(&KeGetCurrentPrcb()->MmDemandZeroCount);
+        Process->NumberOfPrivatePages++;
     }
+    else
+    {
+        /* Check if the PFN database should be acquired */
+        if (OldIrql == MM_NOIRQL)
+        {
+            /* Acquire it and remember we should release it after */
+            OldIrql = MiAcquirePfnLock();
+            HaveLock = TRUE;
+        }
 
-    /* We either manually locked the PFN DB, or already came with it locked */
-    MI_ASSERT_PFN_LOCK_HELD();
-    ASSERT(PointerPte->u.Hard.Valid == 0);
+        /* We either manually locked the PFN DB, or already came with it locked */
+        MI_ASSERT_PFN_LOCK_HELD();
+        ASSERT(PointerPte->u.Hard.Valid == 0);
 
-    /* Assert we have enough pages */
-    //ASSERT(MmAvailablePages >= 32);
+        /* Assert we have enough pages */
+        //ASSERT(MmAvailablePages >= 32);
 
 #if MI_TRACE_PFNS
-    if (UserPdeFault) MI_SET_USAGE(MI_USAGE_PAGE_TABLE);
-    if (!UserPdeFault) MI_SET_USAGE(MI_USAGE_DEMAND_ZERO);
+        if (UserPdeFault) MI_SET_USAGE(MI_USAGE_PAGE_TABLE);
+        if (!UserPdeFault) MI_SET_USAGE(MI_USAGE_DEMAND_ZERO);
 #endif
-    if (Process == HYDRA_PROCESS) MI_SET_PROCESS2("Hydra");
-    else if (Process) MI_SET_PROCESS2(Process->ImageFileName);
-    else MI_SET_PROCESS2("Kernel Demand 0");
+        if (Process == HYDRA_PROCESS) MI_SET_PROCESS2("Hydra");
+        else if (Process) MI_SET_PROCESS2(Process->ImageFileName);
+        else MI_SET_PROCESS2("Kernel Demand 0");
 
-    /* Do we need a zero page? */
-    if (Color != 0xFFFFFFFF)
-    {
-        /* Try to get one, if we couldn't grab a free page and zero it */
-        PageFrameNumber = MiRemoveZeroPageSafe(Color);
-        if (!PageFrameNumber)
+        /* Do we need a zero page? */
+        if (Color != 0xFFFFFFFF)
         {
-            /* We'll need a free page and zero it manually */
-            PageFrameNumber = MiRemoveAnyPage(Color);
-            NeedZero = TRUE;
+            /* Try to get one, if we couldn't grab a free page and zero it */
+            PageFrameNumber = MiRemoveZeroPageSafe(Color);
+            if (!PageFrameNumber)
+            {
+                /* We'll need a free page and zero it manually */
+                PageFrameNumber = MiRemoveAnyPage(Color);
+                NeedZero = TRUE;
+            }
+            else
+            {
+                /* Page guaranteed to be zero-filled */
+                NeedZero = FALSE;
+            }
         }
         else
         {
-            /* Page guaranteed to be zero-filled */
-            NeedZero = FALSE;
-        }
-    }
-    else
-    {
-        /* Get a color, and see if we should grab a zero or non-zero page */
-        Color = MI_GET_NEXT_COLOR();
-        if (!NeedZero)
-        {
-            /* Process or system doesn't want a zero page, grab anything */
-            PageFrameNumber = MiRemoveAnyPage(Color);
+            /* Get a color, and see if we should grab a zero or non-zero page */
+            Color = MI_GET_NEXT_COLOR();
+            if (!NeedZero)
+            {
+                /* Process or system doesn't want a zero page, grab anything */
+                PageFrameNumber = MiRemoveAnyPage(Color);
+            }
+            else
+            {
+                /* System wants a zero page, obtain one */
+                PageFrameNumber = MiRemoveZeroPage(Color);
+                /* No need to zero-fill it */
+                NeedZero = FALSE;
+            }
         }
-        else
+
+        if (PageFrameNumber == 0)
         {
-            /* System wants a zero page, obtain one */
-            PageFrameNumber = MiRemoveZeroPage(Color);
-            /* No need to zero-fill it */
-            NeedZero = FALSE;
+            MiReleasePfnLock(OldIrql);
+            return STATUS_NO_MEMORY;
         }
-    }
 
-    if (PageFrameNumber == 0)
-    {
-        MiReleasePfnLock(OldIrql);
-        return STATUS_NO_MEMORY;
-    }
-
-    /* Initialize it */
-    MiInitializePfn(PageFrameNumber, PointerPte, TRUE);
+        /* Initialize it */
+        MiInitializePfn(PageFrameNumber, PointerPte, TRUE);
 
-    /* Increment demand zero faults */
-    KeGetCurrentPrcb()->MmDemandZeroCount++;
+        /* Increment demand zero faults */
+        KeGetCurrentPrcb()->MmDemandZeroCount++;
 
-    /* Do we have the lock? */
-    if (HaveLock)
-    {
-        /* Release it */
-        MiReleasePfnLock(OldIrql);
+        /* Do we have the lock? */
+        if (HaveLock)
+        {
+            /* Release it */
+            MiReleasePfnLock(OldIrql);
 
-        /* Update performance counters */
-        if (Process > HYDRA_PROCESS) Process->NumberOfPrivatePages++;
+            /* Update performance counters */
+            if (Process > HYDRA_PROCESS) Process->NumberOfPrivatePages++;
+        }
     }
 
     /* Zero the page if need be */
@@ -956,6 +989,10 @@ MiResolvePageFileFault(_In_ BOOLEAN StoreInstruction,
     /* Do the paging IO */
     Status = MiReadPageFile(Page, PageFileIndex, PageFileOffset);
 
+    /* One more hard fault, one page at a time */
+    InterlockedIncrement(&KeGetCurrentPrcb()->MmPageReadCount);
+    InterlockedIncrement(&KeGetCurrentPrcb()->MmPageReadIoCount);
+
     /* Lock the PFN database again */
     *OldIrql = MiAcquirePfnLock();
 
@@ -981,6 +1018,9 @@ MiResolvePageFileFault(_In_ BOOLEAN StoreInstruction,
     {
         /* Tell them we're done */
         KeSetEvent(Pfn1->u1.Event, IO_NO_INCREMENT, FALSE);
+
+        /* The field is the working set index of the page from now on */
+        Pfn1->u1.Event = NULL;
     }
 
     return Status;
@@ -1254,7 +1294,7 @@ MiResolveProtoPteFault(IN BOOLEAN StoreInstruction,
         MiCopyPfn(PageFrameIndex, ProtoPageFrameIndex);
 
         /* This will drop everything MiResolveProtoPteFault referenced */
-        MiDeletePte(PointerPte, Address, Process, PointerProtoPte);
+        MiDeletePte(PointerPte, Address, Process, PointerProtoPte, NULL);
 
         /* Because now we use this */
         Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
@@ -1693,6 +1733,28 @@ MiDispatchFault(IN ULONG FaultCode,
     return Status;
 }
 
+static
+VOID
+MiInsertFaultedPageInWorkingSet(IN PEPROCESS CurrentProcess,
+                                IN PVOID Address)
+{
+    PMMPTE PointerPte = MiAddressToPte(Address);
+    PMMPFN Pfn1;
+
+    /* Only the private pages of the process are tracked for now */
+    if ((Address > MM_HIGHEST_USER_ADDRESS) || !PointerPte->u.Hard.Valid) return;
+    Pfn1 = MiGetPfnEntry(PFN_FROM_PTE(PointerPte));
+    if (!Pfn1 || MI_IS_ROS_PFN(Pfn1) || Pfn1->u3.e1.PrototypePte) return;
+
+    /* Another thread may have faulted it in already */
+    if (Pfn1->u1.WsIndex != 0) return;
+
+    /* Trimming uses the protection of the PFN, the one in the entry is informative */
+    MiInsertInWorkingSetList(&CurrentProcess->Vm,
+                             PAGE_ALIGN(Address),
+                             (ULONG)Pfn1->OriginalPte.u.Soft.Protection);
+}
+
 NTSTATUS
 NTAPI
 MmArmAccessFault(IN ULONG FaultCode,
@@ -2262,10 +2324,22 @@ UserFault:
         ASSERT(KeAreAllApcsDisabled() == TRUE);
         ASSERT(PointerPde->u.Hard.Valid == 1);
     }
-    else
+    else if (MI_IS_PAGE_LARGE(PointerPde))
     {
-        /* Not yet implemented in ReactOS */
-        ASSERT(MI_IS_PAGE_LARGE(PointerPde) == FALSE);
+        /* A large page is always present, so check if the access is allowed */
+        if ((MI_IS_WRITE_ACCESS(FaultCode) && !MI_IS_PAGE_WRITEABLE(PointerPde)) ||
+            (MI_IS_INSTRUCTION_FETCH(FaultCode) && !MI_IS_PAGE_EXECUTABLE(PointerPde)))
+        {
+            Status = STATUS_ACCESS_VIOLATION;
+        }
+        else
+        {
+            /* Another thread mapped it while we were looking */
+            Status = STATUS_SUCCESS;
+        }
+
+        MiUnlockProcessWorkingSet(CurrentProcess, CurrentThread);
+        return Status;
     }
 
     /* Now capture the PTE. */
@@ -2283,6 +2357,14 @@ UserFault:
                 PFN_NUMBER PageFrameIndex, OldPageFrameIndex;
                 PMMPFN Pfn1;
 
+                /* A combined page goes back to being a private one */
+                if (MiIsCombinedPfn(MI_PFN_ELEMENT(PFN_FROM_PTE(&TempPte))))
+                {
+                    Status = MiUncombinePte(CurrentProcess, PointerPte);
+                    MiUnlockProcessWorkingSet(CurrentProcess, CurrentThread);
+                    return NT_SUCCESS(Status) ? STATUS_PAGE_FAULT_COPY_ON_WRITE : Status;
+                }
+
                 LockIrql = MiAcquirePfnLock();
 
                 ASSERT(MmAvailablePages > 0);
@@ -2307,7 +2389,7 @@ UserFault:
                 ASSERT(Pfn1->u3.e1.PrototypePte == 1);
                 ASSERT(!MI_IS_PFN_DELETED(Pfn1));
                 ProtoPte = Pfn1->PteAddress;
-                MiDeletePte(PointerPte, Address, CurrentProcess, ProtoPte);
+                MiDeletePte(PointerPte, Address, CurrentProcess, ProtoPte, NULL);
 
                 /* And make a new shiny one with our page */
                 MiInitializePfn(PageFrameIndex, PointerPte, TRUE);
@@ -2319,6 +2401,9 @@ UserFault:
 
                 MiReleasePfnLock(LockIrql);
 
+                /* The private copy belongs to the working set */
+                MiInsertFaultedPageInWorkingSet(CurrentProcess, Address);
+
                 /* Return the status */
                 MiUnlockProcessWorkingSet(CurrentProcess, CurrentThread);
                 return STATUS_PAGE_FAULT_COPY_ON_WRITE;
@@ -2382,6 +2467,9 @@ UserFault:
             MiGetPfnEntry(PointerPte->u.Hard.PageFrameNumber)->CallSite = _ReturnAddress();
 #endif
 
+        /* The new page belongs to the working set */
+        MiInsertFaultedPageInWorkingSet(CurrentProcess, Address);
+
         /* Return the status */
         MiUnlockProcessWorkingSet(CurrentProcess, CurrentThread);
         return STATUS_PAGE_FAULT_DEMAND_ZERO;
@@ -2536,6 +2624,9 @@ UserFault:
             Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
             ASSERT(Pfn1->u1.Event == NULL);
 
+            /* The new page belongs to the working set, unless it is a page table */
+            MiInsertFaultedPageInWorkingSet(CurrentProcess, Address);
+
             /* Demand zero */
             ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
             MiUnlockProcessWorkingSet(CurrentProcess, CurrentThread);
@@ -2635,6 +2726,9 @@ UserFault:
 
 ExitUser:
 
+    /* A resolved private page belongs to the working set */
+    if (NT_SUCCESS(Status)) MiInsertFaultedPageInWorkingSet(CurrentProcess, Address);
+
     /* Return the status */
     ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
     MiUnlockProcessWorkingSet(CurrentProcess, CurrentThread);
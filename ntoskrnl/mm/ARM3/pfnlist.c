@@ -63,22 +63,47 @@ PMMPFNLIST MmPageLocationList[] =
 ULONG MI_PFN_CURRENT_USAGE;
 CHAR MI_PFN_CURRENT_PROCESS_NAME[16] = "None yet";
 
+/* Per-processor magazines of zeroed and free pages, they still count as available */
+#define MI_PAGE_CACHE_DEPTH 32
+#define MI_PAGE_CACHE_BATCH 16
+
+typedef struct _MI_PAGE_MAGAZINE
+{
+    ULONG Count;
+    PFN_NUMBER Pages[MI_PAGE_CACHE_DEPTH];
+} MI_PAGE_MAGAZINE, *PMI_PAGE_MAGAZINE;
+
+typedef struct DECLSPEC_CACHEALIGN _MI_PROCESSOR_PAGE_CACHE
+{
+    KSPIN_LOCK Lock;
+    MI_PAGE_MAGAZINE Magazine[FreePageList + 1];
+} MI_PROCESSOR_PAGE_CACHE, *PMI_PROCESSOR_PAGE_CACHE;
+
+MI_PROCESSOR_PAGE_CACHE MiProcessorPageCache[MAXIMUM_PROCESSORS];
+
 /* FUNCTIONS ******************************************************************/
+/*
+ * The processor page caches take pages off the count without the PFN lock,
+ * so every update is interlocked and the thresholds are checked against the
+ * value that update produced.
+ */
 static
 VOID
 MiIncrementAvailablePages(
     VOID)
 {
+    PFN_NUMBER AvailablePages;
+
     /* Increment available pages */
-    MmAvailablePages++;
+    AvailablePages = InterlockedIncrementSizeT(&MmAvailablePages);
 
     /* Check if we've reached the configured low memory threshold */
-    if (MmAvailablePages == MmLowMemoryThreshold)
+    if (AvailablePages == MmLowMemoryThreshold)
     {
         /* Clear the event, because now we're ABOVE the threshold */
         KeClearEvent(MiLowMemoryEvent);
     }
-    else if (MmAvailablePages == MmHighMemoryThreshold)
+    else if (AvailablePages == MmHighMemoryThreshold)
     {
         /* Otherwise check if we reached the high threshold and signal the event */
         KeSetEvent(MiHighMemoryEvent, 0, FALSE);
@@ -90,27 +115,29 @@ VOID
 MiDecrementAvailablePages(
     VOID)
 {
-    ASSERT(MmAvailablePages > 0);
+    PFN_NUMBER AvailablePages;
+
+    /* One less page */
+    AvailablePages = InterlockedDecrementSizeT(&MmAvailablePages);
+    ASSERT(AvailablePages != (PFN_NUMBER)-1);
 
     /* See if we hit any thresholds */
-    if (MmAvailablePages == MmHighMemoryThreshold)
+    if (AvailablePages + 1 == MmHighMemoryThreshold)
     {
         /* Clear the high memory event */
         KeClearEvent(MiHighMemoryEvent);
     }
-    else if (MmAvailablePages == MmLowMemoryThreshold)
+    else if (AvailablePages + 1 == MmLowMemoryThreshold)
     {
         /* Signal the low memory event */
         KeSetEvent(MiLowMemoryEvent, 0, FALSE);
     }
 
-    /* One less page */
-    MmAvailablePages--;
-    if (MmAvailablePages < MmMinimumFreePages)
+    if (AvailablePages < MmMinimumFreePages)
     {
         /* FIXME: Should wake up the MPW and working set manager, if we had one */
 
-        DPRINT1("Running low on pages: %lu remaining\n", MmAvailablePages);
+        DPRINT1("Running low on pages: %lu remaining\n", AvailablePages);
 
         /* Call RosMm and see if it can release any pages for us */
         MmRebalanceMemoryConsumers();
@@ -482,8 +509,9 @@ MiRemoveAnyPage(IN ULONG Color)
     /* Make sure PFN lock is held and we have pages */
     MI_ASSERT_PFN_LOCK_HELD();
     ASSERT(Color < MmSecondaryColors);
-    if (MmAvailablePages == 0)
+    if ((MmFreePageListHead.Total == 0) && (MmZeroedPageListHead.Total == 0))
     {
+        /* The available pages may all be sitting in the processor caches */
         return 0;
     }
 
@@ -543,8 +571,9 @@ MiRemoveZeroPage(IN ULONG Color)
     /* Make sure PFN lock is held and we have pages */
     MI_ASSERT_PFN_LOCK_HELD();
     ASSERT(Color < MmSecondaryColors);
-    if (MmAvailablePages == 0)
+    if ((MmFreePageListHead.Total == 0) && (MmZeroedPageListHead.Total == 0))
     {
+        /* The available pages may all be sitting in the processor caches */
         return 0;
     }
 
@@ -594,7 +623,17 @@ MiRemoveZeroPage(IN ULONG Color)
     ASSERT(Pfn1 == MI_PFN_ELEMENT(PageIndex));
 
     /* Zero it, if needed */
-    if (Zero) MiZeroPhysicalPage(PageIndex);
+    if (Zero)
+    {
+        /* The zero page threads fell behind, wake them up */
+        MmZeroedPageMisses++;
+        if (MmFreePageListHead.Total) KeSetEvent(&MmZeroingPageEvent, IO_NO_INCREMENT, FALSE);
+        MiZeroPhysicalPage(PageIndex);
+    }
+    else
+    {
+        MmZeroedPageHits++;
+    }
 
     /* Sanity checks */
     ASSERT(Pfn1->u3.e2.ReferenceCount == 0);
@@ -701,7 +740,7 @@ MiInsertPageInFreeList(IN PFN_NUMBER PageFrameIndex)
     ColorTable->Count++;
 
     /* Notify zero page thread if enough pages are on the free list now */
-    if (ListHead->Total >= 8)
+    if ((ListHead->Total >= 8) && !KeReadStateEvent(&MmZeroingPageEvent))
     {
         /* Set the event */
         KeSetEvent(&MmZeroingPageEvent, IO_NO_INCREMENT, FALSE);
@@ -1335,4 +1374,231 @@ MiInitializePfnForOtherProcess(IN PFN_NUMBER PageFrameIndex,
     }
 }
 
+static
+VOID
+MiReturnCachedPage(IN MMLISTS ListName,
+                   IN PFN_NUMBER PageFrameIndex)
+{
+    /* The page already counts as available, and the list will count it again */
+    InterlockedDecrementSizeT(&MmAvailablePages);
+
+    if (ListName == ZeroedPageList)
+    {
+        MiInsertPageInList(&MmZeroedPageListHead, PageFrameIndex);
+    }
+    else
+    {
+        MiInsertPageInFreeList(PageFrameIndex);
+    }
+}
+
+static
+PFN_NUMBER
+MiPopCachedPage(IN PMI_PAGE_MAGAZINE Magazine,
+                IN ULONG Color)
+{
+    PFN_NUMBER PageFrameIndex;
+    ULONG i;
+
+    /* Look for the color, newest pages first */
+    for (i = Magazine->Count; i > 0; i--)
+    {
+        PageFrameIndex = Magazine->Pages[i - 1];
+        if (MI_GET_PAGE_COLOR(PageFrameIndex) != Color) continue;
+
+        /* Keep the oldest pages first, they are the ones the refill gives back */
+        RtlMoveMemory(&Magazine->Pages[i - 1],
+                      &Magazine->Pages[i],
+                      (Magazine->Count - i) * sizeof(PFN_NUMBER));
+        Magazine->Count--;
+        return PageFrameIndex;
+    }
+
+    return 0;
+}
+
+static
+VOID
+MiRefillProcessorPageCache(IN PMI_PAGE_MAGAZINE Magazine,
+                           IN MMLISTS ListName,
+                           IN ULONG Color)
+{
+    PFN_NUMBER PageFrameIndex;
+    ULONG Surplus, i;
+    KIRQL OldIrql;
+
+    /* Take a whole batch with a single acquisition of the PFN lock */
+    OldIrql = MiAcquirePfnLock();
+
+    /* Make room for it by giving back the oldest pages, nobody asked for their colors */
+    if (Magazine->Count > MI_PAGE_CACHE_DEPTH - MI_PAGE_CACHE_BATCH)
+    {
+        Surplus = Magazine->Count - (MI_PAGE_CACHE_DEPTH - MI_PAGE_CACHE_BATCH);
+        for (i = 0; i < Surplus; i++)
+        {
+            MiReturnCachedPage(ListName, Magazine->Pages[i]);
+        }
+
+        Magazine->Count -= Surplus;
+        RtlMoveMemory(&Magazine->Pages[0],
+                      &Magazine->Pages[Surplus],
+                      Magazine->Count * sizeof(PFN_NUMBER));
+    }
+
+    /* Take the color that was asked for, then the ones the process will ask for next */
+    for (i = 0; i < MI_PAGE_CACHE_BATCH; i++)
+    {
+        /* Leave the last pages to the regular path, it knows how to deal with low memory */
+        if (MmFreePageListHead.Total + MmZeroedPageListHead.Total <=
+            MmMinimumFreePages + MI_PAGE_CACHE_BATCH)
+        {
+            break;
+        }
+
+        MI_SET_USAGE(MI_USAGE_DEMAND_ZERO);
+        MI_SET_PROCESS2("Page cache");
+
+        if (ListName == ZeroedPageList)
+        {
+            /* Only take pages that the zero page thread already cleared */
+            if (!MmZeroedPageListHead.Total) break;
+            PageFrameIndex = MiRemoveZeroPage(MI_GET_PAGE_COLOR(Color + i));
+        }
+        else
+        {
+            /* Don't eat into the zeroed pages, they have their own magazine */
+            if (!MmFreePageListHead.Total) break;
+            PageFrameIndex = MiRemoveAnyPage(MI_GET_PAGE_COLOR(Color + i));
+        }
+
+        if (!PageFrameIndex) break;
+
+        /* Cached pages still count as available */
+        MiIncrementAvailablePages();
+        Magazine->Pages[Magazine->Count++] = PageFrameIndex;
+    }
+
+    MiReleasePfnLock(OldIrql);
+}
+
+PFN_NUMBER
+NTAPI
+MiRemovePageFromProcessorCache(IN MMLISTS ListName,
+                               IN ULONG Color)
+{
+    PMI_PROCESSOR_PAGE_CACHE Cache;
+    PMI_PAGE_MAGAZINE Magazine;
+    PFN_NUMBER PageFrameIndex;
+    KIRQL OldIrql;
+
+    /* The refill takes the PFN lock, so the caller must not hold it */
+    ASSERT((ListName == ZeroedPageList) || (ListName == FreePageList));
+    ASSERT(Color < MmSecondaryColors);
+    ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
+
+    /* Stay on this processor while we use its magazines */
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    Cache = &MiProcessorPageCache[KeGetCurrentProcessorNumber()];
+    KeAcquireSpinLockAtDpcLevel(&Cache->Lock);
+
+    /* Refill the magazine if it has nothing of this color, then pop a page off it */
+    Magazine = &Cache->Magazine[ListName];
+    PageFrameIndex = MiPopCachedPage(Magazine, Color);
+    if (!PageFrameIndex)
+    {
+        MiRefillProcessorPageCache(Magazine, ListName, Color);
+        PageFrameIndex = MiPopCachedPage(Magazine, Color);
+
+        /* The lists ran out of this color, like MiRemoveZeroPage settle for another one */
+        if (!PageFrameIndex && Magazine->Count)
+        {
+            PageFrameIndex = Magazine->Pages[--Magazine->Count];
+        }
+    }
+
+    /* The page is no longer available */
+    if (PageFrameIndex) MiDecrementAvailablePages();
+
+    KeReleaseSpinLockFromDpcLevel(&Cache->Lock);
+    KeLowerIrql(OldIrql);
+    return PageFrameIndex;
+}
+
+/*
+ * Sets up a page from the processor page cache for a user PTE. Nobody else
+ * knows about the page yet, and the share count of a user page table only
+ * changes with the working set lock held, so the PFN lock isn't needed.
+ */
+VOID
+NTAPI
+MiInitializeCachedPfn(IN PFN_NUMBER PageFrameIndex,
+                      IN PMMPTE PointerPte)
+{
+    PMMPFN Pfn1;
+    PMMPTE PointerPtePte;
+
+    ASSERT(PointerPte <= MiHighestUserPte);
+    ASSERT(PointerPte->u.Hard.Valid == 0);
+    ASSERT(MM_ANY_WS_LOCK_HELD_EXCLUSIVE(PsGetCurrentThread()));
+
+    /* Setup the PTE */
+    Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
+    Pfn1->PteAddress = PointerPte;
+    Pfn1->OriginalPte = *PointerPte;
+    ASSERT(!((Pfn1->OriginalPte.u.Soft.Prototype == 0) &&
+             (Pfn1->OriginalPte.u.Soft.Transition == 1)));
+
+    /* This is a fresh page -- set it up */
+    ASSERT(Pfn1->u3.e2.ReferenceCount == 0);
+    ASSERT(Pfn1->u2.ShareCount == 0);
+    Pfn1->u3.e2.ReferenceCount = 1;
+    Pfn1->u2.ShareCount = 1;
+    Pfn1->u3.e1.PageLocation = ActiveAndValid;
+    ASSERT(Pfn1->u3.e1.Rom == 0);
+    Pfn1->u3.e1.Modified = TRUE;
+
+    /* The page table is valid, we are faulting on one of its PTEs */
+    PointerPtePte = MiAddressToPte(PointerPte);
+    ASSERT(PointerPtePte->u.Hard.Valid == 1);
+    PageFrameIndex = PFN_FROM_PTE(PointerPtePte);
+    Pfn1->u4.PteFrame = PageFrameIndex;
+
+    /* Increase its share count so we don't get rid of it */
+    Pfn1 = MI_PFN_ELEMENT(PageFrameIndex);
+    Pfn1->u2.ShareCount++;
+}
+
+VOID
+NTAPI
+MmTrimProcessorPageCaches(VOID)
+{
+    PMI_PROCESSOR_PAGE_CACHE Cache;
+    PMI_PAGE_MAGAZINE Magazine;
+    KIRQL OldIrql, PfnIrql;
+    ULONG i;
+
+    /* Give every cached page back to the zeroed and free lists */
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        Cache = &MiProcessorPageCache[i];
+        KeAcquireSpinLock(&Cache->Lock, &OldIrql);
+        PfnIrql = MiAcquirePfnLock();
+
+        Magazine = &Cache->Magazine[ZeroedPageList];
+        while (Magazine->Count)
+        {
+            MiReturnCachedPage(ZeroedPageList, Magazine->Pages[--Magazine->Count]);
+        }
+
+        Magazine = &Cache->Magazine[FreePageList];
+        while (Magazine->Count)
+        {
+            MiReturnCachedPage(FreePageList, Magazine->Pages[--Magazine->Count]);
+        }
+
+        MiReleasePfnLock(PfnIrql);
+        KeReleaseSpinLock(&Cache->Lock, OldIrql);
+    }
+}
+
 /* EOF */
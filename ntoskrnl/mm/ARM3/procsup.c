@@ -19,7 +19,13 @@
 
 ULONG MmProcessColorSeed = 0x12345678;
 ULONG MmMaximumDeadKernelStacks = 5;
+ULONG MmMaximumProcessorDeadKernelStacks = 8;
 SLIST_HEADER MmDeadStackSListHead;
+SLIST_HEADER MiProcessorDeadStackSListHead[MAXIMUM_PROCESSORS];
+BOOLEAN MiProcessorDeadStacksBypassed;
+ULONG MiProcessorDeadStackHits;
+ULONG MiGlobalDeadStackHits;
+ULONG MiDeadStackMisses;
 ULONG MmRotatingUniprocessorNumber = 0;
 
 /* PRIVATE FUNCTIONS **********************************************************/
@@ -182,10 +188,10 @@ MmDeleteTeb(IN PEPROCESS Process,
     KeDetachProcess();
 }
 
+static
 VOID
-NTAPI
-MmDeleteKernelStack(IN PVOID StackBase,
-                    IN BOOLEAN GuiStack)
+MiFreeKernelStack(IN PVOID StackBase,
+                  IN BOOLEAN GuiStack)
 {
     PMMPTE PointerPte;
     PFN_NUMBER PageFrameNumber, PageTableFrameNumber;
@@ -193,7 +199,6 @@ MmDeleteKernelStack(IN PVOID StackBase,
     PMMPFN Pfn1, Pfn2;
     ULONG i;
     KIRQL OldIrql;
-    PSLIST_ENTRY SListEntry;
 
     //
     // This should be the guard page, so decrement by one
@@ -201,19 +206,6 @@ MmDeleteKernelStack(IN PVOID StackBase,
     PointerPte = MiAddressToPte(StackBase);
     PointerPte--;
 
-    //
-    // If this is a small stack, just push the stack onto the dead stack S-LIST
-    //
-    if (!GuiStack)
-    {
-        if (ExQueryDepthSList(&MmDeadStackSListHead) < MmMaximumDeadKernelStacks)
-        {
-            SListEntry = ((PSLIST_ENTRY)StackBase) - 1;
-            InterlockedPushEntrySList(&MmDeadStackSListHead, SListEntry);
-            return;
-        }
-    }
-
     //
     // Calculate pages used
     //
@@ -271,6 +263,107 @@ MmDeleteKernelStack(IN PVOID StackBase,
     MiReleaseSystemPtes(PointerPte, StackPages + 1, SystemPteSpace);
 }
 
+VOID
+NTAPI
+MmDeleteKernelStack(IN PVOID StackBase,
+                    IN BOOLEAN GuiStack)
+{
+    PSLIST_ENTRY SListEntry;
+    PSLIST_HEADER ListHead;
+
+    //
+    // If this is a small stack, just push the stack onto a dead stack S-LIST
+    //
+    if (!GuiStack)
+    {
+        SListEntry = ((PSLIST_ENTRY)StackBase) - 1;
+
+        //
+        // Try this processor's list first. We may get moved to another
+        // processor in the meantime, which is harmless, the lists are
+        // interlocked and this only balances the lists less evenly.
+        //
+        ListHead = &MiProcessorDeadStackSListHead[KeGetCurrentProcessorNumber()];
+        if (!(MiProcessorDeadStacksBypassed) &&
+            (ExQueryDepthSList(ListHead) < MmMaximumProcessorDeadKernelStacks))
+        {
+            InterlockedPushEntrySList(ListHead, SListEntry);
+            return;
+        }
+
+        //
+        // Then the global overflow list
+        //
+        if (ExQueryDepthSList(&MmDeadStackSListHead) < MmMaximumDeadKernelStacks)
+        {
+            InterlockedPushEntrySList(&MmDeadStackSListHead, SListEntry);
+            return;
+        }
+    }
+
+    MiFreeKernelStack(StackBase, GuiStack);
+}
+
+VOID
+NTAPI
+MmTrimDeadKernelStacks(VOID)
+{
+    PSLIST_ENTRY SListEntry, NextEntry;
+    PSLIST_HEADER ListHead;
+    ULONG i;
+
+    //
+    // Flush every dead stack S-LIST and free the stacks that were on them
+    //
+    for (i = 0; i <= (ULONG)KeNumberProcessors; i++)
+    {
+        ListHead = (i < (ULONG)KeNumberProcessors) ?
+                   &MiProcessorDeadStackSListHead[i] : &MmDeadStackSListHead;
+        if (!ExQueryDepthSList(ListHead)) continue;
+
+        SListEntry = InterlockedFlushSList(ListHead);
+        while (SListEntry)
+        {
+            NextEntry = SListEntry->Next;
+            MiFreeKernelStack(SListEntry + 1, FALSE);
+            SListEntry = NextEntry;
+        }
+    }
+}
+
+VOID
+NTAPI
+MmQueryKernelStackCacheInformation(
+    _Out_ PSYSTEM_KERNEL_STACK_CACHE_INFORMATION Information)
+{
+    ULONG i, CachedStacks = 0;
+
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        CachedStacks += ExQueryDepthSList(&MiProcessorDeadStackSListHead[i]);
+    }
+
+    Information->Enabled = !MiProcessorDeadStacksBypassed;
+    Information->MaximumPerProcessor = MmMaximumProcessorDeadKernelStacks;
+    Information->CachedStacks = CachedStacks;
+    Information->Hits = MiProcessorDeadStackHits;
+    Information->GlobalHits = MiGlobalDeadStackHits;
+    Information->Misses = MiDeadStackMisses;
+}
+
+VOID
+NTAPI
+MmSetKernelStackCache(
+    _In_ BOOLEAN Enable)
+{
+    //
+    // When bypassed, stacks only go through the global list, like they did
+    // before the processor caches. Give back what they held.
+    //
+    MiProcessorDeadStacksBypassed = !Enable;
+    if (!Enable) MmTrimDeadKernelStacks();
+}
+
 PVOID
 NTAPI
 MmCreateKernelStack(IN BOOLEAN GuiStack,
@@ -284,6 +377,7 @@ MmCreateKernelStack(IN BOOLEAN GuiStack,
     PFN_NUMBER PageFrameIndex;
     ULONG i;
     PSLIST_ENTRY SListEntry;
+    PSLIST_HEADER ListHead;
 
     //
     // Calculate pages needed
@@ -299,18 +393,33 @@ MmCreateKernelStack(IN BOOLEAN GuiStack,
     else
     {
         //
-        // If the dead stack S-LIST has a stack on it, use it instead of allocating
-        // new system PTEs for this stack
+        // If a dead stack S-LIST has a stack on it, use it instead of allocating
+        // new system PTEs for this stack. This processor's list comes first,
+        // its stacks are likely still in our caches.
         //
+        ListHead = &MiProcessorDeadStackSListHead[KeGetCurrentProcessorNumber()];
+        if (ExQueryDepthSList(ListHead))
+        {
+            SListEntry = InterlockedPopEntrySList(ListHead);
+            if (SListEntry != NULL)
+            {
+                InterlockedIncrement((PLONG)&MiProcessorDeadStackHits);
+                BaseAddress = (SListEntry + 1);
+                return BaseAddress;
+            }
+        }
+
         if (ExQueryDepthSList(&MmDeadStackSListHead))
         {
             SListEntry = InterlockedPopEntrySList(&MmDeadStackSListHead);
             if (SListEntry != NULL)
             {
+                InterlockedIncrement((PLONG)&MiGlobalDeadStackHits);
                 BaseAddress = (SListEntry + 1);
                 return BaseAddress;
             }
         }
+        InterlockedIncrement((PLONG)&MiDeadStackMisses);
 
         //
         // We'll allocate 12K and that's it
@@ -969,6 +1078,7 @@ MmInitializeProcessAddressSpace(IN PEPROCESS Process,
     /* Initialize the Addresss Space lock */
     KeInitializeGuardedMutex(&Process->AddressCreationLock);
     Process->Vm.WorkingSetExpansionLinks.Flink = NULL;
+    Process->Vm.Flags.PagePriority = MM_DEFAULT_PAGE_PRIORITY;
 
     /* Initialize AVL tree */
     ASSERT(Process->VadRoot.NumberGenericTableElements == 0);
@@ -1112,6 +1222,9 @@ MmInitializeProcessAddressSpace(IN PEPROCESS Process,
 
         /* Save the pointer */
         Process->SectionBaseAddress = ImageBase;
+
+        /* Prefetch and trace the launch */
+        if (NT_SUCCESS(Status)) MmStartLaunchTrace(Process, FileObject);
     }
 
     /* Be nice and detach */
@@ -1135,6 +1248,7 @@ MmInitializeHandBuiltProcess(IN PEPROCESS Process,
     KeInitializeGuardedMutex(&Process->AddressCreationLock);
     KeInitializeSpinLock(&Process->HyperSpaceLock);
     Process->Vm.WorkingSetExpansionLinks.Flink = NULL;
+    Process->Vm.Flags.PagePriority = MM_DEFAULT_PAGE_PRIORITY;
     ASSERT(Process->VadRoot.NumberGenericTableElements == 0);
     Process->VadRoot.BalancedRoot.u1.Parent = &Process->VadRoot.BalancedRoot;
 
@@ -1269,6 +1383,9 @@ MmCleanProcessAddressSpace(IN PEPROCESS Process)
     /* Remove from the session */
     MiSessionRemoveProcess();
 
+    /* Save the launch trace, if the process didn't live long enough to finish it */
+    MmEndLaunchTrace(Process);
+
     /* Abort early, when the address space wasn't fully initialized */
     if (Process->AddressSpaceInitialized < 2)
     {
@@ -1310,8 +1427,9 @@ MmCleanProcessAddressSpace(IN PEPROCESS Process)
         ASSERT(VadTree->NumberGenericTableElements >= 1);
         MiRemoveNode((PMMADDRESS_NODE)Vad, VadTree);
 
-        /* Only regular VADs supported for now */
-        ASSERT(Vad->u.VadFlags.VadType == VadNone);
+        /* Only regular and large page VADs supported for now */
+        ASSERT((Vad->u.VadFlags.VadType == VadNone) ||
+               (Vad->u.VadFlags.VadType == VadLargePages));
 
         /* Check if this is a section VAD */
         if (!(Vad->u.VadFlags.PrivateMemory) && (Vad->ControlArea))
@@ -1345,6 +1463,9 @@ MmCleanProcessAddressSpace(IN PEPROCESS Process)
     /* Delete the shared user data section */
     MiDeleteVirtualAddresses(USER_SHARED_DATA, USER_SHARED_DATA, NULL);
 
+    /* The working set list is empty now, give back the pages it grew into */
+    MiShrinkWorkingSetList(&Process->Vm);
+
     /* Release the working set */
     MiUnlockProcessWorkingSetUnsafe(Process, Thread);
 
@@ -1368,6 +1489,9 @@ MmDeleteProcessAddressSpace(IN PEPROCESS Process)
 
     //ASSERT(Process->CommitCharge == 0);
 
+    /* The launch trace must not outlive the process */
+    MmEndLaunchTrace(Process);
+
     /* Remove us from the list */
     OldIrql = MiAcquireExpansionLock();
     if (Process->Vm.WorkingSetExpansionLinks.Flink != NULL)
@@ -1932,11 +1932,13 @@ MiRemoveMappedPtes(IN PVOID BaseAddress,
     PMMPFN Pfn1, Pfn2;
     MMPTE PteContents;
     KIRQL OldIrql;
+    MMPTE_FLUSH_LIST FlushList;
     DPRINT("Removing mapped view at: 0x%p\n", BaseAddress);
 
     ASSERT(Ws == NULL);
 
     /* Get the PTE and loop each one */
+    MiInitializePteFlushList(&FlushList);
     PointerPte = MiAddressToPte(BaseAddress);
     //FirstPte = PointerPte;
     while (NumberOfPtes)
@@ -1983,6 +1985,9 @@ MiRemoveMappedPtes(IN PVOID BaseAddress,
 
             /* Release the PFN lock */
             MiReleasePfnLock(OldIrql);
+
+            /* This mapping will have to be flushed from the TB */
+            MiInsertPteFlushList(&FlushList, MiPteToAddress(PointerPte));
         }
         else
         {
@@ -2008,8 +2013,8 @@ MiRemoveMappedPtes(IN PVOID BaseAddress,
         NumberOfPtes--;
     }
 
-    /* Flush the TLB */
-    KeFlushCurrentTb();
+    /* Flush the TLB of all processors, this is a system space mapping */
+    MiFlushPteList(&FlushList, TRUE);
 
     /* Acquire the PFN lock */
     OldIrql = MiAcquirePfnLock();
@@ -129,6 +129,28 @@ MiLocateVad(_In_ PMM_AVL_TABLE Table, _In_ PVOID VirtualAddress)
     Vpn = (ULONG_PTR)VirtualAddress >> PAGE_SHIFT;
     if ((Vpn >= FoundVad->StartingVpn) && (Vpn <= FoundVad->EndingVpn)) return FoundVad;
 
+    /* Faults and region walks tend to move to the next or previous VAD, so
+       look at the neighbour on that side before searching the whole tree */
+    if (Vpn > FoundVad->EndingVpn)
+    {
+        FoundVad = (PMMVAD)MiGetNextNode((PMMADDRESS_NODE)FoundVad);
+        if (!FoundVad) return NULL;
+        if (Vpn < FoundVad->StartingVpn) return NULL;
+    }
+    else
+    {
+        FoundVad = (PMMVAD)MiGetPreviousNode((PMMADDRESS_NODE)FoundVad);
+        if (!FoundVad) return NULL;
+        if (Vpn > FoundVad->EndingVpn) return NULL;
+    }
+
+    /* The neighbour covers it, make it the new hint */
+    if ((Vpn >= FoundVad->StartingVpn) && (Vpn <= FoundVad->EndingVpn))
+    {
+        Table->NodeHint = FoundVad;
+        return FoundVad;
+    }
+
     /* VAD hint didn't work, go look for it */
     SearchResult = RtlpFindAvlTableNodeOrParent(Table,
                                                 (PVOID)Vpn,
@@ -166,6 +188,16 @@ MiCheckForConflictingNode(IN ULONG_PTR StartVpn,
     /* If the tree is empty, there is no conflict */
     if (Table->NumberGenericTableElements == 0) return TableEmptyTree;
 
+    /* A conflict with the hint can be reported without walking the tree */
+    CurrentNode = Table->NodeHint;
+    if ((CurrentNode) &&
+        (StartVpn <= CurrentNode->EndingVpn) &&
+        (EndVpn >= CurrentNode->StartingVpn))
+    {
+        *NodeOrParent = CurrentNode;
+        return TableFoundNode;
+    }
+
     /* Start looping from the root node */
     CurrentNode = RtlRightChildAvl(&Table->BalancedRoot);
     ASSERT(CurrentNode != NULL);
@@ -204,6 +236,81 @@ MiCheckForConflictingNode(IN ULONG_PTR StartVpn,
     }
 }
 
+static
+ULONG_PTR
+MiGetGapBelowNode(IN PMMADDRESS_NODE Node)
+{
+    PMMADDRESS_NODE PreviousNode;
+
+    /* The lowest node owns everything down to the bottom of the address space */
+    PreviousNode = MiGetPreviousNode(Node);
+    if (!PreviousNode) return Node->StartingVpn;
+
+    ASSERT(Node->StartingVpn > PreviousNode->EndingVpn);
+    return Node->StartingVpn - PreviousNode->EndingVpn - 1;
+}
+
+static
+VOID
+MiUpdateLargestGap(IN PMMADDRESS_NODE Node)
+{
+    PMMADDRESS_NODE Child;
+    ULONG_PTR LargestGap;
+
+    /* Combine our own gap with the ones of both subtrees */
+    LargestGap = Node->GapBelow;
+    Child = RtlLeftChildAvl(Node);
+    if ((Child) && (Child->LargestGap > LargestGap)) LargestGap = Child->LargestGap;
+    Child = RtlRightChildAvl(Node);
+    if ((Child) && (Child->LargestGap > LargestGap)) LargestGap = Child->LargestGap;
+    Node->LargestGap = LargestGap;
+}
+
+static
+VOID
+MiPropagateLargestGap(IN PMM_AVL_TABLE Table,
+                      IN PMMADDRESS_NODE Node)
+{
+    PMMADDRESS_NODE Child;
+
+    /*
+     * Walk up to the root. A rotation on the way may have moved a node off
+     * this path and under one of the nodes on it, so the children are
+     * refreshed as well before each node on the path.
+     */
+    while (Node != &Table->BalancedRoot)
+    {
+        Child = RtlLeftChildAvl(Node);
+        if (Child) MiUpdateLargestGap(Child);
+        Child = RtlRightChildAvl(Node);
+        if (Child) MiUpdateLargestGap(Child);
+        MiUpdateLargestGap(Node);
+
+        Node = RtlParentAvl(Node);
+    }
+}
+
+VOID
+NTAPI
+MiUpdateNodeGaps(IN PMMADDRESS_NODE Node,
+                 IN PMM_AVL_TABLE Table)
+{
+    PMMADDRESS_NODE NextNode;
+
+    ASSERT_LOCKED_FOR_WRITE(Table);
+
+    /* The node's bounds changed, so did the gaps on both of its sides */
+    Node->GapBelow = MiGetGapBelowNode(Node);
+    MiPropagateLargestGap(Table, Node);
+
+    NextNode = MiGetNextNode(Node);
+    if (NextNode)
+    {
+        NextNode->GapBelow = NextNode->StartingVpn - Node->EndingVpn - 1;
+        MiPropagateLargestGap(Table, NextNode);
+    }
+}
+
 VOID
 NTAPI
 MiInsertNode(IN PMM_AVL_TABLE Table,
@@ -215,6 +322,9 @@ MiInsertNode(IN PMM_AVL_TABLE Table,
 
     /* Insert it into the tree */
     RtlpInsertAvlTreeNode(Table, NewNode, Parent, Result);
+
+    /* The new node splits the gap it was placed in */
+    MiUpdateNodeGaps(NewNode, Table);
 }
 
 VOID
@@ -403,11 +513,46 @@ NTAPI
 MiRemoveNode(IN PMMADDRESS_NODE Node,
              IN PMM_AVL_TABLE Table)
 {
+    PMMADDRESS_NODE DeleteNode, ParentNode, NextNode;
+
     ASSERT_LOCKED_FOR_WRITE(Table);
 
+    /*
+     * Find the node the AVL code will actually unlink. This is the node itself
+     * unless it has two children, in which case it gets replaced by its
+     * neighbour on the heavier side. Rebalancing starts from that node's parent.
+     */
+    DeleteNode = Node;
+    if ((RtlLeftChildAvl(Node)) && (RtlRightChildAvl(Node)))
+    {
+        if (RtlBalance(Node) >= RtlBalancedAvlTree)
+        {
+            DeleteNode = RtlRightChildAvl(Node);
+            while (RtlLeftChildAvl(DeleteNode)) DeleteNode = RtlLeftChildAvl(DeleteNode);
+        }
+        else
+        {
+            DeleteNode = RtlLeftChildAvl(Node);
+            while (RtlRightChildAvl(DeleteNode)) DeleteNode = RtlRightChildAvl(DeleteNode);
+        }
+    }
+    ParentNode = RtlParentAvl(DeleteNode);
+    if (ParentNode == Node) ParentNode = DeleteNode;
+
+    /* The node after this one inherits its gap */
+    NextNode = MiGetNextNode(Node);
+
     /* Call the AVL code */
     RtlpDeleteAvlTreeNode(Table, Node);
 
+    /* Fix up the gaps below the rebalanced part of the tree and the next node */
+    if (ParentNode != &Table->BalancedRoot) MiPropagateLargestGap(Table, ParentNode);
+    if (NextNode)
+    {
+        NextNode->GapBelow = MiGetGapBelowNode(NextNode);
+        MiPropagateLargestGap(Table, NextNode);
+    }
+
     /* Decrease element count */
     Table->NumberGenericTableElements--;
 
@@ -499,8 +644,9 @@ MiFindEmptyAddressRangeInTree(IN SIZE_T Length,
                               OUT PMMADDRESS_NODE *PreviousVad,
                               OUT PULONG_PTR Base)
 {
-    PMMADDRESS_NODE Node, PreviousNode;
-    ULONG_PTR PageCount, AlignmentVpn, LowVpn, HighestVpn;
+    PMMADDRESS_NODE Node, PreviousNode, Child;
+    ULONG_PTR PageCount, AlignmentVpn, LowVpn, HighestVpn, CandidateVpn;
+    BOOLEAN Descend;
     ASSERT(Length != 0);
 
     ASSERT_LOCKED_FOR_READ(Table);
@@ -524,49 +670,81 @@ MiFindEmptyAddressRangeInTree(IN SIZE_T Length,
         return TableEmptyTree;
     }
 
-    /* Otherwise, follow the leftmost child of the right root node's child */
+    /*
+     * Look for the lowest node with a suitable gap below it, in address order.
+     * Subtrees whose largest gap is too small can't hold the allocation and
+     * are skipped, so only a few paths of the tree are walked.
+     */
     Node = RtlRightChildAvl(&Table->BalancedRoot);
-    while (RtlLeftChildAvl(Node)) Node = RtlLeftChildAvl(Node);
-
-    /* Start a search to find a gap */
-    PreviousNode = NULL;
+    Descend = TRUE;
     while (Node != NULL)
     {
-        /* Check if the gap below the current node is suitable */
-        if (Node->StartingVpn >= LowVpn + PageCount)
+        /* Lower addresses come first, try the left subtree */
+        if (Descend)
         {
-            /* There is enough space to add our node */
-            *Base = LowVpn << PAGE_SHIFT;
-
-            /* Can we use the current node as parent? */
-            if (RtlLeftChildAvl(Node) == NULL)
+            Child = RtlLeftChildAvl(Node);
+            if ((Child) && (Child->LargestGap >= PageCount))
             {
-                /* Node has no left child, so use it as parent */
-                *PreviousVad = Node;
-                return TableInsertAsLeft;
+                Node = Child;
+                continue;
             }
-            else
+        }
+
+        /* Check if the gap below the current node is suitable */
+        if (Node->GapBelow >= PageCount)
+        {
+            CandidateVpn = ALIGN_UP_BY(Node->StartingVpn - Node->GapBelow, AlignmentVpn);
+            if (CandidateVpn < LowVpn) CandidateVpn = LowVpn;
+
+            if ((CandidateVpn < Node->StartingVpn) &&
+                ((Node->StartingVpn - CandidateVpn) >= PageCount))
             {
+                /* There is enough space to add our node */
+                *Base = CandidateVpn << PAGE_SHIFT;
+
+                /* Can we use the current node as parent? */
+                if (RtlLeftChildAvl(Node) == NULL)
+                {
+                    /* Node has no left child, so use it as parent */
+                    *PreviousVad = Node;
+                    return TableInsertAsLeft;
+                }
+
                 /* Node has a left child, this means that the previous node is
                    the right-most child of it's left child and can be used as
-                   the parent. In case we use the space before the left-most
-                   node, it's left child must be NULL. */
-                ASSERT(PreviousNode != NULL);
-                ASSERT(RtlRightChildAvl(PreviousNode) == NULL);
+                   the parent. */
+                PreviousNode = RtlLeftChildAvl(Node);
+                while (RtlRightChildAvl(PreviousNode)) PreviousNode = RtlRightChildAvl(PreviousNode);
                 *PreviousVad = PreviousNode;
                 return TableInsertAsRight;
             }
         }
 
-        /* The next candidate is above the current node */
-        if (Node->EndingVpn >= LowVpn)
-            LowVpn = ALIGN_UP_BY(Node->EndingVpn + 1, AlignmentVpn);
+        /* Then the higher addresses in the right subtree */
+        Child = RtlRightChildAvl(Node);
+        if ((Child) && (Child->LargestGap >= PageCount))
+        {
+            Node = Child;
+            Descend = TRUE;
+            continue;
+        }
 
-        /* Remember the current node and go to the next node */
-        PreviousNode = Node;
-        Node = MiGetNextNode(Node);
+        /* This subtree is done, go back up to the first node we left to the left */
+        Descend = FALSE;
+        do
+        {
+            Child = Node;
+            Node = RtlParentAvl(Node);
+        } while ((Node != &Table->BalancedRoot) && (RtlLeftChildAvl(Node) != Child));
+        if (Node == &Table->BalancedRoot) Node = NULL;
     }
 
+    /* Nothing fits between the VADs, so look above the highest one */
+    PreviousNode = RtlRightChildAvl(&Table->BalancedRoot);
+    while (RtlRightChildAvl(PreviousNode)) PreviousNode = RtlRightChildAvl(PreviousNode);
+    if (PreviousNode->EndingVpn >= LowVpn)
+        LowVpn = ALIGN_UP_BY(PreviousNode->EndingVpn + 1, AlignmentVpn);
+
     /* We're up to the highest VAD, will this allocation fit above it? */
     HighestVpn = ((ULONG_PTR)MM_HIGHEST_VAD_ADDRESS + 1) / PAGE_SIZE;
 
@@ -597,9 +775,10 @@ MiFindEmptyAddressRangeDownTree(IN SIZE_T Length,
                                 OUT PULONG_PTR Base,
                                 OUT PMMADDRESS_NODE *Parent)
 {
-    PMMADDRESS_NODE Node, OldNode = NULL, Child;
-    ULONG_PTR LowVpn, HighVpn, AlignmentVpn;
+    PMMADDRESS_NODE Node, Child;
+    ULONG_PTR LowVpn, HighVpn, TopVpn, FloorVpn, AlignmentVpn;
     PFN_NUMBER PageCount;
+    BOOLEAN Descend;
 
     ASSERT_LOCKED_FOR_READ(Table);
 
@@ -637,67 +816,92 @@ MiFindEmptyAddressRangeDownTree(IN SIZE_T Length,
         return TableEmptyTree;
     }
 
-    /* Calculate the initial upper margin */
+    /* Calculate the upper margin, and the lowest address we may hand out */
     HighVpn = (BoundaryAddress + 1) >> PAGE_SHIFT;
+    FloorVpn = ALIGN_UP_BY((ULONG_PTR)MI_LOWEST_VAD_ADDRESS, Alignment) / PAGE_SIZE;
 
-    /* Starting from the root, follow the right children until we found a node
-       that ends above the boundary */
+    /* Start with the gap above the highest node */
     Node = RtlRightChildAvl(&Table->BalancedRoot);
-    while ((Node->EndingVpn < HighVpn) &&
-           ((Child = RtlRightChildAvl(Node)) != NULL)) Node = Child;
+    while (RtlRightChildAvl(Node)) Node = RtlRightChildAvl(Node);
+    LowVpn = ALIGN_UP_BY(Node->EndingVpn + 1, AlignmentVpn);
+    if ((HighVpn > LowVpn) && ((HighVpn - LowVpn) >= PageCount))
+    {
+        /* There is enough space to add our node, above the right-most one */
+        LowVpn = ALIGN_DOWN_BY(HighVpn - PageCount, AlignmentVpn);
+        *Base = LowVpn << PAGE_SHIFT;
+        *Parent = Node;
+        return TableInsertAsRight;
+    }
 
-    /* Now loop the Vad nodes */
-    while (Node)
+    /*
+     * Look for the highest node with a suitable gap below it, in reverse
+     * address order. Subtrees whose largest gap is too small, or which lie
+     * entirely above the boundary, are skipped.
+     */
+    Node = RtlRightChildAvl(&Table->BalancedRoot);
+    Descend = TRUE;
+    while (Node != NULL)
     {
-        /* Calculate the lower margin */
-        LowVpn = ALIGN_UP_BY(Node->EndingVpn + 1, AlignmentVpn);
+        /* Higher addresses come first, try the right subtree */
+        if (Descend)
+        {
+            Child = RtlRightChildAvl(Node);
+            if ((Child) &&
+                (Child->LargestGap >= PageCount) &&
+                ((Node->EndingVpn + 1) < HighVpn))
+            {
+                Node = Child;
+                continue;
+            }
+        }
 
-        /* Check if the current bounds are suitable */
-        if ((HighVpn > LowVpn) && ((HighVpn - LowVpn) >= PageCount))
+        /* Check if the gap below the current node is suitable */
+        if (Node->GapBelow >= PageCount)
         {
-            /* There is enough space to add our node */
-            LowVpn = ALIGN_DOWN_BY(HighVpn - PageCount, AlignmentVpn);
-            *Base = LowVpn << PAGE_SHIFT;
+            LowVpn = ALIGN_UP_BY(Node->StartingVpn - Node->GapBelow, AlignmentVpn);
+            if (LowVpn < FloorVpn) LowVpn = FloorVpn;
+            TopVpn = min(Node->StartingVpn, HighVpn);
 
-            /* Can we use the current node as parent? */
-            if (!RtlRightChildAvl(Node))
+            if ((TopVpn > LowVpn) && ((TopVpn - LowVpn) >= PageCount))
             {
-                /* Node has no right child, so use it as parent */
-                *Parent = Node;
+                /* There is enough space to add our node */
+                LowVpn = ALIGN_DOWN_BY(TopVpn - PageCount, AlignmentVpn);
+                *Base = LowVpn << PAGE_SHIFT;
+
+                /* Can we use the current node as parent? */
+                if (!RtlLeftChildAvl(Node))
+                {
+                    /* Node has no left child, so use it as parent */
+                    *Parent = Node;
+                    return TableInsertAsLeft;
+                }
+
+                /* Otherwise the previous node is the right-most grandchild
+                   of the left child, use it as parent. */
+                Child = RtlLeftChildAvl(Node);
+                while (RtlRightChildAvl(Child)) Child = RtlRightChildAvl(Child);
+                *Parent = Child;
                 return TableInsertAsRight;
             }
-            else
-            {
-                /* Node has a right child. This means we must have already
-                   moved one node left from the right-most node we started
-                   with, thus we already have an OldNode! */
-                ASSERT(OldNode != NULL);
-
-                /* The node we had before is the most left grandchild of
-                   that right child, use it as parent. */
-                ASSERT(RtlLeftChildAvl(OldNode) == NULL);
-                *Parent = OldNode;
-                return TableInsertAsLeft;
-            }
         }
 
-        /* Update the upper margin if necessary */
-        if (Node->StartingVpn < HighVpn) HighVpn = Node->StartingVpn;
-
-        /* Remember the current node and go to the previous node */
-        OldNode = Node;
-        Node = MiGetPreviousNode(Node);
-    }
+        /* Then the lower addresses in the left subtree */
+        Child = RtlLeftChildAvl(Node);
+        if ((Child) && (Child->LargestGap >= PageCount))
+        {
+            Node = Child;
+            Descend = TRUE;
+            continue;
+        }
 
-    /* Check if there's enough space before the lowest Vad */
-    LowVpn = ALIGN_UP_BY((ULONG_PTR)MI_LOWEST_VAD_ADDRESS, Alignment) / PAGE_SIZE;
-    if ((HighVpn > LowVpn) && ((HighVpn - LowVpn) >= PageCount))
-    {
-        /* There is enough space to add our address */
-        LowVpn = ALIGN_DOWN_BY(HighVpn - PageCount, Alignment >> PAGE_SHIFT);
-        *Base = LowVpn << PAGE_SHIFT;
-        *Parent = OldNode;
-        return TableInsertAsLeft;
+        /* This subtree is done, go back up to the first node we left to the right */
+        Descend = FALSE;
+        do
+        {
+            Child = Node;
+            Node = RtlParentAvl(Node);
+        } while ((Node != &Table->BalancedRoot) && (RtlRightChildAvl(Node) != Child));
+        if (Node == &Table->BalancedRoot) Node = NULL;
     }
 
     /* No address space left at all */
@@ -18,6 +18,7 @@
 #define MI_MAPPED_COPY_PAGES  14
 #define MI_POOL_COPY_BYTES    512
 #define MI_MAX_TRANSFER_SIZE  64 * 1024
+#define MI_MAX_QUERY_REGIONS  256
 
 NTSTATUS NTAPI
 MiProtectVirtualMemory(IN PEPROCESS Process,
@@ -369,7 +370,8 @@ NTAPI
 MiDeletePte(IN PMMPTE PointerPte,
             IN PVOID VirtualAddress,
             IN PEPROCESS CurrentProcess,
-            IN PMMPTE PrototypePte)
+            IN PMMPTE PrototypePte,
+            IN PMMPTE_FLUSH_LIST FlushList OPTIONAL)
 {
     PMMPFN Pfn1;
     MMPTE TempPte;
@@ -472,8 +474,10 @@ MiDeletePte(IN PMMPTE PointerPte,
         /* Drop the share count */
         MiDecrementShareCount(Pfn1, PageFrameIndex);
 
-        /* Either a fork, or this is the shared user data page */
-        if ((PointerPte <= MiHighestUserPte) && (PrototypePte != Pfn1->PteAddress))
+        /* Either a fork, a combined page, or this is the shared user data page */
+        if ((PointerPte <= MiHighestUserPte) &&
+            (PrototypePte != Pfn1->PteAddress) &&
+            !MiIsCombinedPfn(Pfn1))
         {
             /* If it's not the shared user page, then crash, since there's no fork() yet */
             if ((PAGE_ALIGN(VirtualAddress) != (PVOID)USER_SHARED_DATA) ||
@@ -504,6 +508,12 @@ MiDeletePte(IN PMMPTE PointerPte,
                          (ULONG_PTR)Pfn1->PteAddress);
         }
 
+        /* Take it out of the working set while the PTE still maps it */
+        if ((PointerPte <= MiHighestUserPte) && (Pfn1->u1.WsIndex != 0))
+        {
+            MiRemoveFromWorkingSetList(&CurrentProcess->Vm, VirtualAddress);
+        }
+
         /* Erase the PTE */
         MI_ERASE_PTE(PointerPte);
 
@@ -521,8 +531,15 @@ MiDeletePte(IN PMMPTE PointerPte,
         //CurrentProcess->NumberOfPrivatePages--;
     }
 
-    /* Flush the TLB */
-    KeFlushCurrentTb();
+    /* Flush the TLB now, unless the caller batches the flush */
+    if (FlushList)
+    {
+        MiInsertPteFlushList(FlushList, VirtualAddress);
+    }
+    else
+    {
+        KeFlushEntireTb(TRUE, FALSE);
+    }
 }
 
 VOID
@@ -545,6 +562,7 @@ MiDeleteVirtualAddresses(
     KIRQL OldIrql;
     BOOLEAN AddressGap = FALSE;
     PSUBSECTION Subsection;
+    MMPTE_FLUSH_LIST FlushList;
 
     /* We should never get RosMm memory areas here */
     ASSERT((Vad == NULL) || !MI_IS_MEMORY_AREA_VAD(Vad));
@@ -568,6 +586,9 @@ MiDeleteVirtualAddresses(
     /* In all cases, we don't support fork() yet */
     ASSERT(CurrentProcess->CloneRoot == NULL);
 
+    /* The TB is flushed once per page table, instead of once per page */
+    MiInitializePteFlushList(&FlushList);
+
     /* Loop the PTE for each VA (EndingAddress is inclusive!) */
     while (Va <= EndingAddress)
     {
@@ -623,6 +644,21 @@ MiDeleteVirtualAddresses(
             continue;
         }
 
+#ifdef _M_AMD64
+        /* Large pages have no PTEs, they go away with their PDE */
+        if ((PointerPde->u.Hard.Valid) && MI_IS_PAGE_LARGE(PointerPde))
+        {
+            ASSERT((Va & (PDE_MAPPED_VA - 1)) == 0);
+            ASSERT(Va + PDE_MAPPED_VA - 1 <= EndingAddress);
+            OldIrql = MiAcquirePfnLock();
+            MiDeletePde(PointerPde, CurrentProcess);
+            MiReleasePfnLock(OldIrql);
+
+            Va = (ULONG_PTR)MiPdeToAddress(PointerPde + 1);
+            continue;
+        }
+#endif
+
         /* Now check if the PDE is mapped in */
         if (!PointerPde->u.Hard.Valid)
         {
@@ -703,7 +739,8 @@ MiDeleteVirtualAddresses(
                         MiDeletePte(PointerPte,
                                     (PVOID)Va,
                                     CurrentProcess,
-                                    PrototypePte);
+                                    PrototypePte,
+                                    &FlushList);
                     }
                 }
                 else
@@ -736,6 +773,9 @@ MiDeleteVirtualAddresses(
             PrototypePte++;
         } while ((Va & (PDE_MAPPED_VA - 1)) && (Va <= EndingAddress));
 
+        /* Flush the TB before the freed pages can be reused */
+        MiFlushPteList(&FlushList, FALSE);
+
         /* Release the lock */
         MiReleasePfnLock(OldIrql);
 
@@ -1456,7 +1496,7 @@ MiGetPageProtection(IN PMMPTE PointerPte)
 
     /* If we get here, the PTE is valid, so look up the page in PFN database */
     Pfn = MiGetPfnEntry(TempPte.u.Hard.PageFrameNumber);
-    if (!Pfn->u3.e1.PrototypePte)
+    if (!Pfn->u3.e1.PrototypePte || MiIsCombinedPfn(Pfn))
     {
         /* Return protection of the original pte */
         ASSERT(Pfn->u4.AweAllocation == 0);
@@ -1494,6 +1534,14 @@ MiQueryAddressState(IN PVOID Va,
     ASSERT((Vad->StartingVpn <= ((ULONG_PTR)Va >> PAGE_SHIFT)) &&
            (Vad->EndingVpn >= ((ULONG_PTR)Va >> PAGE_SHIFT)));
 
+    /* Large pages are committed as a whole, with the protection of the VAD */
+    if (Vad->u.VadFlags.VadType == VadLargePages)
+    {
+        *NextVa = (PVOID)((Vad->EndingVpn + 1) << PAGE_SHIFT);
+        *ReturnedProtect = MmProtectToValue[Vad->u.VadFlags.Protection];
+        return MEM_COMMIT;
+    }
+
     /* Only normal VADs supported */
     ASSERT(Vad->u.VadFlags.VadType == VadNone);
 
@@ -1662,123 +1710,69 @@ MiQueryAddressState(IN PVOID Va,
     return State;
 }
 
-NTSTATUS
-NTAPI
-MiQueryMemoryBasicInformation(IN HANDLE ProcessHandle,
-                              IN PVOID BaseAddress,
-                              OUT PVOID MemoryInformation,
-                              IN SIZE_T MemoryInformationLength,
-                              OUT PSIZE_T ReturnLength)
+static
+BOOLEAN
+MiIsReservedRegion(IN PVOID Address)
 {
-    PEPROCESS TargetProcess;
-    NTSTATUS Status = STATUS_SUCCESS;
-    PMMVAD Vad = NULL;
-    PVOID Address, NextAddress;
-    BOOLEAN Found = FALSE;
-    ULONG NewProtect, NewState;
-    ULONG_PTR BaseVpn;
-    MEMORY_BASIC_INFORMATION MemoryInfo;
-    KAPC_STATE ApcState;
-    KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
-    SIZE_T ResultLength;
-
-    /* Check for illegal addresses in user-space, or the shared memory area */
-    if ((BaseAddress > MM_HIGHEST_VAD_ADDRESS) ||
-        (PAGE_ALIGN(BaseAddress) == (PVOID)MM_SHARED_USER_DATA_VA))
-    {
-        Address = PAGE_ALIGN(BaseAddress);
-
-        /* Make up an info structure describing this range */
-        MemoryInfo.BaseAddress = Address;
-        MemoryInfo.AllocationProtect = PAGE_READONLY;
-        MemoryInfo.Type = MEM_PRIVATE;
-
-        /* Special case for shared data */
-        if (Address == (PVOID)MM_SHARED_USER_DATA_VA)
-        {
-            MemoryInfo.AllocationBase = (PVOID)MM_SHARED_USER_DATA_VA;
-            MemoryInfo.State = MEM_COMMIT;
-            MemoryInfo.Protect = PAGE_READONLY;
-            MemoryInfo.RegionSize = PAGE_SIZE;
-        }
-        else
-        {
-            MemoryInfo.AllocationBase = (PCHAR)MM_HIGHEST_VAD_ADDRESS + 1;
-            MemoryInfo.State = MEM_RESERVE;
-            MemoryInfo.Protect = PAGE_NOACCESS;
-            MemoryInfo.RegionSize = (ULONG_PTR)MM_HIGHEST_USER_ADDRESS + 1 - (ULONG_PTR)Address;
-        }
+    /* Illegal addresses in user-space, or the shared memory area */
+    return ((Address > MM_HIGHEST_VAD_ADDRESS) ||
+            (PAGE_ALIGN(Address) == (PVOID)MM_SHARED_USER_DATA_VA));
+}
 
-        /* Return the data, NtQueryInformation already probed it*/
-        if (PreviousMode != KernelMode)
-        {
-            _SEH2_TRY
-            {
-                *(PMEMORY_BASIC_INFORMATION)MemoryInformation = MemoryInfo;
-                if (ReturnLength) *ReturnLength = sizeof(MEMORY_BASIC_INFORMATION);
-            }
-             _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
-            {
-                Status = _SEH2_GetExceptionCode();
-            }
-            _SEH2_END;
-        }
-        else
-        {
-            *(PMEMORY_BASIC_INFORMATION)MemoryInformation = MemoryInfo;
-            if (ReturnLength) *ReturnLength = sizeof(MEMORY_BASIC_INFORMATION);
-        }
+static
+VOID
+MiQueryReservedRegion(IN PVOID BaseAddress,
+                      OUT PMEMORY_BASIC_INFORMATION MemoryInfo)
+{
+    PVOID Address = PAGE_ALIGN(BaseAddress);
 
-        return Status;
-    }
+    /* Make up an info structure describing this range */
+    MemoryInfo->BaseAddress = Address;
+    MemoryInfo->AllocationProtect = PAGE_READONLY;
+    MemoryInfo->Type = MEM_PRIVATE;
 
-    /* Check if this is for a local or remote process */
-    if (ProcessHandle == NtCurrentProcess())
+    /* Special case for shared data */
+    if (Address == (PVOID)MM_SHARED_USER_DATA_VA)
     {
-        TargetProcess = PsGetCurrentProcess();
+        MemoryInfo->AllocationBase = (PVOID)MM_SHARED_USER_DATA_VA;
+        MemoryInfo->State = MEM_COMMIT;
+        MemoryInfo->Protect = PAGE_READONLY;
+        MemoryInfo->RegionSize = PAGE_SIZE;
     }
     else
     {
-        /* Reference the target process */
-        Status = ObReferenceObjectByHandle(ProcessHandle,
-                                           PROCESS_QUERY_INFORMATION,
-                                           PsProcessType,
-                                           ExGetPreviousMode(),
-                                           (PVOID*)&TargetProcess,
-                                           NULL);
-        if (!NT_SUCCESS(Status)) return Status;
-
-        /* Attach to it now */
-        KeStackAttachProcess(&TargetProcess->Pcb, &ApcState);
+        MemoryInfo->AllocationBase = (PCHAR)MM_HIGHEST_VAD_ADDRESS + 1;
+        MemoryInfo->State = MEM_RESERVE;
+        MemoryInfo->Protect = PAGE_NOACCESS;
+        MemoryInfo->RegionSize = (ULONG_PTR)MM_HIGHEST_USER_ADDRESS + 1 - (ULONG_PTR)Address;
     }
+}
 
-    /* Lock the address space and make sure the process isn't already dead */
-    MmLockAddressSpace(&TargetProcess->Vm);
-    if (TargetProcess->VmDeleted)
-    {
-        /* Unlock the address space of the process */
-        MmUnlockAddressSpace(&TargetProcess->Vm);
-
-        /* Check if we were attached */
-        if (ProcessHandle != NtCurrentProcess())
-        {
-            /* Detach and dereference the process */
-            KeUnstackDetachProcess(&ApcState);
-            ObDereferenceObject(TargetProcess);
-        }
+static
+NTSTATUS
+MiQueryVadRegion(IN PEPROCESS TargetProcess,
+                 IN PVOID BaseAddress,
+                 OUT PMEMORY_BASIC_INFORMATION MemoryInfo)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    PMMVAD Vad = NULL;
+    PVOID Address, NextAddress;
+    BOOLEAN Found = FALSE;
+    ULONG NewProtect, NewState;
+    ULONG_PTR BaseVpn;
+    SIZE_T ResultLength;
 
-        /* Bail out */
-        DPRINT1("Process is dying\n");
-        return STATUS_PROCESS_IS_TERMINATING;
+    /* Region walks move from one VAD to the next, so try the hint first */
+    BaseVpn = (ULONG_PTR)BaseAddress >> PAGE_SHIFT;
+    Vad = MiLocateVad(&TargetProcess->VadRoot, BaseAddress);
+    if (Vad)
+    {
+        Found = TRUE;
     }
-
-    /* Loop the VADs */
-    ASSERT(TargetProcess->VadRoot.NumberGenericTableElements);
-    if (TargetProcess->VadRoot.NumberGenericTableElements)
+    else if (TargetProcess->VadRoot.NumberGenericTableElements)
     {
         /* Scan on the right */
         Vad = (PMMVAD)TargetProcess->VadRoot.BalancedRoot.RightChild;
-        BaseVpn = (ULONG_PTR)BaseAddress >> PAGE_SHIFT;
         while (Vad)
         {
             /* Check if this VAD covers the allocation range */
@@ -1824,7 +1818,7 @@ MiQueryMemoryBasicInformation(IN HANDLE ProcessHandle,
             if (Vad->StartingVpn >= BaseVpn)
             {
                 /* Region size is the free space till the start of that VAD */
-                MemoryInfo.RegionSize = (ULONG_PTR)(Vad->StartingVpn << PAGE_SHIFT) - (ULONG_PTR)Address;
+                MemoryInfo->RegionSize = (ULONG_PTR)(Vad->StartingVpn << PAGE_SHIFT) - (ULONG_PTR)Address;
             }
             else
             {
@@ -1833,83 +1827,51 @@ MiQueryMemoryBasicInformation(IN HANDLE ProcessHandle,
                 if (Vad)
                 {
                     /* Region size is the free space till the start of that VAD */
-                    MemoryInfo.RegionSize = (ULONG_PTR)(Vad->StartingVpn << PAGE_SHIFT) - (ULONG_PTR)Address;
+                    MemoryInfo->RegionSize = (ULONG_PTR)(Vad->StartingVpn << PAGE_SHIFT) - (ULONG_PTR)Address;
                 }
                 else
                 {
                     /* Maximum possible region size with that base address */
-                    MemoryInfo.RegionSize = (PCHAR)MM_HIGHEST_VAD_ADDRESS + 1 - (PCHAR)Address;
+                    MemoryInfo->RegionSize = (PCHAR)MM_HIGHEST_VAD_ADDRESS + 1 - (PCHAR)Address;
                 }
             }
         }
         else
         {
             /* Maximum possible region size with that base address */
-            MemoryInfo.RegionSize = (PCHAR)MM_HIGHEST_VAD_ADDRESS + 1 - (PCHAR)Address;
-        }
-
-        /* Unlock the address space of the process */
-        MmUnlockAddressSpace(&TargetProcess->Vm);
-
-        /* Check if we were attached */
-        if (ProcessHandle != NtCurrentProcess())
-        {
-            /* Detach and dereference the process */
-            KeUnstackDetachProcess(&ApcState);
-            ObDereferenceObject(TargetProcess);
+            MemoryInfo->RegionSize = (PCHAR)MM_HIGHEST_VAD_ADDRESS + 1 - (PCHAR)Address;
         }
 
         /* Build the rest of the initial information block */
-        MemoryInfo.BaseAddress = Address;
-        MemoryInfo.AllocationBase = NULL;
-        MemoryInfo.AllocationProtect = 0;
-        MemoryInfo.State = MEM_FREE;
-        MemoryInfo.Protect = PAGE_NOACCESS;
-        MemoryInfo.Type = 0;
-
-        /* Return the data, NtQueryInformation already probed it*/
-        if (PreviousMode != KernelMode)
-        {
-            _SEH2_TRY
-            {
-                *(PMEMORY_BASIC_INFORMATION)MemoryInformation = MemoryInfo;
-                if (ReturnLength) *ReturnLength = sizeof(MEMORY_BASIC_INFORMATION);
-            }
-             _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
-            {
-                Status = _SEH2_GetExceptionCode();
-            }
-            _SEH2_END;
-        }
-        else
-        {
-            *(PMEMORY_BASIC_INFORMATION)MemoryInformation = MemoryInfo;
-            if (ReturnLength) *ReturnLength = sizeof(MEMORY_BASIC_INFORMATION);
-        }
-
-        return Status;
+        MemoryInfo->BaseAddress = Address;
+        MemoryInfo->AllocationBase = NULL;
+        MemoryInfo->AllocationProtect = 0;
+        MemoryInfo->State = MEM_FREE;
+        MemoryInfo->Protect = PAGE_NOACCESS;
+        MemoryInfo->Type = 0;
+        return STATUS_SUCCESS;
     }
 
     /* Set the correct memory type based on what kind of VAD this is */
     if ((Vad->u.VadFlags.PrivateMemory) ||
         (Vad->u.VadFlags.VadType == VadRotatePhysical))
     {
-        MemoryInfo.Type = MEM_PRIVATE;
+        MemoryInfo->Type = MEM_PRIVATE;
     }
     else if (Vad->u.VadFlags.VadType == VadImageMap)
     {
-        MemoryInfo.Type = MEM_IMAGE;
+        MemoryInfo->Type = MEM_IMAGE;
     }
     else
     {
-        MemoryInfo.Type = MEM_MAPPED;
+        MemoryInfo->Type = MEM_MAPPED;
     }
 
     /* Check if this is a RosMM VAD */
     if (MI_IS_ROSMM_VAD(Vad))
     {
         ASSERT(((PMEMORY_AREA)Vad)->Type == MEMORY_AREA_SECTION_VIEW);
-        Status = MmQuerySectionView((PMEMORY_AREA)Vad, BaseAddress, &MemoryInfo, &ResultLength);
+        Status = MmQuerySectionView((PMEMORY_AREA)Vad, BaseAddress, MemoryInfo, &ResultLength);
         if (!NT_SUCCESS(Status))
         {
             DPRINT1("MmQuerySectionView failed. MemoryArea=%p (%p-%p), BaseAddress=%p\n",
@@ -1921,26 +1883,26 @@ MiQueryMemoryBasicInformation(IN HANDLE ProcessHandle,
     {
         /* Build the initial information block */
         Address = PAGE_ALIGN(BaseAddress);
-        MemoryInfo.BaseAddress = Address;
-        MemoryInfo.AllocationBase = (PVOID)(Vad->StartingVpn << PAGE_SHIFT);
-        MemoryInfo.AllocationProtect = MmProtectToValue[Vad->u.VadFlags.Protection];
-        MemoryInfo.Type = MEM_PRIVATE;
+        MemoryInfo->BaseAddress = Address;
+        MemoryInfo->AllocationBase = (PVOID)(Vad->StartingVpn << PAGE_SHIFT);
+        MemoryInfo->AllocationProtect = MmProtectToValue[Vad->u.VadFlags.Protection];
+        MemoryInfo->Type = MEM_PRIVATE;
 
         /* Acquire the working set lock (shared is enough) */
         MiLockProcessWorkingSetShared(TargetProcess, PsGetCurrentThread());
 
         /* Find the largest chunk of memory which has the same state and protection mask */
-        MemoryInfo.State = MiQueryAddressState(Address,
-                                               Vad,
-                                               TargetProcess,
-                                               &MemoryInfo.Protect,
-                                               &NextAddress);
+        MemoryInfo->State = MiQueryAddressState(Address,
+                                                Vad,
+                                                TargetProcess,
+                                                &MemoryInfo->Protect,
+                                                &NextAddress);
         Address = NextAddress;
         while (((ULONG_PTR)Address >> PAGE_SHIFT) <= Vad->EndingVpn)
         {
             /* Keep going unless the state or protection mask changed */
             NewState = MiQueryAddressState(Address, Vad, TargetProcess, &NewProtect, &NextAddress);
-            if ((NewState != MemoryInfo.State) || (NewProtect != MemoryInfo.Protect)) break;
+            if ((NewState != MemoryInfo->State) || (NewProtect != MemoryInfo->Protect)) break;
             Address = NextAddress;
         }
 
@@ -1948,27 +1910,153 @@ MiQueryMemoryBasicInformation(IN HANDLE ProcessHandle,
         MiUnlockProcessWorkingSetShared(TargetProcess, PsGetCurrentThread());
 
         /* Check if we went outside of the VAD */
-         if (((ULONG_PTR)Address >> PAGE_SHIFT) > Vad->EndingVpn)
-         {
+        if (((ULONG_PTR)Address >> PAGE_SHIFT) > Vad->EndingVpn)
+        {
             /* Set the end of the VAD as the end address */
             Address = (PVOID)((Vad->EndingVpn + 1) << PAGE_SHIFT);
-         }
+        }
 
         /* Now that we know the last VA address, calculate the region size */
-        MemoryInfo.RegionSize = ((ULONG_PTR)Address - (ULONG_PTR)MemoryInfo.BaseAddress);
+        MemoryInfo->RegionSize = ((ULONG_PTR)Address - (ULONG_PTR)MemoryInfo->BaseAddress);
     }
 
-    /* Unlock the address space of the process */
-    MmUnlockAddressSpace(&TargetProcess->Vm);
+    DPRINT("Base: %p AllocBase: %p AllocProtect: %lx Protect: %lx "
+            "State: %lx Type: %lx Size: %lx\n",
+            MemoryInfo->BaseAddress, MemoryInfo->AllocationBase,
+            MemoryInfo->AllocationProtect, MemoryInfo->Protect,
+            MemoryInfo->State, MemoryInfo->Type, MemoryInfo->RegionSize);
 
-    /* Check if we were attached */
-    if (ProcessHandle != NtCurrentProcess())
+    return Status;
+}
+
+static
+NTSTATUS
+MiQueryMemoryRegions(IN HANDLE ProcessHandle,
+                     IN PVOID BaseAddress,
+                     OUT PMEMORY_BASIC_INFORMATION Regions,
+                     IN ULONG MaximumRegions,
+                     OUT PULONG NumberOfRegions,
+                     OUT PVOID *NextAddress)
+{
+    PEPROCESS TargetProcess = NULL;
+    NTSTATUS Status = STATUS_SUCCESS;
+    KAPC_STATE ApcState;
+    ULONG_PTR EndAddress;
+    PVOID Address;
+    ULONG Count;
+
+    /* Describe consecutive regions until the buffer is full */
+    ASSERT(MaximumRegions != 0);
+    Address = BaseAddress;
+    for (Count = 0; Count < MaximumRegions; Count++)
     {
-        /* Detach and dereference the process */
-        KeUnstackDetachProcess(&ApcState);
-        ObDereferenceObject(TargetProcess);
+        if (MiIsReservedRegion(Address))
+        {
+            /* This doesn't need the process at all */
+            MiQueryReservedRegion(Address, &Regions[Count]);
+        }
+        else
+        {
+            /* Attach and lock the address space the first time we need it */
+            if (!TargetProcess)
+            {
+                /* Check if this is for a local or remote process */
+                if (ProcessHandle == NtCurrentProcess())
+                {
+                    TargetProcess = PsGetCurrentProcess();
+                }
+                else
+                {
+                    /* Reference the target process */
+                    Status = ObReferenceObjectByHandle(ProcessHandle,
+                                                       PROCESS_QUERY_INFORMATION,
+                                                       PsProcessType,
+                                                       ExGetPreviousMode(),
+                                                       (PVOID*)&TargetProcess,
+                                                       NULL);
+                    if (!NT_SUCCESS(Status))
+                    {
+                        TargetProcess = NULL;
+                        break;
+                    }
+
+                    /* Attach to it now */
+                    KeStackAttachProcess(&TargetProcess->Pcb, &ApcState);
+                }
+
+                /* Lock the address space and make sure the process isn't already dead */
+                MmLockAddressSpace(&TargetProcess->Vm);
+                if (TargetProcess->VmDeleted)
+                {
+                    DPRINT1("Process is dying\n");
+                    Status = STATUS_PROCESS_IS_TERMINATING;
+                    break;
+                }
+            }
+
+            /* Describe the region at this address */
+            Status = MiQueryVadRegion(TargetProcess, Address, &Regions[Count]);
+            if (!NT_SUCCESS(Status))
+            {
+                Count++;
+                break;
+            }
+        }
+
+        /* The next region starts where this one ends */
+        EndAddress = (ULONG_PTR)Regions[Count].BaseAddress + Regions[Count].RegionSize;
+        if (EndAddress > (ULONG_PTR)MM_HIGHEST_USER_ADDRESS)
+        {
+            /* That was the last one */
+            Address = NULL;
+            Count++;
+            break;
+        }
+        Address = (PVOID)EndAddress;
+    }
+
+    if (TargetProcess)
+    {
+        /* Unlock the address space of the process */
+        MmUnlockAddressSpace(&TargetProcess->Vm);
+
+        /* Check if we were attached */
+        if (ProcessHandle != NtCurrentProcess())
+        {
+            /* Detach and dereference the process */
+            KeUnstackDetachProcess(&ApcState);
+            ObDereferenceObject(TargetProcess);
+        }
     }
 
+    *NumberOfRegions = Count;
+    *NextAddress = Address;
+    return Status;
+}
+
+NTSTATUS
+NTAPI
+MiQueryMemoryBasicInformation(IN HANDLE ProcessHandle,
+                              IN PVOID BaseAddress,
+                              OUT PVOID MemoryInformation,
+                              IN SIZE_T MemoryInformationLength,
+                              OUT PSIZE_T ReturnLength)
+{
+    NTSTATUS Status;
+    MEMORY_BASIC_INFORMATION MemoryInfo;
+    KPROCESSOR_MODE PreviousMode = ExGetPreviousMode();
+    PVOID NextAddress;
+    ULONG Count;
+
+    /* Describe the one region containing this address */
+    Status = MiQueryMemoryRegions(ProcessHandle,
+                                  BaseAddress,
+                                  &MemoryInfo,
+                                  1,
+                                  &Count,
+                                  &NextAddress);
+    if (Count == 0) return Status;
+
     /* Return the data, NtQueryInformation already probed it */
     if (PreviousMode != KernelMode)
     {
@@ -1989,13 +2077,65 @@ MiQueryMemoryBasicInformation(IN HANDLE ProcessHandle,
         if (ReturnLength) *ReturnLength = sizeof(MEMORY_BASIC_INFORMATION);
     }
 
-    /* All went well */
-    DPRINT("Base: %p AllocBase: %p AllocProtect: %lx Protect: %lx "
-            "State: %lx Type: %lx Size: %lx\n",
-            MemoryInfo.BaseAddress, MemoryInfo.AllocationBase,
-            MemoryInfo.AllocationProtect, MemoryInfo.Protect,
-            MemoryInfo.State, MemoryInfo.Type, MemoryInfo.RegionSize);
+    return Status;
+}
 
+static
+NTSTATUS
+MiQueryMemoryBasicInformationList(IN HANDLE ProcessHandle,
+                                  IN PVOID BaseAddress,
+                                  OUT PVOID MemoryInformation,
+                                  IN SIZE_T MemoryInformationLength,
+                                  OUT PSIZE_T ReturnLength)
+{
+    PMEMORY_BASIC_INFORMATION_LIST List = MemoryInformation;
+    PMEMORY_BASIC_INFORMATION Regions;
+    SIZE_T MaximumRegions;
+    PVOID NextAddress;
+    NTSTATUS Status;
+    ULONG Count;
+
+    /* See how many regions fit, capped so the kernel copy stays small */
+    MaximumRegions = (MemoryInformationLength - FIELD_OFFSET(MEMORY_BASIC_INFORMATION_LIST, Regions)) /
+                     sizeof(MEMORY_BASIC_INFORMATION);
+    MaximumRegions = min(MaximumRegions, MI_MAX_QUERY_REGIONS);
+    ASSERT(MaximumRegions != 0);
+
+    /* The regions are gathered with the address space locked, so they can't
+       go to the caller's buffer directly as it might have to be paged in */
+    Regions = ExAllocatePoolWithTag(PagedPool,
+                                    MaximumRegions * sizeof(MEMORY_BASIC_INFORMATION),
+                                    TAG_MM_REGION_LIST);
+    if (!Regions) return STATUS_INSUFFICIENT_RESOURCES;
+
+    Status = MiQueryMemoryRegions(ProcessHandle,
+                                  BaseAddress,
+                                  Regions,
+                                  (ULONG)MaximumRegions,
+                                  &Count,
+                                  &NextAddress);
+    if (Count != 0)
+    {
+        /* Return the data, NtQueryInformation already probed it */
+        _SEH2_TRY
+        {
+            List->NumberOfRegions = Count;
+            List->NextAddress = NextAddress;
+            RtlCopyMemory(List->Regions, Regions, Count * sizeof(MEMORY_BASIC_INFORMATION));
+            if (ReturnLength)
+            {
+                *ReturnLength = FIELD_OFFSET(MEMORY_BASIC_INFORMATION_LIST, Regions) +
+                                Count * sizeof(MEMORY_BASIC_INFORMATION);
+            }
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+    }
+
+    ExFreePoolWithTag(Regions, TAG_MM_REGION_LIST);
     return Status;
 }
 
@@ -2369,6 +2509,20 @@ MiProtectVirtualMemory(IN PEPROCESS Process,
                 /* Get the PFN entry */
                 Pfn1 = MiGetPfnEntry(PFN_FROM_PTE(&PteContents));
 
+                /* A combined page gets its private copy back first */
+                if (MiIsCombinedPfn(Pfn1))
+                {
+                    Status = MiUncombinePte(Process, PointerPte);
+                    if (!NT_SUCCESS(Status))
+                    {
+                        MiUnlockProcessWorkingSetUnsafe(Process, Thread);
+                        goto FailPath;
+                    }
+
+                    PteContents = *PointerPte;
+                    Pfn1 = MiGetPfnEntry(PFN_FROM_PTE(&PteContents));
+                }
+
                 /* We don't support this yet */
                 ASSERT(Pfn1->u3.e1.PrototypePte == 0);
 
@@ -2376,21 +2530,26 @@ MiProtectVirtualMemory(IN PEPROCESS Process,
                 if ((NewAccessProtection & PAGE_NOACCESS) ||
                     (NewAccessProtection & PAGE_GUARD))
                 {
+                    PVOID PageAddress = MiPteToAddress(PointerPte);
+                    PFN_NUMBER PageFrameIndex = PFN_FROM_PTE(&PteContents);
                     KIRQL OldIrql = MiAcquirePfnLock();
 
+                    /* Take it out of the working set while the PTE still maps it */
+                    if (Pfn1->u1.WsIndex != 0)
+                    {
+                        MiRemoveFromWorkingSetList(&Process->Vm, PageAddress);
+                    }
+
                     /* Mark the PTE as transition and change its protection */
+                    if (PteContents.u.Hard.Dirty) Pfn1->u3.e1.Modified = 1;
                     PteContents.u.Hard.Valid = 0;
                     PteContents.u.Soft.Transition = 1;
                     PteContents.u.Trans.Protection = ProtectionMask;
-                    /* Decrease PFN share count and write the PTE */
-                    MiDecrementShareCount(Pfn1, PFN_FROM_PTE(&PteContents));
-                    // FIXME: remove the page from the WS
                     MI_WRITE_INVALID_PTE(PointerPte, PteContents);
-#ifdef CONFIG_SMP
-                    // FIXME: Should invalidate entry in every CPU TLB
-                    ASSERT(KeNumberProcessors == 1);
-#endif
-                    KeInvalidateTlbEntry(MiPteToAddress(PointerPte));
+
+                    /* No processor may use the page anymore once the share is gone */
+                    KeFlushMultipleTb(1, &PageAddress, FALSE);
+                    MiDecrementShareCount(Pfn1, PageFrameIndex);
 
                     /* We are done for this PTE */
                     MiReleasePfnLock(OldIrql);
@@ -2543,12 +2702,14 @@ MiProcessValidPteList(IN PMMPTE *ValidPteList,
     KIRQL OldIrql;
     ULONG i;
     MMPTE TempPte;
-    PFN_NUMBER PageFrameIndex;
+    PFN_NUMBER PageFrameIndex, PageTableIndex;
     PMMPFN Pfn1, Pfn2;
+    MMPTE_FLUSH_LIST FlushList;
 
     //
     // Acquire the PFN lock and loop all the PTEs in the list
     //
+    MiInitializePteFlushList(&FlushList);
     OldIrql = MiAcquirePfnLock();
     for (i = 0; i != Count; i++)
     {
@@ -2563,27 +2724,49 @@ MiProcessValidPteList(IN PMMPTE *ValidPteList,
         //
         PageFrameIndex = PFN_FROM_PTE(&TempPte);
         Pfn1 = MiGetPfnEntry(PageFrameIndex);
-        Pfn2 = MiGetPfnEntry(Pfn1->u4.PteFrame);
+        if (MiIsCombinedPfn(Pfn1))
+        {
+            //
+            // A combined page is shared, so only drop this PTE's references.
+            // The page table is the one mapping the PTE, not the PFN's frame.
+            //
+            PageTableIndex = MiPteToPde(ValidPteList[i])->u.Hard.PageFrameNumber;
+            MiDecrementShareCount(MiGetPfnEntry(PageTableIndex), PageTableIndex);
+            MiDecrementShareCount(Pfn1, PageFrameIndex);
+        }
+        else
+        {
+            //
+            // Take it out of the working set while the PTE still maps it
+            //
+            if (Pfn1->u1.WsIndex != 0)
+            {
+                MiRemoveFromWorkingSetList(&PsGetCurrentProcess()->Vm,
+                                           MiPteToAddress(ValidPteList[i]));
+            }
 
-        //
-        // Decrement the share count on the page table, and then on the page
-        // itself
-        //
-        MiDecrementShareCount(Pfn2, Pfn1->u4.PteFrame);
-        MI_SET_PFN_DELETED(Pfn1);
-        MiDecrementShareCount(Pfn1, PageFrameIndex);
+            //
+            // Decrement the share count on the page table, and then on the page
+            // itself
+            //
+            Pfn2 = MiGetPfnEntry(Pfn1->u4.PteFrame);
+            MiDecrementShareCount(Pfn2, Pfn1->u4.PteFrame);
+            MI_SET_PFN_DELETED(Pfn1);
+            MiDecrementShareCount(Pfn1, PageFrameIndex);
+        }
 
         //
         // Make the page decommitted
         //
         MI_WRITE_INVALID_PTE(ValidPteList[i], MmDecommittedPte);
+        MiInsertPteFlushList(&FlushList, MiPteToAddress(ValidPteList[i]));
     }
 
     //
     // All the PTEs have been dereferenced and made invalid, flush the TLB now
     // and then release the PFN lock
     //
-    KeFlushCurrentTb();
+    MiFlushPteList(&FlushList, FALSE);
     MiReleasePfnLock(OldIrql);
 }
 
@@ -2675,7 +2858,7 @@ MiDecommitPages(IN PVOID StartingAddress,
                     //
                     Pfn1 = MiGetPfnEntry(PteContents.u.Hard.PageFrameNumber);
                     ASSERT(MI_IS_ROS_PFN(Pfn1) == FALSE);
-                    ASSERT(Pfn1->u3.e1.PrototypePte == FALSE);
+                    ASSERT((Pfn1->u3.e1.PrototypePte == FALSE) || MiIsCombinedPfn(Pfn1));
 
                     //
                     // Flush any pending PTEs that we had not yet flushed, if our
@@ -4439,6 +4622,22 @@ NtQueryVirtualMemory(IN HANDLE ProcessHandle,
                                               MemoryInformationLength,
                                               ReturnLength);
             break;
+
+        case MemoryBasicInformationList:
+            /* There must be room for at least one region */
+            if (MemoryInformationLength < (FIELD_OFFSET(MEMORY_BASIC_INFORMATION_LIST, Regions) +
+                                           sizeof(MEMORY_BASIC_INFORMATION)))
+            {
+                /* The size is invalid */
+                return STATUS_INFO_LENGTH_MISMATCH;
+            }
+            Status = MiQueryMemoryBasicInformationList(ProcessHandle,
+                                                       BaseAddress,
+                                                       MemoryInformation,
+                                                       MemoryInformationLength,
+                                                       ReturnLength);
+            break;
+
         case MemoryWorkingSetList:
         case MemoryBasicVlmInformation:
         default:
@@ -4478,6 +4677,11 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
     PMMPTE PointerPte, LastPte;
     PMMPDE PointerPde;
     TABLE_SEARCH_RESULT Result;
+    ULONG_PTR Alignment = MM_VIRTMEM_GRANULARITY;
+#ifdef _M_AMD64
+    PPFN_NUMBER LargePages = NULL;
+    PFN_NUMBER LargePageCount = 0;
+#endif
     PAGED_CODE();
 
     /* Check for valid Zero bits */
@@ -4658,12 +4862,14 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
     //
     // Fail on the things we don't yet support
     //
+#ifndef _M_AMD64
     if ((AllocationType & MEM_LARGE_PAGES) == MEM_LARGE_PAGES)
     {
         DPRINT1("MEM_LARGE_PAGES not supported\n");
         Status = STATUS_INVALID_PARAMETER;
         goto FailPathNoLock;
     }
+#endif
     if ((AllocationType & MEM_PHYSICAL) == MEM_PHYSICAL)
     {
         DPRINT1("MEM_PHYSICAL not supported\n");
@@ -4733,6 +4939,54 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
             StartingAddress = (ULONG_PTR)PBaseAddress;
         }
 
+#ifdef _M_AMD64
+        //
+        // Large pages are grabbed up front, while we can still wait for the
+        // balancer to free memory, and are mapped once the VAD is in place
+        //
+        if (AllocationType & MEM_LARGE_PAGES)
+        {
+            //
+            // They are mapped with plain cached, accessible PDEs
+            //
+            if (ProtectionMask & MM_PROTECT_SPECIAL)
+            {
+                DPRINT1("Invalid protection for large pages\n");
+                Status = STATUS_INVALID_PAGE_PROTECTION;
+                goto FailPathNoLock;
+            }
+
+            //
+            // And the range must be made of whole large pages
+            //
+            if ((StartingAddress & (PDE_MAPPED_VA - 1)) ||
+                (PRegionSize & (PDE_MAPPED_VA - 1)))
+            {
+                DPRINT1("Large page range is not aligned\n");
+                Status = STATUS_INVALID_PARAMETER;
+                goto FailPathNoLock;
+            }
+
+            LargePageCount = PRegionSize / PDE_MAPPED_VA;
+            LargePages = ExAllocatePoolWithTag(PagedPool,
+                                               LargePageCount * sizeof(PFN_NUMBER),
+                                               TAG_MM_LARGE_PAGES);
+            if (!LargePages)
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto FailPathNoLock;
+            }
+
+            Status = MiAllocateLargePages(LargePageCount, LargePages);
+            if (!NT_SUCCESS(Status))
+            {
+                ExFreePoolWithTag(LargePages, TAG_MM_LARGE_PAGES);
+                LargePages = NULL;
+                goto FailPathNoLock;
+            }
+        }
+#endif
+
         // Charge quotas for the VAD
         Status = PsChargeProcessNonPagedPoolQuota(Process, sizeof(MMVAD_LONG));
         if (!NT_SUCCESS(Status))
@@ -4759,6 +5013,13 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
         Vad->u.VadFlags.Protection = ProtectionMask;
         Vad->u.VadFlags.PrivateMemory = 1;
         Vad->ControlArea = NULL; // For Memory-Area hack
+#ifdef _M_AMD64
+        if (LargePages)
+        {
+            Vad->u.VadFlags.VadType = VadLargePages;
+            Alignment = PDE_MAPPED_VA;
+        }
+#endif
 
         //
         // Insert the VAD
@@ -4767,7 +5028,7 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
                                &StartingAddress,
                                PRegionSize,
                                HighestAddress,
-                               MM_VIRTMEM_GRANULARITY,
+                               Alignment,
                                AllocationType);
         if (!NT_SUCCESS(Status))
         {
@@ -4776,6 +5037,35 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
             goto FailPathNoLock;
         }
 
+#ifdef _M_AMD64
+        if (LargePages)
+        {
+            //
+            // Now map the large pages, unless the range was released under us
+            //
+            AddressSpace = MmGetCurrentAddressSpace();
+            MmLockAddressSpace(AddressSpace);
+            if (MiLocateAddress((PVOID)StartingAddress) == Vad)
+            {
+                MiMapLargePages(Process, Vad, LargePages);
+                ExFreePoolWithTag(LargePages, TAG_MM_LARGE_PAGES);
+                LargePages = NULL;
+            }
+            MmUnlockAddressSpace(AddressSpace);
+
+            if (LargePages)
+            {
+                //
+                // The VAD and its quota went away with the release
+                //
+                DPRINT1("Large page VAD was released before it was mapped\n");
+                QuotaCharged = FALSE;
+                Status = STATUS_MEMORY_NOT_ALLOCATED;
+                goto FailPathNoLock;
+            }
+        }
+#endif
+
         //
         // Detach and dereference the target process if
         // it was different from the current process
@@ -5151,6 +5441,16 @@ FailPath:
     }
 
 FailPathNoLock:
+#ifdef _M_AMD64
+    //
+    // Give back the large pages if we never got to map them
+    //
+    if (LargePages)
+    {
+        MiFreeLargePages(LargePageCount, LargePages);
+        ExFreePoolWithTag(LargePages, TAG_MM_LARGE_PAGES);
+    }
+#endif
     if (Attached) KeUnstackDetachProcess(&ApcState);
     if (ProcessHandle != NtCurrentProcess()) ObDereferenceObject(Process);
 
@@ -5365,9 +5665,23 @@ NtFreeVirtualMemory(IN HANDLE ProcessHandle,
     if (FreeType & MEM_RELEASE)
     {
         //
-        // ARM3 only supports this VAD in this path
+        // ARM3 only supports these VADs in this path
+        //
+        ASSERT((Vad->u.VadFlags.VadType == VadNone) ||
+               (Vad->u.VadFlags.VadType == VadLargePages));
+
         //
-        ASSERT(Vad->u.VadFlags.VadType == VadNone);
+        // Large pages can only be released as a whole
+        //
+        if ((Vad->u.VadFlags.VadType == VadLargePages) &&
+            (PRegionSize) &&
+            (((StartingAddress >> PAGE_SHIFT) != Vad->StartingVpn) ||
+             ((EndingAddress >> PAGE_SHIFT) != Vad->EndingVpn)))
+        {
+            DPRINT1("Trying to release part of a large page VAD\n");
+            Status = STATUS_INVALID_PARAMETER;
+            goto FailPath;
+        }
 
         //
         // Is the caller trying to remove the whole VAD, or remove only a portion
@@ -5450,6 +5764,7 @@ NtFreeVirtualMemory(IN HANDLE ProcessHandle,
                                                                 Process);
                     Vad->u.VadFlags.CommitCharge -= CommitReduction;
                     Vad->StartingVpn = (EndingAddress + 1) >> PAGE_SHIFT;
+                    MiUpdateNodeGaps((PMMADDRESS_NODE)Vad, &Process->VadRoot);
 
                     //
                     // After analyzing the VAD, set it to NULL so that we don't
@@ -5480,6 +5795,7 @@ NtFreeVirtualMemory(IN HANDLE ProcessHandle,
                                                                 Process);
                     Vad->u.VadFlags.CommitCharge -= CommitReduction;
                     Vad->EndingVpn = (StartingAddress - 1) >> PAGE_SHIFT;
+                    MiUpdateNodeGaps((PMMADDRESS_NODE)Vad, &Process->VadRoot);
                 }
                 else
                 {
@@ -36,7 +36,6 @@ static void FreeWsleIndex(PMMWSL WsList, ULONG Index)
     PMMWSLE Wsle = WsList->Wsle;
     ULONG& LastEntry = WsList->LastEntry;
     ULONG& FirstFree = WsList->FirstFree;
-    ULONG& LastInitializedWsle = WsList->LastInitializedWsle;
 
     /* Erase it now */
     Wsle[Index].u1.Long = 0;
@@ -72,31 +71,8 @@ static void FreeWsleIndex(PMMWSL WsList, ULONG Index)
             /* No more free entries in our array */
             FirstFree = ULONG_MAX;
         }
-        /* This is the new size of our array */
+        /* This is the new size of our array. The pages past it are freed by ShrinkWsList */
         LastEntry = Index + 1;
-        /* Should we shrink the alloc? */
-        while ((LastInitializedWsle - LastEntry) > (PAGE_SIZE / sizeof(MMWSLE)))
-        {
-            PMMPTE PointerPte = MiAddressToPte(Wsle + LastInitializedWsle - 1);
-            /* We must not free ourself! */
-            ASSERT(MiPteToAddress(PointerPte) != WsList);
-
-            PFN_NUMBER Page = PFN_FROM_PTE(PointerPte);
-
-            {
-                ntoskrnl::MiPfnLockGuard PfnLock;
-
-                PMMPFN Pfn = MiGetPfnEntry(Page);
-                MI_SET_PFN_DELETED(Pfn);
-                MiDecrementShareCount(MiGetPfnEntry(Pfn->u4.PteFrame), Pfn->u4.PteFrame);
-                MiDecrementShareCount(Pfn, Page);
-            }
-
-            PointerPte->u.Long = 0;
-
-            KeInvalidateTlbEntry(Wsle + LastInitializedWsle - 1);
-            LastInitializedWsle -= PAGE_SIZE / sizeof(MMWSLE);
-        }
         return;
     }
 
@@ -146,6 +122,59 @@ static void FreeWsleIndex(PMMWSL WsList, ULONG Index)
     Wsle[NextFree].u1.Free.PreviousFree = (NextFree - Index) & MMWSLE_PREVIOUS_FREE_MASK;
 }
 
+/*
+ * Gives back the pages at the end of the array which only hold unused entries.
+ * This is not done when freeing an entry, as that happens with the PFN lock held.
+ */
+static void ShrinkWsList(PMMWSL WsList)
+{
+    const ULONG EntriesPerPage = PAGE_SIZE / sizeof(MMWSLE);
+    const ULONG FirstPageEntries = (PAGE_SIZE - sizeof(*WsList)) / sizeof(MMWSLE);
+    PMMWSLE Wsle = WsList->Wsle;
+    ULONG& LastInitializedWsle = WsList->LastInitializedWsle;
+    MMPTE_FLUSH_LIST FlushList;
+    PFN_NUMBER Pages[MM_MAXIMUM_FLUSH_COUNT];
+    ULONG Count;
+
+    do
+    {
+        /* Unmap as many pages as we can flush at once. The first one holds the list itself */
+        MiInitializePteFlushList(&FlushList);
+        while ((LastInitializedWsle > FirstPageEntries) &&
+               ((LastInitializedWsle - EntriesPerPage) >= WsList->LastEntry) &&
+               (FlushList.Count < MM_MAXIMUM_FLUSH_COUNT))
+        {
+            PMMPTE PointerPte = MiAddressToPte(Wsle + LastInitializedWsle - 1);
+            ASSERT(MiPteToAddress(PointerPte) != WsList);
+
+            Pages[FlushList.Count] = PFN_FROM_PTE(PointerPte);
+            MiInsertPteFlushList(&FlushList, Wsle + LastInitializedWsle - 1);
+            PointerPte->u.Long = 0;
+
+            LastInitializedWsle -= EntriesPerPage;
+        }
+
+        Count = FlushList.Count;
+        if (Count == 0)
+            break;
+
+        /* Other threads of the process may have used the list from another processor */
+        MiFlushPteList(&FlushList, FALSE);
+
+        {
+            ntoskrnl::MiPfnLockGuard PfnLock;
+
+            for (ULONG i = 0; i < Count; i++)
+            {
+                PMMPFN Pfn = MiGetPfnEntry(Pages[i]);
+                MI_SET_PFN_DELETED(Pfn);
+                MiDecrementShareCount(MiGetPfnEntry(Pfn->u4.PteFrame), Pfn->u4.PteFrame);
+                MiDecrementShareCount(Pfn, Pages[i]);
+            }
+        }
+    } while (Count == MM_MAXIMUM_FLUSH_COUNT);
+}
+
 static ULONG GetFreeWsleIndex(PMMWSL WsList)
 {
     ULONG Index;
@@ -209,22 +238,29 @@ RemoveFromWsList(PMMWSL WsList, PVOID Address)
     /* Nor are "ROS PFN" */
     ASSERT(MI_IS_ROS_PFN(Pfn1) == FALSE);
 
-    /* And we should have a valid index here */
-    ASSERT(Pfn1->u1.WsIndex != 0);
+    /* And we should have a valid index here, for this very address */
+    ULONG Index = Pfn1->u1.WsIndex;
+    ASSERT(Index != 0);
+    ASSERT(WsList->Wsle[Index].u1.e1.VirtualPageNumber == (reinterpret_cast<ULONG_PTR>(Address) >> PAGE_SHIFT));
 
-    FreeWsleIndex(WsList, Pfn1->u1.WsIndex);
+    /* It leaves the age histogram too */
+    WsList->AgeDistribution[WsList->Wsle[Index].u1.e1.Age]--;
+
+    FreeWsleIndex(WsList, Index);
+    Pfn1->u1.WsIndex = 0;
 }
 
 static
-ULONG
-TrimWsList(PMMWSL WsList)
+VOID
+AgeWsList(PMMWSL WsList)
 {
-    /* This should be done under WS lock */
-    ASSERT(MM_ANY_WS_LOCK_HELD(PsGetCurrentThread()));
+    /* We are changing PTEs, this must be done under exclusive WS lock */
+    ASSERT(MM_ANY_WS_LOCK_HELD_EXCLUSIVE(PsGetCurrentThread()));
 
-    ULONG Ret = 0;
+    MMPTE_FLUSH_LIST FlushList;
+    MiInitializePteFlushList(&FlushList);
 
-    /* Walk the array */
+    /* Sweep the whole list, harvesting the accessed bits */
     for (ULONG i = WsList->FirstDynamic; i < WsList->LastEntry; i++)
     {
         MMWSLE& Entry = WsList->Wsle[i];
@@ -234,28 +270,119 @@ TrimWsList(PMMWSL WsList)
         /* Only direct entries for now */
         ASSERT(Entry.u1.e1.Direct == 1);
 
-        /* Check the PTE */
         PMMPTE PointerPte = MiAddressToPte(Entry.u1.VirtualAddress);
+        MMPTE TempPte = *PointerPte;
+        ASSERT(TempPte.u.Hard.Valid);
 
-        /* This must be valid */
-        ASSERT(PointerPte->u.Hard.Valid);
+        WsList->AgeDistribution[Entry.u1.e1.Age]--;
 
-        /* If the PTE was accessed, simply reset and that's the end of it */
-        if (PointerPte->u.Hard.Accessed)
+        if (TempPte.u.Hard.Accessed)
         {
+            /* It was used since the last pass, so it is young again */
             Entry.u1.e1.Age = 0;
-            PointerPte->u.Hard.Accessed = 0;
-            KeInvalidateTlbEntry(Entry.u1.VirtualAddress);
-            continue;
-        }
 
-        /* If the entry is not so old, just age it */
-        if (Entry.u1.e1.Age < 3)
+            /*
+             * Another processor may be setting the dirty bit, don't lose it.
+             * If the PTE changed under us, the page is still in use anyway.
+             */
+            MMPTE NewPte = TempPte;
+            NewPte.u.Hard.Accessed = 0;
+            InterlockedCompareExchangePte(PointerPte, NewPte.u.Long, TempPte.u.Long);
+
+            /* The processors using the process must see the bit cleared to set it again */
+            MiInsertPteFlushList(&FlushList, PAGE_ALIGN(Entry.u1.VirtualAddress));
+        }
+        else if (Entry.u1.e1.Age < 3)
         {
+            /* One more pass without being used */
             Entry.u1.e1.Age++;
-            continue;
         }
 
+        WsList->AgeDistribution[Entry.u1.e1.Age]++;
+    }
+
+    MiFlushPteList(&FlushList, FALSE);
+}
+
+static
+VOID
+FlushTrimmedPages(PMMPTE_FLUSH_LIST FlushList, PFN_NUMBER* Pages)
+{
+    ULONG Count = FlushList->Count;
+    ASSERT(Count <= MM_MAXIMUM_FLUSH_COUNT);
+    if (Count == 0)
+        return;
+
+    /* No processor may use the old translations once the pages are reused */
+    MiFlushPteList(FlushList, FALSE);
+
+    /* Drop the share counts. This will take care of putting them in the standby or modified list. */
+    ntoskrnl::MiPfnLockGuard PfnLock;
+    for (ULONG i = 0; i < Count; i++)
+    {
+        MiDecrementShareCount(MiGetPfnEntry(Pages[i]), Pages[i]);
+    }
+}
+
+static
+ULONG
+TrimWsList(PMMWSL WsList, ULONG Target, BOOLEAN TrimHard, BOOLEAN Empty = FALSE)
+{
+    /* This should be done under exclusive WS lock */
+    ASSERT(MM_ANY_WS_LOCK_HELD_EXCLUSIVE(PsGetCurrentThread()));
+
+    ULONG Ret = 0;
+    MMPTE_FLUSH_LIST FlushList;
+    PFN_NUMBER Pages[MM_MAXIMUM_FLUSH_COUNT];
+
+    MiInitializePteFlushList(&FlushList);
+
+    /*
+     * Use the age histogram to find how young the pages we take may be: we want
+     * the coldest ones first. Pages used during the last pass are only taken
+     * when trimming hard.
+     */
+    ULONG MinimumAge = 3;
+    ULONG Candidates = WsList->AgeDistribution[MinimumAge];
+    while ((Candidates < Target) && (MinimumAge > (TrimHard ? 0U : 1U)))
+    {
+        MinimumAge--;
+        Candidates += WsList->AgeDistribution[MinimumAge];
+    }
+
+    /* Emptying the working set takes everything, however young */
+    if (Empty)
+        MinimumAge = 0;
+
+    /* Walk the array like a clock, starting where we stopped last time */
+    ULONG Count = WsList->LastEntry - WsList->FirstDynamic;
+    ULONG i = WsList->NextSlot;
+    for (ULONG Scanned = 0; (Scanned < Count) && (Ret < Target); Scanned++, i++)
+    {
+        /* Wrap around, the list may also have shrunk behind us */
+        if ((i < WsList->FirstDynamic) || (i >= WsList->LastEntry))
+            i = WsList->FirstDynamic;
+        if (i >= WsList->LastEntry)
+            break;
+
+        MMWSLE& Entry = WsList->Wsle[i];
+        if (!Entry.u1.e1.Valid)
+            continue;
+
+        /* Only direct entries for now */
+        ASSERT(Entry.u1.e1.Direct == 1);
+
+        /* Check the PTE */
+        PVOID Address = PAGE_ALIGN(Entry.u1.VirtualAddress);
+        PMMPTE PointerPte = MiAddressToPte(Address);
+
+        /* This must be valid */
+        ASSERT(PointerPte->u.Hard.Valid);
+
+        /* Leave the pages that are younger than what we are after */
+        if ((Entry.u1.e1.Age < MinimumAge) || (PointerPte->u.Hard.Accessed && !Empty))
+            continue;
+
         if ((Entry.u1.e1.LockedInMemory) || (Entry.u1.e1.LockedInWs))
         {
             /* This one is locked. Next time, maybe... */
@@ -263,7 +390,7 @@ TrimWsList(PMMWSL WsList)
         }
 
         /* FIXME: Invalidating PDEs breaks legacy MMs */
-        if (MI_IS_PAGE_TABLE_ADDRESS(Entry.u1.VirtualAddress))
+        if (MI_IS_PAGE_TABLE_ADDRESS(Address))
             continue;
 
         /* Please put yourself aside and make place for the younger ones */
@@ -283,24 +410,36 @@ TrimWsList(PMMWSL WsList)
                 continue;
             }
 
-            /* We can remove it from the list. Save Protection first */
-            ULONG Protection = Entry.u1.e1.Protection;
-            RemoveFromWsList(WsList, Entry.u1.VirtualAddress);
+            /* Leave the pages locked for I/O alone */
+            if (Pfn->u3.e2.ReferenceCount != 1)
+                continue;
+
+            /* We can remove it from the list */
+            RemoveFromWsList(WsList, Address);
+
+            /* Make this a transition PTE, with the protection the page has now */
+            MMPTE TempPte;
+            MI_MAKE_TRANSITION_PTE(&TempPte, Page, Pfn->OriginalPte.u.Soft.Protection);
+            TempPte.u.Long = InterlockedExchangePte(PointerPte, TempPte.u.Long);
 
             /* Dirtify the page, if needed */
-            if (PointerPte->u.Hard.Dirty)
+            if (TempPte.u.Hard.Dirty)
                 Pfn->u3.e1.Modified = 1;
-
-            /* Make this a transition PTE */
-            MI_MAKE_TRANSITION_PTE(PointerPte, Page, Protection);
-            KeInvalidateTlbEntry(MiAddressToPte(PointerPte));
-
-            /* Drop the share count. This will take care of putting it in the standby or modified list. */
-            MiDecrementShareCount(Pfn, Page);
         }
 
+        /* The page stays in use until no processor can reach it anymore */
+        Pages[FlushList.Count] = Page;
+        MiInsertPteFlushList(&FlushList, Address);
+        if (FlushList.Count == MM_MAXIMUM_FLUSH_COUNT)
+            FlushTrimmedPages(&FlushList, Pages);
+
         Ret++;
     }
+
+    FlushTrimmedPages(&FlushList, Pages);
+
+    /* Next trim goes on from here */
+    WsList->NextSlot = i;
     return Ret;
 }
 
@@ -345,10 +484,12 @@ MiInsertInWorkingSetList(
     NewWsle.LockedInWs = 0;
     NewWsle.Age = 0;
     NewWsle.Valid = 1;
+    WsList->AgeDistribution[0]++;
 
-    Vm->WorkingSetSize += PAGE_SIZE;
-    if (Vm->WorkingSetSize > Vm->PeakWorkingSetSize)
-        Vm->PeakWorkingSetSize = Vm->WorkingSetSize;
+    /* RosMm accounts its pages in there too, without the WS lock */
+    ULONG PrevSize = InterlockedExchangeAddUL(&Vm->WorkingSetSize, PAGE_SIZE);
+    if (PrevSize >= Vm->PeakWorkingSetSize)
+        Vm->PeakWorkingSetSize = PrevSize + PAGE_SIZE;
 }
 
 _Use_decl_annotations_
@@ -360,7 +501,37 @@ MiRemoveFromWorkingSetList(
 {
     RemoveFromWsList(Vm->VmWorkingSetList, Address);
 
-    Vm->WorkingSetSize -= PAGE_SIZE;
+    (void)InterlockedExchangeAddUL(&Vm->WorkingSetSize, -PAGE_SIZE);
+}
+
+_Use_decl_annotations_
+VOID
+NTAPI
+MiShrinkWorkingSetList(
+    _Inout_ PMMSUPPORT Vm)
+{
+    /* Make sure that we are holding the WS lock. */
+    ASSERT(MM_ANY_WS_LOCK_HELD_EXCLUSIVE(PsGetCurrentThread()));
+
+    ShrinkWsList(Vm->VmWorkingSetList);
+}
+
+_Use_decl_annotations_
+VOID
+NTAPI
+MiEmptyWorkingSet(
+    _Inout_ PMMSUPPORT Vm)
+{
+    /* Make sure that we are holding the WS lock. */
+    ASSERT(MM_ANY_WS_LOCK_HELD_EXCLUSIVE(PsGetCurrentThread()));
+
+    Vm->Flags.BeingTrimmed = 1;
+
+    ULONG Trimmed = TrimWsList(Vm->VmWorkingSetList, ULONG_MAX, TRUE, TRUE);
+    (void)InterlockedExchangeAddUL(&Vm->WorkingSetSize, -(LONG)(Trimmed * PAGE_SIZE));
+    ShrinkWsList(Vm->VmWorkingSetList);
+
+    Vm->Flags.BeingTrimmed = 0;
 }
 
 _Use_decl_annotations_
@@ -374,6 +545,8 @@ MiInitializeWorkingSetList(_Inout_ PMMSUPPORT WorkingSet)
     WsList->FirstFree = ULONG_MAX;
     WsList->Wsle = reinterpret_cast<PMMWSLE>(WsList + 1);
     WsList->LastEntry = 0;
+    WsList->NextSlot = 0;
+    RtlZeroMemory(WsList->AgeDistribution, sizeof(WsList->AgeDistribution));
     /* The first page is already allocated */
     WsList->LastInitializedWsle = (PAGE_SIZE - sizeof(*WsList)) / sizeof(MMWSLE);
 
@@ -451,28 +624,29 @@ MmWorkingSetManager(VOID)
 
         MiReleaseExpansionLock(OldIrql);
 
-        /* Share-lock for now, we're only reading */
-        MiLockWorkingSetShared(PsGetCurrentThread(), Vm);
-
-        if (((Vm->WorkingSetSize > Vm->MaximumWorkingSetSize) ||
-            (TrimHard && (Vm->WorkingSetSize > Vm->MinimumWorkingSetSize))) &&
-            MiConvertSharedWorkingSetLockToExclusive(PsGetCurrentThread(), Vm))
-        {
-            /* We're done */
-            Vm->Flags.BeingTrimmed = 1;
+        /* Aging changes the PTEs, so we need the lock exclusively */
+        MiLockWorkingSet(PsGetCurrentThread(), Vm);
+        Vm->Flags.BeingTrimmed = 1;
 
-            ULONG Trimmed = TrimWsList(Vm->VmWorkingSetList);
+        /* Harvest the accessed bits first, so that we know which pages are cold */
+        AgeWsList(Vm->VmWorkingSetList);
 
-            /* We're done */
-            Vm->WorkingSetSize -= Trimmed * PAGE_SIZE;
-            Vm->Flags.BeingTrimmed = 0;
-            MiUnlockWorkingSet(PsGetCurrentThread(), Vm);
-        }
-        else
+        /* The maximum is a soft limit, only trim down to the minimum if we must */
+        ULONG WorkingSetPages = Vm->WorkingSetSize >> PAGE_SHIFT;
+        ULONG Limit = TrimHard ? Vm->MinimumWorkingSetSize : Vm->MaximumWorkingSetSize;
+        if (WorkingSetPages > Limit)
         {
-            MiUnlockWorkingSetShared(PsGetCurrentThread(), Vm);
+            ULONG Trimmed = TrimWsList(Vm->VmWorkingSetList, WorkingSetPages - Limit, TrimHard);
+            (void)InterlockedExchangeAddUL(&Vm->WorkingSetSize, -(LONG)(Trimmed * PAGE_SIZE));
         }
 
+        /* Give back what the list doesn't need anymore */
+        ShrinkWsList(Vm->VmWorkingSetList);
+
+        /* We're done */
+        Vm->Flags.BeingTrimmed = 0;
+        MiUnlockWorkingSet(PsGetCurrentThread(), Vm);
+
         /* Lock again */
         OldIrql = MiAcquireExpansionLock();
 
@@ -17,7 +17,21 @@
 
 /* GLOBALS ********************************************************************/
 
+#define MI_MAXIMUM_ZERO_PAGE_THREADS 16
+
+typedef struct _MI_ZERO_PAGE_WORKER
+{
+    PMMPTE ZeroingPte;
+    ULONG Processor;
+} MI_ZERO_PAGE_WORKER, *PMI_ZERO_PAGE_WORKER;
+
 KEVENT MmZeroingPageEvent;
+ULONG MmZeroPageThreads;
+MI_ZERO_PAGE_WORKER MiZeroPageWorkers[MI_MAXIMUM_ZERO_PAGE_THREADS];
+
+/* Zeroed list hits and misses in MiRemoveZeroPage, under the PFN lock */
+ULONG MmZeroedPageHits;
+ULONG MmZeroedPageMisses;
 
 /* PRIVATE FUNCTIONS **********************************************************/
 
@@ -31,18 +45,15 @@ NTAPI
 MiFreeInitializationCode(IN PVOID StartVa,
 IN PVOID EndVa);
 
+static
 VOID
-NTAPI
-MmZeroPageThread(VOID)
+MiZeroPageWorker(IN PMI_ZERO_PAGE_WORKER Worker)
 {
     PKTHREAD Thread = KeGetCurrentThread();
-    PVOID StartAddress, EndAddress;
     PVOID WaitObjects[2];
 
-    /* Get the discardable sections to free them */
-    MiFindInitializationCode(&StartAddress, &EndAddress);
-    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
-    DPRINT("Free pages: %lx\n", MmAvailablePages);
+    /* Stay on our processor, our zeroing PTEs are only flushed locally */
+    KeSetSystemAffinityThread(AFFINITY_MASK(Worker->Processor));
 
     /* Set our priority to 0 */
     Thread->BasePriority = 0;
@@ -56,6 +67,7 @@ MmZeroPageThread(VOID)
     {
         KIRQL OldIrql;
 
+        /* All workers wake up together and share the free list */
         KeWaitForMultipleObjects(1, // 2
                                  WaitObjects,
                                  WaitAny,
@@ -101,17 +113,24 @@ MmZeroPageThread(VOID)
                 Pfn1 = Pfn2;
                 PageCount++;
             }
-            MiReleasePfnLock(OldIrql);
 
             if (PageCount == 0)
             {
+                /* Clear the event under the PFN lock, so a page freed
+                   right now can't slip through without a new wakeup */
                 KeClearEvent(&MmZeroingPageEvent);
+                MiReleasePfnLock(OldIrql);
                 break;
             }
+            MiReleasePfnLock(OldIrql);
 
-            ZeroAddress = MiMapPagesInZeroSpace(Pfn1, PageCount);
+            ZeroAddress = MiMapPagesInZeroSpace(Worker->ZeroingPte, Pfn1, PageCount);
             ASSERT(ZeroAddress);
+#ifdef _M_AMD64
+            KeZeroPagesNonTemporal(ZeroAddress, PageCount * PAGE_SIZE);
+#else
             KeZeroPages(ZeroAddress, PageCount * PAGE_SIZE);
+#endif
             MiUnmapPagesInZeroSpace(ZeroAddress, PageCount);
 
             OldIrql = MiAcquirePfnLock();
@@ -126,4 +145,80 @@ MmZeroPageThread(VOID)
     }
 }
 
+static
+VOID
+NTAPI
+MiZeroPageWorkerThread(IN PVOID Context)
+{
+    MiZeroPageWorker(Context);
+}
+
+static
+BOOLEAN
+MiCreateZeroPageWorker(IN ULONG Processor)
+{
+    PMI_ZERO_PAGE_WORKER Worker = &MiZeroPageWorkers[MmZeroPageThreads];
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+
+    /* Every worker maps its pages through its own set of zeroing PTEs */
+    Worker->ZeroingPte = MiReserveSystemPtes(MI_ZERO_PTES + 1, SystemPteSpace);
+    if (!Worker->ZeroingPte) return FALSE;
+    RtlZeroMemory(Worker->ZeroingPte, (MI_ZERO_PTES + 1) * sizeof(MMPTE));
+    Worker->ZeroingPte->u.Hard.PageFrameNumber = MI_ZERO_PTES;
+    Worker->Processor = Processor;
+
+    Status = PsCreateSystemThread(&ThreadHandle,
+                                  THREAD_ALL_ACCESS,
+                                  NULL,
+                                  NULL,
+                                  NULL,
+                                  MiZeroPageWorkerThread,
+                                  Worker);
+    if (!NT_SUCCESS(Status))
+    {
+        MiReleaseSystemPtes(Worker->ZeroingPte, MI_ZERO_PTES + 1, SystemPteSpace);
+        return FALSE;
+    }
+
+    ObCloseHandle(ThreadHandle, KernelMode);
+    MmZeroPageThreads++;
+    return TRUE;
+}
+
+VOID
+NTAPI
+MmZeroPageThread(VOID)
+{
+    PVOID StartAddress, EndAddress;
+    ULONG Processor;
+
+    /* Get the discardable sections to free them */
+    MiFindInitializationCode(&StartAddress, &EndAddress);
+    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
+    DPRINT("Free pages: %lx\n", MmAvailablePages);
+
+    /* We are the worker of the boot processor, using the boot zeroing PTEs */
+    MiZeroPageWorkers[0].ZeroingPte = MiFirstReservedZeroingPte;
+    MiZeroPageWorkers[0].Processor = 0;
+    MmZeroPageThreads = 1;
+
+    /* Give every other processor its own worker, so that the zeroed list
+       refills at the rate the free list grows on large machines */
+    for (Processor = 1;
+         (Processor < (ULONG)KeNumberProcessors) &&
+         (MmZeroPageThreads < MI_MAXIMUM_ZERO_PAGE_THREADS);
+         Processor++)
+    {
+        if (!MiCreateZeroPageWorker(Processor))
+        {
+            DPRINT1("Failed to create the zero page thread for processor %lu\n", Processor);
+            break;
+        }
+    }
+
+    /* Become the first worker */
+    MiZeroPageWorker(&MiZeroPageWorkers[0]);
+}
+
 /* EOF */
@@ -134,13 +134,65 @@ MiTrimMemoryConsumer(ULONG Consumer, ULONG InitialTarget)
     return (InitialTarget > NrFreedPages) ? (InitialTarget - NrFreedPages) : 0;
 }
 
+/* Resets the accessed bit of a segment page in all the views of the segment */
+static
+BOOLEAN
+MiResetSegmentPageAccessed(PFN_NUMBER Page)
+{
+    MM_SEGMENT_VIEW_MAPPING Mappings[MM_SEGMENT_VIEW_BATCH];
+    PMM_SECTION_SEGMENT Segment;
+    LARGE_INTEGER SegmentOffset;
+    KAPC_STATE ApcState;
+    PEPROCESS Process;
+    PVOID Address;
+    BOOLEAN Accessed = FALSE;
+    ULONG Skip = 0, Count, i;
+
+    Segment = MmGetSectionAssociation(Page, &SegmentOffset);
+    if (!Segment)
+        return FALSE;
+
+    do
+    {
+        Count = MmReferenceSegmentViews(Segment, &SegmentOffset, &Skip, Mappings);
+        for (i = 0; i < Count; i++)
+        {
+            Process = Mappings[i].Process;
+            Address = Mappings[i].Address;
+
+            KeStackAttachProcess(&Process->Pcb, &ApcState);
+            MiLockProcessWorkingSet(Process, PsGetCurrentThread());
+
+            /* The view may map a private copy of the page, or nothing yet */
+            if (MmIsAddressValid(Address) && (MmGetPfnForProcess(Process, Address) == Page))
+            {
+                PMMPTE Pte = MiAddressToPte(Address);
+                Accessed = Accessed || Pte->u.Hard.Accessed;
+                Pte->u.Hard.Accessed = 0;
+            }
+
+            MiUnlockProcessWorkingSet(Process, PsGetCurrentThread());
+            KeUnstackDetachProcess(&ApcState);
+
+            ExReleaseRundownProtection(&Process->RundownProtect);
+            ObDereferenceObject(Process);
+        }
+    } while (Count == MM_SEGMENT_VIEW_BATCH);
+
+    MmDereferenceSegment(Segment);
+
+    return Accessed;
+}
+
 NTSTATUS
 MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
 {
     PFN_NUMBER FirstPage, CurrentPage;
+    MM_PAGEOUT_CLUSTER Cluster;
     NTSTATUS Status;
 
     (*NrFreedPages) = 0;
+    Cluster.Count = 0;
 
     DPRINT("MM BALANCER: %s\n", Priority ? "Paging out!" : "Removing access bit!");
 
@@ -148,14 +200,21 @@ MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
     CurrentPage = FirstPage;
     while (CurrentPage != 0 && Target > 0)
     {
+        /* Write out the dirty pages gathered so far once we have enough */
+        if (Cluster.Count == MM_PAGEFILE_CLUSTER_PAGES)
+        {
+            MmFlushPageOutCluster(&Cluster, NrFreedPages);
+        }
+
         if (Priority)
         {
-            Status = MmPageOutPhysicalAddress(CurrentPage);
+            Status = MmPageOutPhysicalAddress(CurrentPage, &Cluster);
             if (NT_SUCCESS(Status))
             {
                 DPRINT("Succeeded\n");
                 Target--;
-                (*NrFreedPages)++;
+                /* Pending pages are accounted for when the cluster is written */
+                if (Status != STATUS_PENDING) (*NrFreedPages)++;
                 if (CurrentPage == FirstPage)
                 {
                     FirstPage = 0;
@@ -244,11 +303,15 @@ MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
                 ObDereferenceObject(Process);
             }
 
+            /* Pages of a segment are not in the rmap list, go through the views instead */
+            if (MiResetSegmentPageAccessed(CurrentPage))
+                Accessed = TRUE;
+
             if (!Accessed)
             {
                 /* Nobody accessed this page since the last time we check. Time to clean up */
 
-                Status = MmPageOutPhysicalAddress(CurrentPage);
+                Status = MmPageOutPhysicalAddress(CurrentPage, &Cluster);
                 if (NT_SUCCESS(Status))
                 {
                     if (CurrentPage == FirstPage)
@@ -271,10 +334,13 @@ MmTrimUserMemory(ULONG Target, ULONG Priority, PULONG NrFreedPages)
         else if (CurrentPage == FirstPage)
         {
             DPRINT1("We are back at the start, abort!\n");
+            MmFlushPageOutCluster(&Cluster, NrFreedPages);
             return STATUS_SUCCESS;
         }
     }
 
+    MmFlushPageOutCluster(&Cluster, NrFreedPages);
+
     if (CurrentPage)
     {
         KIRQL OldIrql = MiAcquirePfnLock();
@@ -377,6 +443,13 @@ MiBalancerThread(PVOID Unused)
             ULONG Target;
             ULONG NrFreedPages;
 
+            /* Give back the cached dead kernel stacks and pages when memory is low */
+            if (MmAvailablePages < MiMinimumAvailablePages)
+            {
+                MmTrimDeadKernelStacks();
+                MmTrimProcessorPageCaches();
+            }
+
             do
             {
                 ULONG OldTarget = InitialTarget;
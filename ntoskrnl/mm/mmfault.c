@@ -109,6 +109,9 @@ MmpAccessFault(KPROCESSOR_MODE Mode,
     }
     while (Status == STATUS_MM_RESTART_OPERATION);
 
+    /* Account the fault to the address space, under its lock */
+    if (NT_SUCCESS(Status) && !FromMdl) AddressSpace->PageFaultCount++;
+
     DPRINT("Completed page fault handling\n");
     if (!FromMdl)
     {
@@ -201,6 +204,9 @@ MmNotPresentFault(KPROCESSOR_MODE Mode,
     }
     while (Status == STATUS_MM_RESTART_OPERATION);
 
+    /* Account the fault to the address space, under its lock */
+    if (NT_SUCCESS(Status) && !FromMdl) AddressSpace->PageFaultCount++;
+
     DPRINT("Completed page fault handling\n");
     if (!FromMdl)
     {
@@ -252,6 +252,8 @@ MmInitSystem(IN ULONG Phase,
     MmInitializeRmapList();
     MmInitSectionImplementation();
     MmInitPagingFile();
+    MmInitializePageStore();
+    MmInitializeLaunchPrefetcher();
 
     //
     // Create a PTE to double-map the shared data section. We allocate it
@@ -295,6 +297,9 @@ MmInitSystem(IN ULONG Phase,
     /* Initialize the balance set manager */
     MmInitBsmThread();
 
+    /* Start the page combining scanner, it idles until enabled */
+    MmInitializePageCombining();
+
     /* Loop the boot loaded images (under lock) */
     ExAcquireResourceExclusiveLite(&PsLoadedModuleResource, TRUE);
     for (ListEntry = PsLoadedModuleList.Flink;
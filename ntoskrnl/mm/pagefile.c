@@ -100,6 +100,23 @@ static PFN_COUNT MiReservedSwapPages;
 /* Make sure there can be only 16 paging files */
 C_ASSERT(FILE_FROM_ENTRY(0xffffffff) < MAX_PAGING_FILES);
 
+/*
+ * Number of clustered writes which may be in flight at once. This bounds
+ * the queue depth we put on the paging device while trimming.
+ */
+#define MI_PAGEFILE_WRITES_IN_FLIGHT  (4)
+
+typedef struct _MI_PAGEFILE_WRITE
+{
+    /* Kept first, so that the MDL is pointer aligned */
+    PFN_NUMBER MdlBase[(sizeof(MDL) / sizeof(PFN_NUMBER)) + MM_PAGEFILE_CLUSTER_PAGES];
+    KEVENT Event;
+    IO_STATUS_BLOCK Iosb;
+    NTSTATUS Status;
+    ULONG First;
+    ULONG Count;
+} MI_PAGEFILE_WRITE, *PMI_PAGEFILE_WRITE;
+
 static BOOLEAN MmSwapSpaceMessage = FALSE;
 
 static BOOLEAN MmSystemPageFileLocated = FALSE;
@@ -142,60 +159,218 @@ MmShowOutOfSpaceMessagePagingFile(VOID)
     }
 }
 
-NTSTATUS
-NTAPI
-MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
+static
+PMMPAGING_FILE
+MiGetPagingFileFromEntry(SWAPENTRY SwapEntry)
 {
-    ULONG i;
-    ULONG_PTR offset;
-    LARGE_INTEGER file_offset;
-    IO_STATUS_BLOCK Iosb;
-    NTSTATUS Status;
-    KEVENT Event;
-    UCHAR MdlBase[sizeof(MDL) + sizeof(PFN_NUMBER)];
-    PMDL Mdl = (PMDL)MdlBase;
-
-    DPRINT("MmWriteToSwapPage\n");
+    PMMPAGING_FILE PagingFile;
 
     if (SwapEntry == 0)
     {
         KeBugCheck(MEMORY_MANAGEMENT);
-        return(STATUS_UNSUCCESSFUL);
+        return NULL;
     }
 
-    i = FILE_FROM_ENTRY(SwapEntry);
-    offset = OFFSET_FROM_ENTRY(SwapEntry) - 1;
-
-    if (MmPagingFile[i]->FileObject == NULL ||
-            MmPagingFile[i]->FileObject->DeviceObject == NULL)
+    PagingFile = MmPagingFile[FILE_FROM_ENTRY(SwapEntry)];
+    if (PagingFile == NULL ||
+        PagingFile->FileObject == NULL ||
+        PagingFile->FileObject->DeviceObject == NULL)
     {
         DPRINT1("Bad paging file 0x%.8X\n", SwapEntry);
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
-    MmBuildMdlFromPages(Mdl, &Page);
-    Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+    return PagingFile;
+}
 
-    file_offset.QuadPart = offset * PAGE_SIZE;
+static
+VOID
+MiWaitForPageFileWrite(PMI_PAGEFILE_WRITE Write,
+                       PULONG Order,
+                       NTSTATUS *Statuses)
+{
+    PMDL Mdl = (PMDL)Write->MdlBase;
+    NTSTATUS Status = Write->Status;
+    ULONG i;
 
-    KeInitializeEvent(&Event, NotificationEvent, FALSE);
-    Status = IoSynchronousPageWrite(MmPagingFile[i]->FileObject,
-                                    Mdl,
-                                    &file_offset,
-                                    &Event,
-                                    &Iosb);
     if (Status == STATUS_PENDING)
     {
-        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
-        Status = Iosb.Status;
+        KeWaitForSingleObject(&Write->Event, Executive, KernelMode, FALSE, NULL);
+        Status = Write->Iosb.Status;
     }
 
     if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
     {
-        MmUnmapLockedPages (Mdl->MappedSystemVa, Mdl);
+        MmUnmapLockedPages(Mdl->MappedSystemVa, Mdl);
     }
-    return(Status);
+
+    /* Every page of the run shares its fate */
+    for (i = 0; i < Write->Count; i++)
+    {
+        Statuses[Order[Write->First + i]] = Status;
+    }
+
+    Write->Count = 0;
+}
+
+/*
+ * Writes a batch of pages to their swap entries on disk. Entries which follow
+ * each other in a paging file are gathered into a single paging I/O, and up
+ * to MI_PAGEFILE_WRITES_IN_FLIGHT of these are kept going at once. The status
+ * of each page is returned in the matching slot of Statuses.
+ */
+VOID
+NTAPI
+MiWriteToPageFile(
+    _In_ ULONG PageCount,
+    _In_reads_(PageCount) SWAPENTRY *SwapEntries,
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _Out_writes_(PageCount) NTSTATUS *Statuses)
+{
+    MI_PAGEFILE_WRITE Writes[MI_PAGEFILE_WRITES_IN_FLIGHT];
+    ULONG Order[MM_PAGEFILE_CLUSTER_PAGES];
+    ULONG i, j, First, Count, Slot;
+    SWAPENTRY Entry, Next;
+    PMMPAGING_FILE PagingFile;
+    LARGE_INTEGER FileOffset;
+    PMI_PAGEFILE_WRITE Write;
+    PPFN_NUMBER MdlPages;
+    PMDL Mdl;
+
+    DPRINT("MiWriteToPageFile(%lu)\n", PageCount);
+
+    ASSERT(PageCount <= MM_PAGEFILE_CLUSTER_PAGES);
+
+    /* Sort the pages by paging file and offset, there are only a few */
+    for (i = 0; i < PageCount; i++)
+    {
+        Entry = SwapEntries[i];
+        for (j = i; j > 0; j--)
+        {
+            Next = SwapEntries[Order[j - 1]];
+            if ((FILE_FROM_ENTRY(Next) < FILE_FROM_ENTRY(Entry)) ||
+                ((FILE_FROM_ENTRY(Next) == FILE_FROM_ENTRY(Entry)) &&
+                 (OFFSET_FROM_ENTRY(Next) < OFFSET_FROM_ENTRY(Entry))))
+            {
+                break;
+            }
+            Order[j] = Order[j - 1];
+        }
+        Order[j] = i;
+    }
+
+    for (Slot = 0; Slot < MI_PAGEFILE_WRITES_IN_FLIGHT; Slot++)
+    {
+        Writes[Slot].Count = 0;
+    }
+
+    /* Issue one write per run of consecutive entries */
+    Slot = 0;
+    for (First = 0; First < PageCount; First += Count)
+    {
+        Entry = SwapEntries[Order[First]];
+        PagingFile = MiGetPagingFileFromEntry(Entry);
+
+        for (Count = 1; First + Count < PageCount; Count++)
+        {
+            Next = SwapEntries[Order[First + Count]];
+            if ((FILE_FROM_ENTRY(Next) != FILE_FROM_ENTRY(Entry)) ||
+                (OFFSET_FROM_ENTRY(Next) != OFFSET_FROM_ENTRY(Entry) + Count))
+            {
+                break;
+            }
+        }
+
+        /* Wait for the oldest write if all of them are busy */
+        Write = &Writes[Slot];
+        Slot = (Slot + 1) % MI_PAGEFILE_WRITES_IN_FLIGHT;
+        if (Write->Count) MiWaitForPageFileWrite(Write, Order, Statuses);
+
+        Mdl = (PMDL)Write->MdlBase;
+        MmInitializeMdl(Mdl, NULL, Count << PAGE_SHIFT);
+        MdlPages = MmGetMdlPfnArray(Mdl);
+        for (i = 0; i < Count; i++)
+        {
+            MdlPages[i] = Pages[Order[First + i]];
+        }
+        Mdl->MdlFlags |= MDL_PAGES_LOCKED;
+
+        FileOffset.QuadPart = (OFFSET_FROM_ENTRY(Entry) - 1) * PAGE_SIZE;
+
+        Write->First = First;
+        Write->Count = Count;
+        KeInitializeEvent(&Write->Event, NotificationEvent, FALSE);
+        Write->Status = IoSynchronousPageWrite(PagingFile->FileObject,
+                                               Mdl,
+                                               &FileOffset,
+                                               &Write->Event,
+                                               &Write->Iosb);
+    }
+
+    /* Wait for the stragglers */
+    for (Slot = 0; Slot < MI_PAGEFILE_WRITES_IN_FLIGHT; Slot++)
+    {
+        if (Writes[Slot].Count) MiWaitForPageFileWrite(&Writes[Slot], Order, Statuses);
+    }
+}
+
+/*
+ * Writes a batch of pages to their swap entries. Pages which compress well
+ * are kept in the compressed store, the others go to the disk.
+ */
+VOID
+NTAPI
+MmWriteToSwapPages(
+    _In_ ULONG PageCount,
+    _In_reads_(PageCount) SWAPENTRY *SwapEntries,
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _Out_writes_(PageCount) NTSTATUS *Statuses)
+{
+    SWAPENTRY DiskEntries[MM_PAGEFILE_CLUSTER_PAGES];
+    PFN_NUMBER DiskPages[MM_PAGEFILE_CLUSTER_PAGES];
+    NTSTATUS DiskStatuses[MM_PAGEFILE_CLUSTER_PAGES];
+    ULONG DiskIndex[MM_PAGEFILE_CLUSTER_PAGES];
+    ULONG i, DiskCount = 0;
+
+    ASSERT(PageCount <= MM_PAGEFILE_CLUSTER_PAGES);
+
+    for (i = 0; i < PageCount; i++)
+    {
+        if (MmStorePage(SwapEntries[i], Pages[i]))
+        {
+            Statuses[i] = STATUS_SUCCESS;
+            continue;
+        }
+
+        DiskEntries[DiskCount] = SwapEntries[i];
+        DiskPages[DiskCount] = Pages[i];
+        DiskIndex[DiskCount] = i;
+        DiskCount++;
+    }
+
+    if (DiskCount)
+    {
+        MiWriteToPageFile(DiskCount, DiskEntries, DiskPages, DiskStatuses);
+        for (i = 0; i < DiskCount; i++)
+        {
+            Statuses[DiskIndex[i]] = DiskStatuses[i];
+        }
+    }
+
+    /* The store spills its oldest pages to the disk when it grows too big */
+    MmTrimPageStore();
+}
+
+NTSTATUS
+NTAPI
+MmWriteToSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
+{
+    NTSTATUS Status;
+
+    DPRINT("MmWriteToSwapPage\n");
+
+    MmWriteToSwapPages(1, &SwapEntry, &Page, &Status);
+    return Status;
 }
 
 
@@ -206,20 +381,98 @@ MmReadFromSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
     return MiReadPageFile(Page, FILE_FROM_ENTRY(SwapEntry), OFFSET_FROM_ENTRY(SwapEntry));
 }
 
+/*
+ * Reads PageCount pages from the swap entry and the ones following it in
+ * the same paging file, in a single paging I/O.
+ */
+NTSTATUS
+NTAPI
+MmReadFromSwapPages(
+    _In_ SWAPENTRY SwapEntry,
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _In_ ULONG PageCount)
+{
+    return MiReadPageFileCluster(Pages,
+                                 PageCount,
+                                 FILE_FROM_ENTRY(SwapEntry),
+                                 OFFSET_FROM_ENTRY(SwapEntry));
+}
+
+/*
+ * Tells whether NextEntry is the slot right after SwapEntry, in which case
+ * both can be read back together.
+ */
+BOOLEAN
+NTAPI
+MmIsNextSwapEntry(
+    _In_ SWAPENTRY SwapEntry,
+    _In_ SWAPENTRY NextEntry)
+{
+    return (FILE_FROM_ENTRY(NextEntry) == FILE_FROM_ENTRY(SwapEntry)) &&
+           (OFFSET_FROM_ENTRY(NextEntry) == OFFSET_FROM_ENTRY(SwapEntry) + 1);
+}
+
 NTSTATUS
 NTAPI
 MiReadPageFile(
     _In_ PFN_NUMBER Page,
     _In_ ULONG PageFileIndex,
     _In_ ULONG_PTR PageFileOffset)
+{
+    return MiReadPageFileCluster(&Page, 1, PageFileIndex, PageFileOffset);
+}
+
+static
+NTSTATUS
+MiReadPageFileRun(
+    _In_ PMMPAGING_FILE PagingFile,
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _In_ ULONG PageCount,
+    _In_ ULONG_PTR PageFileOffset)
 {
     LARGE_INTEGER file_offset;
     IO_STATUS_BLOCK Iosb;
     NTSTATUS Status;
     KEVENT Event;
-    UCHAR MdlBase[sizeof(MDL) + sizeof(PFN_NUMBER)];
+    PFN_NUMBER MdlBase[(sizeof(MDL) / sizeof(PFN_NUMBER)) + MM_PAGEFILE_CLUSTER_PAGES];
     PMDL Mdl = (PMDL)MdlBase;
+
+    MmInitializeMdl(Mdl, NULL, PageCount << PAGE_SHIFT);
+    RtlCopyMemory(MmGetMdlPfnArray(Mdl), Pages, PageCount * sizeof(PFN_NUMBER));
+    Mdl->MdlFlags |= MDL_PAGES_LOCKED | MDL_IO_PAGE_READ;
+
+    file_offset.QuadPart = PageFileOffset * PAGE_SIZE;
+
+    KeInitializeEvent(&Event, NotificationEvent, FALSE);
+    Status = IoPageRead(PagingFile->FileObject,
+                        Mdl,
+                        &file_offset,
+                        &Event,
+                        &Iosb);
+    if (Status == STATUS_PENDING)
+    {
+        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
+        Status = Iosb.Status;
+    }
+    if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
+    {
+        MmUnmapLockedPages (Mdl->MappedSystemVa, Mdl);
+    }
+    return(Status);
+}
+
+NTSTATUS
+NTAPI
+MiReadPageFileCluster(
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _In_ ULONG PageCount,
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset)
+{
+    BOOLEAN Loaded[MM_PAGEFILE_CLUSTER_PAGES];
     PMMPAGING_FILE PagingFile;
+    NTSTATUS Status;
+    ULONG First, Count;
 
     DPRINT("MiReadSwapFile\n");
 
@@ -229,10 +482,8 @@ MiReadPageFile(
         return(STATUS_UNSUCCESSFUL);
     }
 
-    /* Normalize offset. */
-    PageFileOffset--;
-
     ASSERT(PageFileIndex < MAX_PAGING_FILES);
+    ASSERT((PageCount > 0) && (PageCount <= MM_PAGEFILE_CLUSTER_PAGES));
 
     PagingFile = MmPagingFile[PageFileIndex];
 
@@ -242,27 +493,27 @@ MiReadPageFile(
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
-    MmBuildMdlFromPages(Mdl, &Page);
-    Mdl->MdlFlags |= MDL_PAGES_LOCKED | MDL_IO_PAGE_READ;
-
-    file_offset.QuadPart = PageFileOffset * PAGE_SIZE;
-
-    KeInitializeEvent(&Event, NotificationEvent, FALSE);
-    Status = IoPageRead(PagingFile->FileObject,
-                        Mdl,
-                        &file_offset,
-                        &Event,
-                        &Iosb);
-    if (Status == STATUS_PENDING)
+    /* Pages held by the compressed store never made it to the disk */
+    for (First = 0; First < PageCount; First++)
     {
-        KeWaitForSingleObject(&Event, Executive, KernelMode, FALSE, NULL);
-        Status = Iosb.Status;
+        Loaded[First] = MmLoadPageFromStore(ENTRY_FROM_FILE_OFFSET(PageFileIndex,
+                                                                   PageFileOffset + First),
+                                            Pages[First]);
     }
-    if (Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA)
+
+    /* Normalize offset. */
+    PageFileOffset--;
+
+    /* Read the runs of pages which are left */
+    Status = STATUS_SUCCESS;
+    for (First = 0; (First < PageCount) && NT_SUCCESS(Status); First += Count)
     {
-        MmUnmapLockedPages (Mdl->MappedSystemVa, Mdl);
+        for (Count = 1; (First + Count < PageCount) && (Loaded[First + Count] == Loaded[First]); Count++);
+        if (Loaded[First]) continue;
+
+        Status = MiReadPageFileRun(PagingFile, &Pages[First], Count, PageFileOffset + First);
     }
+
     return(Status);
 }
 
@@ -297,6 +548,9 @@ MmFreeSwapPage(SWAPENTRY Entry)
     i = FILE_FROM_ENTRY(Entry);
     off = OFFSET_FROM_ENTRY(Entry) - 1;
 
+    /* Drop any compressed copy first, the slot may be reused right away */
+    MmRemovePageFromStore(Entry);
+
     KeAcquireGuardedMutex(&MmPageFileCreationLock);
 
     PagingFile = MmPagingFile[i];
@@ -305,7 +559,7 @@ MmFreeSwapPage(SWAPENTRY Entry)
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    RtlClearBit(PagingFile->Bitmap, off >> 5);
+    RtlClearBit(PagingFile->Bitmap, (ULONG)off);
 
     PagingFile->FreeSpace++;
     PagingFile->CurrentUsage--;
@@ -338,13 +592,18 @@ MmAllocSwapPage(VOID)
         if (MmPagingFile[i] != NULL &&
                 MmPagingFile[i]->FreeSpace >= 1)
         {
-            off = RtlFindClearBitsAndSet(MmPagingFile[i]->Bitmap, 1, 0);
+            /* Carry on from the last allocation, so that pages written out
+               one after another get consecutive slots and can be clustered */
+            off = RtlFindClearBitsAndSet(MmPagingFile[i]->Bitmap,
+                                         1,
+                                         MmPagingFile[i]->AllocationHint);
             if (off == 0xFFFFFFFF)
             {
                 KeBugCheck(MEMORY_MANAGEMENT);
                 KeReleaseGuardedMutex(&MmPageFileCreationLock);
                 return(STATUS_UNSUCCESSFUL);
             }
+            MmPagingFile[i]->AllocationHint = off + 1;
             MiUsedSwapPages++;
             MiFreeSwapPages--;
             UpdateTotalCommittedPages(1);
@@ -771,6 +1030,7 @@ EarlyQuit:
      */
     PagingFile->FreeSpace = PagingFile->Size - 1;
     PagingFile->CurrentUsage = 0;
+    PagingFile->AllocationHint = 0;
     PagingFile->PageFileName = PageFileName;
     ASSERT(PagingFile->Size == PagingFile->FreeSpace + PagingFile->CurrentUsage + 1);
 
@@ -0,0 +1,385 @@
+/*
+ * PROJECT:     ReactOS Kernel
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Compressed page store in front of the paging files
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+#include "ARM3/miarm.h"
+
+/* GLOBALS *******************************************************************/
+
+/*
+ * Pages on their way to a paging file are compressed with LZNT1 and kept in
+ * non paged pool instead, as long as they shrink enough. They keep their
+ * swap entry, which is both the key of the store and the place where the
+ * page goes when the store gets too big and spills its oldest pages.
+ */
+
+#define MI_PAGE_STORE_BUCKETS           1024
+#define MI_PAGE_STORE_MAXIMUM_SIZE      (PAGE_SIZE * 3 / 4)
+#define MI_PAGE_STORE_FORMAT            (COMPRESSION_FORMAT_LZNT1 | COMPRESSION_ENGINE_STANDARD)
+
+/* The store lives in non paged pool, which the rest of the system needs too */
+#define MI_PAGE_STORE_POOL_FRACTION     8
+
+typedef struct _MI_STORED_PAGE
+{
+    LIST_ENTRY HashLinks;
+    LIST_ENTRY AgeLinks;
+    SWAPENTRY SwapEntry;
+    ULONG Size;
+    BOOLEAN Spilling;
+    UCHAR Data[ANYSIZE_ARRAY];
+} MI_STORED_PAGE, *PMI_STORED_PAGE;
+
+/*
+ * Upper bound of the store, in pages of pool. (ULONG)-1 picks 1/16 of RAM, 0 turns it off.
+ * Either way, it never takes more than 1/8 of the non paged pool.
+ */
+ULONG MmPageStoreMaximumPages = (ULONG)-1;
+
+/* Statistics */
+ULONG MmPageStoreHits;
+ULONG MmPageStoreStores;
+ULONG MmPageStoreRejects;
+ULONG MmPageStoreSpills;
+
+static KGUARDED_MUTEX MiPageStoreLock;
+static LIST_ENTRY MiPageStoreHash[MI_PAGE_STORE_BUCKETS];
+static LIST_ENTRY MiPageStoreAgeList;
+static SIZE_T MiPageStoreBytes;
+static SIZE_T MiPageStoreMaximumBytes;
+static PVOID MiPageStoreWorkSpace;
+static PUCHAR MiPageStoreBuffer;
+static PFN_NUMBER MiPageStoreSpillPage;
+static BOOLEAN MiPageStoreSpilling;
+static KEVENT MiPageStoreSpillEvent;
+
+/* PRIVATE FUNCTIONS *********************************************************/
+
+FORCEINLINE
+PLIST_ENTRY
+MiGetPageStoreBucket(SWAPENTRY SwapEntry)
+{
+    return &MiPageStoreHash[((SwapEntry >> 11) ^ SwapEntry) & (MI_PAGE_STORE_BUCKETS - 1)];
+}
+
+static
+PMI_STORED_PAGE
+MiLookupStoredPage(SWAPENTRY SwapEntry)
+{
+    PLIST_ENTRY Bucket, NextEntry;
+    PMI_STORED_PAGE StoredPage;
+
+    Bucket = MiGetPageStoreBucket(SwapEntry);
+    for (NextEntry = Bucket->Flink; NextEntry != Bucket; NextEntry = NextEntry->Flink)
+    {
+        StoredPage = CONTAINING_RECORD(NextEntry, MI_STORED_PAGE, HashLinks);
+        if (StoredPage->SwapEntry == SwapEntry) return StoredPage;
+    }
+
+    return NULL;
+}
+
+static
+VOID
+MiFreeStoredPage(PMI_STORED_PAGE StoredPage)
+{
+    RemoveEntryList(&StoredPage->HashLinks);
+    if (!StoredPage->Spilling) RemoveEntryList(&StoredPage->AgeLinks);
+    MiPageStoreBytes -= FIELD_OFFSET(MI_STORED_PAGE, Data[StoredPage->Size]);
+    ExFreePoolWithTag(StoredPage, TAG_MM_PAGE_STORE);
+}
+
+static
+BOOLEAN
+MiDecompressStoredPage(PMI_STORED_PAGE StoredPage, PFN_NUMBER Page)
+{
+    PEPROCESS Process = PsGetCurrentProcess();
+    ULONG FinalSize;
+    NTSTATUS Status;
+    PVOID Address;
+    KIRQL Irql;
+
+    Address = MiMapPageInHyperSpace(Process, Page, &Irql);
+    Status = RtlDecompressBuffer(COMPRESSION_FORMAT_LZNT1,
+                                 Address,
+                                 PAGE_SIZE,
+                                 StoredPage->Data,
+                                 StoredPage->Size,
+                                 &FinalSize);
+    MiUnmapPageInHyperSpace(Process, Address, Irql);
+
+    return NT_SUCCESS(Status) && (FinalSize == PAGE_SIZE);
+}
+
+/*
+ * Waits for the spill in progress to be over. Called and returns with the
+ * store lock held.
+ */
+static
+VOID
+MiWaitForPageStoreSpill(VOID)
+{
+    while (MiPageStoreSpilling)
+    {
+        KeReleaseGuardedMutex(&MiPageStoreLock);
+        KeWaitForSingleObject(&MiPageStoreSpillEvent, Executive, KernelMode, FALSE, NULL);
+        KeAcquireGuardedMutex(&MiPageStoreLock);
+    }
+}
+
+/* PUBLIC FUNCTIONS **********************************************************/
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+MmInitializePageStore(VOID)
+{
+    ULONG WorkSpaceSize, FragmentWorkSpaceSize, i;
+
+    KeInitializeGuardedMutex(&MiPageStoreLock);
+    KeInitializeEvent(&MiPageStoreSpillEvent, NotificationEvent, TRUE);
+    InitializeListHead(&MiPageStoreAgeList);
+    for (i = 0; i < MI_PAGE_STORE_BUCKETS; i++)
+    {
+        InitializeListHead(&MiPageStoreHash[i]);
+    }
+
+    /* Size the store */
+    if (MmPageStoreMaximumPages == (ULONG)-1)
+    {
+        MmPageStoreMaximumPages = (ULONG)(MmNumberOfPhysicalPages / 16);
+    }
+    MmPageStoreMaximumPages = (ULONG)min(MmPageStoreMaximumPages,
+                                         BYTES_TO_PAGES(MmMaximumNonPagedPoolInBytes / MI_PAGE_STORE_POOL_FRACTION));
+    if (MmPageStoreMaximumPages == 0) return;
+    MiPageStoreMaximumBytes = (SIZE_T)MmPageStoreMaximumPages << PAGE_SHIFT;
+
+    /* Get what the compressor needs, and a page to spill through */
+    if (!NT_SUCCESS(RtlGetCompressionWorkSpaceSize(MI_PAGE_STORE_FORMAT,
+                                                   &WorkSpaceSize,
+                                                   &FragmentWorkSpaceSize)))
+    {
+        MiPageStoreMaximumBytes = 0;
+        return;
+    }
+
+    MiPageStoreWorkSpace = ExAllocatePoolWithTag(NonPagedPool, WorkSpaceSize, TAG_MM_PAGE_STORE);
+    MiPageStoreBuffer = ExAllocatePoolWithTag(NonPagedPool, MI_PAGE_STORE_MAXIMUM_SIZE, TAG_MM_PAGE_STORE);
+    if (!MiPageStoreWorkSpace ||
+        !MiPageStoreBuffer ||
+        !NT_SUCCESS(MmRequestPageMemoryConsumer(MC_SYSTEM, TRUE, &MiPageStoreSpillPage)))
+    {
+        /* The store is an optimization, we can live without it */
+        DPRINT1("Failed to set up the compressed page store\n");
+        if (MiPageStoreWorkSpace) ExFreePoolWithTag(MiPageStoreWorkSpace, TAG_MM_PAGE_STORE);
+        if (MiPageStoreBuffer) ExFreePoolWithTag(MiPageStoreBuffer, TAG_MM_PAGE_STORE);
+        MiPageStoreMaximumBytes = 0;
+        return;
+    }
+
+    DPRINT("Compressed page store: up to %lu pages\n", MmPageStoreMaximumPages);
+}
+
+/*
+ * Tries to keep the page in the store rather than writing it to its swap
+ * entry. Returns FALSE if the page has to be written out.
+ */
+BOOLEAN
+NTAPI
+MmStorePage(
+    _In_ SWAPENTRY SwapEntry,
+    _In_ PFN_NUMBER Page)
+{
+    PEPROCESS Process = PsGetCurrentProcess();
+    PMI_STORED_PAGE StoredPage;
+    ULONG Size;
+    NTSTATUS Status;
+    PVOID Address;
+    KIRQL Irql;
+
+    if (!MiPageStoreMaximumBytes) return FALSE;
+
+    KeAcquireGuardedMutex(&MiPageStoreLock);
+
+    /* Don't let a spill put an older copy of this slot on the disk after us */
+    StoredPage = MiLookupStoredPage(SwapEntry);
+    if (StoredPage && StoredPage->Spilling)
+    {
+        MiWaitForPageStoreSpill();
+        StoredPage = MiLookupStoredPage(SwapEntry);
+    }
+
+    /* Any older copy is stale now */
+    if (StoredPage) MiFreeStoredPage(StoredPage);
+
+    /* Compress it, pages which don't shrink enough aren't worth keeping */
+    Address = MiMapPageInHyperSpace(Process, Page, &Irql);
+    Status = RtlCompressBuffer(MI_PAGE_STORE_FORMAT,
+                               Address,
+                               PAGE_SIZE,
+                               MiPageStoreBuffer,
+                               MI_PAGE_STORE_MAXIMUM_SIZE,
+                               PAGE_SIZE,
+                               &Size,
+                               MiPageStoreWorkSpace);
+    MiUnmapPageInHyperSpace(Process, Address, Irql);
+    if (!NT_SUCCESS(Status))
+    {
+        MmPageStoreRejects++;
+        KeReleaseGuardedMutex(&MiPageStoreLock);
+        return FALSE;
+    }
+
+    StoredPage = ExAllocatePoolWithTag(NonPagedPool,
+                                       FIELD_OFFSET(MI_STORED_PAGE, Data[Size]),
+                                       TAG_MM_PAGE_STORE);
+    if (!StoredPage)
+    {
+        KeReleaseGuardedMutex(&MiPageStoreLock);
+        return FALSE;
+    }
+
+    StoredPage->SwapEntry = SwapEntry;
+    StoredPage->Size = Size;
+    StoredPage->Spilling = FALSE;
+    RtlCopyMemory(StoredPage->Data, MiPageStoreBuffer, Size);
+
+    /* Newest pages go at the tail, spills are taken from the head */
+    InsertTailList(MiGetPageStoreBucket(SwapEntry), &StoredPage->HashLinks);
+    InsertTailList(&MiPageStoreAgeList, &StoredPage->AgeLinks);
+    MiPageStoreBytes += FIELD_OFFSET(MI_STORED_PAGE, Data[Size]);
+    MmPageStoreStores++;
+
+    KeReleaseGuardedMutex(&MiPageStoreLock);
+    return TRUE;
+}
+
+/*
+ * Fills the page from the store if it holds the given swap entry. Returns
+ * FALSE if it has to be read from the disk.
+ */
+BOOLEAN
+NTAPI
+MmLoadPageFromStore(
+    _In_ SWAPENTRY SwapEntry,
+    _In_ PFN_NUMBER Page)
+{
+    PMI_STORED_PAGE StoredPage;
+    BOOLEAN Loaded = FALSE;
+
+    if (!MiPageStoreMaximumBytes) return FALSE;
+
+    KeAcquireGuardedMutex(&MiPageStoreLock);
+
+    /* A page being spilled is still good to read from */
+    StoredPage = MiLookupStoredPage(SwapEntry);
+    if (StoredPage)
+    {
+        Loaded = MiDecompressStoredPage(StoredPage, Page);
+        ASSERT(Loaded);
+        if (Loaded) MmPageStoreHits++;
+    }
+
+    KeReleaseGuardedMutex(&MiPageStoreLock);
+    return Loaded;
+}
+
+/*
+ * Forgets about the swap entry, which is being freed.
+ */
+VOID
+NTAPI
+MmRemovePageFromStore(
+    _In_ SWAPENTRY SwapEntry)
+{
+    PMI_STORED_PAGE StoredPage;
+
+    if (!MiPageStoreMaximumBytes) return;
+
+    KeAcquireGuardedMutex(&MiPageStoreLock);
+
+    /* The slot must not be handed out again while a spill is writing to it */
+    StoredPage = MiLookupStoredPage(SwapEntry);
+    if (StoredPage && StoredPage->Spilling)
+    {
+        MiWaitForPageStoreSpill();
+        StoredPage = MiLookupStoredPage(SwapEntry);
+    }
+
+    if (StoredPage) MiFreeStoredPage(StoredPage);
+
+    KeReleaseGuardedMutex(&MiPageStoreLock);
+}
+
+/*
+ * Spills the oldest pages of the store to their swap entries, until it is
+ * back under its limit. Only one thread spills at a time, and the pages are
+ * written synchronously, one at a time, through the single spill page.
+ */
+VOID
+NTAPI
+MmTrimPageStore(VOID)
+{
+    PMI_STORED_PAGE StoredPage;
+    SWAPENTRY SwapEntry;
+    NTSTATUS Status;
+
+    if (!MiPageStoreMaximumBytes) return;
+
+    KeAcquireGuardedMutex(&MiPageStoreLock);
+
+    while ((MiPageStoreBytes > MiPageStoreMaximumBytes) &&
+           !IsListEmpty(&MiPageStoreAgeList) &&
+           !MiPageStoreSpilling)
+    {
+        /* Take the oldest page, it stays in the hash so it can still be read */
+        StoredPage = CONTAINING_RECORD(RemoveHeadList(&MiPageStoreAgeList),
+                                       MI_STORED_PAGE,
+                                       AgeLinks);
+        StoredPage->Spilling = TRUE;
+        MiPageStoreSpilling = TRUE;
+        KeClearEvent(&MiPageStoreSpillEvent);
+
+        if (!MiDecompressStoredPage(StoredPage, MiPageStoreSpillPage))
+        {
+            KeBugCheck(MEMORY_MANAGEMENT);
+        }
+        SwapEntry = StoredPage->SwapEntry;
+
+        /* Write it without the lock, nobody else touches the spill page */
+        KeReleaseGuardedMutex(&MiPageStoreLock);
+        MiWriteToPageFile(1, &SwapEntry, &MiPageStoreSpillPage, &Status);
+        KeAcquireGuardedMutex(&MiPageStoreLock);
+
+        /* Nobody could free it meanwhile, they wait for us */
+        ASSERT(MiLookupStoredPage(SwapEntry) == StoredPage);
+        if (NT_SUCCESS(Status))
+        {
+            MiFreeStoredPage(StoredPage);
+            MmPageStoreSpills++;
+        }
+        else
+        {
+            /* Keep it, as the newest page so we don't retry it right away */
+            DPRINT1("Failed to spill a compressed page: 0x%lx\n", Status);
+            StoredPage->Spilling = FALSE;
+            InsertTailList(&MiPageStoreAgeList, &StoredPage->AgeLinks);
+        }
+
+        MiPageStoreSpilling = FALSE;
+        KeSetEvent(&MiPageStoreSpillEvent, IO_NO_INCREMENT, FALSE);
+        if (!NT_SUCCESS(Status)) break;
+    }
+
+    KeReleaseGuardedMutex(&MiPageStoreLock);
+}
+
+/* EOF */
@@ -0,0 +1,777 @@
+/*
+ * PROJECT:     ReactOS Kernel
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Application launch prefetcher
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <ntoskrnl.h>
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS *******************************************************************/
+
+/*
+ * For the first seconds of a process, every page it faults in from a file
+ * section is recorded. The trace is then sorted, merged into runs and saved
+ * under \SystemRoot\Prefetch, keyed by the image path. When the same image
+ * is launched again, a worker thread reads those runs into the section
+ * segments ahead of the faults, in file order and in large chunks.
+ */
+
+#define MI_LAUNCH_TRACE_SIGNATURE       'FPSR'
+#define MI_LAUNCH_TRACE_VERSION         1
+#define MI_LAUNCH_TRACE_SECONDS         10
+#define MI_LAUNCH_TRACE_FILES           64
+#define MI_LAUNCH_TRACE_PAGES           2048
+#define MI_LAUNCH_TRACE_MAXIMUM_SIZE    (256 * 1024)
+#define MI_LAUNCH_TRACE_DIRECTORY       L"\\SystemRoot\\Prefetch"
+
+/* Flags of a trace page or run */
+#define MI_LAUNCH_TRACE_IMAGE           0x1
+
+/* EnablePrefetcher values, same as Windows. Only the launch prefetcher exists */
+#define MI_PREFETCH_APPLICATION_LAUNCH  0x1
+
+/*
+ * Image segments don't have to start on a page boundary in the file, so the
+ * pages are recorded by their byte offset, which is what MmPrefetchFilePages
+ * takes back.
+ */
+typedef struct _MI_LAUNCH_TRACE_PAGE
+{
+    USHORT FileIndex;
+    USHORT Flags;
+    ULONGLONG FileOffset;
+} MI_LAUNCH_TRACE_PAGE, *PMI_LAUNCH_TRACE_PAGE;
+
+typedef struct _MI_LAUNCH_TRACE
+{
+    LIST_ENTRY Links;
+    PEPROCESS Process;
+    ULONGLONG EndTime;
+    UNICODE_STRING TraceName;
+    WCHAR TraceNameBuffer[80];
+    ULONG NumberOfFiles;
+    PFILE_OBJECT Files[MI_LAUNCH_TRACE_FILES];
+    ULONG NumberOfPages;
+    MI_LAUNCH_TRACE_PAGE Pages[MI_LAUNCH_TRACE_PAGES];
+} MI_LAUNCH_TRACE, *PMI_LAUNCH_TRACE;
+
+typedef struct _MI_LAUNCH_REPLAY
+{
+    WORK_QUEUE_ITEM WorkItem;
+    UNICODE_STRING TraceName;
+    WCHAR TraceNameBuffer[80];
+} MI_LAUNCH_REPLAY, *PMI_LAUNCH_REPLAY;
+
+/*
+ * On disk layout: the header, the runs sorted by file and offset, then the
+ * NT path of each file as a USHORT byte count followed by the characters.
+ */
+typedef struct _MI_LAUNCH_TRACE_HEADER
+{
+    ULONG Signature;
+    ULONG Version;
+    ULONG Size;
+    ULONG NumberOfFiles;
+    ULONG NumberOfRuns;
+} MI_LAUNCH_TRACE_HEADER, *PMI_LAUNCH_TRACE_HEADER;
+
+typedef struct _MI_LAUNCH_TRACE_RUN
+{
+    USHORT FileIndex;
+    USHORT Flags;
+    ULONG PageCount;
+    ULONGLONG FileOffset;
+} MI_LAUNCH_TRACE_RUN, *PMI_LAUNCH_TRACE_RUN;
+
+ULONG MmEnablePrefetcher = MI_PREFETCH_APPLICATION_LAUNCH;
+
+/* Statistics */
+ULONG MmLaunchTracesSaved;
+ULONG MmLaunchPrefetchPages;
+
+/*
+ * The traces are paged, so they are only touched under the guarded mutex.
+ * A timer wakes up the worker at the end of the oldest trace; the worker
+ * also saves the traces that ended because of a fault or of an exit.
+ */
+static KGUARDED_MUTEX MiLaunchTraceLock;
+static LIST_ENTRY MiLaunchTraceListHead;
+static LIST_ENTRY MiLaunchTraceSaveListHead;
+static volatile LONG MiActiveLaunchTraces;
+static KTIMER MiLaunchTraceTimer;
+static KDPC MiLaunchTraceDpc;
+static WORK_QUEUE_ITEM MiLaunchTraceWorkItem;
+static volatile LONG MiLaunchTraceWorkQueued;
+
+/* PRIVATE FUNCTIONS *********************************************************/
+
+static
+int
+__cdecl
+MiCompareLaunchTracePages(const void *First, const void *Second)
+{
+    const MI_LAUNCH_TRACE_PAGE *A = First, *B = Second;
+
+    /* Order by file, then by offset, so that runs come out in file order */
+    if (A->FileIndex != B->FileIndex) return (int)A->FileIndex - (int)B->FileIndex;
+    if (A->FileOffset != B->FileOffset) return (A->FileOffset < B->FileOffset) ? -1 : 1;
+    return (int)A->Flags - (int)B->Flags;
+}
+
+static
+PMI_LAUNCH_TRACE
+MiFindLaunchTrace(PEPROCESS Process)
+{
+    PLIST_ENTRY NextEntry;
+    PMI_LAUNCH_TRACE Trace;
+
+    for (NextEntry = MiLaunchTraceListHead.Flink;
+         NextEntry != &MiLaunchTraceListHead;
+         NextEntry = NextEntry->Flink)
+    {
+        Trace = CONTAINING_RECORD(NextEntry, MI_LAUNCH_TRACE, Links);
+        if (Trace->Process == Process) return Trace;
+    }
+
+    return NULL;
+}
+
+static
+NTSTATUS
+MiWriteLaunchTrace(
+    _In_ PUNICODE_STRING TraceName,
+    _In_reads_bytes_(Size) PVOID Buffer,
+    _In_ ULONG Size)
+{
+    UNICODE_STRING DirectoryName = RTL_CONSTANT_STRING(MI_LAUNCH_TRACE_DIRECTORY);
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+    HANDLE Handle;
+    NTSTATUS Status;
+
+    /* Make sure the directory is there */
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &DirectoryName,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    Status = ZwCreateFile(&Handle,
+                          FILE_LIST_DIRECTORY | SYNCHRONIZE,
+                          &ObjectAttributes,
+                          &IoStatusBlock,
+                          NULL,
+                          FILE_ATTRIBUTE_NORMAL,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE,
+                          FILE_OPEN_IF,
+                          FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+                          NULL,
+                          0);
+    if (!NT_SUCCESS(Status)) return Status;
+    ZwClose(Handle);
+
+    /* And replace the old trace */
+    InitializeObjectAttributes(&ObjectAttributes,
+                               TraceName,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    Status = ZwCreateFile(&Handle,
+                          FILE_WRITE_DATA | SYNCHRONIZE,
+                          &ObjectAttributes,
+                          &IoStatusBlock,
+                          NULL,
+                          FILE_ATTRIBUTE_NORMAL,
+                          0,
+                          FILE_OVERWRITE_IF,
+                          FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+                          NULL,
+                          0);
+    if (!NT_SUCCESS(Status)) return Status;
+
+    Status = ZwWriteFile(Handle, NULL, NULL, NULL, &IoStatusBlock, Buffer, Size, NULL, NULL);
+    ZwClose(Handle);
+    return Status;
+}
+
+static
+VOID
+MiSaveLaunchTrace(PMI_LAUNCH_TRACE Trace)
+{
+    POBJECT_NAME_INFORMATION Names[MI_LAUNCH_TRACE_FILES] = { NULL };
+    PMI_LAUNCH_TRACE_HEADER Header;
+    PMI_LAUNCH_TRACE_RUN Run;
+    PMI_LAUNCH_TRACE_PAGE Page;
+    PUCHAR Buffer, NameCursor;
+    ULONGLONG LastOffset;
+    ULONG i, ReturnLength, NamesSize = 0, NumberOfRuns = 0, Size;
+    USHORT NameLength;
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    /* Get the full NT path of each file, we'll open them by name on replay */
+    for (i = 0; i < Trace->NumberOfFiles; i++)
+    {
+        Names[i] = ExAllocatePoolWithTag(PagedPool, 1024, TAG_MM_PREFETCH);
+        if (Names[i])
+        {
+            Status = ObQueryNameString(Trace->Files[i], Names[i], 1024, &ReturnLength);
+            if (!NT_SUCCESS(Status)) Names[i]->Name.Length = 0;
+            NamesSize += sizeof(USHORT) + Names[i]->Name.Length;
+        }
+        else
+        {
+            NamesSize += sizeof(USHORT);
+        }
+    }
+
+    /* Sort the pages, so that they can be merged into runs */
+    qsort(Trace->Pages, Trace->NumberOfPages, sizeof(MI_LAUNCH_TRACE_PAGE), MiCompareLaunchTracePages);
+
+    Size = sizeof(MI_LAUNCH_TRACE_HEADER) + Trace->NumberOfPages * sizeof(MI_LAUNCH_TRACE_RUN) + NamesSize;
+    Buffer = ExAllocatePoolWithTag(PagedPool, Size, TAG_MM_PREFETCH);
+    if (!Buffer) goto Cleanup;
+
+    Header = (PMI_LAUNCH_TRACE_HEADER)Buffer;
+    Run = (PMI_LAUNCH_TRACE_RUN)(Header + 1);
+    for (i = 0; i < Trace->NumberOfPages; i++)
+    {
+        Page = &Trace->Pages[i];
+
+        /* Leave out the files we couldn't name */
+        if (!(Names[Page->FileIndex]) || !(Names[Page->FileIndex]->Name.Length)) continue;
+
+        if ((NumberOfRuns) &&
+            (Run[-1].FileIndex == Page->FileIndex) &&
+            (Run[-1].Flags == Page->Flags))
+        {
+            LastOffset = Run[-1].FileOffset + ((ULONGLONG)(Run[-1].PageCount - 1) << PAGE_SHIFT);
+
+            /* Same page faulted twice */
+            if (Page->FileOffset == LastOffset) continue;
+
+            /*
+             * Next page, grow the run. Pages of two image segments may overlap
+             * in the file, those start a run of their own.
+             */
+            if (Page->FileOffset == LastOffset + PAGE_SIZE)
+            {
+                Run[-1].PageCount++;
+                continue;
+            }
+        }
+
+        Run->FileIndex = Page->FileIndex;
+        Run->Flags = Page->Flags;
+        Run->FileOffset = Page->FileOffset;
+        Run->PageCount = 1;
+        Run++;
+        NumberOfRuns++;
+    }
+
+    /* The names go right after the runs */
+    NameCursor = (PUCHAR)Run;
+    for (i = 0; i < Trace->NumberOfFiles; i++)
+    {
+        NameLength = Names[i] ? Names[i]->Name.Length : 0;
+        RtlCopyMemory(NameCursor, &NameLength, sizeof(USHORT));
+        NameCursor += sizeof(USHORT);
+        if (NameLength) RtlCopyMemory(NameCursor, Names[i]->Name.Buffer, NameLength);
+        NameCursor += NameLength;
+    }
+
+    Header->Signature = MI_LAUNCH_TRACE_SIGNATURE;
+    Header->Version = MI_LAUNCH_TRACE_VERSION;
+    Header->Size = (ULONG)(NameCursor - Buffer);
+    Header->NumberOfFiles = Trace->NumberOfFiles;
+    Header->NumberOfRuns = NumberOfRuns;
+
+    if (NumberOfRuns)
+    {
+        Status = MiWriteLaunchTrace(&Trace->TraceName, Buffer, Header->Size);
+        if (NT_SUCCESS(Status))
+        {
+            InterlockedIncrement((PLONG)&MmLaunchTracesSaved);
+        }
+        else
+        {
+            DPRINT("Failed to save launch trace %wZ: 0x%lx\n", &Trace->TraceName, Status);
+        }
+    }
+
+    ExFreePoolWithTag(Buffer, TAG_MM_PREFETCH);
+
+Cleanup:
+    for (i = 0; i < Trace->NumberOfFiles; i++)
+    {
+        if (Names[i]) ExFreePoolWithTag(Names[i], TAG_MM_PREFETCH);
+        ObDereferenceObject(Trace->Files[i]);
+    }
+
+    ExFreePoolWithTag(Trace, TAG_MM_PREFETCH);
+}
+
+static
+VOID
+MiQueueLaunchTraceWork(VOID)
+{
+    /* Once is enough, the worker picks up everything that is pending */
+    if (!InterlockedExchange(&MiLaunchTraceWorkQueued, 1))
+    {
+        ExQueueWorkItem(&MiLaunchTraceWorkItem, DelayedWorkQueue);
+    }
+}
+
+static
+VOID
+MiFinishLaunchTrace(PMI_LAUNCH_TRACE Trace)
+{
+    /* Move it to the save list, the worker saves it. We may be deep in a page fault */
+    RemoveEntryList(&Trace->Links);
+    InsertTailList(&MiLaunchTraceSaveListHead, &Trace->Links);
+    InterlockedDecrement(&MiActiveLaunchTraces);
+}
+
+static
+VOID
+NTAPI
+MiLaunchTraceDpcRoutine(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(DeferredContext);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    /* The traces are paged, end them from a worker thread */
+    MiQueueLaunchTraceWork();
+}
+
+static
+VOID
+NTAPI
+MiLaunchTraceWorker(PVOID Context)
+{
+    PLIST_ENTRY NextEntry;
+    PMI_LAUNCH_TRACE Trace;
+    LIST_ENTRY SaveListHead;
+    ULONGLONG CurrentTime, NextEndTime = MAXULONGLONG;
+    LARGE_INTEGER DueTime;
+
+    UNREFERENCED_PARAMETER(Context);
+    PAGED_CODE();
+
+    /* Anything that ends from now on needs another pass */
+    InterlockedExchange(&MiLaunchTraceWorkQueued, 0);
+
+    KeAcquireGuardedMutex(&MiLaunchTraceLock);
+
+    /* End the traces that ran out of time, so that they don't keep their files referenced */
+    CurrentTime = KeQueryInterruptTime();
+    NextEntry = MiLaunchTraceListHead.Flink;
+    while (NextEntry != &MiLaunchTraceListHead)
+    {
+        Trace = CONTAINING_RECORD(NextEntry, MI_LAUNCH_TRACE, Links);
+        NextEntry = NextEntry->Flink;
+
+        if (CurrentTime >= Trace->EndTime)
+            MiFinishLaunchTrace(Trace);
+        else
+            NextEndTime = min(NextEndTime, Trace->EndTime);
+    }
+
+    /* And come back for the next one */
+    if (NextEndTime != MAXULONGLONG)
+    {
+        DueTime.QuadPart = -(LONGLONG)(NextEndTime - CurrentTime);
+        KeSetTimer(&MiLaunchTraceTimer, DueTime, &MiLaunchTraceDpc);
+    }
+    else
+    {
+        KeCancelTimer(&MiLaunchTraceTimer);
+    }
+
+    /* Take the ended traces */
+    if (IsListEmpty(&MiLaunchTraceSaveListHead))
+    {
+        InitializeListHead(&SaveListHead);
+    }
+    else
+    {
+        SaveListHead = MiLaunchTraceSaveListHead;
+        SaveListHead.Flink->Blink = &SaveListHead;
+        SaveListHead.Blink->Flink = &SaveListHead;
+        InitializeListHead(&MiLaunchTraceSaveListHead);
+    }
+
+    KeReleaseGuardedMutex(&MiLaunchTraceLock);
+
+    /* And save them without holding up the page faults */
+    while (!IsListEmpty(&SaveListHead))
+    {
+        NextEntry = RemoveHeadList(&SaveListHead);
+        MiSaveLaunchTrace(CONTAINING_RECORD(NextEntry, MI_LAUNCH_TRACE, Links));
+    }
+}
+
+static
+HANDLE
+MiOpenLaunchTraceFile(
+    _In_reads_bytes_(NameLength) PWCHAR Name,
+    _In_ USHORT NameLength)
+{
+    UNICODE_STRING FileName;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+    HANDLE Handle;
+    NTSTATUS Status;
+
+    FileName.Buffer = Name;
+    FileName.Length = FileName.MaximumLength = NameLength;
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &FileName,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+
+    /* Don't get in the way of anybody */
+    Status = ZwOpenFile(&Handle,
+                        FILE_READ_DATA | SYNCHRONIZE,
+                        &ObjectAttributes,
+                        &IoStatusBlock,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    return NT_SUCCESS(Status) ? Handle : NULL;
+}
+
+static
+VOID
+NTAPI
+MiReplayLaunchTrace(PVOID Context)
+{
+    PMI_LAUNCH_REPLAY Replay = Context;
+    PWCHAR FileNames[MI_LAUNCH_TRACE_FILES];
+    USHORT FileNameLengths[MI_LAUNCH_TRACE_FILES];
+    FILE_STANDARD_INFORMATION StandardInformation;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+    PMI_LAUNCH_TRACE_HEADER Header;
+    PMI_LAUNCH_TRACE_RUN Runs;
+    PFILE_OBJECT FileObject = NULL;
+    HANDLE Handle, FileHandle = NULL;
+    PUCHAR Buffer = NULL, Cursor, End;
+    ULONG i, CurrentFile = MAXULONG;
+    USHORT NameLength;
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    /* Read the trace in one go */
+    InitializeObjectAttributes(&ObjectAttributes,
+                               &Replay->TraceName,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL,
+                               NULL);
+    Status = ZwOpenFile(&Handle,
+                        FILE_READ_DATA | SYNCHRONIZE,
+                        &ObjectAttributes,
+                        &IoStatusBlock,
+                        FILE_SHARE_READ,
+                        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    if (!NT_SUCCESS(Status)) goto Cleanup;
+
+    Status = ZwQueryInformationFile(Handle,
+                                    &IoStatusBlock,
+                                    &StandardInformation,
+                                    sizeof(StandardInformation),
+                                    FileStandardInformation);
+    if ((NT_SUCCESS(Status)) &&
+        ((StandardInformation.EndOfFile.QuadPart < sizeof(MI_LAUNCH_TRACE_HEADER)) ||
+         (StandardInformation.EndOfFile.QuadPart > MI_LAUNCH_TRACE_MAXIMUM_SIZE)))
+    {
+        Status = STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        Buffer = ExAllocatePoolWithTag(PagedPool, StandardInformation.EndOfFile.LowPart, TAG_MM_PREFETCH);
+        if (!Buffer) Status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        Status = ZwReadFile(Handle,
+                            NULL,
+                            NULL,
+                            NULL,
+                            &IoStatusBlock,
+                            Buffer,
+                            StandardInformation.EndOfFile.LowPart,
+                            NULL,
+                            NULL);
+    }
+
+    ZwClose(Handle);
+    if (!NT_SUCCESS(Status)) goto Cleanup;
+
+    /* Don't trust anything in there */
+    Header = (PMI_LAUNCH_TRACE_HEADER)Buffer;
+    End = Buffer + StandardInformation.EndOfFile.LowPart;
+    if ((Header->Signature != MI_LAUNCH_TRACE_SIGNATURE) ||
+        (Header->Version != MI_LAUNCH_TRACE_VERSION) ||
+        (Header->Size != StandardInformation.EndOfFile.LowPart) ||
+        (Header->NumberOfFiles > MI_LAUNCH_TRACE_FILES) ||
+        (Header->NumberOfRuns > MI_LAUNCH_TRACE_PAGES))
+    {
+        goto Cleanup;
+    }
+
+    Runs = (PMI_LAUNCH_TRACE_RUN)(Header + 1);
+    Cursor = (PUCHAR)&Runs[Header->NumberOfRuns];
+    if (Cursor > End) goto Cleanup;
+    for (i = 0; i < Header->NumberOfFiles; i++)
+    {
+        if (Cursor + sizeof(USHORT) > End) goto Cleanup;
+        RtlCopyMemory(&NameLength, Cursor, sizeof(USHORT));
+        Cursor += sizeof(USHORT);
+        if ((NameLength & 1) || (Cursor + NameLength > End)) goto Cleanup;
+
+        FileNames[i] = (PWCHAR)Cursor;
+        FileNameLengths[i] = NameLength;
+        Cursor += NameLength;
+    }
+
+    /* Now read the runs ahead of the process, they are sorted by file */
+    for (i = 0; i < Header->NumberOfRuns; i++)
+    {
+        if ((Runs[i].FileIndex >= Header->NumberOfFiles) ||
+            (Runs[i].PageCount > MI_LAUNCH_TRACE_PAGES))
+        {
+            break;
+        }
+
+        if (Runs[i].FileIndex != CurrentFile)
+        {
+            /* Done with the previous file */
+            if (FileObject) ObDereferenceObject(FileObject);
+            if (FileHandle) ZwClose(FileHandle);
+            FileObject = NULL;
+            CurrentFile = Runs[i].FileIndex;
+
+            FileHandle = MiOpenLaunchTraceFile(FileNames[CurrentFile], FileNameLengths[CurrentFile]);
+            if (!FileHandle) continue;
+
+            Status = ObReferenceObjectByHandle(FileHandle,
+                                               FILE_READ_DATA,
+                                               *IoFileObjectType,
+                                               KernelMode,
+                                               (PVOID*)&FileObject,
+                                               NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                ZwClose(FileHandle);
+                FileHandle = NULL;
+                FileObject = NULL;
+                continue;
+            }
+        }
+
+        /* The file may be gone or have no section yet */
+        if (!FileObject) continue;
+
+        Status = MmPrefetchFilePages(FileObject,
+                                     BooleanFlagOn(Runs[i].Flags, MI_LAUNCH_TRACE_IMAGE),
+                                     (LONGLONG)Runs[i].FileOffset,
+                                     Runs[i].PageCount << PAGE_SHIFT);
+        if (NT_SUCCESS(Status))
+        {
+            InterlockedExchangeAdd((PLONG)&MmLaunchPrefetchPages, Runs[i].PageCount);
+        }
+        else if (Status == STATUS_NO_MEMORY)
+        {
+            /* Don't push anybody out for this */
+            break;
+        }
+    }
+
+    if (FileObject) ObDereferenceObject(FileObject);
+    if (FileHandle) ZwClose(FileHandle);
+
+Cleanup:
+    if (Buffer) ExFreePoolWithTag(Buffer, TAG_MM_PREFETCH);
+    ExFreePoolWithTag(Replay, TAG_MM_PREFETCH);
+}
+
+/* PUBLIC FUNCTIONS **********************************************************/
+
+CODE_SEG("INIT")
+VOID
+NTAPI
+MmInitializeLaunchPrefetcher(VOID)
+{
+    KeInitializeGuardedMutex(&MiLaunchTraceLock);
+    InitializeListHead(&MiLaunchTraceListHead);
+    InitializeListHead(&MiLaunchTraceSaveListHead);
+    KeInitializeTimer(&MiLaunchTraceTimer);
+    KeInitializeDpc(&MiLaunchTraceDpc, MiLaunchTraceDpcRoutine, NULL);
+    ExInitializeWorkItem(&MiLaunchTraceWorkItem, MiLaunchTraceWorker, NULL);
+}
+
+VOID
+NTAPI
+MmStartLaunchTrace(
+    _In_ PEPROCESS Process,
+    _In_ PFILE_OBJECT ImageFileObject)
+{
+    PMI_LAUNCH_TRACE Trace;
+    PMI_LAUNCH_REPLAY Replay;
+    UNICODE_STRING BaseName;
+    LARGE_INTEGER DueTime;
+    ULONG Hash, i;
+    NTSTATUS Status;
+
+    if (!(MmEnablePrefetcher & MI_PREFETCH_APPLICATION_LAUNCH)) return;
+    if (!ImageFileObject->FileName.Length) return;
+
+    /* The trace is named after the image, and a hash of its full path */
+    BaseName = ImageFileObject->FileName;
+    for (i = BaseName.Length / sizeof(WCHAR); i > 0; i--)
+    {
+        if (BaseName.Buffer[i - 1] == OBJ_NAME_PATH_SEPARATOR) break;
+    }
+    BaseName.Buffer += i;
+    BaseName.Length -= (USHORT)(i * sizeof(WCHAR));
+    BaseName.Length = min(BaseName.Length, 32 * sizeof(WCHAR));
+    BaseName.MaximumLength = BaseName.Length;
+
+    Status = RtlHashUnicodeString(&ImageFileObject->FileName, TRUE, HASH_STRING_ALGORITHM_X65599, &Hash);
+    if (!NT_SUCCESS(Status)) return;
+
+    Trace = ExAllocatePoolWithTag(PagedPool, sizeof(MI_LAUNCH_TRACE), TAG_MM_PREFETCH);
+    if (!Trace) return;
+
+    Trace->Process = Process;
+    Trace->EndTime = KeQueryInterruptTime() + (ULONGLONG)MI_LAUNCH_TRACE_SECONDS * 10000000;
+    Trace->NumberOfFiles = 0;
+    Trace->NumberOfPages = 0;
+    RtlInitEmptyUnicodeString(&Trace->TraceName, Trace->TraceNameBuffer, sizeof(Trace->TraceNameBuffer));
+    Status = RtlUnicodeStringPrintf(&Trace->TraceName, L"%s\\%wZ-%08lX.pf", MI_LAUNCH_TRACE_DIRECTORY, &BaseName, Hash);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreePoolWithTag(Trace, TAG_MM_PREFETCH);
+        return;
+    }
+    RtlUpcaseUnicodeString(&Trace->TraceName, &Trace->TraceName, FALSE);
+
+    /* Replay what we saw last time, in the background */
+    Replay = ExAllocatePoolWithTag(NonPagedPool, sizeof(MI_LAUNCH_REPLAY), TAG_MM_PREFETCH);
+    if (Replay)
+    {
+        RtlInitEmptyUnicodeString(&Replay->TraceName, Replay->TraceNameBuffer, sizeof(Replay->TraceNameBuffer));
+        RtlCopyUnicodeString(&Replay->TraceName, &Trace->TraceName);
+        ExInitializeWorkItem(&Replay->WorkItem, MiReplayLaunchTrace, Replay);
+        ExQueueWorkItem(&Replay->WorkItem, DelayedWorkQueue);
+    }
+
+    /* And record this launch. The older traces end first, so the timer only needs setting for the first one */
+    KeAcquireGuardedMutex(&MiLaunchTraceLock);
+    if (IsListEmpty(&MiLaunchTraceListHead))
+    {
+        DueTime.QuadPart = -(LONGLONG)MI_LAUNCH_TRACE_SECONDS * 10000000;
+        KeSetTimer(&MiLaunchTraceTimer, DueTime, &MiLaunchTraceDpc);
+    }
+    InsertTailList(&MiLaunchTraceListHead, &Trace->Links);
+    InterlockedIncrement(&MiActiveLaunchTraces);
+    KeReleaseGuardedMutex(&MiLaunchTraceLock);
+}
+
+VOID
+NTAPI
+MmRecordLaunchFault(
+    _In_ PEPROCESS Process,
+    _In_ PMM_SECTION_SEGMENT Segment,
+    _In_ LONGLONG Offset)
+{
+    PMI_LAUNCH_TRACE Trace;
+    PMI_LAUNCH_TRACE_PAGE Page;
+    BOOLEAN Image;
+    ULONG i;
+
+    /* Most of the time, nobody is launching */
+    if (!MiActiveLaunchTraces || !Process) return;
+
+    /* Only pages backed by the file are interesting */
+    Image = !FlagOn(*Segment->Flags, MM_DATAFILE_SEGMENT);
+    if ((Image) && (Offset >= Segment->RawLength.QuadPart)) return;
+
+    KeAcquireGuardedMutex(&MiLaunchTraceLock);
+
+    Trace = MiFindLaunchTrace(Process);
+    if (!Trace)
+    {
+        KeReleaseGuardedMutex(&MiLaunchTraceLock);
+        return;
+    }
+
+    /* Stop recording once the launch is over or the trace is full */
+    if ((KeQueryInterruptTime() >= Trace->EndTime) ||
+        (Trace->NumberOfPages == MI_LAUNCH_TRACE_PAGES))
+    {
+        MiFinishLaunchTrace(Trace);
+        KeReleaseGuardedMutex(&MiLaunchTraceLock);
+        MiQueueLaunchTraceWork();
+        return;
+    }
+
+    /* Find the file in the trace, or add it */
+    for (i = 0; i < Trace->NumberOfFiles; i++)
+    {
+        if (Trace->Files[i] == Segment->FileObject) break;
+    }
+
+    if (i == Trace->NumberOfFiles)
+    {
+        if (i == MI_LAUNCH_TRACE_FILES)
+        {
+            KeReleaseGuardedMutex(&MiLaunchTraceLock);
+            return;
+        }
+
+        ObReferenceObject(Segment->FileObject);
+        Trace->Files[i] = Segment->FileObject;
+        Trace->NumberOfFiles++;
+    }
+
+    Page = &Trace->Pages[Trace->NumberOfPages++];
+    Page->FileIndex = (USHORT)i;
+    Page->Flags = Image ? MI_LAUNCH_TRACE_IMAGE : 0;
+    Page->FileOffset = Image ? Segment->Image.FileOffset + Offset : Offset;
+
+    KeReleaseGuardedMutex(&MiLaunchTraceLock);
+}
+
+VOID
+NTAPI
+MmEndLaunchTrace(
+    _In_ PEPROCESS Process)
+{
+    PMI_LAUNCH_TRACE Trace;
+
+    if (!MiActiveLaunchTraces) return;
+
+    /* Save what the process did if it exits before the end of the trace */
+    KeAcquireGuardedMutex(&MiLaunchTraceLock);
+    Trace = MiFindLaunchTrace(Process);
+    if (Trace) MiFinishLaunchTrace(Trace);
+    KeReleaseGuardedMutex(&MiLaunchTraceLock);
+    if (Trace) MiQueueLaunchTraceWork();
+}
+
+/* EOF */
@@ -22,6 +22,28 @@ static NPAGED_LOOKASIDE_LIST RmapLookasideList;
 
 /* FUNCTIONS ****************************************************************/
 
+static
+VOID
+MmAddWorkingSetPage(PEPROCESS Process)
+{
+    ULONG PrevSize;
+
+    ASSERT(Process != NULL);
+    PrevSize = InterlockedExchangeAddUL(&Process->Vm.WorkingSetSize, PAGE_SIZE);
+    if (PrevSize >= Process->Vm.PeakWorkingSetSize)
+    {
+        Process->Vm.PeakWorkingSetSize = PrevSize + PAGE_SIZE;
+    }
+}
+
+static
+VOID
+MmRemoveWorkingSetPage(PEPROCESS Process)
+{
+    ASSERT(Process != NULL);
+    (void)InterlockedExchangeAddUL(&Process->Vm.WorkingSetSize, -PAGE_SIZE);
+}
+
 _IRQL_requires_max_(DISPATCH_LEVEL)
 static
 VOID
@@ -46,9 +68,88 @@ MmInitializeRmapList(VOID)
                                      50);
 }
 
+/*
+ * Unmaps a page of a segment from one of its views. Returns TRUE if that was
+ * the last mapping of the page and the segment let it go.
+ */
+static
+BOOLEAN
+MmPageOutSegmentView(
+    _In_ PMM_SECTION_SEGMENT Segment,
+    _In_ PLARGE_INTEGER Offset,
+    _In_ PFN_NUMBER Page,
+    _In_ PEPROCESS Process,
+    _In_ PVOID Address)
+{
+    PMMSUPPORT AddressSpace = &Process->Vm;
+    PMEMORY_AREA MemoryArea;
+    ULONG_PTR Entry;
+    PFN_NUMBER MapPage;
+    BOOLEAN Dirty;
+    BOOLEAN Released = FALSE;
+
+    MmLockAddressSpace(AddressSpace);
+
+    MemoryArea = MmLocateMemoryAreaByAddress(AddressSpace, Address);
+    if ((MemoryArea == NULL) ||
+        MemoryArea->DeleteInProgress ||
+        (MemoryArea->Type != MEMORY_AREA_SECTION_VIEW) ||
+        (MemoryArea->SectionData.Segment != Segment))
+    {
+        /* The view went away while we were not looking */
+        MmUnlockAddressSpace(AddressSpace);
+        return FALSE;
+    }
+
+    ASSERT(PsGetCurrentProcess() == PsInitialSystemProcess);
+    if (Process != PsInitialSystemProcess)
+        KeAttachProcess(&Process->Pcb);
+
+    /* This view may not have faulted the page in, or have a private copy of it */
+    if (MmGetPfnForProcess(Process, Address) == Page)
+    {
+        MmLockSectionSegment(Segment);
+
+        Entry = MmGetPageEntrySectionSegment(Segment, Offset);
+        if (Entry && !IS_SWAP_FROM_SSE(Entry) && (PFN_FROM_SSE(Entry) == Page))
+        {
+            if (!MmDeleteVirtualMapping(Process, Address, &Dirty, &MapPage) || (MapPage != Page))
+            {
+                KeBugCheckEx(MEMORY_MANAGEMENT,
+                             (ULONG_PTR)Process,
+                             (ULONG_PTR)Address,
+                             (ULONG_PTR)__FILE__,
+                             __LINE__);
+            }
+            MmDeleteSegmentMapping(Page, Process, Address);
+
+            /* One less mapping referencing this segment */
+            Released = MmUnsharePageEntrySectionSegment(MemoryArea, Segment, Offset, Dirty, TRUE, NULL);
+        }
+
+        MmUnlockSectionSegment(Segment);
+    }
+
+    if (Process != PsInitialSystemProcess)
+        KeDetachProcess();
+    MmUnlockAddressSpace(AddressSpace);
+
+    return Released;
+}
+
+/*
+ * Pages out a physical page. If a cluster is given, a dirty private page is
+ * not written right away: it is unmapped and handed over to the cluster
+ * along with our references on its process, and STATUS_PENDING is returned.
+ * MmFlushPageOutCluster then writes it together with the other pages.
+ * A page of a section segment is unmapped from all the views of the segment
+ * in one go.
+ */
 NTSTATUS
 NTAPI
-MmPageOutPhysicalAddress(PFN_NUMBER Page)
+MmPageOutPhysicalAddress(
+    _In_ PFN_NUMBER Page,
+    _Inout_opt_ PMM_PAGEOUT_CLUSTER Cluster)
 {
     PMM_RMAP_ENTRY entry;
     PMEMORY_AREA MemoryArea;
@@ -216,6 +317,22 @@ GetEntry:
                 MmCreatePageFileMapping(Process, Address, MM_WAIT_ENTRY);
                 MmUnlockAddressSpace(AddressSpace);
 
+                if (Cluster)
+                {
+                    ULONG Index = Cluster->Count++;
+
+                    ASSERT(Index < MM_PAGEFILE_CLUSTER_PAGES);
+
+                    /* The cluster owns the process references from now on */
+                    if (Process != PsInitialSystemProcess)
+                        KeDetachProcess();
+                    Cluster->Processes[Index] = Process;
+                    Cluster->Addresses[Index] = Address;
+                    Cluster->SwapEntries[Index] = SwapEntry;
+                    Cluster->Pages[Index] = Page;
+                    return STATUS_PENDING;
+                }
+
                 Status = MmWriteToSwapPage(SwapEntry, Page);
 
                 MmLockAddressSpace(AddressSpace);
@@ -299,17 +416,41 @@ GetEntry:
     }
 
 WriteSegment:
-    /* Now write this page to file, if needed */
     Segment = MmGetSectionAssociation(Page, &SegmentOffset);
     if (Segment)
     {
-        BOOLEAN Released;
+        MM_SEGMENT_VIEW_MAPPING Mappings[MM_SEGMENT_VIEW_BATCH];
+        BOOLEAN Released = FALSE;
+        ULONG Skip = 0, Count, i;
 
-        MmLockSectionSegment(Segment);
+        /* Unmap the page from every view of the segment */
+        do
+        {
+            Count = MmReferenceSegmentViews(Segment, &SegmentOffset, &Skip, Mappings);
+            for (i = 0; i < Count; i++)
+            {
+                if (!Released)
+                {
+                    Released = MmPageOutSegmentView(Segment,
+                                                    &SegmentOffset,
+                                                    Page,
+                                                    Mappings[i].Process,
+                                                    Mappings[i].Address);
+                }
 
-        Released = MmCheckDirtySegment(Segment, &SegmentOffset, FALSE, TRUE);
+                ExReleaseRundownProtection(&Mappings[i].Process->RundownProtect);
+                ObDereferenceObject(Mappings[i].Process);
+            }
+        } while ((Count == MM_SEGMENT_VIEW_BATCH) && !Released);
+
+        /* Now write this page to file, if needed */
+        if (!Released)
+        {
+            MmLockSectionSegment(Segment);
+            Released = MmCheckDirtySegment(Segment, &SegmentOffset, FALSE, TRUE);
+            MmUnlockSectionSegment(Segment);
+        }
 
-        MmUnlockSectionSegment(Segment);
         MmDereferenceSegment(Segment);
 
         if (Released)
@@ -322,6 +463,88 @@ WriteSegment:
     return STATUS_UNSUCCESSFUL;
 }
 
+VOID
+NTAPI
+MmFlushPageOutCluster(
+    _Inout_ PMM_PAGEOUT_CLUSTER Cluster,
+    _Out_opt_ PULONG NrFreedPages)
+{
+    NTSTATUS Statuses[MM_PAGEFILE_CLUSTER_PAGES];
+    PMMSUPPORT AddressSpace;
+    PMEMORY_AREA MemoryArea;
+    PMM_REGION Region;
+    PEPROCESS Process;
+    PVOID Address;
+    PFN_NUMBER Page;
+    SWAPENTRY SwapEntry, Dummy;
+    ULONG i;
+
+    if (Cluster->Count == 0) return;
+
+    /* Write everything out in as few I/Os as possible */
+    MmWriteToSwapPages(Cluster->Count,
+                       Cluster->SwapEntries,
+                       Cluster->Pages,
+                       Statuses);
+
+    /* And finish the page out of each page, as MmPageOutPhysicalAddress would */
+    for (i = 0; i < Cluster->Count; i++)
+    {
+        Process = Cluster->Processes[i];
+        Address = Cluster->Addresses[i];
+        SwapEntry = Cluster->SwapEntries[i];
+        Page = Cluster->Pages[i];
+        AddressSpace = &Process->Vm;
+
+        MmLockAddressSpace(AddressSpace);
+        if (Process != PsInitialSystemProcess)
+            KeAttachProcess(&Process->Pcb);
+
+        MmDeletePageFileMapping(Process, Address, &Dummy);
+        ASSERT(Dummy == MM_WAIT_ENTRY);
+
+        if (!NT_SUCCESS(Statuses[i]))
+        {
+            /* We failed at saving the content of this page. Keep it in */
+            MemoryArea = MmLocateMemoryAreaByAddress(AddressSpace, Address);
+            Region = MmFindRegion((PVOID)MA_GetStartingAddress(MemoryArea),
+                                  &MemoryArea->SectionData.RegionListHead,
+                                  Address, NULL);
+
+            /* This Swap Entry is useless to us */
+            MmSetSavedSwapEntryPage(Page, 0);
+            MmFreeSwapPage(SwapEntry);
+
+            MmCreateVirtualMapping(Process, Address, Region->Protect, Page);
+            MmInsertRmap(Page, Process, Address);
+            MmSetDirtyPage(Process, Address);
+
+            MmUnlockAddressSpace(AddressSpace);
+            if (Process != PsInitialSystemProcess)
+                KeDetachProcess();
+        }
+        else
+        {
+            /* Keep this in the process VM */
+            MmCreatePageFileMapping(Process, Address, SwapEntry);
+            MmSetSavedSwapEntryPage(Page, 0);
+
+            /* We can finally let this page go */
+            MmUnlockAddressSpace(AddressSpace);
+            if (Process != PsInitialSystemProcess)
+                KeDetachProcess();
+            MmReleasePageMemoryConsumer(MC_USER, Page);
+
+            if (NrFreedPages) (*NrFreedPages)++;
+        }
+
+        ExReleaseRundownProtection(&Process->RundownProtect);
+        ObDereferenceObject(Process);
+    }
+
+    Cluster->Count = 0;
+}
+
 VOID
 NTAPI
 MmInsertRmap(PFN_NUMBER Page, PEPROCESS Process,
@@ -329,7 +552,6 @@ MmInsertRmap(PFN_NUMBER Page, PEPROCESS Process,
 {
     PMM_RMAP_ENTRY current_entry;
     PMM_RMAP_ENTRY new_entry;
-    ULONG PrevSize;
     KIRQL OldIrql;
 
     if (!RMAP_IS_SEGMENT(Address))
@@ -398,14 +620,7 @@ MmInsertRmap(PFN_NUMBER Page, PEPROCESS Process,
     MiReleasePfnLock(OldIrql);
 
     if (!RMAP_IS_SEGMENT(Address))
-    {
-        ASSERT(Process != NULL);
-        PrevSize = InterlockedExchangeAddUL(&Process->Vm.WorkingSetSize, PAGE_SIZE);
-        if (PrevSize >= Process->Vm.PeakWorkingSetSize)
-        {
-            Process->Vm.PeakWorkingSetSize = PrevSize + PAGE_SIZE;
-        }
-    }
+        MmAddWorkingSetPage(Process);
 }
 
 VOID
@@ -437,10 +652,7 @@ MmDeleteRmap(PFN_NUMBER Page, PEPROCESS Process,
 
             ExFreeToNPagedLookasideList(&RmapLookasideList, current_entry);
             if (!RMAP_IS_SEGMENT(Address))
-            {
-                ASSERT(Process != NULL);
-                (void)InterlockedExchangeAddUL(&Process->Vm.WorkingSetSize, -PAGE_SIZE);
-            }
+                MmRemoveWorkingSetPage(Process);
             return;
         }
         previous_entry = current_entry;
@@ -449,6 +661,120 @@ MmDeleteRmap(PFN_NUMBER Page, PEPROCESS Process,
     KeBugCheck(MEMORY_MANAGEMENT);
 }
 
+/*
+ * Pages of a section segment are not tracked per mapping. The segment keeps
+ * the list of the process views mapping it instead, and the mappings of one
+ * of its pages are found from the offset of the page in each view. The
+ * functions below only account for the working set of the process.
+ */
+VOID
+NTAPI
+MmInsertSegmentMapping(PFN_NUMBER Page, PEPROCESS Process,
+                       PVOID Address)
+{
+    if (MmGetPfnForProcess(Process, Address) != Page)
+    {
+        DPRINT1("Insert segment mapping (%p, 0x%p) which doesn't match physical "
+                "address 0x%.8X\n", Process->UniqueProcessId, Address,
+                Page << PAGE_SHIFT);
+        KeBugCheck(MEMORY_MANAGEMENT);
+    }
+
+    MmAddWorkingSetPage(Process);
+}
+
+VOID
+NTAPI
+MmDeleteSegmentMapping(PFN_NUMBER Page, PEPROCESS Process,
+                       PVOID Address)
+{
+    UNREFERENCED_PARAMETER(Page);
+    UNREFERENCED_PARAMETER(Address);
+
+    MmRemoveWorkingSetPage(Process);
+}
+
+/* Must hold the segment lock */
+VOID
+NTAPI
+MmInsertSegmentView(PMEMORY_AREA MemoryArea, PEPROCESS Process)
+{
+    MemoryArea->SectionData.Process = Process;
+    InsertTailList(&MemoryArea->SectionData.Segment->ViewListHead,
+                   &MemoryArea->SectionData.ViewListEntry);
+}
+
+/* Must hold the segment lock */
+VOID
+NTAPI
+MmRemoveSegmentView(PMEMORY_AREA MemoryArea)
+{
+    if (MemoryArea->SectionData.Process == NULL)
+        return;
+
+    RemoveEntryList(&MemoryArea->SectionData.ViewListEntry);
+    MemoryArea->SectionData.Process = NULL;
+}
+
+/*
+ * Gathers the process views which may map the page at the given offset of a
+ * segment, skipping the first *Skip of them which the caller already went
+ * through. The processes are referenced and run down protected, so that the
+ * caller can go through them once the segment lock is released. Views which
+ * come and go in the meantime may be missed or seen twice, which the callers
+ * have to cope with anyway, since the PTEs are only checked afterwards.
+ */
+ULONG
+NTAPI
+MmReferenceSegmentViews(
+    _In_ PMM_SECTION_SEGMENT Segment,
+    _In_ PLARGE_INTEGER Offset,
+    _Inout_ PULONG Skip,
+    _Out_writes_(MM_SEGMENT_VIEW_BATCH) PMM_SEGMENT_VIEW_MAPPING Mappings)
+{
+    PLIST_ENTRY ListEntry;
+    PMEMORY_AREA MemoryArea;
+    PEPROCESS Process;
+    LONGLONG ViewOffset, ViewSize;
+    ULONG Count = 0, Index = 0;
+
+    MmLockSectionSegment(Segment);
+
+    for (ListEntry = Segment->ViewListHead.Flink;
+         (ListEntry != &Segment->ViewListHead) && (Count < MM_SEGMENT_VIEW_BATCH);
+         ListEntry = ListEntry->Flink)
+    {
+        MemoryArea = CONTAINING_RECORD(ListEntry, MEMORY_AREA, SectionData.ViewListEntry);
+        ViewOffset = MemoryArea->SectionData.ViewOffset;
+        ViewSize = MA_GetEndingAddress(MemoryArea) - MA_GetStartingAddress(MemoryArea);
+
+        /* Only the views covering this offset can map the page */
+        if ((Offset->QuadPart < ViewOffset) || (Offset->QuadPart >= ViewOffset + ViewSize))
+            continue;
+
+        if (Index++ < *Skip)
+            continue;
+
+        if (MemoryArea->DeleteInProgress)
+            continue;
+
+        Process = MemoryArea->SectionData.Process;
+        if (!ExAcquireRundownProtection(&Process->RundownProtect))
+            continue;
+        ObReferenceObject(Process);
+
+        Mappings[Count].Process = Process;
+        Mappings[Count].Address = (PVOID)(MA_GetStartingAddress(MemoryArea) +
+                                          (ULONG_PTR)(Offset->QuadPart - ViewOffset));
+        Count++;
+    }
+
+    MmUnlockSectionSegment(Segment);
+
+    *Skip = Index;
+    return Count;
+}
+
 /*
 
 Return the process pointer given when a previous call to MmInsertRmap was
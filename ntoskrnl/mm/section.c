@@ -197,6 +197,9 @@ POBJECT_TYPE MmSectionObjectType = NULL;
 
 ULONG_PTR MmSubsectionBase;
 
+/* How many pages around a section view fault get mapped if they are resident */
+ULONG MmFaultAroundPages = 16;
+
 static ULONG SectionCharacteristicsToProtect[16] =
 {
     PAGE_NOACCESS,          /* 0 = NONE */
@@ -1555,6 +1558,95 @@ MmAlterViewAttributes(PMMSUPPORT AddressSpace,
     MmUnlockSectionSegment(Segment);
 }
 
+static
+ULONG
+MmGetFaultAroundPages(PEPROCESS Process)
+{
+    ULONG Pages = min(MmFaultAroundPages, MM_MAXIMUM_FAULT_AROUND_PAGES);
+
+    /* Processes with a lowered page priority get a smaller window, down
+       to none at all for the lowest priority */
+    if (Process && (Process->Vm.Flags.PagePriority < MM_DEFAULT_PAGE_PRIORITY))
+    {
+        Pages >>= (MM_DEFAULT_PAGE_PRIORITY - Process->Vm.Flags.PagePriority);
+    }
+
+    return Pages;
+}
+
+/*
+ * Maps the pages around a resolved fault which are already resident in the
+ * segment, so that sequential access to a view doesn't take one fault per
+ * page. The window is aligned on its size and doesn't leave the region.
+ * Called with the address space and the segment locked.
+ */
+static
+VOID
+MmFaultAroundSectionView(PMMSUPPORT AddressSpace,
+                         MEMORY_AREA* MemoryArea,
+                         PMM_SECTION_SEGMENT Segment,
+                         PMM_REGION Region,
+                         PVOID RegionBase,
+                         PVOID Address,
+                         ULONG Attributes)
+{
+    PEPROCESS Process = MmGetAddressSpaceOwner(AddressSpace);
+    ULONG_PTR WindowStart, WindowEnd, CurrentAddress;
+    LARGE_INTEGER Offset;
+    ULONG_PTR Entry;
+    PFN_NUMBER Page;
+    ULONG Pages;
+
+    Pages = MmGetFaultAroundPages(Process);
+    if (Pages <= 1) return;
+
+    /* Get the window and clip it to the region */
+    WindowStart = ALIGN_DOWN_BY((ULONG_PTR)Address, Pages * PAGE_SIZE);
+    WindowEnd = WindowStart + Pages * PAGE_SIZE;
+    WindowStart = max(WindowStart, (ULONG_PTR)RegionBase);
+    WindowEnd = min(WindowEnd, (ULONG_PTR)RegionBase + Region->Length);
+    WindowEnd = min(WindowEnd, MA_GetEndingAddress(MemoryArea));
+
+    for (CurrentAddress = WindowStart; CurrentAddress < WindowEnd; CurrentAddress += PAGE_SIZE)
+    {
+        /* Leave alone anything that already has a PTE of its own */
+        if (MmIsPagePresent(Process, (PVOID)CurrentAddress) ||
+            MmIsPageSwapEntry(Process, (PVOID)CurrentAddress) ||
+            MmIsDisabledPage(Process, (PVOID)CurrentAddress))
+        {
+            continue;
+        }
+
+        Offset.QuadPart = CurrentAddress - MA_GetStartingAddress(MemoryArea)
+                          + MemoryArea->SectionData.ViewOffset;
+        if (Offset.QuadPart >= Segment->Length.QuadPart) break;
+
+        /* Only take pages which are resident, anything else takes a real fault */
+        Entry = MmGetPageEntrySectionSegment(Segment, &Offset);
+        if ((Entry == 0) ||
+            IS_SWAP_FROM_SSE(Entry) ||
+            (SHARE_COUNT_FROM_SSE(Entry) == MAX_SHARE_COUNT))
+        {
+            continue;
+        }
+
+        Page = PFN_FROM_SSE(Entry);
+        if (!NT_SUCCESS(MmCreateVirtualMapping(Process,
+                                               (PVOID)CurrentAddress,
+                                               Attributes,
+                                               Page)))
+        {
+            /* Not fatal, the page will simply fault later */
+            break;
+        }
+
+        if (Process)
+            MmInsertSegmentMapping(Page, Process, (PVOID)CurrentAddress);
+
+        MmSharePageEntrySectionSegment(Segment, &Offset);
+    }
+}
+
 NTSTATUS
 NTAPI
 MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
@@ -1572,6 +1664,7 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
     PMM_REGION Region;
     BOOLEAN HasSwapEntry;
     PVOID PAddress;
+    PVOID RegionBase;
     PEPROCESS Process = MmGetAddressSpaceOwner(AddressSpace);
     SWAPENTRY SwapEntry;
 
@@ -1607,7 +1700,7 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
     Segment = MemoryArea->SectionData.Segment;
     Region = MmFindRegion((PVOID)MA_GetStartingAddress(MemoryArea),
                           &MemoryArea->SectionData.RegionListHead,
-                          Address, NULL);
+                          Address, &RegionBase);
     ASSERT(Region != NULL);
 
     /* Check for a NOACCESS mapping */
@@ -1638,6 +1731,10 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
     if (HasSwapEntry)
     {
         SWAPENTRY DummyEntry;
+        SWAPENTRY SwapEntries[MM_PAGEFILE_CLUSTER_PAGES];
+        PFN_NUMBER Pages[MM_PAGEFILE_CLUSTER_PAGES];
+        ULONG_PTR ClusterEnd;
+        ULONG PageCount, i;
 
         MmGetPageFileMapping(Process, Address, &SwapEntry);
         if (SwapEntry == MM_WAIT_ENTRY)
@@ -1670,16 +1767,66 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
         /* Tell everyone else we are serving the fault. */
         MmCreatePageFileMapping(Process, Address, MM_WAIT_ENTRY);
 
+        /*
+         * Pages which were written out together are usually needed together.
+         * Bring in the following pages of the region as well, as long as
+         * their swap entries follow ours and we can get memory cheaply.
+         */
+        SwapEntries[0] = SwapEntry;
+        Pages[0] = Page;
+        ClusterEnd = min((ULONG_PTR)RegionBase + Region->Length, MA_GetEndingAddress(MemoryArea));
+        for (PageCount = 1; PageCount < MM_PAGEFILE_CLUSTER_PAGES; PageCount++)
+        {
+            PVOID NextAddress = (PVOID)((ULONG_PTR)PAddress + PageCount * PAGE_SIZE);
+
+            if ((ULONG_PTR)NextAddress >= ClusterEnd) break;
+            if (!MmIsPageSwapEntry(Process, NextAddress)) break;
+
+            MmGetPageFileMapping(Process, NextAddress, &SwapEntries[PageCount]);
+            if ((SwapEntries[PageCount] == MM_WAIT_ENTRY) ||
+                !MmIsNextSwapEntry(SwapEntries[PageCount - 1], SwapEntries[PageCount]))
+            {
+                break;
+            }
+
+            if (!NT_SUCCESS(MmRequestPageMemoryConsumer(MC_USER, FALSE, &Pages[PageCount])))
+                break;
+
+            MmDeletePageFileMapping(Process, NextAddress, &DummyEntry);
+            MmCreatePageFileMapping(Process, NextAddress, MM_WAIT_ENTRY);
+        }
+
         MmUnlockAddressSpace(AddressSpace);
 
-        Status = MmReadFromSwapPage(SwapEntry, Page);
+        Status = MmReadFromSwapPages(SwapEntry, Pages, PageCount);
         if (!NT_SUCCESS(Status))
         {
-            DPRINT1("MmReadFromSwapPage failed, status = %x\n", Status);
+            DPRINT1("MmReadFromSwapPages failed, status = %x\n", Status);
             KeBugCheck(MEMORY_MANAGEMENT);
         }
 
         MmLockAddressSpace(AddressSpace);
+
+        /* Map the pages we read along, they keep their swap entries too */
+        for (i = 1; i < PageCount; i++)
+        {
+            PVOID NextAddress = (PVOID)((ULONG_PTR)PAddress + i * PAGE_SIZE);
+
+            MmDeletePageFileMapping(Process, NextAddress, &DummyEntry);
+            ASSERT(DummyEntry == MM_WAIT_ENTRY);
+
+            Status = MmCreateVirtualMapping(Process, NextAddress, Region->Protect, Pages[i]);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT("MmCreateVirtualMapping failed, not out of memory\n");
+                KeBugCheck(MEMORY_MANAGEMENT);
+                return Status;
+            }
+
+            MmSetSavedSwapEntryPage(Pages[i], SwapEntries[i]);
+            if (Process) MmInsertRmap(Pages[i], Process, NextAddress);
+        }
+
         MmDeletePageFileMapping(Process, PAddress, &DummyEntry);
         ASSERT(DummyEntry == MM_WAIT_ENTRY);
 
@@ -1789,7 +1936,7 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
             }
             ASSERT(MmIsPagePresent(Process, PAddress));
             if (Process)
-                MmInsertRmap(Page, Process, Address);
+                MmInsertSegmentMapping(Page, Process, Address);
 
             DPRINT("Address 0x%p\n", Address);
             return STATUS_SUCCESS;
@@ -1798,6 +1945,9 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
         MmUnlockSectionSegment(Segment);
         MmUnlockAddressSpace(AddressSpace);
 
+        /* Let the launch prefetcher know about it */
+        MmRecordLaunchFault(Process, Segment, Offset.QuadPart);
+
         /* The data must be paged in. Lock the file, so that the VDL doesn't get updated behind us. */
         FsRtlAcquireFileExclusive(Segment->FileObject);
 
@@ -1893,7 +2043,7 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
             KeBugCheck(MEMORY_MANAGEMENT);
         }
         if (Process)
-            MmInsertRmap(Page, Process, Address);
+            MmInsertSegmentMapping(Page, Process, Address);
 
         /*
          * Mark the offset within the section as having valid, in-memory
@@ -1922,10 +2072,22 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
         }
 
         if (Process)
-            MmInsertRmap(Page, Process, Address);
+            MmInsertSegmentMapping(Page, Process, Address);
 
         /* Take a reference on it */
         MmSharePageEntrySectionSegment(Segment, &Offset);
+
+        /* Record it too, so that a prefetched launch still traces the pages it needs */
+        MmRecordLaunchFault(Process, Segment, Offset.QuadPart);
+
+        /* Map the resident neighbours while we are at it */
+        MmFaultAroundSectionView(AddressSpace,
+                                 MemoryArea,
+                                 Segment,
+                                 Region,
+                                 RegionBase,
+                                 PAddress,
+                                 Attributes);
         MmUnlockSectionSegment(Segment);
 
         DPRINT("Address 0x%p\n", Address);
@@ -2066,7 +2228,7 @@ MmAccessFaultSectionView(PMMSUPPORT AddressSpace,
     }
 
     if (Process)
-        MmDeleteRmap(OldPage, Process, PAddress);
+        MmDeleteSegmentMapping(OldPage, Process, PAddress);
     MmUnsharePageEntrySectionSegment(MemoryArea, Segment, &Offset, FALSE, FALSE, NULL);
     MmUnlockSectionSegment(Segment);
 
@@ -2298,6 +2460,7 @@ MmCreatePhysicalMemorySection(VOID)
     Segment->Flags = &Segment->SegFlags;
 
     ExInitializeFastMutex(&Segment->Lock);
+    InitializeListHead(&Segment->ViewListHead);
     Segment->Image.FileOffset = 0;
     Segment->Protection = PAGE_EXECUTE_READWRITE;
     Segment->RawLength = SectionSize;
@@ -2533,6 +2696,7 @@ grab_segment:
         Segment->SectionCount = 1;
 
         ExInitializeFastMutex(&Segment->Lock);
+        InitializeListHead(&Segment->ViewListHead);
         Segment->FileObject = FileObject;
         ObReferenceObject(FileObject);
 
@@ -3193,6 +3357,7 @@ ExeFmtpCreateImageSection(PFILE_OBJECT FileObject,
     for ( i = 0; i < ImageSectionObject->NrSegments; ++ i )
     {
         ExInitializeFastMutex(&ImageSectionObject->Segments[i].Lock);
+        InitializeListHead(&ImageSectionObject->Segments[i].ViewListHead);
         ImageSectionObject->Segments[i].ReferenceCount = &ImageSectionObject->RefCount;
         ImageSectionObject->Segments[i].Flags = &ImageSectionObject->SegFlags;
         MiInitializeSectionPageTable(&ImageSectionObject->Segments[i]);
@@ -3411,6 +3576,7 @@ MmMapViewOfSegment(
     ULONG AllocationType)
 {
     PMEMORY_AREA MArea;
+    PEPROCESS Process;
     NTSTATUS Status;
     ULONG Granularity;
 
@@ -3474,6 +3640,11 @@ MmMapViewOfSegment(
     MmInitializeRegion(&MArea->SectionData.RegionListHead,
                        ViewSize, 0, Protect);
 
+    /* Let the page out find the mappings of the segment pages from there */
+    Process = MmGetAddressSpaceOwner(AddressSpace);
+    if (Process)
+        MmInsertSegmentView(MArea, Process);
+
     return STATUS_SUCCESS;
 }
 
@@ -3553,7 +3724,7 @@ MmFreeSectionPage(PVOID Context, MEMORY_AREA* MemoryArea, PVOID Address,
         {
             if (Process)
             {
-                MmDeleteRmap(Page, Process, Address);
+                MmDeleteSegmentMapping(Page, Process, Address);
             }
 
             /* We don't dirtify for System Space Maps. We let Cc manage that */
@@ -3597,6 +3768,8 @@ MmUnmapViewOfSegment(PMMSUPPORT AddressSpace,
 
     MmLockSectionSegment(Segment);
 
+    MmRemoveSegmentView(MemoryArea);
+
     RegionListHead = &MemoryArea->SectionData.RegionListHead;
     while (!IsListEmpty(RegionListHead))
     {
@@ -5057,6 +5230,100 @@ MmMakeDataSectionResident(
     return Status;
 }
 
+NTSTATUS
+NTAPI
+MmPrefetchFilePages(
+    _In_ PFILE_OBJECT FileObject,
+    _In_ BOOLEAN Image,
+    _In_ LONGLONG FileOffset,
+    _In_ ULONG Length)
+{
+    PSECTION_OBJECT_POINTERS SectionObjectPointer = FileObject->SectionObjectPointer;
+    PMM_IMAGE_SECTION_OBJECT ImageSectionObject = NULL;
+    PMM_SECTION_SEGMENT Segment = NULL;
+    PFSRTL_COMMON_FCB_HEADER FcbHeader;
+    LONGLONG SegmentOffset, SegmentEnd;
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG ChunkLength;
+    KIRQL OldIrql;
+
+    PAGED_CODE();
+
+    if (!SectionObjectPointer)
+        return STATUS_NOT_FOUND;
+
+    /* Only fill sections that exist already, we are not going to create one here */
+    if (Image)
+    {
+        OldIrql = MiAcquirePfnLock();
+        ImageSectionObject = SectionObjectPointer->ImageSectionObject;
+        if (ImageSectionObject && !(ImageSectionObject->SegFlags & (MM_SEGMENT_INCREATE | MM_SEGMENT_INDELETE)))
+            InterlockedIncrement64(&ImageSectionObject->RefCount);
+        else
+            ImageSectionObject = NULL;
+        MiReleasePfnLock(OldIrql);
+
+        if (!ImageSectionObject)
+            return STATUS_NOT_FOUND;
+    }
+    else
+    {
+        Segment = MiGrabDataSection(SectionObjectPointer);
+        if (!Segment)
+            return STATUS_NOT_FOUND;
+    }
+
+    while (Length && NT_SUCCESS(Status))
+    {
+        if (Image)
+        {
+            /* Find the image segment backed by this part of the file */
+            Segment = NULL;
+            for (ULONG i = 0; i < ImageSectionObject->NrSegments; i++)
+            {
+                PMM_SECTION_SEGMENT Current = &ImageSectionObject->Segments[i];
+
+                if ((FileOffset >= Current->Image.FileOffset) &&
+                    (FileOffset < Current->Image.FileOffset + Current->RawLength.QuadPart))
+                {
+                    Segment = Current;
+                    break;
+                }
+            }
+
+            if (!Segment)
+                break;
+
+            SegmentOffset = FileOffset - Segment->Image.FileOffset;
+            SegmentEnd = Segment->RawLength.QuadPart;
+        }
+        else
+        {
+            SegmentOffset = FileOffset;
+            SegmentEnd = FileOffset + Length;
+        }
+
+        /* A run may span several image segments */
+        ChunkLength = (ULONG)min((LONGLONG)Length, SegmentEnd - SegmentOffset);
+
+        /* Lock the file like the page fault path does, so that the VDL doesn't get updated behind us */
+        FsRtlAcquireFileExclusive(Segment->FileObject);
+        FcbHeader = Segment->FileObject->FsContext;
+        Status = MmMakeSegmentResident(Segment, SegmentOffset, ChunkLength, &FcbHeader->ValidDataLength, FALSE);
+        FsRtlReleaseFile(Segment->FileObject);
+
+        FileOffset += ChunkLength;
+        Length -= ChunkLength;
+    }
+
+    if (Image)
+        MmDereferenceSegment(&ImageSectionObject->Segments[0]);
+    else
+        MmDereferenceSegment(Segment);
+
+    return Status;
+}
+
 NTSTATUS
 NTAPI
 MmMakeSegmentDirty(
@@ -39,7 +39,8 @@ else()
         ${REACTOS_SOURCE_DIR}/ntoskrnl/cc/lazywrite.c
         ${REACTOS_SOURCE_DIR}/ntoskrnl/cc/mdl.c
         ${REACTOS_SOURCE_DIR}/ntoskrnl/cc/pin.c
-        ${REACTOS_SOURCE_DIR}/ntoskrnl/cc/view.c)
+        ${REACTOS_SOURCE_DIR}/ntoskrnl/cc/view.c
+        ${REACTOS_SOURCE_DIR}/ntoskrnl/cc/volume.c)
 endif()
 
 list(APPEND SOURCE
@@ -194,6 +195,7 @@ list(APPEND SOURCE
     ${REACTOS_SOURCE_DIR}/ntoskrnl/ke/procobj.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/ke/profobj.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/ke/queue.c
+    ${REACTOS_SOURCE_DIR}/ntoskrnl/ke/schedtrc.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/ke/semphobj.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/ke/spinlock.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/ke/thrdobj.c
@@ -209,6 +211,7 @@ list(APPEND SOURCE
     ${REACTOS_SOURCE_DIR}/ntoskrnl/lpc/port.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/lpc/reply.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/lpc/send.c
+    ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/ARM3/combine.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/ARM3/contmem.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/ARM3/drvmgmt.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/ARM3/dynamic.c
@@ -241,6 +244,8 @@ list(APPEND SOURCE
     ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/mmfault.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/mminit.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/pagefile.c
+    ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/pagestore.c
+    ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/prefetch.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/region.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/rmap.c
     ${REACTOS_SOURCE_DIR}/ntoskrnl/mm/section.c
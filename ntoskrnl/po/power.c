@@ -1223,7 +1223,7 @@ NtSetSystemPowerState(IN POWER_ACTION SystemAction,
 #ifndef NEWCC
         /* Flush dirty cache pages */
         /* XXX: Is that still mandatory? As now we'll wait on lazy writer to complete? */
-        CcRosFlushDirtyPages(MAXULONG, &Dummy, TRUE, FALSE);
+        CcRosFlushDirtyPages(MAXULONG, &Dummy, TRUE, FALSE, NULL);
         DPRINT("Cache flushed %lu pages\n", Dummy);
 #else
         Dummy = 0;
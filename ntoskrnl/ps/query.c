@@ -1049,6 +1049,44 @@ NtQueryInformationProcess(
             ObDereferenceObject(Process);
             break;
 
+        case ProcessPagePriority:
+
+            if (ProcessInformationLength != sizeof(PAGE_PRIORITY_INFORMATION))
+            {
+                Status = STATUS_INFO_LENGTH_MISMATCH;
+                break;
+            }
+
+            /* Set the return length */
+            Length = sizeof(PAGE_PRIORITY_INFORMATION);
+
+            /* Reference the process */
+            Status = ObReferenceObjectByHandle(ProcessHandle,
+                                               PROCESS_QUERY_INFORMATION,
+                                               PsProcessType,
+                                               PreviousMode,
+                                               (PVOID*)&Process,
+                                               NULL);
+            if (!NT_SUCCESS(Status)) break;
+
+            /* Enter SEH for writing back data */
+            _SEH2_TRY
+            {
+                /* Return the page priority */
+                ((PPAGE_PRIORITY_INFORMATION)ProcessInformation)->PagePriority =
+                    Process->Vm.Flags.PagePriority;
+            }
+            _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+            {
+                /* Get the exception code */
+                Status = _SEH2_GetExceptionCode();
+            }
+            _SEH2_END;
+
+            /* Dereference the process */
+            ObDereferenceObject(Process);
+            break;
+
         /* Per-process security cookie */
         case ProcessCookie:
         {
@@ -1412,6 +1450,7 @@ NtSetInformationProcess(
     ULONG DefaultHardErrorMode = 0;
     ULONG DebugFlags = 0, EnableFixup = 0, Boost = 0;
     ULONG NoExecute = 0, VdmPower = 0;
+    ULONG PagePriority = 0;
     BOOLEAN HasPrivilege;
     PLIST_ENTRY Next;
     PETHREAD Thread;
@@ -1928,6 +1967,39 @@ NtSetInformationProcess(
 
             break;
 
+        case ProcessPagePriority:
+
+            /* Check buffer length */
+            if (ProcessInformationLength != sizeof(PAGE_PRIORITY_INFORMATION))
+            {
+                Status = STATUS_INFO_LENGTH_MISMATCH;
+                break;
+            }
+
+            /* Enter SEH for direct buffer read */
+            _SEH2_TRY
+            {
+                PagePriority = ((PPAGE_PRIORITY_INFORMATION)ProcessInformation)->PagePriority;
+            }
+            _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+            {
+                /* Get exception code */
+                Status = _SEH2_GetExceptionCode();
+                _SEH2_YIELD(break);
+            }
+            _SEH2_END;
+
+            /* Validate it */
+            if (PagePriority > MM_HIGHEST_PAGE_PRIORITY)
+            {
+                Status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            /* Mm uses it to size the fault-around window of the process */
+            Process->Vm.Flags.PagePriority = PagePriority;
+            break;
+
         case ProcessAffinityMask:
 
             /* Check buffer length */
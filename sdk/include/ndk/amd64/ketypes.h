@@ -74,6 +74,9 @@ Author:
 #define KF_SSE4_2               0x0002000000000000ULL
 
 // ReactOS specific
+#define KF_ERMS                 0x0200000000000000ULL
+#define KF_XINUSE               0x0400000000000000ULL
+#define KF_XSAVEC               0x0800000000000000ULL
 #define KF_AVX                  0x1000000000000000ULL
 #define KF_AVX2                 0x2000000000000000ULL
 #define KF_AVX512F              0x4000000000000000ULL
@@ -483,6 +483,19 @@ typedef enum _SYSTEM_INFORMATION_CLASS
     SystemOslRamdiskInformation                           = 247, // 0xF7
 #endif // (NTDDI_VERSION >= NTDDI_WIN11)
 
+#ifdef __REACTOS__
+    //
+    // ReactOS-specific classes, kept clear of the Windows range
+    //
+    SystemQueuedSpinLockInformation                       = 256, // 0x100
+    SystemDpcRoutineInformation                           = 257, // 0x101
+    SystemStackProfileInformation                         = 258, // 0x102
+    SystemSchedulerTraceInformation                       = 259, // 0x103
+    SystemKernelStackCacheInformation                     = 260, // 0x104
+    SystemPageCombiningInformation                        = 261, // 0x105
+    SystemCacheManagerInformation                         = 262, // 0x106
+#endif // __REACTOS__
+
     MaxSystemInfoClass
 } SYSTEM_INFORMATION_CLASS, *PSYSTEM_INFORMATION_CLASS;
 
@@ -1752,6 +1765,239 @@ typedef struct _SYSTEM_MEMORY_LIST_INFORMATION
     SIZE_T ModifiedPageCountPageFile;
 } SYSTEM_MEMORY_LIST_INFORMATION, *PSYSTEM_MEMORY_LIST_INFORMATION;
 
+#ifdef __REACTOS__
+//
+// Class 0x100
+//
+#define SYSTEM_QUEUED_SPINLOCK_IN_STACK                             0xFFFFFFFF
+
+typedef struct _SYSTEM_QUEUED_SPINLOCK_ENTRY
+{
+    ULONG LockNumber;
+    ULONG Reserved;
+    ULONGLONG AcquireCount;
+    ULONGLONG ContentionCount;
+    ULONGLONG SpinCycles;
+    ULONGLONG MaxHoldCycles;
+} SYSTEM_QUEUED_SPINLOCK_ENTRY, *PSYSTEM_QUEUED_SPINLOCK_ENTRY;
+
+typedef struct _SYSTEM_QUEUED_SPINLOCK_INFORMATION
+{
+    BOOLEAN StatisticsEnabled;
+    ULONG NumberOfLocks;
+    SYSTEM_QUEUED_SPINLOCK_ENTRY Locks[1];
+} SYSTEM_QUEUED_SPINLOCK_INFORMATION, *PSYSTEM_QUEUED_SPINLOCK_INFORMATION;
+
+typedef struct _SYSTEM_QUEUED_SPINLOCK_CONTROL
+{
+    BOOLEAN EnableStatistics;
+    BOOLEAN ResetStatistics;
+} SYSTEM_QUEUED_SPINLOCK_CONTROL, *PSYSTEM_QUEUED_SPINLOCK_CONTROL;
+
+//
+// Class 0x101
+//
+// Histogram bucket 0 counts times below 1 microsecond, bucket N counts times
+// of [2^(N-1), 2^N) microseconds, and the last bucket everything above.
+//
+#define SYSTEM_DPC_HISTOGRAM_BUCKETS                                16
+
+typedef struct _SYSTEM_DPC_ROUTINE_ENTRY
+{
+    PVOID DeferredRoutine;
+    ULONG ExecutionCount;
+    ULONG WatchdogCount;
+    LARGE_INTEGER TotalRunTime;
+    ULONG MaximumRunTime;
+    ULONG MaximumLatency;
+    ULONG RunTimeHistogram[SYSTEM_DPC_HISTOGRAM_BUCKETS];
+    ULONG LatencyHistogram[SYSTEM_DPC_HISTOGRAM_BUCKETS];
+} SYSTEM_DPC_ROUTINE_ENTRY, *PSYSTEM_DPC_ROUTINE_ENTRY;
+
+typedef struct _SYSTEM_DPC_ROUTINE_INFORMATION
+{
+    BOOLEAN StatisticsEnabled;
+    BOOLEAN ThreadedDpcsEnabled;
+    ULONG NumberOfRoutines;
+    SYSTEM_DPC_ROUTINE_ENTRY Routines[1];
+} SYSTEM_DPC_ROUTINE_INFORMATION, *PSYSTEM_DPC_ROUTINE_INFORMATION;
+
+typedef struct _SYSTEM_DPC_ROUTINE_CONTROL
+{
+    BOOLEAN EnableStatistics;
+    BOOLEAN ResetStatistics;
+} SYSTEM_DPC_ROUTINE_CONTROL, *PSYSTEM_DPC_ROUTINE_CONTROL;
+
+//
+// Class 0x102
+//
+// Frames holds KernelFrameCount kernel-mode return addresses, innermost
+// first, followed by UserFrameCount user-mode ones. On x86, the user walk
+// stops at the first frame that isn't resident. On x64, kernel stacks are
+// only unwound through the kernel image, and only the interrupted user-mode
+// PC is recorded.
+//
+#define SYSTEM_STACK_PROFILE_MAX_FRAMES                             32
+
+typedef struct _SYSTEM_STACK_PROFILE_SAMPLE
+{
+    ULONGLONG InterruptTime;
+    HANDLE UniqueProcess;
+    HANDLE UniqueThread;
+    USHORT Processor;
+    UCHAR KernelFrameCount;
+    UCHAR UserFrameCount;
+    ULONG Reserved;
+    PVOID Frames[SYSTEM_STACK_PROFILE_MAX_FRAMES];
+} SYSTEM_STACK_PROFILE_SAMPLE, *PSYSTEM_STACK_PROFILE_SAMPLE;
+
+typedef struct _SYSTEM_STACK_PROFILE_INFORMATION
+{
+    BOOLEAN Enabled;
+    BOOLEAN CaptureUserStacks;
+    ULONG Interval;
+    ULONG DroppedSamples;
+    ULONG NumberOfSamples;
+    SYSTEM_STACK_PROFILE_SAMPLE Samples[1];
+} SYSTEM_STACK_PROFILE_INFORMATION, *PSYSTEM_STACK_PROFILE_INFORMATION;
+
+typedef struct _SYSTEM_STACK_PROFILE_CONTROL
+{
+    BOOLEAN Enable;
+    BOOLEAN CaptureUserStacks;
+    ULONG Interval;
+    ULONG SamplesPerProcessor;
+} SYSTEM_STACK_PROFILE_CONTROL, *PSYSTEM_STACK_PROFILE_CONTROL;
+
+//
+// Class 0x103
+//
+typedef enum _SYSTEM_SCHEDULER_TRACE_EVENT
+{
+    SchedulerTraceContextSwitch = 1,
+    SchedulerTraceReadyThread,
+    SchedulerTraceWaitBegin,
+    SchedulerTraceWaitEnd,
+    SchedulerTraceSetPriority
+} SYSTEM_SCHEDULER_TRACE_EVENT;
+
+//
+// ContextSwitch: ThreadId switched out for OtherThreadId, Priority is the new
+//                thread's, Reason the old thread's wait reason and Data its state
+// ReadyThread:   Data is the processor the thread was last running on
+// WaitBegin:     Reason is the wait reason, Data the number of objects
+// WaitEnd:       Data is the wait status
+// SetPriority:   Priority is the new priority, Data the old one
+//
+typedef struct _SYSTEM_SCHEDULER_TRACE_RECORD
+{
+    ULONGLONG TimeStamp;
+    ULONG Sequence;
+    UCHAR Event;
+    UCHAR Processor;
+    UCHAR Priority;
+    UCHAR Reason;
+    ULONG ThreadId;
+    ULONG OtherThreadId;
+    ULONG ProcessId;
+    LONG Data;
+} SYSTEM_SCHEDULER_TRACE_RECORD, *PSYSTEM_SCHEDULER_TRACE_RECORD;
+
+typedef struct _SYSTEM_SCHEDULER_TRACE_INFORMATION
+{
+    BOOLEAN Enabled;
+    BOOLEAN CycleTimeStamps;
+    ULONGLONG TimeStampFrequency;
+    ULONG NumberOfProcessors;
+    ULONG RecordsPerProcessor;
+    ULONG NumberOfRecords;
+    SYSTEM_SCHEDULER_TRACE_RECORD Records[1];
+} SYSTEM_SCHEDULER_TRACE_INFORMATION, *PSYSTEM_SCHEDULER_TRACE_INFORMATION;
+
+typedef struct _SYSTEM_SCHEDULER_TRACE_CONTROL
+{
+    BOOLEAN Enable;
+    BOOLEAN Reset;
+} SYSTEM_SCHEDULER_TRACE_CONTROL, *PSYSTEM_SCHEDULER_TRACE_CONTROL;
+
+//
+// Class 0x104
+//
+// Counters since boot. Hits are small stacks taken from a processor's cache,
+// GlobalHits from the global dead stack list, Misses had to be built.
+//
+typedef struct _SYSTEM_KERNEL_STACK_CACHE_INFORMATION
+{
+    BOOLEAN Enabled;
+    ULONG MaximumPerProcessor;
+    ULONG CachedStacks;
+    ULONG Hits;
+    ULONG GlobalHits;
+    ULONG Misses;
+} SYSTEM_KERNEL_STACK_CACHE_INFORMATION, *PSYSTEM_KERNEL_STACK_CACHE_INFORMATION;
+
+typedef struct _SYSTEM_KERNEL_STACK_CACHE_CONTROL
+{
+    BOOLEAN Enable;
+} SYSTEM_KERNEL_STACK_CACHE_CONTROL, *PSYSTEM_KERNEL_STACK_CACHE_CONTROL;
+
+//
+// Class 0x105
+//
+// CombinedPages is the number of shared pages currently held, PagesMerged and
+// PagesUnmerged count the private pages folded into them and split off again.
+//
+typedef struct _SYSTEM_PAGE_COMBINING_INFORMATION
+{
+    BOOLEAN Enabled;
+    ULONG NumberOfScans;
+    ULONG_PTR CombinedPages;
+    ULONGLONG PagesScanned;
+    ULONGLONG PagesMerged;
+    ULONGLONG PagesUnmerged;
+} SYSTEM_PAGE_COMBINING_INFORMATION, *PSYSTEM_PAGE_COMBINING_INFORMATION;
+
+typedef struct _SYSTEM_PAGE_COMBINING_CONTROL
+{
+    BOOLEAN Enable;
+    BOOLEAN ScanNow;
+} SYSTEM_PAGE_COMBINING_CONTROL, *PSYSTEM_PAGE_COMBINING_CONTROL;
+
+//
+// Class 0x106
+//
+// Counters since boot. A copy read misses when any of its pages had to be
+// read from disk, ReadAheadPagesUsed counts read ahead pages the reader got to.
+// VacbSteals counts unused views unmapped to make room for others.
+//
+typedef struct _SYSTEM_CACHE_MANAGER_INFORMATION
+{
+    ULONG CopyReadWait;
+    ULONG CopyReadNoWait;
+    ULONG CopyReadWaitMiss;
+    ULONG CopyReadNoWaitMiss;
+    ULONG FastReadWait;
+    ULONG FastReadNoWait;
+    ULONG FastReadResourceMiss;
+    ULONG FastReadNotPossible;
+    ULONG ReadAheadIos;
+    ULONG ReadAheadPages;
+    ULONG ReadAheadPagesUsed;
+    ULONG LazyWriteIos;
+    ULONG LazyWritePages;
+    ULONG DataFlushes;
+    ULONG DataPages;
+    ULONG DeferredWrites;
+    ULONG VacbAllocations;
+    ULONG VacbSteals;
+    ULONG PinReadWait;
+    ULONG PinReadNoWait;
+    ULONG PinContention;
+    ULONG DirtyPages;
+    ULONG DirtyPageThreshold;
+} SYSTEM_CACHE_MANAGER_INFORMATION, *PSYSTEM_CACHE_MANAGER_INFORMATION;
+#endif // __REACTOS__
+
 //
 // Firmware variable attributes
 //
@@ -184,7 +184,13 @@ typedef enum _MEMORY_INFORMATION_CLASS
     MemoryWorkingSetList,
     MemorySectionName,
     MemoryBasicVlmInformation,
-    MemoryWorkingSetExList
+    MemoryWorkingSetExList,
+#ifdef __REACTOS__
+    //
+    // ReactOS-specific classes, kept clear of the Windows range
+    //
+    MemoryBasicInformationList = 0x100,
+#endif
 } MEMORY_INFORMATION_CLASS;
 
 //
@@ -652,6 +658,15 @@ typedef struct _MMADDRESS_NODE
     struct _MMADDRESS_NODE *RightChild;
     ULONG_PTR StartingVpn;
     ULONG_PTR EndingVpn;
+#ifdef __REACTOS__
+    //
+    // Free pages between this node and the one before it, and the largest
+    // such gap in the subtree rooted here. Lets free range searches skip
+    // whole subtrees.
+    //
+    ULONG_PTR GapBelow;
+    ULONG_PTR LargestGap;
+#endif
 } MMADDRESS_NODE, *PMMADDRESS_NODE;
 
 //
@@ -728,6 +743,10 @@ typedef struct _MMVAD
     struct _MMVAD *RightChild;
     ULONG_PTR StartingVpn;
     ULONG_PTR EndingVpn;
+#ifdef __REACTOS__
+    ULONG_PTR GapBelow;
+    ULONG_PTR LargestGap;
+#endif
     union
     {
         ULONG_PTR LongFlags;
@@ -757,6 +776,10 @@ typedef struct _MMVAD_LONG
     PMMVAD RightChild;
     ULONG_PTR StartingVpn;
     ULONG_PTR EndingVpn;
+#ifdef __REACTOS__
+    ULONG_PTR GapBelow;
+    ULONG_PTR LargestGap;
+#endif
     union
     {
         ULONG_PTR LongFlags;
@@ -796,6 +819,10 @@ typedef struct _MMVAD_SHORT
     PMMVAD RightChild;
     ULONG_PTR StartingVpn;
     ULONG_PTR EndingVpn;
+#ifdef __REACTOS__
+    ULONG_PTR GapBelow;
+    ULONG_PTR LargestGap;
+#endif
     union
     {
         ULONG_PTR LongFlags;
@@ -882,6 +909,9 @@ typedef struct _MMWSL
     PVOID HighestPermittedHashAddress;
     ULONG NumberOfImageWaiters;
     ULONG VadBitMapHint;
+#ifdef __REACTOS__
+    ULONG AgeDistribution[4]; // Number of entries for each MMWSLENTRY::Age
+#endif
 #ifndef _M_AMD64
     USHORT UsedPageTableEntries[768];
     ULONG CommittedPageTables[24];
@@ -913,7 +943,8 @@ typedef struct _MMSUPPORT_FLAGS
     ULONG MemoryPriority:8;
     ULONG GrowWsleHash:1;
     ULONG AcquiredUnsafe:1;
-    ULONG Available:14;
+    ULONG PagePriority:3; // ReactOS-specific
+    ULONG Available:11;
 } MMSUPPORT_FLAGS, *PMMSUPPORT_FLAGS;
 
 //
@@ -978,6 +1009,19 @@ typedef struct _MEMORY_BASIC_INFORMATION
     ULONG Type;
 } MEMORY_BASIC_INFORMATION,*PMEMORY_BASIC_INFORMATION;
 
+#ifdef __REACTOS__
+//
+// Consecutive regions starting at the queried address. NextAddress is where
+// the next query should resume, or NULL once the address space is exhausted.
+//
+typedef struct _MEMORY_BASIC_INFORMATION_LIST
+{
+    ULONG NumberOfRegions;
+    PVOID NextAddress;
+    MEMORY_BASIC_INFORMATION Regions[ANYSIZE_ARRAY];
+} MEMORY_BASIC_INFORMATION_LIST, *PMEMORY_BASIC_INFORMATION_LIST;
+#endif
+
 //
 // Driver Verifier Data
 //
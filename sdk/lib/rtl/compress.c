@@ -20,6 +20,11 @@
 #define COMPRESSION_FORMAT_MASK  0x00FF
 #define COMPRESSION_ENGINE_MASK  0xFF00
 
+/* LZNT1 match finder of the standard engine, kept in the caller's workspace */
+#define LZNT1_HASH_SIZE          0x1000
+#define LZNT1_HASH_NONE          0xFFFF
+#define LZNT1_CHAIN_DEPTH        16
+
 
 
 
@@ -216,28 +221,176 @@ out:
 }
 
 
+/* length of the match between two positions of a chunk */
+static ULONG lznt1_match_length(UCHAR *src, ULONG candidate, ULONG pos, ULONG max_length)
+{
+    ULONG length = 0;
+
+    while (length < max_length && src[candidate + length] == src[pos + length])
+        length++;
+
+    return length;
+}
+
+static ULONG lznt1_hash(UCHAR *src)
+{
+    return ((src[0] << 8) ^ (src[1] << 4) ^ src[2]) & (LZNT1_HASH_SIZE - 1);
+}
+
+/* compress a single LZNT1 chunk, returns NULL if it doesn't fit in dst */
+static PUCHAR lznt1_compress_chunk(UCHAR *dst, ULONG dst_size, UCHAR *src, ULONG src_size,
+                                   USHORT *workspace)
+{
+    UCHAR *dst_cur = dst, *dst_end = dst + dst_size;
+    UCHAR *flags = NULL;
+    USHORT *head = NULL, *chain = NULL;
+    ULONG pos = 0, flag_bit = 8, i;
+    ULONG displacement_bits, length_bits, max_length, max_displacement;
+    ULONG candidate, length, best_length, best_displacement, depth;
+    WORD code;
+
+    /* the standard engine finds matches through hash chains, the maximum
+     * engine (or a caller without workspace) searches the whole window */
+    if (workspace)
+    {
+        head = workspace;
+        chain = workspace + LZNT1_HASH_SIZE;
+        for (i = 0; i < LZNT1_HASH_SIZE; i++)
+            head[i] = LZNT1_HASH_NONE;
+    }
+
+    while (pos < src_size)
+    {
+        /* every 8 entities are preceded by a flags byte */
+        if (flag_bit == 8)
+        {
+            if (dst_cur >= dst_end) return NULL;
+            flags = dst_cur++;
+            *flags = 0;
+            flag_bit = 0;
+        }
+
+        /* find length / displacement bits, as the decompressor does */
+        for (displacement_bits = 12; displacement_bits > 4; displacement_bits--)
+            if ((1 << (displacement_bits - 1)) < pos) break;
+        length_bits      = 16 - displacement_bits;
+        max_length       = min((1 << length_bits) + 2, src_size - pos);
+        max_displacement = min(1 << displacement_bits, pos);
+
+        /* look for the longest match in the window */
+        best_length = 0;
+        best_displacement = 0;
+        if (max_length >= 3)
+        {
+            if (head)
+            {
+                candidate = head[lznt1_hash(src + pos)];
+                for (depth = 0; depth < LZNT1_CHAIN_DEPTH && candidate != LZNT1_HASH_NONE; depth++)
+                {
+                    if (pos - candidate > max_displacement) break;
+                    length = lznt1_match_length(src, candidate, pos, max_length);
+                    if (length > best_length)
+                    {
+                        best_length = length;
+                        best_displacement = pos - candidate;
+                        if (length == max_length) break;
+                    }
+                    candidate = chain[candidate];
+                }
+            }
+            else
+            {
+                for (candidate = pos - 1; pos - candidate <= max_displacement; candidate--)
+                {
+                    length = lznt1_match_length(src, candidate, pos, max_length);
+                    if (length > best_length)
+                    {
+                        best_length = length;
+                        best_displacement = pos - candidate;
+                        if (length == max_length) break;
+                    }
+                    if (!candidate) break;
+                }
+            }
+        }
+
+        if (best_length >= 3)
+        {
+            /* backwards reference */
+            if (dst_cur + sizeof(WORD) > dst_end) return NULL;
+            code = (WORD)(((best_displacement - 1) << length_bits) | (best_length - 3));
+            dst_cur[0] = LOBYTE(code);
+            dst_cur[1] = HIBYTE(code);
+            dst_cur += sizeof(WORD);
+            *flags |= 1 << flag_bit;
+        }
+        else
+        {
+            /* uncompressed data */
+            if (dst_cur >= dst_end) return NULL;
+            *dst_cur++ = src[pos];
+            best_length = 1;
+        }
+        flag_bit++;
+
+        /* remember the positions we went over */
+        for (; best_length; best_length--, pos++)
+        {
+            if (head && pos + 2 < src_size)
+            {
+                i = lznt1_hash(src + pos);
+                chain[pos] = head[i];
+                head[i] = (USHORT)pos;
+            }
+        }
+    }
+
+    return dst_cur;
+}
+
 static NTSTATUS
 RtlpCompressBufferLZNT1(UCHAR *src, ULONG src_size, UCHAR *dst, ULONG dst_size,
-                        ULONG chunk_size, ULONG *final_size, UCHAR *workspace)
+                        USHORT engine, ULONG *final_size, UCHAR *workspace)
 {
         UCHAR *src_cur = src, *src_end = src + src_size;
         UCHAR *dst_cur = dst, *dst_end = dst + dst_size;
+        UCHAR *ptr;
         ULONG block_size;
 
+        /* the maximum engine has no room for the match finder */
+        if (engine != COMPRESSION_ENGINE_STANDARD)
+            workspace = NULL;
+
         while (src_cur < src_end)
         {
             /* determine size of current chunk */
             block_size = min(0x1000, src_end - src_cur);
-            if (dst_cur + sizeof(WORD) + block_size > dst_end)
+            if (dst_cur + sizeof(WORD) > dst_end)
                 return STATUS_BUFFER_TOO_SMALL;
 
-            /* write (uncompressed) chunk header */
-            *(WORD *)dst_cur = 0x3000 | (block_size - 1);
-            dst_cur += sizeof(WORD);
+            /* try to compress it, it must end up smaller than the chunk itself */
+            ptr = lznt1_compress_chunk(dst_cur + sizeof(WORD),
+                                       min(block_size - 1, (ULONG)(dst_end - dst_cur - sizeof(WORD))),
+                                       src_cur, block_size, (USHORT *)workspace);
+            if (ptr)
+            {
+                /* write compressed chunk header */
+                *(WORD *)dst_cur = 0xB000 | (ptr - dst_cur - sizeof(WORD) - 1);
+                dst_cur = ptr;
+            }
+            else
+            {
+                if (dst_cur + sizeof(WORD) + block_size > dst_end)
+                    return STATUS_BUFFER_TOO_SMALL;
 
-            /* write chunk content */
-            memcpy(dst_cur, src_cur, block_size);
-            dst_cur += block_size;
+                /* write (uncompressed) chunk header */
+                *(WORD *)dst_cur = 0x3000 | (block_size - 1);
+                dst_cur += sizeof(WORD);
+
+                /* write chunk content */
+                memcpy(dst_cur, src_cur, block_size);
+                dst_cur += block_size;
+            }
             src_cur += block_size;
         }
 
@@ -284,7 +437,7 @@ RtlCompressBuffer(IN USHORT CompressionFormatAndEngine,
                   IN PVOID WorkSpace)
 {
    USHORT Format = CompressionFormatAndEngine & COMPRESSION_FORMAT_MASK;
-   /* USHORT Engine = CompressionFormatAndEngine & COMPRESSION_ENGINE_MASK; */
+   USHORT Engine = CompressionFormatAndEngine & COMPRESSION_ENGINE_MASK;
 
    if ((Format == COMPRESSION_FORMAT_NONE) ||
          (Format == COMPRESSION_FORMAT_DEFAULT))
@@ -295,7 +448,7 @@ RtlCompressBuffer(IN USHORT CompressionFormatAndEngine,
                                      UncompressedBufferSize,
                                      CompressedBuffer,
                                      CompressedBufferSize,
-                                     UncompressedChunkSize,
+                                     Engine,
                                      FinalCompressedSize,
                                      WorkSpace));
 